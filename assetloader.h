@@ -0,0 +1,359 @@
+/*
+ * AssetLoader
+ *
+ * Background loading of model files and textures so the window is up and
+ * drawing before every image of the scene has been decoded.
+ *
+ * Loader threads read files and decode images. LoadModelAsync() still
+ * calls LoadModel() on the GL thread (raylib uploads meshes while parsing),
+ * but every file read it makes goes through a LoadFileData callback:
+ *
+ *   - files queued with PrefetchAssetFile() (the .gltf and .bin) are read
+ *     ahead on the loader threads and handed over from memory
+ *   - images are queued for decoding and answered right away with a tiny
+ *     placeholder PNG, (request + 1) x 1 pixels so the placeholder texture
+ *     can be matched back to its material map afterwards
+ *
+ * Placeholders are filled with a neutral value for their map (grey albedo,
+ * flat normal, ...). UpdateAssetLoader() is called once a frame on the GL
+ * thread and swaps in the decoded textures, uploading at most a byte budget
+ * per frame so the frame rate holds while the scene fills in.
+ *
+ */
+
+#ifndef ASSETLOADER_H
+#define ASSETLOADER_H
+
+#include "raylib.h"
+#include "rlgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "jobs.h"
+
+#define MAX_ASSET_THREADS 8
+#define MAX_ASSET_FILES 32          // prefetched files
+#define MAX_ASSET_IMAGES 128        // distinct image files
+#define MAX_ASSET_TEXTURES 256      // placeholder textures handed out (one per material map)
+#define ASSET_IMAGE_EXTENSIONS ".png;.jpg;.jpeg;.bmp;.tga"
+
+
+typedef enum {
+    ASSET_QUEUED = 0,
+    ASSET_READY,                // loaded, waiting to be used on the GL thread
+    ASSET_DONE                  // used, data handed over or released
+} AssetState;
+
+typedef struct AssetFile {
+    char *path;
+    unsigned char *data;
+    int size;
+    atomic_int state;
+} AssetFile;
+
+typedef struct AssetImage {
+    char *path;
+    Image image;
+    int pendingTextures;        // placeholders still waiting for this image
+    atomic_int state;
+} AssetImage;
+
+// Placeholder texture given out for one image request
+typedef struct AssetTexture {
+    int image;
+    Texture2D *target;          // material map it ended up in, NULL until LoadModelAsync matches it
+    bool uploaded;
+} AssetTexture;
+
+typedef struct AssetTask {
+    bool image;                 // decode images[index], otherwise read files[index]
+    int index;
+} AssetTask;
+
+typedef struct AssetLoader {
+    int threadCount;
+    JobThread threads[MAX_ASSET_THREADS];
+    JobMutex lock;
+    JobCondition work;      // tasks were queued
+    JobCondition done;      // a task finished
+    bool running;
+
+    AssetTask tasks[MAX_ASSET_FILES + MAX_ASSET_IMAGES];
+    int taskHead;
+    int taskTail;
+
+    AssetFile files[MAX_ASSET_FILES];
+    int fileCount;
+    AssetImage images[MAX_ASSET_IMAGES];
+    int imageCount;
+    AssetTexture textures[MAX_ASSET_TEXTURES];
+    int textureCount;
+    int uploadedCount;
+} AssetLoader;
+
+static AssetLoader assetLoader = { 0 };
+
+
+// Plain read that never goes through the LoadFileData callback
+// NOTE: allocated with RL_MALLOC so UnloadFileData can release it
+static unsigned char *ReadAssetFile(const char *fileName, int *size) {
+    *size = 0;
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char *data = NULL;
+    if (length > 0) {
+        data = RL_MALLOC(length);
+        if (data != NULL && fread(data, 1, length, file) == (size_t)length) {
+            *size = (int)length;
+        } else {
+            RL_FREE(data);
+            data = NULL;
+        }
+    }
+
+    fclose(file);
+    return data;
+}
+
+static void RunAssetTask(AssetTask task) {
+    if (task.image) {
+        AssetImage *image = &assetLoader.images[task.index];
+        int size = 0;
+        unsigned char *data = ReadAssetFile(image->path, &size);
+        if (data != NULL) {
+            image->image = LoadImageFromMemory(GetFileExtension(image->path), data, size);
+            RL_FREE(data);
+        }
+        if (image->image.data == NULL) printf("asset loader: could not load %s\n", image->path);
+        atomic_store_explicit(&image->state, ASSET_READY, memory_order_release);
+    } else {
+        AssetFile *file = &assetLoader.files[task.index];
+        file->data = ReadAssetFile(file->path, &file->size);
+        atomic_store_explicit(&file->state, ASSET_READY, memory_order_release);
+    }
+}
+
+static JobThreadResult AssetWorkerMain(void *arg) {
+    (void)arg;
+    LockJobMutex(&assetLoader.lock);
+    while (assetLoader.running) {
+        if (assetLoader.taskHead == assetLoader.taskTail) {
+            WaitJobCondition(&assetLoader.work, &assetLoader.lock);
+            continue;
+        }
+
+        AssetTask task = assetLoader.tasks[assetLoader.taskHead++];
+        UnlockJobMutex(&assetLoader.lock);
+        RunAssetTask(task);
+        LockJobMutex(&assetLoader.lock);
+        BroadcastJobCondition(&assetLoader.done);
+    }
+    UnlockJobMutex(&assetLoader.lock);
+    return JOB_THREAD_RESULT;
+}
+
+static void QueueAssetTask(AssetTask task) {
+    LockJobMutex(&assetLoader.lock);
+    assetLoader.tasks[assetLoader.taskTail++] = task;
+    SignalJobCondition(&assetLoader.work);
+    UnlockJobMutex(&assetLoader.lock);
+}
+
+// Start threadCount loader threads, threadCount <= 0 uses half the cores
+void InitAssetLoader(int threadCount) {
+    if (threadCount <= 0) threadCount = GetCoreCount() / 2;
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount > MAX_ASSET_THREADS) threadCount = MAX_ASSET_THREADS;
+
+    assetLoader = (AssetLoader){ 0 };
+    InitJobMutex(&assetLoader.lock);
+    InitJobCondition(&assetLoader.work);
+    InitJobCondition(&assetLoader.done);
+    assetLoader.running = true;
+
+    for (int i = 0; i < threadCount; i++) {
+        if (!StartJobThread(&assetLoader.threads[i], AssetWorkerMain, NULL)) break;
+        assetLoader.threadCount++;
+    }
+    printf("asset loader: %d threads\n", assetLoader.threadCount);
+}
+
+// Stop the loader threads, images that were never uploaded are released
+void ShutdownAssetLoader(void) {
+    LockJobMutex(&assetLoader.lock);
+    assetLoader.running = false;
+    BroadcastJobCondition(&assetLoader.work);
+    UnlockJobMutex(&assetLoader.lock);
+
+    for (int i = 0; i < assetLoader.threadCount; i++) JoinJobThread(assetLoader.threads[i]);
+
+    for (int i = 0; i < assetLoader.fileCount; i++) {
+        if (atomic_load(&assetLoader.files[i].state) == ASSET_READY) RL_FREE(assetLoader.files[i].data);
+        free(assetLoader.files[i].path);
+    }
+    for (int i = 0; i < assetLoader.imageCount; i++) {
+        if (atomic_load(&assetLoader.images[i].state) == ASSET_READY) UnloadImage(assetLoader.images[i].image);
+        free(assetLoader.images[i].path);
+    }
+
+    DestroyJobCondition(&assetLoader.done);
+    DestroyJobCondition(&assetLoader.work);
+    DestroyJobMutex(&assetLoader.lock);
+    assetLoader = (AssetLoader){ 0 };
+}
+
+// Start reading a file now, the next LoadFileData of it is served from memory
+void PrefetchAssetFile(const char *fileName) {
+    if (assetLoader.threadCount == 0 || assetLoader.fileCount == MAX_ASSET_FILES) return;
+
+    int index = assetLoader.fileCount++;
+    assetLoader.files[index].path = strdup(fileName);
+    atomic_store(&assetLoader.files[index].state, ASSET_QUEUED);
+    QueueAssetTask((AssetTask){ false, index });
+}
+
+// Tiny PNG standing in for texture request index until the real image is decoded
+static unsigned char *LoadPlaceholderImageData(int index, int *dataSize) {
+    Image image = GenImageColor(index + 1, 1, GRAY);
+    unsigned char *data = ExportImageToMemory(image, ".png", dataSize);
+    UnloadImage(image);
+    return data;
+}
+
+// LoadFileData callback used while LoadModelAsync runs
+static unsigned char *LoadAssetFileData(const char *fileName, int *dataSize) {
+    for (int i = 0; i < assetLoader.fileCount; i++) {
+        AssetFile *file = &assetLoader.files[i];
+        if (strcmp(file->path, fileName) != 0 || atomic_load(&file->state) == ASSET_DONE) continue;
+
+        LockJobMutex(&assetLoader.lock);
+        while (atomic_load_explicit(&file->state, memory_order_acquire) != ASSET_READY) {
+            WaitJobCondition(&assetLoader.done, &assetLoader.lock);
+        }
+        UnlockJobMutex(&assetLoader.lock);
+
+        // ownership goes to the caller, it is released with UnloadFileData
+        atomic_store(&file->state, ASSET_DONE);
+        *dataSize = file->size;
+        return file->data;
+    }
+
+    if (IsFileExtension(fileName, ASSET_IMAGE_EXTENSIONS) && assetLoader.textureCount < MAX_ASSET_TEXTURES) {
+        int image = 0;
+        while (image < assetLoader.imageCount && strcmp(assetLoader.images[image].path, fileName) != 0) image++;
+        if (image == assetLoader.imageCount && image < MAX_ASSET_IMAGES) {
+            assetLoader.imageCount++;
+            assetLoader.images[image] = (AssetImage){ .path = strdup(fileName) };
+            atomic_store(&assetLoader.images[image].state, ASSET_QUEUED);
+            QueueAssetTask((AssetTask){ true, image });
+        }
+
+        if (image < assetLoader.imageCount) {
+            int index = assetLoader.textureCount++;
+            assetLoader.textures[index] = (AssetTexture){ image, NULL, false };
+            assetLoader.images[image].pendingTextures++;
+            return LoadPlaceholderImageData(index, dataSize);
+        }
+    }
+
+    return ReadAssetFile(fileName, dataSize);
+}
+
+// Value a placeholder shows in material map slot, until its real texture arrives
+static Color GetPlaceholderColor(int map) {
+    switch (map) {
+        case MATERIAL_MAP_METALNESS: return (Color){ 0, 200, 255, 255 };   // mra: not metal, rough, no occlusion
+        case MATERIAL_MAP_NORMAL: return (Color){ 128, 128, 255, 255 };    // flat
+        case MATERIAL_MAP_ROUGHNESS: return (Color){ 200, 200, 200, 255 };
+        case MATERIAL_MAP_OCCLUSION: return WHITE;
+        case MATERIAL_MAP_EMISSION: return BLACK;
+        default: return GRAY;
+    }
+}
+
+// LoadModel with its images decoded in the background, placeholders are shown until UpdateAssetLoader swaps them
+// NOTE: falls back to a plain LoadModel when the loader is not running
+Model LoadModelAsync(const char *fileName) {
+    if (assetLoader.threadCount == 0) return LoadModel(fileName);
+
+    int firstTexture = assetLoader.textureCount;
+    SetLoadFileDataCallback(LoadAssetFileData);
+    Model model = LoadModel(fileName);
+    SetLoadFileDataCallback(NULL);
+
+    // the placeholder width says which request each map texture came from
+    Color pixels[MAX_ASSET_TEXTURES];
+    for (int m = 0; m < model.materialCount; m++) {
+        for (int k = 0; k < MAX_MATERIAL_MAPS; k++) {
+            Texture2D *texture = &model.materials[m].maps[k].texture;
+            int index = texture->width - 1;
+            if (texture->id == 0 || texture->id == rlGetTextureIdDefault() || texture->height != 1) continue;
+            if (index < firstTexture || index >= assetLoader.textureCount || assetLoader.textures[index].target != NULL) continue;
+
+            assetLoader.textures[index].target = texture;
+            for (int p = 0; p < texture->width; p++) pixels[p] = GetPlaceholderColor(k);
+            UpdateTexture(*texture, pixels);
+        }
+    }
+
+    // requests the loader did not turn into a material map never need their image
+    for (int i = firstTexture; i < assetLoader.textureCount; i++) {
+        if (assetLoader.textures[i].target == NULL) {
+            assetLoader.textures[i].uploaded = true;
+            assetLoader.images[assetLoader.textures[i].image].pendingTextures--;
+            assetLoader.uploadedCount++;
+        }
+    }
+
+    return model;
+}
+
+// Swap decoded images in for their placeholders, at least one and at most byteBudget bytes a frame
+// Returns true once every texture requested so far is in place
+bool UpdateAssetLoader(int byteBudget) {
+    int uploadedBytes = 0;
+
+    for (int i = 0; i < assetLoader.textureCount; i++) {
+        AssetTexture *texture = &assetLoader.textures[i];
+        AssetImage *image = &assetLoader.images[texture->image];
+        if (texture->uploaded || atomic_load_explicit(&image->state, memory_order_acquire) != ASSET_READY) continue;
+
+        int size = GetPixelDataSize(image->image.width, image->image.height, image->image.format);
+        if (uploadedBytes > 0 && uploadedBytes + size > byteBudget) break;
+
+        if (image->image.data != NULL) {
+            Texture2D loaded = LoadTextureFromImage(image->image);
+            if (loaded.id > 0) {
+                UnloadTexture(*texture->target);
+                *texture->target = loaded;
+            }
+            uploadedBytes += size;
+        }
+        texture->uploaded = true;
+        assetLoader.uploadedCount++;
+
+        // every material using the image has its own copy now
+        if (--image->pendingTextures == 0) {
+            UnloadImage(image->image);
+            atomic_store(&image->state, ASSET_DONE);
+        }
+    }
+
+    return assetLoader.uploadedCount == assetLoader.textureCount;
+}
+
+// Textures swapped in so far and requested in total
+void GetAssetLoaderProgress(int *uploaded, int *total) {
+    *uploaded = assetLoader.uploadedCount;
+    *total = assetLoader.textureCount;
+}
+
+
+#endif
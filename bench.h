@@ -0,0 +1,196 @@
+/*
+ * Bench
+ *
+ * Frame time recording for the --bench mode. A benchmark runs a fixed
+ * number of frames with a fixed seed, a fixed timestep and a scripted
+ * camera (GetBenchCamera), so two runs of the same build do the same work
+ * and runs of different builds can be compared.
+ *
+ * Each frame is split into named stages. BeginBenchFrame() starts the frame
+ * clock, EndBenchStage() charges the time since the previous mark to a stage
+ * and EndBenchFrame() records the whole frame. The time of every stage of
+ * every frame is kept, so the summary can give percentiles and not only a
+ * mean. ExportBenchmark() writes it as JSON or CSV, picked by extension.
+ *
+ * Times come from the monotonic clock, not GetTime(), so the simulation only
+ * benchmark can run without a window.
+ *
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_STAGES 8
+#define BENCH_SEED 20250519u          // rain seed of every benchmark run
+#define BENCH_TIMESTEP (1.0f / 60.0f) // simulated seconds per frame
+
+
+typedef struct Benchmark {
+    int frames;                 // frames to record
+    int frame;                  // frames recorded so far
+    int stageCount;
+    const char *stageNames[BENCH_MAX_STAGES];
+    double *times;              // per frame: whole frame then every stage, in seconds
+    double frameStart;
+    double mark;                // end of the last stage
+} Benchmark;
+
+typedef struct BenchStats {
+    double mean;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+} BenchStats;
+
+
+// Seconds on the monotonic clock
+static double GetBenchTime(void) {
+#if defined(_WIN32)
+    return (double)clock() / CLOCKS_PER_SEC;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+
+Benchmark LoadBenchmark(int frames, const char **stageNames, int stageCount) {
+    Benchmark bench = { 0 };
+    bench.frames = frames;
+    bench.stageCount = (stageCount < BENCH_MAX_STAGES) ? stageCount : BENCH_MAX_STAGES;
+    for (int i = 0; i < bench.stageCount; i++) bench.stageNames[i] = stageNames[i];
+    bench.times = RL_CALLOC((size_t)frames * (bench.stageCount + 1), sizeof(double));
+    return bench;
+}
+
+void UnloadBenchmark(Benchmark *bench) {
+    RL_FREE(bench->times);
+    *bench = (Benchmark){ 0 };
+}
+
+bool IsBenchmarkDone(const Benchmark *bench) {
+    return bench->frame >= bench->frames;
+}
+
+void BeginBenchFrame(Benchmark *bench) {
+    bench->frameStart = bench->mark = GetBenchTime();
+}
+
+// Charge the time since the last mark to stage
+void EndBenchStage(Benchmark *bench, int stage) {
+    double now = GetBenchTime();
+    if (bench->frame < bench->frames) bench->times[bench->frame * (bench->stageCount + 1) + 1 + stage] += now - bench->mark;
+    bench->mark = now;
+}
+
+void EndBenchFrame(Benchmark *bench) {
+    if (bench->frame >= bench->frames) return;
+    bench->times[bench->frame * (bench->stageCount + 1)] = GetBenchTime() - bench->frameStart;
+    bench->frame++;
+}
+
+// Camera for frame time of the run: an orbit around the car that swings in and out over the city
+// and up and down, so culling, LOD and collision all see changing work
+Camera GetBenchCamera(float time) {
+    float radius = 18.0f + 8.0f * sinf(0.2f * time);
+    float angle = 0.5f * time;
+    Camera camera = { 0 };
+    camera.position = (Vector3){ radius * cosf(angle), 10.0f + 5.0f * sinf(0.3f * time), radius * sinf(angle) };
+    camera.target = (Vector3){ 0.0f, 0.5f, 0.0f };
+    camera.up = (Vector3){ 0.0f, 1.0f, 0.0f };
+    camera.fovy = 45.0f;
+    camera.projection = CAMERA_PERSPECTIVE;
+    return camera;
+}
+
+static int CompareBenchTimes(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Statistics of column (0 the whole frame, 1 + stage a stage) over the recorded frames
+BenchStats GetBenchStats(const Benchmark *bench, int column) {
+    BenchStats stats = { 0 };
+    int n = bench->frame;
+    if (n == 0) return stats;
+
+    double *sorted = RL_MALLOC(n * sizeof(double));
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        sorted[i] = bench->times[i * (bench->stageCount + 1) + column];
+        sum += sorted[i];
+    }
+    qsort(sorted, n, sizeof(double), CompareBenchTimes);
+
+    // nearest rank
+    stats.mean = sum / n;
+    stats.p50 = sorted[(int)ceil(0.50 * n) - 1];
+    stats.p95 = sorted[(int)ceil(0.95 * n) - 1];
+    stats.p99 = sorted[(int)ceil(0.99 * n) - 1];
+    stats.max = sorted[n - 1];
+
+    RL_FREE(sorted);
+    return stats;
+}
+
+static const char *GetBenchColumnName(const Benchmark *bench, int column) {
+    return (column == 0) ? "frame" : bench->stageNames[column - 1];
+}
+
+// Summary of the run in milliseconds, JSON when fileName ends in .json, CSV otherwise
+// mode and threads are written along so results from different setups are not mixed up
+bool ExportBenchmark(const Benchmark *bench, const char *fileName, const char *mode, int threads) {
+    FILE *file = fopen(fileName, "w");
+    if (file == NULL) {
+        printf("bench: could not write %s\n", fileName);
+        return false;
+    }
+
+    bool json = IsFileExtension(fileName, ".json");
+    if (json) {
+        fprintf(file, "{\n  \"mode\": \"%s\",\n  \"frames\": %d,\n  \"threads\": %d,\n  \"seed\": %u,\n  \"timestep\": %f,\n",
+                mode, bench->frame, threads, BENCH_SEED, BENCH_TIMESTEP);
+        fprintf(file, "  \"stages\": {\n");
+    } else {
+        fprintf(file, "mode,frames,threads,stage,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+    }
+
+    for (int column = 0; column <= bench->stageCount; column++) {
+        BenchStats s = GetBenchStats(bench, column);
+        const char *name = GetBenchColumnName(bench, column);
+        if (json) {
+            fprintf(file, "    \"%s\": { \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f }%s\n",
+                    name, s.mean * 1000.0, s.p50 * 1000.0, s.p95 * 1000.0, s.p99 * 1000.0, s.max * 1000.0,
+                    (column < bench->stageCount) ? "," : "");
+        } else {
+            fprintf(file, "%s,%d,%d,%s,%.4f,%.4f,%.4f,%.4f,%.4f\n", mode, bench->frame, threads, name,
+                    s.mean * 1000.0, s.p50 * 1000.0, s.p95 * 1000.0, s.p99 * 1000.0, s.max * 1000.0);
+        }
+    }
+
+    if (json) fprintf(file, "  }\n}\n");
+    fclose(file);
+    return true;
+}
+
+void PrintBenchmark(const Benchmark *bench, const char *mode) {
+    printf("bench: %s, %d frames\n", mode, bench->frame);
+    printf("  %-10s %9s %9s %9s %9s %9s\n", "stage (ms)", "mean", "p50", "p95", "p99", "max");
+    for (int column = 0; column <= bench->stageCount; column++) {
+        BenchStats s = GetBenchStats(bench, column);
+        printf("  %-10s %9.3f %9.3f %9.3f %9.3f %9.3f\n", GetBenchColumnName(bench, column),
+                s.mean * 1000.0, s.p50 * 1000.0, s.p95 * 1000.0, s.p99 * 1000.0, s.max * 1000.0);
+    }
+}
+
+
+#endif
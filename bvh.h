@@ -0,0 +1,466 @@
+/*
+ * BVH
+ *
+ * Bounding volume hierarchy over the triangles of the loaded models, used
+ * to find where rain hits the city and the car.
+ *
+ * The tree is built once at load with a binned surface area heuristic.
+ * Nodes are stored in one flat array where the two children of a node are
+ * always next to each other, and the triangles are reordered so each leaf
+ * covers a contiguous run of them. Big subtrees are built in parallel on
+ * the job system. Splitting stops BVH_STACK_SIZE levels down, so the fixed
+ * traversal stack always holds every child left to visit.
+ *
+ * Queries are closest hit rays, batches of segments (one per drop) and
+ * any hit occlusion tests.
+ *
+ */
+
+#ifndef BVH_H
+#define BVH_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include <stdlib.h>
+#include <float.h>
+#include <assert.h>
+#include "jobs.h"
+
+#define BVH_BINS 16                 // SAH candidate splits per axis
+#define BVH_LEAF_TRIANGLES 2        // nodes this small are never split
+#define BVH_STACK_SIZE 64           // traversal stack, also the depth trees are built to at most
+#define BVH_PARALLEL_TRIANGLES 8192 // subtrees bigger than this build their children as jobs
+
+
+typedef struct BVHNode {
+    Vector3 min;
+    int leftFirst;  // first triangle of a leaf, left child of an inner node (right child is leftFirst + 1)
+    Vector3 max;
+    int count;      // triangles in a leaf, 0 for inner nodes
+} BVHNode;
+
+typedef struct BVHTriangle {
+    Vector3 v0, v1, v2;
+} BVHTriangle;
+
+typedef struct BVH {
+    BVHNode *nodes;         // nodes[0] is the root
+    int nodeCount;
+    BVHTriangle *triangles; // world space, in leaf order
+    int triangleCount;
+} BVH;
+
+// Scratch state shared by every thread of one build
+typedef struct BVHBuild {
+    BVH *bvh;
+    const BVHTriangle *triangles; // input order
+    Vector3 *centroids;
+    int *indices;                 // input triangle of each leaf slot
+    atomic_int nodesUsed;
+} BVHBuild;
+
+typedef struct BVHSplitJob {
+    BVHBuild *build;
+    int left;
+    int depth;                    // of the children
+} BVHSplitJob;
+
+
+// NOTE: fminf/fmaxf handle NaN and end up as library calls, these compile to single instructions
+static inline float BVHMin(float a, float b) { return (a < b) ? a : b; }
+static inline float BVHMax(float a, float b) { return (a > b) ? a : b; }
+
+static inline Vector3 BVHMin3(Vector3 a, Vector3 b) {
+    return (Vector3){ BVHMin(a.x, b.x), BVHMin(a.y, b.y), BVHMin(a.z, b.z) };
+}
+
+static inline Vector3 BVHMax3(Vector3 a, Vector3 b) {
+    return (Vector3){ BVHMax(a.x, b.x), BVHMax(a.y, b.y), BVHMax(a.z, b.z) };
+}
+
+static inline float BVHAxis(Vector3 v, int axis) {
+    return (axis == 0) ? v.x : (axis == 1) ? v.y : v.z;
+}
+
+static inline float BVHBoxArea(Vector3 min, Vector3 max) {
+    Vector3 e = Vector3Subtract(max, min);
+    if (e.x < 0.0f) return 0.0f; // empty
+    return e.x * e.y + e.y * e.z + e.z * e.x;
+}
+
+static inline void GrowBVHBox(Vector3 *min, Vector3 *max, const BVHTriangle *t) {
+    *min = BVHMin3(*min, BVHMin3(t->v0, BVHMin3(t->v1, t->v2)));
+    *max = BVHMax3(*max, BVHMax3(t->v0, BVHMax3(t->v1, t->v2)));
+}
+
+static void UpdateBVHNodeBounds(BVHBuild *b, BVHNode *node) {
+    node->min = (Vector3){ FLT_MAX, FLT_MAX, FLT_MAX };
+    node->max = (Vector3){ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int i = 0; i < node->count; i++) {
+        GrowBVHBox(&node->min, &node->max, &b->triangles[b->indices[node->leftFirst + i]]);
+    }
+}
+
+// Cheapest binned split of a node, returns its SAH cost (FLT_MAX when nothing can be split)
+static float FindBVHSplit(BVHBuild *b, const BVHNode *node, int *bestAxis, float *bestSplit) {
+    const int *indices = b->indices + node->leftFirst;
+
+    // splits are placed between triangle centroids, not the node bounds
+    Vector3 cmin = { FLT_MAX, FLT_MAX, FLT_MAX };
+    Vector3 cmax = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int i = 0; i < node->count; i++) {
+        cmin = BVHMin3(cmin, b->centroids[indices[i]]);
+        cmax = BVHMax3(cmax, b->centroids[indices[i]]);
+    }
+
+    float bestCost = FLT_MAX;
+    for (int axis = 0; axis < 3; axis++) {
+        float lo = BVHAxis(cmin, axis);
+        float hi = BVHAxis(cmax, axis);
+        if (hi <= lo) continue;
+
+        Vector3 binMin[BVH_BINS], binMax[BVH_BINS];
+        int binCount[BVH_BINS] = { 0 };
+        for (int i = 0; i < BVH_BINS; i++) {
+            binMin[i] = (Vector3){ FLT_MAX, FLT_MAX, FLT_MAX };
+            binMax[i] = (Vector3){ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        }
+
+        float scale = BVH_BINS / (hi - lo);
+        for (int i = 0; i < node->count; i++) {
+            int bin = (int)((BVHAxis(b->centroids[indices[i]], axis) - lo) * scale);
+            if (bin > BVH_BINS - 1) bin = BVH_BINS - 1;
+            binCount[bin]++;
+            GrowBVHBox(&binMin[bin], &binMax[bin], &b->triangles[indices[i]]);
+        }
+
+        // sweep from both sides to get the area and count left/right of every plane
+        float leftArea[BVH_BINS - 1], rightArea[BVH_BINS - 1];
+        int leftCount[BVH_BINS - 1], rightCount[BVH_BINS - 1];
+        Vector3 lmin = binMin[0], lmax = binMax[0];
+        Vector3 rmin = binMin[BVH_BINS - 1], rmax = binMax[BVH_BINS - 1];
+        int lsum = 0, rsum = 0;
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            lsum += binCount[i];
+            lmin = BVHMin3(lmin, binMin[i]);
+            lmax = BVHMax3(lmax, binMax[i]);
+            leftCount[i] = lsum;
+            leftArea[i] = BVHBoxArea(lmin, lmax);
+
+            int r = BVH_BINS - 1 - i;
+            rsum += binCount[r];
+            rmin = BVHMin3(rmin, binMin[r]);
+            rmax = BVHMax3(rmax, binMax[r]);
+            rightCount[r - 1] = rsum;
+            rightArea[r - 1] = BVHBoxArea(rmin, rmax);
+        }
+
+        for (int i = 0; i < BVH_BINS - 1; i++) {
+            float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+            if (cost < bestCost) {
+                bestCost = cost;
+                *bestAxis = axis;
+                *bestSplit = lo + (i + 1) / scale;
+            }
+        }
+    }
+
+    return bestCost;
+}
+
+static void SubdivideBVHNode(BVHBuild *b, int nodeIndex, int depth);
+
+static void SubdivideBVHJob(void *data, int begin, int end) {
+    BVHSplitJob *job = (BVHSplitJob *)data;
+    for (int i = begin; i < end; i++) SubdivideBVHNode(job->build, job->left + i, job->depth);
+}
+
+// Split a node until the SAH says a leaf is cheaper, node bounds must be set
+// Every inner node above a leaf can leave one child on the traversal stack, deeper nodes stay leaves
+static void SubdivideBVHNode(BVHBuild *b, int nodeIndex, int depth) {
+    BVHNode *node = &b->bvh->nodes[nodeIndex];
+    if (node->count <= BVH_LEAF_TRIANGLES || depth >= BVH_STACK_SIZE) return;
+
+    int axis = 0;
+    float split = 0.0f;
+    float splitCost = FindBVHSplit(b, node, &axis, &split);
+    float leafCost = node->count * BVHBoxArea(node->min, node->max);
+    if (splitCost >= leafCost) return;
+
+    // partition the triangle indices around the plane
+    int i = node->leftFirst;
+    int j = i + node->count - 1;
+    while (i <= j) {
+        if (BVHAxis(b->centroids[b->indices[i]], axis) < split) {
+            i++;
+        } else {
+            int tmp = b->indices[i];
+            b->indices[i] = b->indices[j];
+            b->indices[j--] = tmp;
+        }
+    }
+
+    int leftCount = i - node->leftFirst;
+    if (leftCount == 0 || leftCount == node->count) return;
+
+    int left = atomic_fetch_add(&b->nodesUsed, 2);
+    BVHNode *nodes = b->bvh->nodes;
+    nodes[left].leftFirst = node->leftFirst;
+    nodes[left].count = leftCount;
+    nodes[left + 1].leftFirst = i;
+    nodes[left + 1].count = node->count - leftCount;
+    UpdateBVHNodeBounds(b, &nodes[left]);
+    UpdateBVHNodeBounds(b, &nodes[left + 1]);
+
+    int count = node->count;
+    node->leftFirst = left;
+    node->count = 0;
+
+    // children own disjoint index ranges and node slots, so they can be built at the same time
+    if (count > BVH_PARALLEL_TRIANGLES && GetJobThreadCount() > 1) {
+        BVHSplitJob job = { b, left, depth + 1 };
+        JobCounter counter = { 0 };
+        JobParallelFor(&counter, 2, 1, SubdivideBVHJob, &job);
+        JobWait(&counter);
+    } else {
+        SubdivideBVHNode(b, left, depth + 1);
+        SubdivideBVHNode(b, left + 1, depth + 1);
+    }
+}
+
+// Build a BVH over count triangles, the triangles are copied
+BVH LoadBVH(const BVHTriangle *triangles, int count) {
+    BVH bvh = { 0 };
+    if (count <= 0) return bvh;
+
+    // every split adds a pair of children and leaves are never empty, so 2n - 1 nodes at most
+    bvh.nodes = malloc(2 * count * sizeof(BVHNode));
+    bvh.triangleCount = count;
+
+    BVHBuild b = { .bvh = &bvh, .triangles = triangles };
+    b.centroids = malloc(count * sizeof(Vector3));
+    b.indices = malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        b.centroids[i] = Vector3Scale(Vector3Add(triangles[i].v0, Vector3Add(triangles[i].v1, triangles[i].v2)), 1.0f / 3.0f);
+        b.indices[i] = i;
+    }
+
+    atomic_store(&b.nodesUsed, 1);
+    bvh.nodes[0].leftFirst = 0;
+    bvh.nodes[0].count = count;
+    UpdateBVHNodeBounds(&b, &bvh.nodes[0]);
+    SubdivideBVHNode(&b, 0, 0);
+
+    bvh.nodeCount = atomic_load(&b.nodesUsed);
+    bvh.nodes = realloc(bvh.nodes, bvh.nodeCount * sizeof(BVHNode));
+
+    // store the triangles in leaf order so a leaf reads one contiguous block
+    bvh.triangles = malloc(count * sizeof(BVHTriangle));
+    for (int i = 0; i < count; i++) bvh.triangles[i] = triangles[b.indices[i]];
+
+    free(b.centroids);
+    free(b.indices);
+    return bvh;
+}
+
+// Transform DrawModel(model, position, scale, tint) draws the model with
+Matrix GetModelDrawTransform(Model model, Vector3 position, float scale) {
+    Matrix placement = MatrixMultiply(MatrixScale(scale, scale, scale), MatrixTranslate(position.x, position.y, position.z));
+    return MatrixMultiply(model.transform, placement);
+}
+
+// Build a BVH over every mesh of modelCount models, placed with their own transform
+BVH LoadBVHFromModels(const Model *models, const Matrix *transforms, int modelCount) {
+    int count = 0;
+    for (int m = 0; m < modelCount; m++) {
+        for (int i = 0; i < models[m].meshCount; i++) {
+            if (models[m].meshes[i].vertices != NULL) count += models[m].meshes[i].triangleCount;
+        }
+    }
+
+    BVHTriangle *triangles = malloc(((count > 0) ? count : 1) * sizeof(BVHTriangle));
+    int n = 0;
+    for (int m = 0; m < modelCount; m++) {
+        for (int i = 0; i < models[m].meshCount; i++) {
+            Mesh mesh = models[m].meshes[i];
+            if (mesh.vertices == NULL) continue;
+
+            for (int t = 0; t < mesh.triangleCount; t++) {
+                Vector3 v[3];
+                for (int k = 0; k < 3; k++) {
+                    int index = (mesh.indices != NULL) ? mesh.indices[t * 3 + k] : t * 3 + k;
+                    Vector3 p = { mesh.vertices[index * 3], mesh.vertices[index * 3 + 1], mesh.vertices[index * 3 + 2] };
+                    v[k] = Vector3Transform(p, transforms[m]);
+                }
+                triangles[n++] = (BVHTriangle){ v[0], v[1], v[2] };
+            }
+        }
+    }
+
+    BVH bvh = LoadBVH(triangles, n);
+    free(triangles);
+    return bvh;
+}
+
+void UnloadBVH(BVH *bvh) {
+    free(bvh->nodes);
+    free(bvh->triangles);
+    *bvh = (BVH){ 0 };
+}
+
+BoundingBox GetBVHBounds(const BVH *bvh) {
+    if (bvh->nodeCount == 0) return (BoundingBox){ 0 };
+    return (BoundingBox){ bvh->nodes[0].min, bvh->nodes[0].max };
+}
+
+// Entry distance of a ray into a box, FLT_MAX on a miss or past tmax
+static inline float IntersectBVHBox(const BVHNode *node, Vector3 origin, Vector3 invDir, float tmax) {
+    float tx1 = (node->min.x - origin.x) * invDir.x, tx2 = (node->max.x - origin.x) * invDir.x;
+    float ty1 = (node->min.y - origin.y) * invDir.y, ty2 = (node->max.y - origin.y) * invDir.y;
+    float tz1 = (node->min.z - origin.z) * invDir.z, tz2 = (node->max.z - origin.z) * invDir.z;
+    float tnear = BVHMax(BVHMax(BVHMin(tx1, tx2), BVHMin(ty1, ty2)), BVHMin(tz1, tz2));
+    float tfar = BVHMin(BVHMin(BVHMax(tx1, tx2), BVHMax(ty1, ty2)), BVHMax(tz1, tz2));
+    return (tfar >= tnear && tnear < tmax && tfar > 0.0f) ? tnear : FLT_MAX;
+}
+
+// Moller-Trumbore, both sides of the triangle count as a hit
+static inline bool IntersectBVHTriangle(const BVHTriangle *tri, Vector3 origin, Vector3 dir, float *t) {
+    Vector3 e1 = Vector3Subtract(tri->v1, tri->v0);
+    Vector3 e2 = Vector3Subtract(tri->v2, tri->v0);
+    Vector3 p = Vector3CrossProduct(dir, e2);
+    float det = Vector3DotProduct(e1, p);
+    if (fabsf(det) < 1e-12f) return false;
+
+    float invDet = 1.0f / det;
+    Vector3 s = Vector3Subtract(origin, tri->v0);
+    float u = Vector3DotProduct(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f) return false;
+
+    Vector3 q = Vector3CrossProduct(s, e1);
+    float v = Vector3DotProduct(dir, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    float d = Vector3DotProduct(e2, q) * invDet;
+    if (d <= 0.0f || d >= *t) return false;
+    *t = d;
+    return true;
+}
+
+// Walk the tree for origin + dir * t, t in (0, tmax), nearest child first
+// Returns the triangle hit (closest one unless anyHit) or -1, *t is the hit distance
+static int TraverseBVH(const BVH *bvh, Vector3 origin, Vector3 dir, float tmax, bool anyHit, float *t) {
+    if (bvh->nodeCount == 0) return -1;
+
+    // avoid 0 * inf in the slab test for axis aligned rays
+    Vector3 invDir = {
+        1.0f / ((fabsf(dir.x) > 1e-20f) ? dir.x : 1e-20f),
+        1.0f / ((fabsf(dir.y) > 1e-20f) ? dir.y : 1e-20f),
+        1.0f / ((fabsf(dir.z) > 1e-20f) ? dir.z : 1e-20f)
+    };
+
+    *t = tmax;
+    int hit = -1;
+    if (IntersectBVHBox(&bvh->nodes[0], origin, invDir, *t) == FLT_MAX) return -1;
+
+    int stack[BVH_STACK_SIZE];
+    int top = 0;
+    int current = 0;
+    while (true) {
+        const BVHNode *node = &bvh->nodes[current];
+        if (node->count > 0) {
+            for (int i = 0; i < node->count; i++) {
+                if (IntersectBVHTriangle(&bvh->triangles[node->leftFirst + i], origin, dir, t)) {
+                    hit = node->leftFirst + i;
+                    if (anyHit) return hit;
+                }
+            }
+        } else {
+            int near = node->leftFirst;
+            int far = node->leftFirst + 1;
+            float dnear = IntersectBVHBox(&bvh->nodes[near], origin, invDir, *t);
+            float dfar = IntersectBVHBox(&bvh->nodes[far], origin, invDir, *t);
+            if (dfar < dnear) {
+                float d = dnear; dnear = dfar; dfar = d;
+                int n = near; near = far; far = n;
+            }
+
+            if (dnear != FLT_MAX) {
+                if (dfar != FLT_MAX) {
+                    assert(top < BVH_STACK_SIZE); // trees are never built deeper
+                    stack[top++] = far;
+                }
+                current = near;
+                continue;
+            }
+        }
+
+        // pop, skipping nodes that are now further away than the closest hit
+        if (top == 0) break;
+        current = stack[--top];
+        while (!anyHit && IntersectBVHBox(&bvh->nodes[current], origin, invDir, *t) == FLT_MAX) {
+            if (top == 0) return hit;
+            current = stack[--top];
+        }
+    }
+
+    return hit;
+}
+
+static RayCollision GetBVHCollision(const BVH *bvh, int triangle, Vector3 origin, Vector3 dir, float t) {
+    RayCollision collision = { 0 };
+    if (triangle < 0) return collision;
+
+    const BVHTriangle *tri = &bvh->triangles[triangle];
+    Vector3 normal = Vector3Normalize(Vector3CrossProduct(Vector3Subtract(tri->v1, tri->v0), Vector3Subtract(tri->v2, tri->v0)));
+    if (Vector3DotProduct(normal, dir) > 0.0f) normal = Vector3Negate(normal); // face the incoming ray
+
+    collision.hit = true;
+    collision.distance = t * Vector3Length(dir);
+    collision.point = Vector3Add(origin, Vector3Scale(dir, t));
+    collision.normal = normal;
+    return collision;
+}
+
+// Closest hit along a ray within maxDistance
+RayCollision GetRayCollisionBVH(const BVH *bvh, Ray ray, float maxDistance) {
+    Vector3 dir = Vector3Normalize(ray.direction);
+    float t;
+    int triangle = TraverseBVH(bvh, ray.position, dir, maxDistance, false, &t);
+    return GetBVHCollision(bvh, triangle, ray.position, dir, t);
+}
+
+// Closest hit on each of count segments from[i] -> to[i]
+// NOTE: meant for one segment per drop per frame, any number of threads may query at once
+void GetSegmentCollisionsBVH(const BVH *bvh, const Vector3 *from, const Vector3 *to, int count, RayCollision *hits) {
+    if (bvh->nodeCount == 0) {
+        for (int i = 0; i < count; i++) hits[i] = (RayCollision){ 0 };
+        return;
+    }
+
+    // most drops are nowhere near any geometry, reject them against the root box first
+    Vector3 rootMin = bvh->nodes[0].min;
+    Vector3 rootMax = bvh->nodes[0].max;
+    for (int i = 0; i < count; i++) {
+        Vector3 a = from[i], b = to[i];
+        if (BVHMax(a.x, b.x) < rootMin.x || BVHMin(a.x, b.x) > rootMax.x ||
+            BVHMax(a.y, b.y) < rootMin.y || BVHMin(a.y, b.y) > rootMax.y ||
+            BVHMax(a.z, b.z) < rootMin.z || BVHMin(a.z, b.z) > rootMax.z) {
+            hits[i] = (RayCollision){ 0 };
+            continue;
+        }
+
+        Vector3 dir = Vector3Subtract(b, a);
+        float t;
+        int triangle = TraverseBVH(bvh, a, dir, 1.0f, false, &t);
+        hits[i] = GetBVHCollision(bvh, triangle, a, dir, t);
+    }
+}
+
+// True when anything lies between from and to
+bool IsSegmentOccludedBVH(const BVH *bvh, Vector3 from, Vector3 to) {
+    float t;
+    return TraverseBVH(bvh, from, Vector3Subtract(to, from), 1.0f, true, &t) >= 0;
+}
+
+
+#endif
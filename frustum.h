@@ -0,0 +1,108 @@
+/*
+ * Frustum
+ *
+ * View frustum planes for culling, extracted from a view-projection matrix
+ * (Gribb/Hartmann). Planes point inwards: a point p is inside a plane when
+ * dot(plane.xyz, p) + plane.w >= 0.
+ *
+ */
+
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+
+typedef enum {
+    FRUSTUM_LEFT = 0,
+    FRUSTUM_RIGHT,
+    FRUSTUM_BOTTOM,
+    FRUSTUM_TOP,
+    FRUSTUM_NEAR,
+    FRUSTUM_FAR
+} FrustumPlane;
+
+typedef struct Frustum {
+    Vector4 planes[6];
+} Frustum;
+
+
+static inline Vector4 NormalizePlane(Vector4 p) {
+    float len = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+    if (len > 0.0f) len = 1.0f / len;
+    return (Vector4){ p.x * len, p.y * len, p.z * len, p.w * len };
+}
+
+// Frustum of a raylib view-projection matrix, MatrixMultiply(view, projection)
+Frustum GetFrustumFromMatrix(Matrix m) {
+    // rows of the (column vector) clip matrix
+    Vector4 row0 = { m.m0, m.m4, m.m8, m.m12 };
+    Vector4 row1 = { m.m1, m.m5, m.m9, m.m13 };
+    Vector4 row2 = { m.m2, m.m6, m.m10, m.m14 };
+    Vector4 row3 = { m.m3, m.m7, m.m11, m.m15 };
+
+    Frustum f = { 0 };
+    f.planes[FRUSTUM_LEFT] = NormalizePlane((Vector4){ row3.x + row0.x, row3.y + row0.y, row3.z + row0.z, row3.w + row0.w });
+    f.planes[FRUSTUM_RIGHT] = NormalizePlane((Vector4){ row3.x - row0.x, row3.y - row0.y, row3.z - row0.z, row3.w - row0.w });
+    f.planes[FRUSTUM_BOTTOM] = NormalizePlane((Vector4){ row3.x + row1.x, row3.y + row1.y, row3.z + row1.z, row3.w + row1.w });
+    f.planes[FRUSTUM_TOP] = NormalizePlane((Vector4){ row3.x - row1.x, row3.y - row1.y, row3.z - row1.z, row3.w - row1.w });
+    f.planes[FRUSTUM_NEAR] = NormalizePlane((Vector4){ row3.x + row2.x, row3.y + row2.y, row3.z + row2.z, row3.w + row2.w });
+    f.planes[FRUSTUM_FAR] = NormalizePlane((Vector4){ row3.x - row2.x, row3.y - row2.y, row3.z - row2.z, row3.w - row2.w });
+    return f;
+}
+
+// View-projection matrix BeginMode3D() will use for camera at the given aspect ratio
+Matrix GetCameraViewProjection(Camera camera, float aspect) {
+    Matrix view = GetCameraMatrix(camera);
+    Matrix projection;
+    if (camera.projection == CAMERA_PERSPECTIVE) {
+        projection = MatrixPerspective(camera.fovy * DEG2RAD, aspect, RL_CULL_DISTANCE_NEAR, RL_CULL_DISTANCE_FAR);
+    } else {
+        float top = camera.fovy / 2.0f;
+        float right = top * aspect;
+        projection = MatrixOrtho(-right, right, -top, top, RL_CULL_DISTANCE_NEAR, RL_CULL_DISTANCE_FAR);
+    }
+    return MatrixMultiply(view, projection);
+}
+
+Frustum GetCameraFrustum(Camera camera, float aspect) {
+    return GetFrustumFromMatrix(GetCameraViewProjection(camera, aspect));
+}
+
+static inline float PlaneDistance(Vector4 plane, Vector3 p) {
+    return plane.x * p.x + plane.y * p.y + plane.z * p.z + plane.w;
+}
+
+bool FrustumContainsSphere(const Frustum *f, Vector3 center, float radius) {
+    for (int i = 0; i < 6; i++) {
+        if (PlaneDistance(f->planes[i], center) < -radius) return false;
+    }
+    return true;
+}
+
+typedef enum {
+    FRUSTUM_OUTSIDE = 0,
+    FRUSTUM_INTERSECTS,
+    FRUSTUM_INSIDE
+} FrustumTest;
+
+// Classify a box against the frustum, may report FRUSTUM_INTERSECTS for boxes
+// that are just outside near a corner
+FrustumTest FrustumTestBox(const Frustum *f, BoundingBox box) {
+    FrustumTest result = FRUSTUM_INSIDE;
+    for (int i = 0; i < 6; i++) {
+        Vector4 p = f->planes[i];
+
+        // corner furthest along the plane normal, and the one furthest against it
+        Vector3 positive = { (p.x >= 0) ? box.max.x : box.min.x, (p.y >= 0) ? box.max.y : box.min.y, (p.z >= 0) ? box.max.z : box.min.z };
+        Vector3 negative = { (p.x >= 0) ? box.min.x : box.max.x, (p.y >= 0) ? box.min.y : box.max.y, (p.z >= 0) ? box.min.z : box.max.z };
+
+        if (PlaneDistance(p, positive) < 0.0f) return FRUSTUM_OUTSIDE;
+        if (PlaneDistance(p, negative) < 0.0f) result = FRUSTUM_INTERSECTS;
+    }
+    return result;
+}
+
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * Heightmap
+ *
+ * Top down rain occlusion map: the highest surface of the scene over a grid
+ * of texels on x/z. A drop has hit something once its y is below the height
+ * of its texel, so collision costs one lookup per drop, on the CPU through
+ * GetRainSurfaceHeight() and in rain.vs through the same data uploaded as a
+ * one channel float texture.
+ *
+ * The map is baked at load by casting one ray straight down through every
+ * texel center into the scene BVH, spread over the job system. Baking the
+ * whole city takes a while, so the result is cached to disk with a hash of
+ * the world space scene triangles. Any change to the models or to where they
+ * are placed changes the hash and the map is baked again.
+ *
+ */
+
+#ifndef HEIGHTMAP_H
+#define HEIGHTMAP_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bvh.h"
+#include "jobs.h"
+
+#define RAIN_HEIGHTMAP_EMPTY -1.0e6f // height of texels with nothing in them, must match rain.vs
+#define RAIN_HEIGHTMAP_VERSION 1     // bump when the baked data changes meaning
+#define RAIN_HEIGHTMAP_ROWS_PER_JOB 8
+
+
+typedef struct RainHeightmap {
+    int width;          // texels along x
+    int depth;          // texels along z
+    float texelSize;    // world units per texel
+    Vector2 origin;     // world x/z of the corner of texel (0, 0)
+    float *heights;     // width * depth, row major by z
+    Texture2D texture;  // heights as PIXELFORMAT_UNCOMPRESSED_R32
+} RainHeightmap;
+
+// Cache file layout: header followed by the heights
+typedef struct RainHeightmapHeader {
+    char magic[4];      // "RHMP"
+    int version;
+    uint64_t key;
+    int width;
+    int depth;
+    float texelSize;
+    Vector2 origin;
+} RainHeightmapHeader;
+
+typedef struct RainHeightmapBake {
+    const BVH *scene;
+    RainHeightmap *map;
+    float top;          // rays start here
+    float length;
+} RainHeightmapBake;
+
+
+// Highest surface under world (x, z), RAIN_HEIGHTMAP_EMPTY off the map
+static inline float GetRainSurfaceHeight(const RainHeightmap *map, float x, float z) {
+    int tx = (int)floorf((x - map->origin.x) / map->texelSize);
+    int tz = (int)floorf((z - map->origin.y) / map->texelSize);
+    if (tx < 0 || tz < 0 || tx >= map->width || tz >= map->depth) return RAIN_HEIGHTMAP_EMPTY;
+    return map->heights[tz * map->width + tx];
+}
+
+// FNV-1a over the scene triangles, they are already placed in the world
+static uint64_t HashRainHeightmapScene(const BVH *scene, float texelSize) {
+    uint64_t hash = 14695981039346656037ull;
+    const uint32_t *words = (const uint32_t *)scene->triangles;
+    size_t count = scene->triangleCount * sizeof(BVHTriangle) / sizeof(uint32_t);
+    for (size_t i = 0; i < count; i++) {
+        hash = (hash ^ words[i]) * 1099511628211ull;
+    }
+
+    uint32_t texel;
+    memcpy(&texel, &texelSize, sizeof(texel));
+    hash = (hash ^ texel) * 1099511628211ull;
+    return (hash ^ RAIN_HEIGHTMAP_VERSION) * 1099511628211ull;
+}
+
+static void BakeRainHeightmapJob(void *data, int begin, int end) {
+    RainHeightmapBake *bake = (RainHeightmapBake *)data;
+    RainHeightmap *map = bake->map;
+
+    for (int z = begin; z < end; z++) {
+        for (int x = 0; x < map->width; x++) {
+            Ray ray = {
+                { map->origin.x + (x + 0.5f) * map->texelSize, bake->top, map->origin.y + (z + 0.5f) * map->texelSize },
+                { 0.0f, -1.0f, 0.0f }
+            };
+            RayCollision hit = GetRayCollisionBVH(bake->scene, ray, bake->length);
+            map->heights[z * map->width + x] = (hit.hit) ? hit.point.y : RAIN_HEIGHTMAP_EMPTY;
+        }
+    }
+}
+
+// Cast a ray down through every texel of a map covering the scene bounds
+static RainHeightmap BakeRainHeightmap(const BVH *scene, float texelSize) {
+    RainHeightmap map = { 0 };
+    BoundingBox bounds = GetBVHBounds(scene);
+
+    map.texelSize = texelSize;
+    map.origin = (Vector2){ bounds.min.x, bounds.min.z };
+    map.width = (int)ceilf((bounds.max.x - bounds.min.x) / texelSize);
+    map.depth = (int)ceilf((bounds.max.z - bounds.min.z) / texelSize);
+    if (map.width < 1) map.width = 1;
+    if (map.depth < 1) map.depth = 1;
+    map.heights = malloc(map.width * map.depth * sizeof(float));
+
+    RainHeightmapBake bake = { scene, &map, bounds.max.y + 1.0f, bounds.max.y - bounds.min.y + 2.0f };
+    JobCounter counter = { 0 };
+    JobParallelFor(&counter, map.depth, RAIN_HEIGHTMAP_ROWS_PER_JOB, BakeRainHeightmapJob, &bake);
+    JobWait(&counter);
+
+    return map;
+}
+
+// Load a cached map, fails when the file is missing or was baked from something else
+static bool LoadRainHeightmapCache(const char *fileName, uint64_t key, float texelSize, RainHeightmap *map) {
+    if (!FileExists(fileName)) return false;
+
+    int size = 0;
+    unsigned char *data = LoadFileData(fileName, &size);
+    if (data == NULL) return false;
+
+    RainHeightmapHeader header;
+    bool valid = (size >= (int)sizeof(header));
+    if (valid) {
+        memcpy(&header, data, sizeof(header));
+        valid = (memcmp(header.magic, "RHMP", 4) == 0) && (header.version == RAIN_HEIGHTMAP_VERSION) &&
+            (header.key == key) && (header.texelSize == texelSize) && (header.width > 0) && (header.depth > 0) &&
+            (size == (int)(sizeof(header) + header.width * header.depth * sizeof(float)));
+    }
+
+    if (valid) {
+        *map = (RainHeightmap){ 0 };
+        map->width = header.width;
+        map->depth = header.depth;
+        map->texelSize = header.texelSize;
+        map->origin = header.origin;
+        map->heights = malloc(header.width * header.depth * sizeof(float));
+        memcpy(map->heights, data + sizeof(header), header.width * header.depth * sizeof(float));
+    }
+
+    UnloadFileData(data);
+    return valid;
+}
+
+static void SaveRainHeightmapCache(const char *fileName, uint64_t key, const RainHeightmap *map) {
+    RainHeightmapHeader header = { { 'R', 'H', 'M', 'P' }, RAIN_HEIGHTMAP_VERSION, key, map->width, map->depth,
+        map->texelSize, map->origin };
+    int heightsSize = map->width * map->depth * sizeof(float);
+
+    unsigned char *data = malloc(sizeof(header) + heightsSize);
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), map->heights, heightsSize);
+    if (!SaveFileData(fileName, data, sizeof(header) + heightsSize)) {
+        printf("heightmap: could not write cache %s\n", fileName);
+    }
+    free(data);
+}
+
+// Occlusion map of the scene with texelSize world units per texel, heights only (no texture, no GL needed)
+// cacheFileName is reused when it matches the scene, otherwise it is baked and rewritten
+RainHeightmap LoadRainHeightmapData(const BVH *scene, float texelSize, const char *cacheFileName) {
+    RainHeightmap map = { 0 };
+    uint64_t key = HashRainHeightmapScene(scene, texelSize);
+
+    if (LoadRainHeightmapCache(cacheFileName, key, texelSize, &map)) {
+        printf("heightmap: %d x %d from %s\n", map.width, map.depth, cacheFileName);
+    } else {
+        double start = GetTime();
+        map = BakeRainHeightmap(scene, texelSize);
+        printf("heightmap: %d x %d baked in %.1f ms\n", map.width, map.depth, (GetTime() - start) * 1000.0);
+        SaveRainHeightmapCache(cacheFileName, key, &map);
+    }
+
+    return map;
+}
+
+// Occlusion map of the scene with its heights uploaded for rain.vs, see LoadRainHeightmapData
+RainHeightmap LoadRainHeightmap(const BVH *scene, float texelSize, const char *cacheFileName) {
+    RainHeightmap map = LoadRainHeightmapData(scene, texelSize, cacheFileName);
+
+    // point sampled, texels past the edge are handled in the shader
+    Image image = { map.heights, map.width, map.depth, 1, PIXELFORMAT_UNCOMPRESSED_R32 };
+    map.texture = LoadTextureFromImage(image);
+    SetTextureFilter(map.texture, TEXTURE_FILTER_POINT);
+    SetTextureWrap(map.texture, TEXTURE_WRAP_CLAMP);
+
+    return map;
+}
+
+void UnloadRainHeightmap(RainHeightmap *map) {
+    if (map->texture.id > 0) UnloadTexture(map->texture);
+    free(map->heights);
+    *map = (RainHeightmap){ 0 };
+}
+
+// Where the map texture sits in the world, for the heightMapOrigin / heightMapSize uniforms
+Vector2 GetRainHeightmapSize(const RainHeightmap *map) {
+    return (Vector2){ map->width * map->texelSize, map->depth * map->texelSize };
+}
+
+
+#endif
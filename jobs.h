@@ -0,0 +1,310 @@
+/*
+ * Jobs
+ *
+ * Small work-stealing job system used to spread the per-frame simulation
+ * over every core.
+ *
+ * One worker thread is started per extra core. Every thread (the main
+ * thread is thread 0) owns a deque of jobs: the owner pushes and pops at
+ * the bottom, idle threads steal from the top of a random victim. Work is
+ * submitted as a parallel-for over [0, count) split into chunks, and its
+ * completion is tracked with a JobCounter. Waiting on a counter runs queued
+ * jobs instead of blocking, so jobs may submit and wait on other jobs.
+ *
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#if defined(_MSC_VER)
+#include <threads.h>
+#else
+#include <pthread.h>
+#endif
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#define JOB_THREAD_LOCAL __declspec(thread)
+#else
+#define JOB_THREAD_LOCAL _Thread_local
+#endif
+
+#define MAX_JOB_THREADS 64      // including the main thread
+#define JOB_QUEUE_SIZE 4096     // jobs per thread, must be a power of two
+
+
+// Thread primitives of the job system and the asset loader
+// NOTE: MSVC has no pthreads, its C11 threads are used instead (/std:c11, with
+// /experimental:c11atomics for stdatomic.h), windows.h would clash with raylib names
+#if defined(_MSC_VER)
+typedef thrd_t JobThread;
+typedef mtx_t JobMutex;
+typedef cnd_t JobCondition;
+typedef int JobThreadResult;
+#define JOB_THREAD_RESULT 0
+
+static inline bool StartJobThread(JobThread *thread, JobThreadResult (*main)(void *), void *arg) { return thrd_create(thread, main, arg) == thrd_success; }
+static inline void JoinJobThread(JobThread thread) { thrd_join(thread, NULL); }
+static inline void InitJobMutex(JobMutex *mutex) { mtx_init(mutex, mtx_plain); }
+static inline void DestroyJobMutex(JobMutex *mutex) { mtx_destroy(mutex); }
+static inline void LockJobMutex(JobMutex *mutex) { mtx_lock(mutex); }
+static inline void UnlockJobMutex(JobMutex *mutex) { mtx_unlock(mutex); }
+static inline void InitJobCondition(JobCondition *cond) { cnd_init(cond); }
+static inline void DestroyJobCondition(JobCondition *cond) { cnd_destroy(cond); }
+static inline void WaitJobCondition(JobCondition *cond, JobMutex *mutex) { cnd_wait(cond, mutex); }
+static inline void SignalJobCondition(JobCondition *cond) { cnd_signal(cond); }
+static inline void BroadcastJobCondition(JobCondition *cond) { cnd_broadcast(cond); }
+#else
+typedef pthread_t JobThread;
+typedef pthread_mutex_t JobMutex;
+typedef pthread_cond_t JobCondition;
+typedef void *JobThreadResult;
+#define JOB_THREAD_RESULT NULL
+
+static inline bool StartJobThread(JobThread *thread, JobThreadResult (*main)(void *), void *arg) { return pthread_create(thread, NULL, main, arg) == 0; }
+static inline void JoinJobThread(JobThread thread) { pthread_join(thread, NULL); }
+static inline void InitJobMutex(JobMutex *mutex) { pthread_mutex_init(mutex, NULL); }
+static inline void DestroyJobMutex(JobMutex *mutex) { pthread_mutex_destroy(mutex); }
+static inline void LockJobMutex(JobMutex *mutex) { pthread_mutex_lock(mutex); }
+static inline void UnlockJobMutex(JobMutex *mutex) { pthread_mutex_unlock(mutex); }
+static inline void InitJobCondition(JobCondition *cond) { pthread_cond_init(cond, NULL); }
+static inline void DestroyJobCondition(JobCondition *cond) { pthread_cond_destroy(cond); }
+static inline void WaitJobCondition(JobCondition *cond, JobMutex *mutex) { pthread_cond_wait(cond, mutex); }
+static inline void SignalJobCondition(JobCondition *cond) { pthread_cond_signal(cond); }
+static inline void BroadcastJobCondition(JobCondition *cond) { pthread_cond_broadcast(cond); }
+#endif
+
+
+typedef void (*JobFunc)(void *data, int begin, int end);
+
+// Number of jobs still running for one submission
+typedef struct JobCounter {
+    atomic_int pending;
+} JobCounter;
+
+typedef struct Job {
+    JobFunc func;
+    void *data;
+    int begin;
+    int end;
+    JobCounter *counter;
+} Job;
+
+// Per thread deque, the owner works at the bottom and thieves take from the top
+// NOTE: critical sections are a few instructions long, so a spinlock is used
+typedef struct JobQueue {
+    Job jobs[JOB_QUEUE_SIZE];
+    int top;
+    int bottom;
+    atomic_flag lock;
+} JobQueue;
+
+typedef struct JobSystem {
+    int threadCount;            // worker threads + the main thread
+    JobThread threads[MAX_JOB_THREADS];
+    JobQueue *queues;
+
+    atomic_int running;
+    atomic_int queued;          // jobs sitting in any queue
+    JobMutex sleepLock;
+    JobCondition wake;
+} JobSystem;
+
+static JobSystem jobSystem = { 0 };
+static JOB_THREAD_LOCAL int jobThreadIndex = 0;
+static JOB_THREAD_LOCAL unsigned int jobStealSeed = 1;
+
+
+int GetCoreCount(void) {
+#if defined(_WIN32)
+    // NOTE: windows.h clashes with raylib names, so ask the environment instead
+    const char *n = getenv("NUMBER_OF_PROCESSORS");
+    return (n != NULL && atoi(n) > 0) ? atoi(n) : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+#endif
+}
+
+static void LockJobQueue(JobQueue *q) {
+    while (atomic_flag_test_and_set_explicit(&q->lock, memory_order_acquire)) { }
+}
+
+static void UnlockJobQueue(JobQueue *q) {
+    atomic_flag_clear_explicit(&q->lock, memory_order_release);
+}
+
+// Push to the calling thread's queue, returns false when it is full
+static bool PushJob(Job job) {
+    JobQueue *q = &jobSystem.queues[jobThreadIndex];
+    bool pushed = false;
+
+    LockJobQueue(q);
+    if (q->bottom - q->top < JOB_QUEUE_SIZE) {
+        q->jobs[q->bottom & (JOB_QUEUE_SIZE - 1)] = job;
+        q->bottom++;
+        pushed = true;
+    }
+    UnlockJobQueue(q);
+
+    if (pushed) atomic_fetch_add(&jobSystem.queued, 1);
+    return pushed;
+}
+
+// Pop the newest job of the calling thread, or steal the oldest job of another thread
+static bool PopJob(Job *job) {
+    JobQueue *own = &jobSystem.queues[jobThreadIndex];
+
+    LockJobQueue(own);
+    if (own->bottom > own->top) {
+        own->bottom--;
+        *job = own->jobs[own->bottom & (JOB_QUEUE_SIZE - 1)];
+        UnlockJobQueue(own);
+        atomic_fetch_sub(&jobSystem.queued, 1);
+        return true;
+    }
+    UnlockJobQueue(own);
+
+    if (atomic_load(&jobSystem.queued) == 0) return false;
+
+    // start at a random victim so thieves spread out
+    jobStealSeed = jobStealSeed * 1103515245u + 12345u;
+    int start = (int)((jobStealSeed >> 16) % (unsigned int)jobSystem.threadCount);
+    for (int n = 0; n < jobSystem.threadCount; n++) {
+        int victim = (start + n) % jobSystem.threadCount;
+        if (victim == jobThreadIndex) continue;
+
+        JobQueue *q = &jobSystem.queues[victim];
+        LockJobQueue(q);
+        if (q->bottom > q->top) {
+            *job = q->jobs[q->top & (JOB_QUEUE_SIZE - 1)];
+            q->top++;
+            UnlockJobQueue(q);
+            atomic_fetch_sub(&jobSystem.queued, 1);
+            return true;
+        }
+        UnlockJobQueue(q);
+    }
+
+    return false;
+}
+
+static void RunJob(Job job) {
+    job.func(job.data, job.begin, job.end);
+    atomic_fetch_sub_explicit(&job.counter->pending, 1, memory_order_release);
+}
+
+static JobThreadResult JobWorkerMain(void *arg) {
+    jobThreadIndex = (int)(intptr_t)arg;
+    jobStealSeed = 2654435761u * (unsigned int)(jobThreadIndex + 1);
+
+    while (atomic_load(&jobSystem.running)) {
+        Job job;
+        if (PopJob(&job)) {
+            RunJob(job);
+            continue;
+        }
+
+        LockJobMutex(&jobSystem.sleepLock);
+        while (atomic_load(&jobSystem.running) && atomic_load(&jobSystem.queued) == 0) {
+            WaitJobCondition(&jobSystem.wake, &jobSystem.sleepLock);
+        }
+        UnlockJobMutex(&jobSystem.sleepLock);
+    }
+
+    return JOB_THREAD_RESULT;
+}
+
+// Start threadCount - 1 workers, the main thread is the remaining one
+// threadCount <= 0 uses one thread per core
+void InitJobSystem(int threadCount) {
+    if (threadCount <= 0) threadCount = GetCoreCount();
+    if (threadCount > MAX_JOB_THREADS) threadCount = MAX_JOB_THREADS;
+
+    jobSystem.threadCount = threadCount;
+    jobSystem.queues = calloc(threadCount, sizeof(JobQueue));
+    for (int i = 0; i < threadCount; i++) {
+        atomic_flag_clear(&jobSystem.queues[i].lock);
+    }
+    atomic_store(&jobSystem.running, 1);
+    atomic_store(&jobSystem.queued, 0);
+    InitJobMutex(&jobSystem.sleepLock);
+    InitJobCondition(&jobSystem.wake);
+
+    jobThreadIndex = 0;
+    for (int i = 1; i < threadCount; i++) {
+        if (!StartJobThread(&jobSystem.threads[i], JobWorkerMain, (void *)(intptr_t)i)) {
+            printf("Could not start job thread %d\n", i);
+            jobSystem.threadCount = i;
+            break;
+        }
+    }
+
+    printf("job system: %d threads\n", jobSystem.threadCount);
+}
+
+void ShutdownJobSystem(void) {
+    LockJobMutex(&jobSystem.sleepLock);
+    atomic_store(&jobSystem.running, 0);
+    BroadcastJobCondition(&jobSystem.wake);
+    UnlockJobMutex(&jobSystem.sleepLock);
+
+    for (int i = 1; i < jobSystem.threadCount; i++) {
+        JoinJobThread(jobSystem.threads[i]);
+    }
+
+    DestroyJobCondition(&jobSystem.wake);
+    DestroyJobMutex(&jobSystem.sleepLock);
+    free(jobSystem.queues);
+    jobSystem = (JobSystem){ 0 };
+}
+
+// Threads that may run jobs, use with GetJobThreadIndex for per thread scratch data
+int GetJobThreadCount(void) {
+    return (jobSystem.threadCount > 0) ? jobSystem.threadCount : 1;
+}
+
+int GetJobThreadIndex(void) {
+    return jobThreadIndex;
+}
+
+// Queue func over [0, count) in chunks of chunkSize, returns without waiting
+// NOTE: counter must stay alive until JobWait returns
+void JobParallelFor(JobCounter *counter, int count, int chunkSize, JobFunc func, void *data) {
+    if (chunkSize < 1) chunkSize = 1;
+    int chunks = (count + chunkSize - 1) / chunkSize;
+    atomic_store(&counter->pending, chunks);
+
+    for (int begin = 0; begin < count; begin += chunkSize) {
+        int end = (begin + chunkSize < count) ? begin + chunkSize : count;
+        Job job = { func, data, begin, end, counter };
+
+        // no workers, just run it here (chunks are kept so callers can rely on them)
+        if (jobSystem.threadCount <= 1 || !PushJob(job)) RunJob(job);
+    }
+    if (jobSystem.threadCount <= 1) return;
+
+    LockJobMutex(&jobSystem.sleepLock);
+    BroadcastJobCondition(&jobSystem.wake);
+    UnlockJobMutex(&jobSystem.sleepLock);
+}
+
+// Run queued jobs until every job of counter has finished
+void JobWait(JobCounter *counter) {
+    while (atomic_load_explicit(&counter->pending, memory_order_acquire) > 0) {
+        Job job;
+        if (PopJob(&job)) RunJob(job);
+    }
+}
+
+
+#endif
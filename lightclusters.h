@@ -0,0 +1,306 @@
+/*
+ * LightClusters
+ *
+ * Clustered forward lighting. The view frustum is split into a grid of
+ * clusters (froxels): CLUSTER_TILES_X x CLUSTER_TILES_Y screen tiles, each cut
+ * into CLUSTER_SLICES depth slices spaced exponentially between CLUSTER_NEAR
+ * and CLUSTER_FAR. Once a frame UpdateLightClusters() finds the clusters every
+ * light reaches and writes a list of light indices per cluster, so a fragment
+ * only loops over the few lights around it however many are in the scene.
+ *
+ * Lights are point lights with a range, past which their light is cut off.
+ * The range is where CLUSTER_LIGHT_FALLOFF * intensity / d^2 (the falloff of
+ * rain.vs, pbr.fs is a little dimmer) drops to CLUSTER_LIGHT_CUTOFF, and the
+ * shaders fade lights out towards it so the cut is not visible.
+ *
+ * Everything is handed to the shaders in three float textures, sampled with
+ * texture2D() as GLSL 100 has no buffers or texelFetch:
+ *
+ *   lights:   2 texels per light, (position, range) and (color, intensity)
+ *   clusters: one texel per cluster, offset * 64 + count into the index list,
+ *             tiles along x, slices along y
+ *   indices:  light index per texel, the lists of all clusters back to back
+ *
+ * BindLightClusters() binds them to texture units from CLUSTER_TEXTURE_UNIT
+ * on, past the ones DrawMesh() uses for material maps, so they stay bound
+ * for every draw of the frame. The shader side (ClusterLights() in pbr.fs
+ * and rain.vs) must use the same grid and texture sizes.
+ *
+ */
+
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include <math.h>
+#include <string.h>
+#include "uniforms.h"
+
+#define MAX_CLUSTER_LIGHTS 1024     // lights per frame
+#define MAX_LIGHTS_PER_CLUSTER 32   // lights one fragment loops over at most, below 64 for the packing
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#define CLUSTER_COUNT (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+#define CLUSTER_NEAR 0.5f           // view depth of the first slice, anything closer shares it
+#define CLUSTER_FAR 300.0f          // view depth of the end of the last slice
+
+#define CLUSTER_LIGHT_FALLOFF 5.0f
+#define CLUSTER_LIGHT_CUTOFF 0.05f
+
+// Index texture, large enough for every cluster to be full
+#define CLUSTER_INDEX_WIDTH 512
+#define CLUSTER_INDEX_HEIGHT ((CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER + CLUSTER_INDEX_WIDTH - 1) / CLUSTER_INDEX_WIDTH)
+
+#define CLUSTER_TEXTURE_UNIT 12     // lights, clusters and indices take this unit and the next two
+
+
+typedef struct LightClusters {
+    int lightCount;
+    float *lightData;           // 2 RGBA texels per light
+    float *clusterData;         // offset * 64 + count per cluster
+    float *indexData;
+    int *clusterCounts;         // lights per cluster, while building
+    int *clusterOffsets;        // start of each cluster's list, while building
+    Vector3 *views;             // light positions in view space, while building
+    int indexCount;             // indices used this frame
+    int maxClusterLights;       // most lights in one cluster this frame
+    int overflow;               // light to cluster assignments dropped because the cluster was full
+
+    Texture2D lightTexture;
+    Texture2D clusterTexture;
+    Texture2D indexTexture;
+
+    // View the clusters were built for, the shaders need it to find their cluster
+    Vector3 origin;
+    Vector3 forward;
+    Vector2 tileSize;           // pixels
+} LightClusters;
+
+// Uniforms a shader using the clusters needs set every frame
+typedef struct LightClusterLocations {
+    int origin;
+    int forward;
+    int screen;
+    int depth;
+} LightClusterLocations;
+
+
+static Texture2D LoadClusterTexture(int width, int height, int format) {
+    Texture2D texture = { 0 };
+    texture.id = rlLoadTexture(NULL, width, height, format, 1);
+    texture.width = width;
+    texture.height = height;
+    texture.mipmaps = 1;
+    texture.format = format;
+    SetTextureFilter(texture, TEXTURE_FILTER_POINT);
+    SetTextureWrap(texture, TEXTURE_WRAP_CLAMP);
+    return texture;
+}
+
+LightClusters LoadLightClusters(void) {
+    LightClusters clusters = { 0 };
+    clusters.lightData = RL_CALLOC(MAX_CLUSTER_LIGHTS * 8, sizeof(float));
+    clusters.clusterData = RL_CALLOC(CLUSTER_COUNT, sizeof(float));
+    clusters.indexData = RL_CALLOC(CLUSTER_INDEX_WIDTH * CLUSTER_INDEX_HEIGHT, sizeof(float));
+    clusters.clusterCounts = RL_CALLOC(CLUSTER_COUNT, sizeof(int));
+    clusters.clusterOffsets = RL_CALLOC(CLUSTER_COUNT, sizeof(int));
+    clusters.views = RL_CALLOC(MAX_CLUSTER_LIGHTS, sizeof(Vector3));
+
+    clusters.lightTexture = LoadClusterTexture(MAX_CLUSTER_LIGHTS * 2, 1, PIXELFORMAT_UNCOMPRESSED_R32G32B32A32);
+    clusters.clusterTexture = LoadClusterTexture(CLUSTER_TILES_X * CLUSTER_TILES_Y, CLUSTER_SLICES, PIXELFORMAT_UNCOMPRESSED_R32);
+    clusters.indexTexture = LoadClusterTexture(CLUSTER_INDEX_WIDTH, CLUSTER_INDEX_HEIGHT, PIXELFORMAT_UNCOMPRESSED_R32);
+    return clusters;
+}
+
+void UnloadLightClusters(LightClusters *clusters) {
+    UnloadTexture(clusters->lightTexture);
+    UnloadTexture(clusters->clusterTexture);
+    UnloadTexture(clusters->indexTexture);
+    RL_FREE(clusters->lightData);
+    RL_FREE(clusters->clusterData);
+    RL_FREE(clusters->indexData);
+    RL_FREE(clusters->clusterCounts);
+    RL_FREE(clusters->clusterOffsets);
+    RL_FREE(clusters->views);
+    *clusters = (LightClusters){ 0 };
+}
+
+// Distance where a light of intensity falls off to CLUSTER_LIGHT_CUTOFF
+float GetClusterLightRange(float intensity) {
+    return sqrtf(CLUSTER_LIGHT_FALLOFF * fmaxf(intensity, 0.0f) / CLUSTER_LIGHT_CUTOFF);
+}
+
+// Drop the lights of the last frame
+void ClearClusterLights(LightClusters *clusters) {
+    clusters->lightCount = 0;
+}
+
+// Add a point light for this frame, color is normalized, returns false when the clusters are full
+bool AddClusterLight(LightClusters *clusters, Vector3 position, Vector4 color, float intensity) {
+    if (clusters->lightCount == MAX_CLUSTER_LIGHTS) return false;
+
+    float *light = clusters->lightData + clusters->lightCount * 8;
+    light[0] = position.x;
+    light[1] = position.y;
+    light[2] = position.z;
+    light[3] = GetClusterLightRange(intensity);
+    light[4] = color.x;
+    light[5] = color.y;
+    light[6] = color.z;
+    light[7] = intensity;
+    clusters->lightCount++;
+    return true;
+}
+
+// Slice holding view depth, depths before CLUSTER_NEAR are in the first one
+static int GetClusterSlice(float depth) {
+    if (depth <= CLUSTER_NEAR) return 0;
+    int slice = (int)(logf(depth / CLUSTER_NEAR) * (CLUSTER_SLICES / logf(CLUSTER_FAR / CLUSTER_NEAR)));
+    return (slice < CLUSTER_SLICES - 1) ? slice : CLUSTER_SLICES - 1;
+}
+
+static float GetClusterSliceDepth(int slice) {
+    return CLUSTER_NEAR * powf(CLUSTER_FAR / CLUSTER_NEAR, (float)slice / CLUSTER_SLICES);
+}
+
+// Tiles [first, last] covered by the view space interval [low, high] (x or y) between depths near and far
+// tanHalf is the tangent of half the field of view on that axis, returns false when it is off screen
+static bool GetClusterTileRange(float low, float high, float near, float far, float tanHalf, int tiles, int *first, int *last) {
+    // n / z is monotonic in z, so the extremes of either bound are at one of the two depths
+    float lowNdc = fminf(low / (near * tanHalf), low / (far * tanHalf));
+    float highNdc = fmaxf(high / (near * tanHalf), high / (far * tanHalf));
+    if (highNdc < -1.0f || lowNdc > 1.0f) return false;
+
+    *first = (int)floorf((lowNdc * 0.5f + 0.5f) * tiles);
+    *last = (int)floorf((highNdc * 0.5f + 0.5f) * tiles);
+    if (*first < 0) *first = 0;
+    if (*last > tiles - 1) *last = tiles - 1;
+    return true;
+}
+
+// Count (fill false) or write (fill true) light into every cluster its range reaches
+static void AssignClusterLight(LightClusters *clusters, int light, float tanX, float tanY, bool fill) {
+    Vector3 view = clusters->views[light];
+    float range = clusters->lightData[light * 8 + 3];
+    if (view.z + range < 0.0f) return; // behind the camera
+
+    int firstSlice = GetClusterSlice(view.z - range);
+    int lastSlice = GetClusterSlice(view.z + range);
+    for (int slice = firstSlice; slice <= lastSlice; slice++) {
+        // part of the light's depth range inside this slice, kept in front of the camera
+        float near = fmaxf(fmaxf(view.z - range, (slice == 0) ? 0.0f : GetClusterSliceDepth(slice)), 0.01f);
+        float far = fmaxf(fminf(view.z + range, GetClusterSliceDepth(slice + 1)), near);
+        if (slice == CLUSTER_SLICES - 1) far = fmaxf(view.z + range, near);
+
+        int x0, x1, y0, y1;
+        if (!GetClusterTileRange(view.x - range, view.x + range, near, far, tanX, CLUSTER_TILES_X, &x0, &x1)) continue;
+        if (!GetClusterTileRange(view.y - range, view.y + range, near, far, tanY, CLUSTER_TILES_Y, &y0, &y1)) continue;
+
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                int cluster = (slice * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x;
+                int count = clusters->clusterCounts[cluster];
+                if (count == MAX_LIGHTS_PER_CLUSTER) {
+                    if (!fill) clusters->overflow++;
+                    continue;
+                }
+                if (fill) clusters->indexData[clusters->clusterOffsets[cluster] + count] = (float)light;
+                clusters->clusterCounts[cluster] = count + 1;
+            }
+        }
+    }
+}
+
+// Assign the lights added this frame to the clusters of camera and upload everything
+// width and height are the size in pixels of the target the frame is drawn to
+void UpdateLightClusters(LightClusters *clusters, Camera camera, int width, int height) {
+    Vector3 forward = Vector3Normalize(Vector3Subtract(camera.target, camera.position));
+    Vector3 right = Vector3Normalize(Vector3CrossProduct(forward, camera.up));
+    Vector3 up = Vector3CrossProduct(right, forward);
+    float tanY = tanf(camera.fovy * DEG2RAD * 0.5f);
+    float tanX = tanY * (float)width / (float)height;
+
+    clusters->origin = camera.position;
+    clusters->forward = forward;
+    clusters->tileSize = (Vector2){ (float)width / CLUSTER_TILES_X, (float)height / CLUSTER_TILES_Y };
+    clusters->overflow = 0;
+
+    // light positions in view space, depth along forward
+    for (int i = 0; i < clusters->lightCount; i++) {
+        const float *light = clusters->lightData + i * 8;
+        Vector3 d = Vector3Subtract((Vector3){ light[0], light[1], light[2] }, camera.position);
+        clusters->views[i] = (Vector3){ Vector3DotProduct(d, right), Vector3DotProduct(d, up), Vector3DotProduct(d, forward) };
+    }
+
+    // count, lay the lists out back to back, then fill them
+    memset(clusters->clusterCounts, 0, CLUSTER_COUNT * sizeof(int));
+    for (int i = 0; i < clusters->lightCount; i++) AssignClusterLight(clusters, i, tanX, tanY, false);
+
+    int total = 0;
+    clusters->maxClusterLights = 0;
+    for (int c = 0; c < CLUSTER_COUNT; c++) {
+        int count = clusters->clusterCounts[c];
+        clusters->clusterOffsets[c] = total;
+        clusters->clusterData[c] = (float)(total * 64 + count);
+        if (count > clusters->maxClusterLights) clusters->maxClusterLights = count;
+        total += count;
+    }
+    clusters->indexCount = total;
+
+    memset(clusters->clusterCounts, 0, CLUSTER_COUNT * sizeof(int));
+    for (int i = 0; i < clusters->lightCount; i++) AssignClusterLight(clusters, i, tanX, tanY, true);
+
+    // only the parts in use are uploaded
+    if (clusters->lightCount > 0) {
+        UpdateTextureRec(clusters->lightTexture, (Rectangle){ 0, 0, clusters->lightCount * 2, 1 }, clusters->lightData);
+    }
+    UpdateTexture(clusters->clusterTexture, clusters->clusterData);
+    if (total > 0) {
+        int rows = (total + CLUSTER_INDEX_WIDTH - 1) / CLUSTER_INDEX_WIDTH;
+        UpdateTextureRec(clusters->indexTexture, (Rectangle){ 0, 0, CLUSTER_INDEX_WIDTH, rows }, clusters->indexData);
+    }
+}
+
+// Bind the cluster textures for the draws that follow
+void BindLightClusters(const LightClusters *clusters) {
+    rlActiveTextureSlot(CLUSTER_TEXTURE_UNIT);
+    rlEnableTexture(clusters->lightTexture.id);
+    rlActiveTextureSlot(CLUSTER_TEXTURE_UNIT + 1);
+    rlEnableTexture(clusters->clusterTexture.id);
+    rlActiveTextureSlot(CLUSTER_TEXTURE_UNIT + 2);
+    rlEnableTexture(clusters->indexTexture.id);
+    rlActiveTextureSlot(0);
+}
+
+// Locations of the cluster uniforms of shader, its samplers are pointed at the cluster texture units
+LightClusterLocations GetLightClusterLocations(Shader shader) {
+    const char *samplers[3] = { "clusterLights", "clusterGrid", "clusterIndices" };
+    for (int i = 0; i < 3; i++) {
+        int unit = CLUSTER_TEXTURE_UNIT + i;
+        SetShaderValue(shader, GetShaderLocation(shader, samplers[i]), &unit, SHADER_UNIFORM_SAMPLER2D);
+    }
+
+    LightClusterLocations locs = { 0 };
+    locs.origin = GetShaderLocation(shader, "clusterOrigin");
+    locs.forward = GetShaderLocation(shader, "clusterForward");
+    locs.screen = GetShaderLocation(shader, "clusterScreen");
+    locs.depth = GetShaderLocation(shader, "clusterDepth");
+    return locs;
+}
+
+// Send the view the clusters were built for
+// scale is pixels of the target the shader draws into per pixel the clusters were built for
+void SetLightClusterUniforms(ShaderUniforms *uniforms, LightClusterLocations locs, const LightClusters *clusters, float scale) {
+    float screen[4] = { clusters->tileSize.x * scale, clusters->tileSize.y * scale, CLUSTER_TILES_X, CLUSTER_TILES_Y };
+    float depth[4] = { CLUSTER_NEAR, CLUSTER_SLICES / logf(CLUSTER_FAR / CLUSTER_NEAR), CLUSTER_SLICES, 0.0f };
+    SetShaderUniform(uniforms, locs.origin, &clusters->origin, SHADER_UNIFORM_VEC3);
+    SetShaderUniform(uniforms, locs.forward, &clusters->forward, SHADER_UNIFORM_VEC3);
+    SetShaderUniform(uniforms, locs.screen, screen, SHADER_UNIFORM_VEC4);
+    SetShaderUniform(uniforms, locs.depth, depth, SHADER_UNIFORM_VEC4);
+}
+
+
+#endif
@@ -0,0 +1,616 @@
+/*
+ * MeshLOD
+ *
+ * Levels of detail for static meshes, built at load and cached to disk. Every
+ * level keeps about MESH_LOD_RATIO of the triangles of the one before, made
+ * by collapsing edges in order of their quadric error (Garland & Heckbert):
+ * each vertex carries the sum of the squared distances to the planes of the
+ * triangles around it, and the collapse that moves the surface the least
+ * goes first. A vertex only ever collapses onto a neighbour, so the kept
+ * vertices keep their exact texcoords and normals.
+ *
+ * Vertices on a UV or normal seam (one position with different attributes)
+ * and on open borders are never collapsed, so seams and silhouettes of open
+ * meshes stay where they are. Collapses that would flip a triangle are
+ * skipped. The error of a level is the largest collapse error that went into
+ * it, as a distance in mesh units.
+ *
+ * Every frame SelectMeshLOD() projects the error of each level to pixels at
+ * the distance of the mesh and picks the coarsest one under the pixel error
+ * of the view. A mesh only goes coarser once the next level is well under it
+ * (MESH_LOD_HYSTERESIS), so it does not switch back and forth at the edge.
+ *
+ * Simplifying takes a while for a whole city, the index lists of every level
+ * are cached keyed by a hash of the source meshes, like the heightmap.
+ *
+ */
+
+#ifndef MESHLOD_H
+#define MESHLOD_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "jobs.h"
+
+#define MESH_LOD_LEVELS 4           // including the source mesh
+#define MESH_LOD_RATIO 0.5f         // triangles kept from one level to the next
+#define MESH_LOD_MIN_GAIN 0.85f     // a level keeping more than this share of the last one is not worth keeping
+#define MESH_LOD_HYSTERESIS 0.25f   // share under the pixel error a coarser level needs before it is picked
+#define MESH_LOD_VERSION 1          // bump when the simplifier output changes
+
+
+typedef struct MeshLOD {
+    Mesh levels[MESH_LOD_LEVELS];   // levels[0] is the source mesh, not owned
+    float errors[MESH_LOD_LEVELS];  // mesh space error of each level, 0 for the source
+    int levelCount;
+    Vector3 center;                 // bounding sphere of the source, mesh space
+    float radius;
+    int level;                      // picked by the last SelectMeshLOD
+} MeshLOD;
+
+// What SelectMeshLOD needs of the camera
+typedef struct LODView {
+    Vector3 position;
+    float pixelsPerUnit;            // pixels covered by one world unit at a distance of one
+    float pixelError;               // largest error in pixels a level may show
+} LODView;
+
+// Index lists of the levels of one mesh, made on the job threads or read from the cache
+typedef struct MeshLODBuild {
+    const Mesh *mesh;
+    int levelCount;
+    float errors[MESH_LOD_LEVELS];
+    int indexCounts[MESH_LOD_LEVELS];
+    unsigned short *indices[MESH_LOD_LEVELS];   // levels past the first, into the source vertices
+} MeshLODBuild;
+
+// Cache file layout: header, then per mesh its level count, errors and index counts followed by the indices
+typedef struct MeshLODHeader {
+    char magic[4];      // "MLOD"
+    int version;
+    uint64_t key;
+    int meshCount;
+} MeshLODHeader;
+
+// Symmetric 4x4 matrix of a quadric, upper triangle
+typedef struct LODQuadric {
+    double m[10];
+} LODQuadric;
+
+
+//----------------------------------------------------------------------------------
+// Simplification
+//----------------------------------------------------------------------------------
+
+static inline Vector3 GetLODPosition(const float *positions, int index) {
+    return (Vector3){ positions[index * 3], positions[index * 3 + 1], positions[index * 3 + 2] };
+}
+
+static void AddLODQuadric(LODQuadric *q, const LODQuadric *other) {
+    for (int i = 0; i < 10; i++) q->m[i] += other->m[i];
+}
+
+// Quadric of the plane through a triangle, zero for degenerate triangles
+static LODQuadric GetLODTriangleQuadric(Vector3 a, Vector3 b, Vector3 c) {
+    LODQuadric q = { 0 };
+    Vector3 n = Vector3CrossProduct(Vector3Subtract(b, a), Vector3Subtract(c, a));
+    float length = Vector3Length(n);
+    if (length <= 0.0f) return q;
+
+    double x = n.x / length, y = n.y / length, z = n.z / length;
+    double w = -(x * a.x + y * a.y + z * a.z);
+    double p[4] = { x, y, z, w };
+    int k = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int j = i; j < 4; j++) q.m[k++] = p[i] * p[j];
+    }
+    return q;
+}
+
+// Sum of the squared distances from p to the planes of q
+static double EvaluateLODQuadric(const LODQuadric *q, Vector3 p) {
+    const double *m = q->m;
+    double x = p.x, y = p.y, z = p.z;
+    double e = m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x
+        + m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y
+        + m[7] * z * z + 2.0 * m[8] * z
+        + m[9];
+    return (e > 0.0) ? e : 0.0;
+}
+
+// FNV-1a over a vertex's attributes
+static uint64_t HashLODVertex(const Mesh *mesh, int v) {
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char *bytes = (const unsigned char *)&mesh->vertices[v * 3];
+    for (int i = 0; i < 12; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+static bool EqualLODVertices(const Mesh *mesh, int a, int b, bool attributes) {
+    if (memcmp(&mesh->vertices[a * 3], &mesh->vertices[b * 3], 3 * sizeof(float)) != 0) return false;
+    if (!attributes) return true;
+    if (mesh->texcoords != NULL && memcmp(&mesh->texcoords[a * 2], &mesh->texcoords[b * 2], 2 * sizeof(float)) != 0) return false;
+    if (mesh->normals != NULL && memcmp(&mesh->normals[a * 3], &mesh->normals[b * 3], 3 * sizeof(float)) != 0) return false;
+    return true;
+}
+
+// Weld vertices equal in position (and in texcoord and normal when attributes) into the first of them
+// weld[v] is that first vertex, returns how many there are
+static int WeldLODVertices(const Mesh *mesh, bool attributes, int *weld) {
+    int n = mesh->vertexCount;
+    int size = 1;
+    while (size < n * 2) size <<= 1;
+    int *table = malloc(size * sizeof(int));
+    for (int i = 0; i < size; i++) table[i] = -1;
+
+    int unique = 0;
+    for (int v = 0; v < n; v++) {
+        unsigned int slot = (unsigned int)HashLODVertex(mesh, v) & (size - 1);
+        while (table[slot] >= 0 && !EqualLODVertices(mesh, table[slot], v, attributes)) slot = (slot + 1) & (size - 1);
+        if (table[slot] < 0) {
+            table[slot] = v;
+            unique++;
+        }
+        weld[v] = table[slot];
+    }
+
+    free(table);
+    return unique;
+}
+
+// Lock vertices on a seam (a position shared by welded vertices) or on an open border
+static void LockLODVertices(const Mesh *mesh, const int *weld, const int *indices, int indexCount, bool *locked) {
+    int n = mesh->vertexCount;
+    int *position = malloc(n * sizeof(int));
+    int *seen = malloc(n * sizeof(int));
+    WeldLODVertices(mesh, false, position);
+
+    // a position is a seam when more than one welded vertex is at it
+    for (int v = 0; v < n; v++) seen[v] = -1;
+    for (int v = 0; v < n; v++) {
+        if (weld[v] != v) continue;
+        int p = position[v];
+        if (seen[p] == -1) seen[p] = v;
+        else if (seen[p] != v) seen[p] = -2;
+    }
+    for (int v = 0; v < n; v++) locked[v] = (seen[position[v]] == -2);
+    free(seen);
+
+    // an edge used by a single triangle is a border, counted with both directions folded onto one key
+    int edgeCount = indexCount;
+    int size = 1;
+    while (size < edgeCount * 2) size <<= 1;
+    uint64_t *keys = malloc(size * sizeof(uint64_t));
+    int *uses = calloc(size, sizeof(int));
+    for (int i = 0; i < size; i++) keys[i] = UINT64_MAX;
+
+    for (int i = 0; i < indexCount; i++) {
+        int a = position[indices[i]];
+        int b = position[indices[(i % 3 == 2) ? i - 2 : i + 1]];
+        uint64_t key = (a < b) ? ((uint64_t)a << 32 | (uint32_t)b) : ((uint64_t)b << 32 | (uint32_t)a);
+        unsigned int slot = (unsigned int)((key * 11400714819323198485ull) >> 32) & (size - 1);
+        while (keys[slot] != UINT64_MAX && keys[slot] != key) slot = (slot + 1) & (size - 1);
+        keys[slot] = key;
+        uses[slot]++;
+    }
+    for (int i = 0; i < indexCount; i++) {
+        int a = position[indices[i]];
+        int b = position[indices[(i % 3 == 2) ? i - 2 : i + 1]];
+        uint64_t key = (a < b) ? ((uint64_t)a << 32 | (uint32_t)b) : ((uint64_t)b << 32 | (uint32_t)a);
+        unsigned int slot = (unsigned int)((key * 11400714819323198485ull) >> 32) & (size - 1);
+        while (keys[slot] != key) slot = (slot + 1) & (size - 1);
+        if (uses[slot] == 1) {
+            locked[indices[i]] = true;
+            locked[indices[(i % 3 == 2) ? i - 2 : i + 1]] = true;
+        }
+    }
+
+    free(keys);
+    free(uses);
+    free(position);
+}
+
+typedef struct LODCollapse {
+    double cost;
+    int from;
+    int to;
+} LODCollapse;
+
+static int CompareLODCollapses(const void *a, const void *b) {
+    double ca = ((const LODCollapse *)a)->cost;
+    double cb = ((const LODCollapse *)b)->cost;
+    return (ca < cb) ? -1 : (ca > cb);
+}
+
+// Would moving vertex from onto to flip (or squash flat) any triangle around from that is kept
+static bool IsLODCollapseFlipping(const float *positions, const int *indices, const int *triangles, int begin, int end,
+        int from, int to) {
+    Vector3 target = GetLODPosition(positions, to);
+    for (int i = begin; i < end; i++) {
+        const int *tri = &indices[triangles[i] * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to) continue;
+
+        Vector3 p[3], q[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = GetLODPosition(positions, tri[k]);
+            q[k] = (tri[k] == from) ? target : p[k];
+        }
+        Vector3 before = Vector3CrossProduct(Vector3Subtract(p[1], p[0]), Vector3Subtract(p[2], p[0]));
+        Vector3 after = Vector3CrossProduct(Vector3Subtract(q[1], q[0]), Vector3Subtract(q[2], q[0]));
+        if (Vector3DotProduct(before, after) <= 0.25f * Vector3Length(before) * Vector3Length(after)) return true;
+    }
+    return false;
+}
+
+// Collapse edges of the triangles in indices (welded vertex indices) until at most targetCount indices are left
+// quadrics carry over from level to level, returns the index count left and raises *error to the largest collapse
+static int SimplifyLODIndices(const float *positions, const bool *locked, LODQuadric *quadrics, int vertexCount,
+        int *indices, int indexCount, int targetCount, double *error) {
+    int *offsets = malloc((vertexCount + 1) * sizeof(int));
+    int *triangles = malloc(indexCount * sizeof(int));
+    int *remap = malloc(vertexCount * sizeof(int));
+    bool *touched = malloc(vertexCount * sizeof(bool));
+    LODCollapse *collapses = malloc(vertexCount * sizeof(LODCollapse));
+
+    while (indexCount > targetCount) {
+        // triangles around every vertex
+        memset(offsets, 0, (vertexCount + 1) * sizeof(int));
+        for (int i = 0; i < indexCount; i++) offsets[indices[i] + 1]++;
+        for (int v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+        for (int i = 0; i < indexCount; i++) triangles[offsets[indices[i]]++] = i / 3;
+        for (int v = vertexCount; v > 0; v--) offsets[v] = offsets[v - 1];
+        offsets[0] = 0;
+
+        // cheapest collapse of every free vertex onto one of its neighbours
+        int collapseCount = 0;
+        for (int v = 0; v < vertexCount; v++) {
+            if (locked[v] || offsets[v] == offsets[v + 1]) continue;
+            LODCollapse best = { INFINITY, v, -1 };
+            for (int i = offsets[v]; i < offsets[v + 1]; i++) {
+                const int *tri = &indices[triangles[i] * 3];
+                for (int k = 0; k < 3; k++) {
+                    if (tri[k] == v) continue;
+                    LODQuadric q = quadrics[v];
+                    AddLODQuadric(&q, &quadrics[tri[k]]);
+                    double cost = EvaluateLODQuadric(&q, GetLODPosition(positions, tri[k]));
+                    if (cost < best.cost) best = (LODCollapse){ cost, v, tri[k] };
+                }
+            }
+            if (best.to >= 0) collapses[collapseCount++] = best;
+        }
+        if (collapseCount == 0) break;
+        qsort(collapses, collapseCount, sizeof(LODCollapse), CompareLODCollapses);
+
+        // cheapest first, one collapse per neighbourhood per pass so the flip tests see the current triangles
+        for (int v = 0; v < vertexCount; v++) {
+            remap[v] = v;
+            touched[v] = false;
+        }
+        int removed = 0;
+        int goal = (indexCount - targetCount) / 3;
+        int done = 0;
+        for (int c = 0; c < collapseCount && removed < goal; c++) {
+            int from = collapses[c].from, to = collapses[c].to;
+            if (touched[from] || touched[to]) continue;
+            if (IsLODCollapseFlipping(positions, indices, triangles, offsets[from], offsets[from + 1], from, to)) continue;
+
+            remap[from] = to;
+            AddLODQuadric(&quadrics[to], &quadrics[from]);
+            if (collapses[c].cost > *error) *error = collapses[c].cost;
+            for (int i = offsets[from]; i < offsets[from + 1]; i++) {
+                const int *tri = &indices[triangles[i] * 3];
+                if (tri[0] == to || tri[1] == to || tri[2] == to) removed++;
+                for (int k = 0; k < 3; k++) touched[tri[k]] = true;
+            }
+            done++;
+        }
+        if (done == 0) break;
+
+        // drop the triangles that lost an edge
+        int count = 0;
+        for (int i = 0; i < indexCount; i += 3) {
+            int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+            if (a == b || b == c || a == c) continue;
+            indices[count++] = a;
+            indices[count++] = b;
+            indices[count++] = c;
+        }
+        indexCount = count;
+    }
+
+    free(offsets);
+    free(triangles);
+    free(remap);
+    free(touched);
+    free(collapses);
+    return indexCount;
+}
+
+// Index lists of the levels of build->mesh
+static void SimplifyMeshLOD(MeshLODBuild *build) {
+    const Mesh *mesh = build->mesh;
+    build->levelCount = 1;
+    if (mesh->vertices == NULL || mesh->triangleCount == 0) return;
+    if (mesh->vertexCount > 65536) return;  // the levels would not fit 16 bit indices
+
+    int n = mesh->vertexCount;
+    int indexCount = mesh->triangleCount * 3;
+    int *weld = malloc(n * sizeof(int));
+    int *indices = malloc(indexCount * sizeof(int));
+    bool *locked = malloc(n * sizeof(bool));
+    LODQuadric *quadrics = calloc(n, sizeof(LODQuadric));
+
+    // duplicated vertices are one vertex to the simplifier
+    WeldLODVertices(mesh, true, weld);
+    for (int i = 0; i < indexCount; i++) indices[i] = weld[(mesh->indices != NULL) ? mesh->indices[i] : i];
+    LockLODVertices(mesh, weld, indices, indexCount, locked);
+
+    for (int i = 0; i < indexCount; i += 3) {
+        LODQuadric q = GetLODTriangleQuadric(GetLODPosition(mesh->vertices, indices[i]),
+                GetLODPosition(mesh->vertices, indices[i + 1]), GetLODPosition(mesh->vertices, indices[i + 2]));
+        for (int k = 0; k < 3; k++) AddLODQuadric(&quadrics[indices[i + k]], &q);
+    }
+
+    double error = 0.0;
+    int previous = indexCount;
+    for (int level = 1; level < MESH_LOD_LEVELS; level++) {
+        int target = (int)(previous * MESH_LOD_RATIO) / 3 * 3;
+        int count = SimplifyLODIndices(mesh->vertices, locked, quadrics, n, indices, previous, target, &error);
+        if (count == 0 || count > previous * MESH_LOD_MIN_GAIN) break;
+
+        build->indices[level] = malloc(count * sizeof(unsigned short));
+        for (int i = 0; i < count; i++) build->indices[level][i] = (unsigned short)indices[i];
+        build->indexCounts[level] = count;
+        build->errors[level] = (float)sqrt(error);
+        build->levelCount = level + 1;
+        previous = count;
+    }
+
+    free(weld);
+    free(indices);
+    free(locked);
+    free(quadrics);
+}
+
+static void SimplifyMeshLODJob(void *data, int begin, int end) {
+    MeshLODBuild *builds = (MeshLODBuild *)data;
+    for (int i = begin; i < end; i++) SimplifyMeshLOD(&builds[i]);
+}
+
+
+//----------------------------------------------------------------------------------
+// Cache
+//----------------------------------------------------------------------------------
+
+static uint64_t HashLODBytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// FNV-1a over everything the simplifier looks at
+static uint64_t HashMeshLODSources(const Mesh *meshes, int count) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < count; i++) {
+        const Mesh *mesh = &meshes[i];
+        hash = HashLODBytes(hash, &mesh->vertexCount, sizeof(int));
+        hash = HashLODBytes(hash, &mesh->triangleCount, sizeof(int));
+        if (mesh->vertices != NULL) hash = HashLODBytes(hash, mesh->vertices, mesh->vertexCount * 3 * sizeof(float));
+        if (mesh->texcoords != NULL) hash = HashLODBytes(hash, mesh->texcoords, mesh->vertexCount * 2 * sizeof(float));
+        if (mesh->normals != NULL) hash = HashLODBytes(hash, mesh->normals, mesh->vertexCount * 3 * sizeof(float));
+        if (mesh->indices != NULL) hash = HashLODBytes(hash, mesh->indices, mesh->triangleCount * 3 * sizeof(unsigned short));
+    }
+    int version = MESH_LOD_VERSION;
+    return HashLODBytes(hash, &version, sizeof(int));
+}
+
+// Read the index lists of every mesh, fails when the file is missing or was made from other meshes
+static bool LoadMeshLODCache(const char *fileName, uint64_t key, MeshLODBuild *builds, int count) {
+    if (!FileExists(fileName)) return false;
+
+    int size = 0;
+    unsigned char *data = LoadFileData(fileName, &size);
+    if (data == NULL) return false;
+
+    MeshLODHeader header;
+    bool valid = (size >= (int)sizeof(header));
+    if (valid) {
+        memcpy(&header, data, sizeof(header));
+        valid = (memcmp(header.magic, "MLOD", 4) == 0) && (header.version == MESH_LOD_VERSION) &&
+            (header.key == key) && (header.meshCount == count);
+    }
+
+    int offset = sizeof(header);
+    for (int i = 0; valid && i < count; i++) {
+        MeshLODBuild *build = &builds[i];
+        int meta = sizeof(int) + sizeof(build->errors) + sizeof(build->indexCounts);
+        if (offset + meta > size) { valid = false; break; }
+        memcpy(&build->levelCount, data + offset, sizeof(int));
+        memcpy(build->errors, data + offset + sizeof(int), sizeof(build->errors));
+        memcpy(build->indexCounts, data + offset + sizeof(int) + sizeof(build->errors), sizeof(build->indexCounts));
+        offset += meta;
+        if (build->levelCount < 1 || build->levelCount > MESH_LOD_LEVELS) { valid = false; break; }
+
+        for (int level = 1; level < build->levelCount; level++) {
+            int bytes = build->indexCounts[level] * sizeof(unsigned short);
+            if (build->indexCounts[level] <= 0 || offset + bytes > size) { valid = false; break; }
+            build->indices[level] = malloc(bytes);
+            memcpy(build->indices[level], data + offset, bytes);
+            offset += bytes;
+        }
+    }
+    if (valid && offset != size) valid = false;
+
+    UnloadFileData(data);
+    return valid;
+}
+
+static void SaveMeshLODCache(const char *fileName, uint64_t key, const MeshLODBuild *builds, int count) {
+    MeshLODHeader header = { { 'M', 'L', 'O', 'D' }, MESH_LOD_VERSION, key, count };
+    int size = sizeof(header);
+    for (int i = 0; i < count; i++) {
+        size += sizeof(int) + sizeof(builds[i].errors) + sizeof(builds[i].indexCounts);
+        for (int level = 1; level < builds[i].levelCount; level++) size += builds[i].indexCounts[level] * sizeof(unsigned short);
+    }
+
+    unsigned char *data = malloc(size);
+    int offset = 0;
+    memcpy(data, &header, sizeof(header));
+    offset += sizeof(header);
+    for (int i = 0; i < count; i++) {
+        const MeshLODBuild *build = &builds[i];
+        memcpy(data + offset, &build->levelCount, sizeof(int));
+        offset += sizeof(int);
+        memcpy(data + offset, build->errors, sizeof(build->errors));
+        offset += sizeof(build->errors);
+        memcpy(data + offset, build->indexCounts, sizeof(build->indexCounts));
+        offset += sizeof(build->indexCounts);
+        for (int level = 1; level < build->levelCount; level++) {
+            memcpy(data + offset, build->indices[level], build->indexCounts[level] * sizeof(unsigned short));
+            offset += build->indexCounts[level] * sizeof(unsigned short);
+        }
+    }
+    if (!SaveFileData(fileName, data, size)) {
+        printf("mesh lod: could not write cache %s\n", fileName);
+    }
+    free(data);
+}
+
+
+//----------------------------------------------------------------------------------
+// Levels
+//----------------------------------------------------------------------------------
+
+// Mesh of the source vertices indices uses, renumbered in the order they are first used
+static Mesh LoadMeshLODLevel(const Mesh *source, const unsigned short *indices, int indexCount) {
+    int *remap = malloc(source->vertexCount * sizeof(int));
+    for (int v = 0; v < source->vertexCount; v++) remap[v] = -1;
+    int vertexCount = 0;
+    for (int i = 0; i < indexCount; i++) {
+        if (remap[indices[i]] < 0) remap[indices[i]] = vertexCount++;
+    }
+
+    Mesh mesh = { 0 };
+    mesh.vertexCount = vertexCount;
+    mesh.triangleCount = indexCount / 3;
+    mesh.vertices = RL_MALLOC(vertexCount * 3 * sizeof(float));
+    mesh.indices = RL_MALLOC(indexCount * sizeof(unsigned short));
+    if (source->texcoords != NULL) mesh.texcoords = RL_MALLOC(vertexCount * 2 * sizeof(float));
+    if (source->texcoords2 != NULL) mesh.texcoords2 = RL_MALLOC(vertexCount * 2 * sizeof(float));
+    if (source->normals != NULL) mesh.normals = RL_MALLOC(vertexCount * 3 * sizeof(float));
+    if (source->tangents != NULL) mesh.tangents = RL_MALLOC(vertexCount * 4 * sizeof(float));
+    if (source->colors != NULL) mesh.colors = RL_MALLOC(vertexCount * 4 * sizeof(unsigned char));
+
+    for (int v = 0; v < source->vertexCount; v++) {
+        int d = remap[v];
+        if (d < 0) continue;
+        memcpy(&mesh.vertices[d * 3], &source->vertices[v * 3], 3 * sizeof(float));
+        if (mesh.texcoords != NULL) memcpy(&mesh.texcoords[d * 2], &source->texcoords[v * 2], 2 * sizeof(float));
+        if (mesh.texcoords2 != NULL) memcpy(&mesh.texcoords2[d * 2], &source->texcoords2[v * 2], 2 * sizeof(float));
+        if (mesh.normals != NULL) memcpy(&mesh.normals[d * 3], &source->normals[v * 3], 3 * sizeof(float));
+        if (mesh.tangents != NULL) memcpy(&mesh.tangents[d * 4], &source->tangents[v * 4], 4 * sizeof(float));
+        if (mesh.colors != NULL) memcpy(&mesh.colors[d * 4], &source->colors[v * 4], 4);
+    }
+    for (int i = 0; i < indexCount; i++) mesh.indices[i] = (unsigned short)remap[indices[i]];
+
+    free(remap);
+    UploadMesh(&mesh, false);
+    return mesh;
+}
+
+// Levels of detail of count meshes, simplified on the job threads or read from cacheFileName (NULL for no cache)
+// NOTE: The meshes need their CPU side data, they stay level 0 and are not copied
+MeshLOD *LoadMeshLODs(const Mesh *meshes, int count, const char *cacheFileName) {
+    MeshLODBuild *builds = calloc((count > 0) ? count : 1, sizeof(MeshLODBuild));
+    for (int i = 0; i < count; i++) builds[i].mesh = &meshes[i];
+
+    uint64_t key = HashMeshLODSources(meshes, count);
+    double start = GetTime();
+    if (cacheFileName != NULL && LoadMeshLODCache(cacheFileName, key, builds, count)) {
+        printf("mesh lod: %d meshes from %s\n", count, cacheFileName);
+    } else {
+        // a cache that did not match may have left some lists behind
+        for (int i = 0; i < count; i++) {
+            for (int level = 1; level < MESH_LOD_LEVELS; level++) free(builds[i].indices[level]);
+            builds[i] = (MeshLODBuild){ .mesh = &meshes[i] };
+        }
+        JobCounter counter = { 0 };
+        JobParallelFor(&counter, count, 1, SimplifyMeshLODJob, builds);
+        JobWait(&counter);
+        printf("mesh lod: %d meshes simplified in %.1f ms\n", count, (GetTime() - start) * 1000.0);
+        if (cacheFileName != NULL) SaveMeshLODCache(cacheFileName, key, builds, count);
+    }
+
+    MeshLOD *lods = calloc((count > 0) ? count : 1, sizeof(MeshLOD));
+    for (int i = 0; i < count; i++) {
+        MeshLOD *lod = &lods[i];
+        const MeshLODBuild *build = &builds[i];
+        lod->levels[0] = meshes[i];
+        lod->levelCount = build->levelCount;
+        for (int level = 1; level < build->levelCount; level++) {
+            lod->levels[level] = LoadMeshLODLevel(&meshes[i], build->indices[level], build->indexCounts[level]);
+            lod->errors[level] = build->errors[level];
+            free(build->indices[level]);
+        }
+
+        BoundingBox box = GetMeshBoundingBox(meshes[i]);
+        lod->center = Vector3Scale(Vector3Add(box.min, box.max), 0.5f);
+        lod->radius = Vector3Distance(box.min, box.max) * 0.5f;
+    }
+
+    free(builds);
+    return lods;
+}
+
+// Unload the levels made from the meshes, the meshes themselves are left alone
+void UnloadMeshLODs(MeshLOD *lods, int count) {
+    if (lods == NULL) return;
+    for (int i = 0; i < count; i++) {
+        for (int level = 1; level < lods[i].levelCount; level++) UnloadMesh(lods[i].levels[level]);
+    }
+    free(lods);
+}
+
+// View for a camera drawing into a target height pixels tall
+LODView GetLODView(Camera camera, int height, float pixelError) {
+    LODView view = { camera.position, 0.0f, pixelError };
+    view.pixelsPerUnit = height / (2.0f * tanf(camera.fovy * 0.5f * DEG2RAD));
+    return view;
+}
+
+// Pick the level of a mesh placed with transform (uniform scale) for the view, the pick is kept in lod->level
+int SelectMeshLOD(MeshLOD *lod, Matrix transform, float scale, const LODView *view) {
+    Vector3 center = Vector3Transform(lod->center, transform);
+    float distance = Vector3Distance(center, view->position) - lod->radius * scale;
+    if (distance < 0.001f) distance = 0.001f;
+    float pixels = scale * view->pixelsPerUnit / distance;
+
+    // finer straight away when the current level shows, coarser only well under the limit
+    int level = (lod->level < lod->levelCount) ? lod->level : lod->levelCount - 1;
+    while (level > 0 && lod->errors[level] * pixels > view->pixelError) level--;
+    while (level + 1 < lod->levelCount && lod->errors[level + 1] * pixels <= view->pixelError * (1.0f - MESH_LOD_HYSTERESIS)) level++;
+
+    lod->level = level;
+    return level;
+}
+
+// DrawModel with every mesh at the level the view needs, lods made from model.meshes
+// transform places the model (see GetModelDrawTransform) with a uniform scale, returns the triangles drawn
+// NOTE: Must be called inside BeginMode3D(), like DrawModel()
+int DrawModelLOD(Model model, MeshLOD *lods, Matrix transform, float scale, const LODView *view) {
+    int triangles = 0;
+    for (int i = 0; i < model.meshCount; i++) {
+        int level = SelectMeshLOD(&lods[i], transform, scale, view);
+        DrawMesh(lods[i].levels[level], model.materials[model.meshMaterial[i]], transform);
+        triangles += lods[i].levels[level].triangleCount;
+    }
+    return triangles;
+}
+
+
+#endif
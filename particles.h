@@ -1,30 +1,411 @@
+/*
+ * Particles
+ *
+ * CPU rain particle engine. Drops are stored as a structure of arrays
+ * (one aligned array per component) so the integration step can run over
+ * 4 (SSE) or 8 (AVX) drops at a time. A scalar path is used for the tail
+ * of each range and on targets without SSE.
+ *
+ * Drops that fall below the bottom of the spawn volume are respawned at
+ * the top with a new x/z position taken from their own random seed, so the
+ * update has no shared state and any range of drops can be updated
+ * independently.
+ *
+ * The volume is meant to follow the camera (SetRainVolume), drops that end
+ * up outside of it on x/z are wrapped around to the opposite side, so the
+ * same drops are reused as a tile around the viewer wherever it goes.
+ *
+ * Every block of RAIN_COLUMN_DROPS consecutive drops respawns inside its
+ * own column of the volume, so blocks stay spatially coherent and can be
+ * culled as a whole.
+ *
+ * The position before the last step is kept next to the current one, so a
+ * renderer running faster or slower than the simulation can draw drops in
+ * between the two (see simclock.h). Wrapping moves both, and respawned
+ * drops start with both at the new position, so drops that jump never
+ * streak across the volume.
+ *
+ */
+
 #ifndef PARTICLES_H
 #define PARTICLES_H
 
 #include "raymath.h"
 #include "stdlib.h"
+#include <stdint.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PARTICLE_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLE_SIMD_WIDTH 4
+#else
+#define PARTICLE_SIMD_WIDTH 1
+#endif
+
+#define PARTICLE_ALIGN 32           // alignment of every particle array, in bytes (one AVX register)
+
+#define RAIN_GRAVITY 9.81f          // world units / s^2
+#define RAIN_TERMINAL_VELOCITY 25.0f // fall speed drops settle at, world units / s
+#define RAIN_COLUMN_DROPS 256       // consecutive drops sharing a column of the volume
 
-typedef struct Particle {
-    Vector3 p;
-    Vector3 v;
-} Particle;
 
 Vector3 randomPos(Vector3 min, Vector3 max) {
-        
+
     double xrand = rand()/(double)RAND_MAX;
     double yrand = rand()/(double)RAND_MAX;
     double zrand = rand()/(double)RAND_MAX;
-    
+
     Vector3 out = {
-        Lerp(min.x, max.x, xrand), 
-        Lerp(min.y, max.y, yrand), 
+        Lerp(min.x, max.x, xrand),
+        Lerp(min.y, max.y, yrand),
         Lerp(min.z, max.z, zrand)
     };
     return out;
 
 }
 
+// Allocate memory aligned to PARTICLE_ALIGN, must be released with AlignedFree
+// NOTE: aligned_alloc is not available on MSVC, so the offset to the
+// original block is stored just before the returned pointer
+void *AlignedAlloc(size_t size) {
+    unsigned char *raw = malloc(size + PARTICLE_ALIGN + sizeof(void *));
+    if (raw == NULL) return NULL;
+
+    uintptr_t start = (uintptr_t)(raw + sizeof(void *));
+    uintptr_t aligned = (start + PARTICLE_ALIGN - 1) & ~(uintptr_t)(PARTICLE_ALIGN - 1);
+    ((void **)aligned)[-1] = raw;
+    return (void *)aligned;
+}
+
+void AlignedFree(void *ptr) {
+    if (ptr != NULL) free(((void **)ptr)[-1]);
+}
+
+// Advance a per particle xorshift seed and return a value in [0, 1)
+static inline float ParticleRandom(uint32_t *seed) {
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+    return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+
+// Rain drops, structure of arrays
+typedef struct RainParticles {
+    int count;          // number of live drops
+    int capacity;       // allocated drops, rounded up to PARTICLE_SIMD_WIDTH
+
+    float *px, *py, *pz; // position
+    float *ox, *oy, *oz; // position before the last step
+    float *vx, *vy, *vz; // velocity
+    float *age;         // seconds since the drop was last spawned
+    uint32_t *seed;     // per drop random state, used on respawn
+
+    Vector3 boundsMin;  // spawn volume, drops wrap around it on x/z
+    Vector3 boundsMax;
+    Vector3 wind;       // horizontal air velocity drops are dragged towards
+    float drag;         // 1/s, gives RAIN_TERMINAL_VELOCITY with RAIN_GRAVITY
+    int columns;        // the volume is split into columns x columns blocks of drops
+} RainParticles;
+
+
+// Give drop i a new position at the top of the volume and a fresh velocity
+// keepY keeps the height relative to the volume so respawned drops stay spread out
+static inline void RespawnRainDrop(RainParticles *ps, int i, bool keepY) {
+    uint32_t seed = ps->seed[i];
+    float height = ps->boundsMax.y - ps->boundsMin.y;
+
+    // respawn inside the column of this drop's block
+    int column = (i / RAIN_COLUMN_DROPS) % (ps->columns * ps->columns);
+    float columnX = (column % ps->columns + ParticleRandom(&seed)) / ps->columns;
+    float columnZ = (column / ps->columns + ParticleRandom(&seed)) / ps->columns;
+    ps->px[i] = Lerp(ps->boundsMin.x, ps->boundsMax.x, columnX);
+    ps->pz[i] = Lerp(ps->boundsMin.z, ps->boundsMax.z, columnZ);
+    if (keepY) {
+        ps->py[i] += height;
+        if (ps->py[i] < ps->boundsMin.y) ps->py[i] = ps->boundsMax.y;
+    } else {
+        ps->py[i] = Lerp(ps->boundsMin.y, ps->boundsMax.y, ParticleRandom(&seed));
+    }
+
+    // spread fall speeds a little so drops don't move in lockstep
+    ps->vx[i] = ps->wind.x;
+    ps->vy[i] = -RAIN_TERMINAL_VELOCITY * (0.8f + 0.4f * ParticleRandom(&seed));
+    ps->vz[i] = ps->wind.z;
+    ps->age[i] = 0.0f;
+    ps->seed[i] = seed;
+
+    ps->ox[i] = ps->px[i];
+    ps->oy[i] = ps->py[i];
+    ps->oz[i] = ps->pz[i];
+}
+
+// Allocate count drops spread through the volume (min, max)
+RainParticles LoadRainParticles(int count, Vector3 min, Vector3 max, unsigned int seed) {
+    RainParticles ps = { 0 };
+    ps.count = count;
+    ps.capacity = (count + PARTICLE_SIMD_WIDTH - 1) / PARTICLE_SIMD_WIDTH * PARTICLE_SIMD_WIDTH;
+    ps.boundsMin = min;
+    ps.boundsMax = max;
+    ps.wind = (Vector3){ 0.0f, 0.0f, 0.0f };
+    ps.drag = RAIN_GRAVITY / RAIN_TERMINAL_VELOCITY;
+
+    // NOTE: counts that aren't a square number of blocks leave some columns denser
+    int blocks = (count + RAIN_COLUMN_DROPS - 1) / RAIN_COLUMN_DROPS;
+    ps.columns = (int)floorf(sqrtf((float)blocks));
+    if (ps.columns < 1) ps.columns = 1;
+
+    size_t size = sizeof(float) * ps.capacity;
+    ps.px = AlignedAlloc(size);
+    ps.py = AlignedAlloc(size);
+    ps.pz = AlignedAlloc(size);
+    ps.ox = AlignedAlloc(size);
+    ps.oy = AlignedAlloc(size);
+    ps.oz = AlignedAlloc(size);
+    ps.vx = AlignedAlloc(size);
+    ps.vy = AlignedAlloc(size);
+    ps.vz = AlignedAlloc(size);
+    ps.age = AlignedAlloc(size);
+    ps.seed = AlignedAlloc(sizeof(uint32_t) * ps.capacity);
+
+    for (int i = 0; i < ps.capacity; i++) {
+        // xorshift must never be seeded with 0
+        uint32_t s = (seed + (uint32_t)i) * 2654435761u;
+        ps.seed[i] = (s == 0) ? 1 : s;
+        RespawnRainDrop(&ps, i, false);
+    }
+
+    return ps;
+}
+
+void UnloadRainParticles(RainParticles *ps) {
+    AlignedFree(ps->px);
+    AlignedFree(ps->py);
+    AlignedFree(ps->pz);
+    AlignedFree(ps->ox);
+    AlignedFree(ps->oy);
+    AlignedFree(ps->oz);
+    AlignedFree(ps->vx);
+    AlignedFree(ps->vy);
+    AlignedFree(ps->vz);
+    AlignedFree(ps->age);
+    AlignedFree(ps->seed);
+    *ps = (RainParticles){ 0 };
+}
+
+
+// Center the volume on center (usually the camera), size is the full extent
+// The bottom of the volume is never placed below floorY
+void SetRainVolume(RainParticles *ps, Vector3 center, Vector3 size, float floorY) {
+    float bottom = center.y - size.y / 2.0f;
+    if (bottom < floorY) bottom = floorY;
+
+    ps->boundsMin = (Vector3){ center.x - size.x / 2.0f, bottom, center.z - size.z / 2.0f };
+    ps->boundsMax = (Vector3){ center.x + size.x / 2.0f, bottom + size.y, center.z + size.z / 2.0f };
+}
+
+
+// Integrate drops [begin, end) one at a time
+static void UpdateRainParticlesScalar(RainParticles *ps, int begin, int end, float dt) {
+    float k = ps->drag * dt;
+    float gdt = RAIN_GRAVITY * dt;
+
+    Vector3 size = Vector3Subtract(ps->boundsMax, ps->boundsMin);
+    Vector3 center = Vector3Scale(Vector3Add(ps->boundsMax, ps->boundsMin), 0.5f);
+
+    for (int i = begin; i < end; i++) {
+        ps->ox[i] = ps->px[i];
+        ps->oy[i] = ps->py[i];
+        ps->oz[i] = ps->pz[i];
+
+        // a = g + drag * (wind - v), semi implicit euler
+        ps->vx[i] += (ps->wind.x - ps->vx[i]) * k;
+        ps->vy[i] += -gdt - ps->vy[i] * k;
+        ps->vz[i] += (ps->wind.z - ps->vz[i]) * k;
+
+        ps->px[i] += ps->vx[i] * dt;
+        ps->py[i] += ps->vy[i] * dt;
+        ps->pz[i] += ps->vz[i] * dt;
+        ps->age[i] += dt;
+
+        // wrap around the volume on x/z, and from the top back down when the volume sinks
+        float wrapx = size.x * floorf((ps->px[i] - center.x) / size.x + 0.5f);
+        float wrapz = size.z * floorf((ps->pz[i] - center.z) / size.z + 0.5f);
+        float wrapy = (ps->py[i] > ps->boundsMax.y) ? size.y : 0.0f;
+        ps->px[i] -= wrapx;
+        ps->py[i] -= wrapy;
+        ps->pz[i] -= wrapz;
+        ps->ox[i] -= wrapx;
+        ps->oy[i] -= wrapy;
+        ps->oz[i] -= wrapz;
+
+        if (ps->py[i] < ps->boundsMin.y) RespawnRainDrop(ps, i, true);
+    }
+}
+
+#if PARTICLE_SIMD_WIDTH == 8
+static void UpdateRainParticlesSIMD(RainParticles *ps, int begin, int end, float dt) {
+    __m256 vdt = _mm256_set1_ps(dt);
+    __m256 vk = _mm256_set1_ps(ps->drag * dt);
+    __m256 vgdt = _mm256_set1_ps(RAIN_GRAVITY * dt);
+    __m256 windx = _mm256_set1_ps(ps->wind.x);
+    __m256 windz = _mm256_set1_ps(ps->wind.z);
+    __m256 bottom = _mm256_set1_ps(ps->boundsMin.y);
+    __m256 top = _mm256_set1_ps(ps->boundsMax.y);
+    __m256 centerx = _mm256_set1_ps((ps->boundsMax.x + ps->boundsMin.x) * 0.5f);
+    __m256 centerz = _mm256_set1_ps((ps->boundsMax.z + ps->boundsMin.z) * 0.5f);
+    __m256 sizex = _mm256_set1_ps(ps->boundsMax.x - ps->boundsMin.x);
+    __m256 sizey = _mm256_set1_ps(ps->boundsMax.y - ps->boundsMin.y);
+    __m256 sizez = _mm256_set1_ps(ps->boundsMax.z - ps->boundsMin.z);
+    __m256 invx = _mm256_set1_ps(1.0f / (ps->boundsMax.x - ps->boundsMin.x));
+    __m256 invz = _mm256_set1_ps(1.0f / (ps->boundsMax.z - ps->boundsMin.z));
+
+    for (int i = begin; i < end; i += 8) {
+        __m256 vx = _mm256_loadu_ps(ps->vx + i);
+        __m256 vy = _mm256_loadu_ps(ps->vy + i);
+        __m256 vz = _mm256_loadu_ps(ps->vz + i);
+
+        vx = _mm256_add_ps(vx, _mm256_mul_ps(_mm256_sub_ps(windx, vx), vk));
+        vy = _mm256_sub_ps(vy, _mm256_add_ps(vgdt, _mm256_mul_ps(vy, vk)));
+        vz = _mm256_add_ps(vz, _mm256_mul_ps(_mm256_sub_ps(windz, vz), vk));
+
+        __m256 ox = _mm256_loadu_ps(ps->px + i);
+        __m256 oy = _mm256_loadu_ps(ps->py + i);
+        __m256 oz = _mm256_loadu_ps(ps->pz + i);
+        __m256 px = _mm256_add_ps(ox, _mm256_mul_ps(vx, vdt));
+        __m256 py = _mm256_add_ps(oy, _mm256_mul_ps(vy, vdt));
+        __m256 pz = _mm256_add_ps(oz, _mm256_mul_ps(vz, vdt));
+        __m256 age = _mm256_add_ps(_mm256_loadu_ps(ps->age + i), vdt);
+
+        // wrap around the volume on x/z, and from the top back down when the volume sinks
+        __m256 wrapx = _mm256_round_ps(_mm256_mul_ps(_mm256_sub_ps(px, centerx), invx), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 wrapz = _mm256_round_ps(_mm256_mul_ps(_mm256_sub_ps(pz, centerz), invz), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        wrapx = _mm256_mul_ps(wrapx, sizex);
+        wrapz = _mm256_mul_ps(wrapz, sizez);
+        __m256 wrapy = _mm256_and_ps(_mm256_cmp_ps(py, top, _CMP_GT_OQ), sizey);
+        px = _mm256_sub_ps(px, wrapx);
+        py = _mm256_sub_ps(py, wrapy);
+        pz = _mm256_sub_ps(pz, wrapz);
+        ox = _mm256_sub_ps(ox, wrapx);
+        oy = _mm256_sub_ps(oy, wrapy);
+        oz = _mm256_sub_ps(oz, wrapz);
+
+        _mm256_storeu_ps(ps->vx + i, vx);
+        _mm256_storeu_ps(ps->vy + i, vy);
+        _mm256_storeu_ps(ps->vz + i, vz);
+        _mm256_storeu_ps(ps->px + i, px);
+        _mm256_storeu_ps(ps->py + i, py);
+        _mm256_storeu_ps(ps->pz + i, pz);
+        _mm256_storeu_ps(ps->ox + i, ox);
+        _mm256_storeu_ps(ps->oy + i, oy);
+        _mm256_storeu_ps(ps->oz + i, oz);
+        _mm256_storeu_ps(ps->age + i, age);
+
+        // respawns are rare, fix them up one lane at a time
+        int below = _mm256_movemask_ps(_mm256_cmp_ps(py, bottom, _CMP_LT_OQ));
+        for (int lane = 0; below; lane++, below >>= 1) {
+            if (below & 1) RespawnRainDrop(ps, i + lane, true);
+        }
+    }
+}
+#elif PARTICLE_SIMD_WIDTH == 4
+static void UpdateRainParticlesSIMD(RainParticles *ps, int begin, int end, float dt) {
+    __m128 vdt = _mm_set1_ps(dt);
+    __m128 vk = _mm_set1_ps(ps->drag * dt);
+    __m128 vgdt = _mm_set1_ps(RAIN_GRAVITY * dt);
+    __m128 windx = _mm_set1_ps(ps->wind.x);
+    __m128 windz = _mm_set1_ps(ps->wind.z);
+    __m128 bottom = _mm_set1_ps(ps->boundsMin.y);
+    __m128 top = _mm_set1_ps(ps->boundsMax.y);
+    __m128 centerx = _mm_set1_ps((ps->boundsMax.x + ps->boundsMin.x) * 0.5f);
+    __m128 centerz = _mm_set1_ps((ps->boundsMax.z + ps->boundsMin.z) * 0.5f);
+    __m128 sizex = _mm_set1_ps(ps->boundsMax.x - ps->boundsMin.x);
+    __m128 sizey = _mm_set1_ps(ps->boundsMax.y - ps->boundsMin.y);
+    __m128 sizez = _mm_set1_ps(ps->boundsMax.z - ps->boundsMin.z);
+    __m128 invx = _mm_set1_ps(1.0f / (ps->boundsMax.x - ps->boundsMin.x));
+    __m128 invz = _mm_set1_ps(1.0f / (ps->boundsMax.z - ps->boundsMin.z));
+
+    for (int i = begin; i < end; i += 4) {
+        __m128 vx = _mm_loadu_ps(ps->vx + i);
+        __m128 vy = _mm_loadu_ps(ps->vy + i);
+        __m128 vz = _mm_loadu_ps(ps->vz + i);
+
+        vx = _mm_add_ps(vx, _mm_mul_ps(_mm_sub_ps(windx, vx), vk));
+        vy = _mm_sub_ps(vy, _mm_add_ps(vgdt, _mm_mul_ps(vy, vk)));
+        vz = _mm_add_ps(vz, _mm_mul_ps(_mm_sub_ps(windz, vz), vk));
+
+        __m128 ox = _mm_loadu_ps(ps->px + i);
+        __m128 oy = _mm_loadu_ps(ps->py + i);
+        __m128 oz = _mm_loadu_ps(ps->pz + i);
+        __m128 px = _mm_add_ps(ox, _mm_mul_ps(vx, vdt));
+        __m128 py = _mm_add_ps(oy, _mm_mul_ps(vy, vdt));
+        __m128 pz = _mm_add_ps(oz, _mm_mul_ps(vz, vdt));
+        __m128 age = _mm_add_ps(_mm_loadu_ps(ps->age + i), vdt);
+
+        // wrap around the volume on x/z, and from the top back down when the volume sinks
+        // NOTE: SSE2 has no floor, cvtps rounds to nearest which is what we want here
+        __m128 wrapx = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(px, centerx), invx)));
+        __m128 wrapz = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(_mm_sub_ps(pz, centerz), invz)));
+        wrapx = _mm_mul_ps(wrapx, sizex);
+        wrapz = _mm_mul_ps(wrapz, sizez);
+        __m128 wrapy = _mm_and_ps(_mm_cmpgt_ps(py, top), sizey);
+        px = _mm_sub_ps(px, wrapx);
+        py = _mm_sub_ps(py, wrapy);
+        pz = _mm_sub_ps(pz, wrapz);
+        ox = _mm_sub_ps(ox, wrapx);
+        oy = _mm_sub_ps(oy, wrapy);
+        oz = _mm_sub_ps(oz, wrapz);
 
+        _mm_storeu_ps(ps->vx + i, vx);
+        _mm_storeu_ps(ps->vy + i, vy);
+        _mm_storeu_ps(ps->vz + i, vz);
+        _mm_storeu_ps(ps->px + i, px);
+        _mm_storeu_ps(ps->py + i, py);
+        _mm_storeu_ps(ps->pz + i, pz);
+        _mm_storeu_ps(ps->ox + i, ox);
+        _mm_storeu_ps(ps->oy + i, oy);
+        _mm_storeu_ps(ps->oz + i, oz);
+        _mm_storeu_ps(ps->age + i, age);
+
+        // respawns are rare, fix them up one lane at a time
+        int below = _mm_movemask_ps(_mm_cmplt_ps(py, bottom));
+        for (int lane = 0; below; lane++, below >>= 1) {
+            if (below & 1) RespawnRainDrop(ps, i + lane, true);
+        }
+    }
+}
 #endif
 
+// Integrate drops [begin, end) by dt seconds
+// Ranges are independent, so disjoint ranges may be updated from different threads
+void UpdateRainParticlesRange(RainParticles *ps, int begin, int end, float dt) {
+    if (end > ps->count) end = ps->count;
+    if (begin >= end) return;
 
+#if PARTICLE_SIMD_WIDTH > 1
+    int simdEnd = begin + (end - begin) / PARTICLE_SIMD_WIDTH * PARTICLE_SIMD_WIDTH;
+    UpdateRainParticlesSIMD(ps, begin, simdEnd, dt);
+    begin = simdEnd;
+#endif
+    UpdateRainParticlesScalar(ps, begin, end, dt);
+}
+
+void UpdateRainParticles(RainParticles *ps, float dt) {
+    UpdateRainParticlesRange(ps, 0, ps->count, dt);
+}
+
+// Position of drop i alpha of the way from the previous step to the current one
+static inline Vector3 GetRainDropPosition(const RainParticles *ps, int i, float alpha) {
+    return (Vector3){
+        ps->ox[i] + (ps->px[i] - ps->ox[i]) * alpha,
+        ps->oy[i] + (ps->py[i] - ps->oy[i]) * alpha,
+        ps->oz[i] + (ps->pz[i] - ps->oz[i]) * alpha
+    };
+}
+
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ * PlanarReflection
+ *
+ * The scene mirrored in the ground plane, for the puddles. It is drawn into
+ * a target at 1/divisor of the screen resolution, and optionally only every
+ * interval frames, so it costs a fraction of a second scene pass.
+ *
+ * The reflection is drawn from the real camera, with everything mirrored
+ * below the plane instead: the mirror goes into the model transform of
+ * every draw (GetPlanarReflectionMirror()), so the shaders see mirrored
+ * positions and normals, and the lights are mirrored into their own set of
+ * clusters. The image then lines up with the screen, and the lighting of
+ * the mirrored world is the same as the real one. The mirror flips the
+ * winding of every triangle, so front faces are culled while it is drawn.
+ *
+ * What is below the plane before mirroring (the underside of the ground,
+ * anything sunk into it) would come out above it. GLSL 100 has no clip
+ * distances, the near plane of the projection is tilted onto the plane
+ * instead (Lengyel's oblique near plane), which clips it for free.
+ *
+ * Culling goes through the same frustum tests as the main view, with the
+ * frustum of the mirrored view, so only what shows in the mirror is drawn.
+ *
+ * pbr.fs projects ground fragments with the view-projection the reflection
+ * was drawn with (ground points are their own mirror image), so a
+ * reflection a few frames old stays in place while the camera moves, it
+ * only lags in parallax. Where it samples is limited by the puddle mask, a
+ * tiling noise texture laid over the ground.
+ *
+ */
+
+#ifndef PLANARREFLECTION_H
+#define PLANARREFLECTION_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include <stdio.h>
+#include <math.h>
+#include "frustum.h"
+#include "uniforms.h"
+
+#define REFLECTION_CLIP_OFFSET 0.01f    // the plane clips this far under itself, so the ground does not reflect itself
+#define PUDDLE_MASK_SIZE 256            // pixels
+#define PUDDLE_MASK_SCALE 24.0f         // world units the mask covers before it repeats
+#define PUDDLE_COVERAGE 0.55f           // noise level the puddles start at, higher is drier
+
+#define REFLECTION_TEXTURE_UNIT 8       // reflection and puddle mask take this unit and the next, maps pbr.fs does not use
+
+
+typedef struct PlanarReflection {
+    RenderTexture2D target;     // at 1/divisor of the screen
+    Texture2D puddleMask;       // r: how wet the ground is
+    int divisor;                // screen pixels per reflection pixel along each axis
+    int interval;               // frames between draws, 1 draws every frame
+    int age;                    // frames since the last draw, -1 when there is nothing drawn yet
+    float height;               // of the plane
+    Matrix viewProjection;      // of the camera it was last drawn for
+    int draws;                  // draws this frame, 0 or 1
+} PlanarReflection;
+
+// Reflection uniforms of a shader
+typedef struct PlanarReflectionLocations {
+    int matrix;
+    int height;
+    int scale;
+    int strength;
+} PlanarReflectionLocations;
+
+
+// Tiling puddles: thresholded noise, soft at the edges
+static Texture2D LoadPuddleMask(void) {
+    Image noise = GenImagePerlinNoise(PUDDLE_MASK_SIZE, PUDDLE_MASK_SIZE, 0, 0, 4.0f);
+    ImageFormat(&noise, PIXELFORMAT_UNCOMPRESSED_GRAYSCALE);
+    unsigned char *pixels = (unsigned char *)noise.data;
+    for (int i = 0; i < noise.width * noise.height; i++) {
+        float wet = (pixels[i] / 255.0f - PUDDLE_COVERAGE) / 0.1f;
+        pixels[i] = (unsigned char)(Clamp(wet, 0.0f, 1.0f) * 255.0f);
+    }
+
+    Texture2D mask = LoadTextureFromImage(noise);
+    UnloadImage(noise);
+    GenTextureMipmaps(&mask);
+    SetTextureFilter(mask, TEXTURE_FILTER_TRILINEAR);
+    SetTextureWrap(mask, TEXTURE_WRAP_REPEAT);
+    return mask;
+}
+
+// Reflection in the plane at height for a width x height screen, drawn at 1/divisor of it every interval frames
+PlanarReflection LoadPlanarReflection(int width, int height, int divisor, int interval, float planeHeight) {
+    PlanarReflection reflection = { 0 };
+    reflection.divisor = (divisor > 1) ? divisor : 1;
+    reflection.interval = (interval > 1) ? interval : 1;
+    reflection.age = -1;
+    reflection.height = planeHeight;
+    reflection.viewProjection = MatrixIdentity();
+
+    reflection.target = LoadRenderTexture(width / reflection.divisor, height / reflection.divisor);
+    if (reflection.target.id == 0) printf("planar reflection: no render target, puddles reflect nothing\n");
+
+    // sampled at screen positions that move with the camera between draws
+    SetTextureFilter(reflection.target.texture, TEXTURE_FILTER_BILINEAR);
+    SetTextureWrap(reflection.target.texture, TEXTURE_WRAP_CLAMP);
+
+    reflection.puddleMask = LoadPuddleMask();
+    return reflection;
+}
+
+void UnloadPlanarReflection(PlanarReflection *reflection) {
+    if (reflection->target.id > 0) UnloadRenderTexture(reflection->target);
+    UnloadTexture(reflection->puddleMask);
+    *reflection = (PlanarReflection){ 0 };
+}
+
+// Count a frame, true when the reflection has to be drawn in it
+bool IsPlanarReflectionDue(PlanarReflection *reflection) {
+    reflection->draws = 0;
+    if (reflection->target.id == 0) return false;
+    if (reflection->age >= 0 && reflection->age + 1 < reflection->interval) {
+        reflection->age++;
+        return false;
+    }
+    return true;
+}
+
+// Draw the reflection again the next time it is asked for, whatever its age
+void ResetPlanarReflection(PlanarReflection *reflection) {
+    reflection->age = -1;
+    reflection->draws = 0;
+}
+
+// Mirror transform about the plane, to multiply the model transform of every draw of the reflection by
+Matrix GetPlanarReflectionMirror(const PlanarReflection *reflection) {
+    return MatrixMultiply(MatrixScale(1.0f, -1.0f, 1.0f), MatrixTranslate(0.0f, 2.0f * reflection->height, 0.0f));
+}
+
+// Where point shows up in the mirror
+Vector3 MirrorPlanarReflectionPoint(const PlanarReflection *reflection, Vector3 point) {
+    return (Vector3){ point.x, 2.0f * reflection->height - point.y, point.z };
+}
+
+// projection with its near plane moved onto plane (view space, the camera on its negative side)
+// Lengyel, "Oblique View Frustum Depth Projection and Clipping", the far plane tilts with it
+static Matrix GetObliqueProjection(Matrix projection, Vector4 plane) {
+    Vector4 corner = {
+        ((plane.x > 0.0f) - (plane.x < 0.0f) + projection.m8) / projection.m0,
+        ((plane.y > 0.0f) - (plane.y < 0.0f) + projection.m9) / projection.m5,
+        -1.0f,
+        (1.0f + projection.m10) / projection.m14
+    };
+    float scale = 2.0f / (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w * corner.w);
+    projection.m2 = plane.x * scale;
+    projection.m6 = plane.y * scale;
+    projection.m10 = plane.z * scale + 1.0f;
+    projection.m14 = plane.w * scale;
+    return projection;
+}
+
+// Clear the reflection and set up to draw the mirrored scene seen by camera, until EndPlanarReflection
+// Returns the frustum to cull with: bounds in the real world that end up in view once mirrored
+// NOTE: Draws have to be mirrored with GetPlanarReflectionMirror(), and the lights with MirrorPlanarReflectionPoint()
+Frustum BeginPlanarReflection(PlanarReflection *reflection, Camera camera) {
+    reflection->age = 0;
+    reflection->draws = 1;
+
+    // the target may still be bound for the puddles of last frame, it can not be sampled while drawn
+    rlActiveTextureSlot(REFLECTION_TEXTURE_UNIT);
+    rlDisableTexture();
+    rlActiveTextureSlot(0);
+
+    BeginTextureMode(reflection->target);
+    ClearBackground(BLACK);
+
+    float aspect = (float)reflection->target.texture.width / (float)reflection->target.texture.height;
+    Matrix view = GetCameraMatrix(camera);
+    Matrix projection = MatrixPerspective(camera.fovy * DEG2RAD, aspect, RL_CULL_DISTANCE_NEAR, RL_CULL_DISTANCE_FAR);
+    reflection->viewProjection = MatrixMultiply(view, projection);
+
+    // keep what is under the plane once mirrored, the camera is above it
+    Vector3 normal = Vector3Subtract(Vector3Transform((Vector3){ 0.0f, -1.0f, 0.0f }, view), Vector3Transform(Vector3Zero(), view));
+    Vector3 point = Vector3Transform((Vector3){ 0.0f, reflection->height - REFLECTION_CLIP_OFFSET, 0.0f }, view);
+    Vector4 plane = { normal.x, normal.y, normal.z, -Vector3DotProduct(normal, point) };
+
+    rlDrawRenderBatchActive();
+    rlMatrixMode(RL_PROJECTION);
+    rlLoadIdentity();
+    rlMultMatrixf(MatrixToFloat(GetObliqueProjection(projection, plane)));
+    rlMatrixMode(RL_MODELVIEW);
+    rlLoadIdentity();
+    rlMultMatrixf(MatrixToFloat(view));
+
+    rlSetCullFace(RL_CULL_FACE_FRONT);
+    rlEnableDepthTest();
+
+    return GetFrustumFromMatrix(MatrixMultiply(GetPlanarReflectionMirror(reflection), reflection->viewProjection));
+}
+
+void EndPlanarReflection(PlanarReflection *reflection) {
+    (void)reflection;
+    rlDrawRenderBatchActive();
+    rlSetCullFace(RL_CULL_FACE_BACK);
+    EndTextureMode();
+}
+
+// Bind the reflection and the puddle mask from REFLECTION_TEXTURE_UNIT on for the rest of the frame
+void BindPlanarReflection(const PlanarReflection *reflection) {
+    rlActiveTextureSlot(REFLECTION_TEXTURE_UNIT);
+    rlEnableTexture(reflection->target.texture.id);
+    rlActiveTextureSlot(REFLECTION_TEXTURE_UNIT + 1);
+    rlEnableTexture(reflection->puddleMask.id);
+    rlActiveTextureSlot(0);
+}
+
+PlanarReflectionLocations GetPlanarReflectionLocations(Shader shader) {
+    const char *samplers[2] = { "reflectionMap", "puddleMask" };
+    for (int i = 0; i < 2; i++) {
+        int unit = REFLECTION_TEXTURE_UNIT + i;
+        SetShaderValue(shader, GetShaderLocation(shader, samplers[i]), &unit, SHADER_UNIFORM_SAMPLER2D);
+    }
+
+    PlanarReflectionLocations locs = { 0 };
+    locs.matrix = GetShaderLocation(shader, "reflectionMatrix");
+    locs.height = GetShaderLocation(shader, "puddleHeight");
+    locs.scale = GetShaderLocation(shader, "puddleScale");
+    locs.strength = GetShaderLocation(shader, "puddleStrength");
+    return locs;
+}
+
+// Send the plane and how wet the puddles are, 0 for none (while the reflection itself is drawn)
+// The view-projection only goes out in frames the reflection was drawn
+void SetPlanarReflectionUniforms(ShaderUniforms *uniforms, PlanarReflectionLocations locs, const PlanarReflection *reflection,
+        float strength) {
+    float scale = 1.0f / PUDDLE_MASK_SCALE;
+    if (reflection->target.id == 0) strength = 0.0f;
+    SetShaderUniform(uniforms, locs.height, &reflection->height, SHADER_UNIFORM_FLOAT);
+    SetShaderUniform(uniforms, locs.scale, &scale, SHADER_UNIFORM_FLOAT);
+    SetShaderUniform(uniforms, locs.strength, &strength, SHADER_UNIFORM_FLOAT);
+    if (reflection->draws > 0) SetShaderValueMatrix(uniforms->shader, locs.matrix, reflection->viewProjection);
+}
+
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Profiler
+ *
+ * Scoped CPU timers for the frame loop. BeginProfileZone(name) and
+ * EndProfileZone() bracket a piece of work and may nest. Zone names must be
+ * string literals, zones are told apart by pointer.
+ *
+ * Every thread that opens a zone gets its own slot: a stack of open zones
+ * and a ring of the last PROFILE_RING_SIZE closed ones. Recording only
+ * writes to the thread's own slot and bumps its ring head, there are no
+ * locks and no allocation.
+ *
+ * Once a frame UpdateProfiler() drains the rings of every thread into a
+ * table of zones with their time and call count for the frame plus a
+ * smoothed average, which the overlay in rain_simulator.c draws.
+ * ExportProfileTrace() writes the events still in the rings as a
+ * chrome://tracing (Trace Event Format) JSON file, one track per thread.
+ *
+ * Building with PROFILER_DISABLED defined turns the zones into no-ops.
+ *
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "jobs.h"
+
+#define MAX_PROFILE_THREADS 32
+#define MAX_PROFILE_ZONES 64        // distinct zone names in the overlay table
+#define MAX_PROFILE_DEPTH 16
+#define PROFILE_RING_SIZE 4096      // events kept per thread, must be a power of two
+#define PROFILE_SMOOTHING 0.1f      // weight of the newest frame in the averages
+
+
+typedef struct ProfileEvent {
+    const char *name;
+    uint64_t start;             // ns on the monotonic clock
+    uint64_t end;
+    int depth;
+} ProfileEvent;
+
+typedef struct ProfileThread {
+    char name[16];
+    int depth;                  // open zones
+    const char *open[MAX_PROFILE_DEPTH];
+    uint64_t openStart[MAX_PROFILE_DEPTH];
+    atomic_uint head;           // events ever written, written only by the owner
+    unsigned int read;          // events already counted by UpdateProfiler
+    ProfileEvent events[PROFILE_RING_SIZE];
+} ProfileThread;
+
+// One row of the overlay
+typedef struct ProfileZone {
+    const char *name;
+    int depth;                  // shallowest nesting it was seen at
+    int calls;                  // last frame, summed over threads
+    float time;                 // ms last frame, summed over threads
+    float average;              // smoothed ms per frame
+    uint64_t first;             // start of the first call seen, the table is kept in this order
+} ProfileZone;
+
+typedef struct Profiler {
+    atomic_int threadCount;
+    ProfileThread threads[MAX_PROFILE_THREADS];
+    ProfileZone zones[MAX_PROFILE_ZONES];
+    int zoneCount;
+    uint64_t origin;            // trace timestamps are relative to this
+} Profiler;
+
+static Profiler profiler = { 0 };
+static JOB_THREAD_LOCAL ProfileThread *profileThread = NULL;
+static JOB_THREAD_LOCAL bool profileThreadFull = false;
+
+
+static inline uint64_t GetProfileTime(void) {
+    struct timespec now;
+#if defined(_MSC_VER)
+    timespec_get(&now, TIME_UTC);   // no clock_gettime on MSVC
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// Slot of the calling thread, claimed on its first zone
+static ProfileThread *GetProfileThread(void) {
+    if (profileThread == NULL && !profileThreadFull) {
+        int index = atomic_fetch_add(&profiler.threadCount, 1);
+        if (index < MAX_PROFILE_THREADS) {
+            profileThread = &profiler.threads[index];
+            if (profileThread->name[0] == '\0') snprintf(profileThread->name, sizeof(profileThread->name), "thread %d", index);
+        } else {
+            profileThreadFull = true;
+        }
+    }
+    return profileThread;
+}
+
+// Claim the first slot for the calling thread (the main thread) and start the trace clock
+void InitProfiler(const char *threadName) {
+    profiler.origin = GetProfileTime();
+    ProfileThread *thread = GetProfileThread();
+    if (thread != NULL) snprintf(thread->name, sizeof(thread->name), "%s", threadName);
+}
+
+#if defined(PROFILER_DISABLED)
+static inline void BeginProfileZone(const char *name) { (void)name; }
+static inline void EndProfileZone(void) { }
+#else
+void BeginProfileZone(const char *name) {
+    ProfileThread *thread = GetProfileThread();
+    if (thread == NULL) return;
+
+    if (thread->depth < MAX_PROFILE_DEPTH) {
+        thread->open[thread->depth] = name;
+        thread->openStart[thread->depth] = GetProfileTime();
+    }
+    thread->depth++;
+}
+
+void EndProfileZone(void) {
+    ProfileThread *thread = profileThread;
+    if (thread == NULL || thread->depth == 0) return;
+
+    int depth = --thread->depth;
+    if (depth >= MAX_PROFILE_DEPTH) return;
+
+    unsigned int head = atomic_load_explicit(&thread->head, memory_order_relaxed);
+    thread->events[head & (PROFILE_RING_SIZE - 1)] = (ProfileEvent){
+        thread->open[depth], thread->openStart[depth], GetProfileTime(), depth
+    };
+    atomic_store_explicit(&thread->head, head + 1, memory_order_release);
+}
+#endif
+
+// Table row of zone name, added in start order so parents come before their children
+static ProfileZone *GetProfileZone(const char *name, int depth, uint64_t start) {
+    for (int i = 0; i < profiler.zoneCount; i++) {
+        if (profiler.zones[i].name == name) {
+            if (depth < profiler.zones[i].depth) profiler.zones[i].depth = depth;
+            return &profiler.zones[i];
+        }
+    }
+    if (profiler.zoneCount == MAX_PROFILE_ZONES) return NULL;
+
+    int index = profiler.zoneCount++;
+    while (index > 0 && profiler.zones[index - 1].first > start) {
+        profiler.zones[index] = profiler.zones[index - 1];
+        index--;
+    }
+    profiler.zones[index] = (ProfileZone){ name, depth, 0, 0.0f, 0.0f, start };
+    return &profiler.zones[index];
+}
+
+// Fold the zones closed since the last call into the table, call once a frame
+void UpdateProfiler(void) {
+    for (int i = 0; i < profiler.zoneCount; i++) {
+        profiler.zones[i].calls = 0;
+        profiler.zones[i].time = 0.0f;
+    }
+
+    int threadCount = atomic_load(&profiler.threadCount);
+    if (threadCount > MAX_PROFILE_THREADS) threadCount = MAX_PROFILE_THREADS;
+    for (int t = 0; t < threadCount; t++) {
+        ProfileThread *thread = &profiler.threads[t];
+        unsigned int head = atomic_load_explicit(&thread->head, memory_order_acquire);
+
+        // fell more than a ring behind, the oldest events are gone
+        if (head - thread->read > PROFILE_RING_SIZE) thread->read = head - PROFILE_RING_SIZE;
+
+        for (; thread->read != head; thread->read++) {
+            const ProfileEvent *event = &thread->events[thread->read & (PROFILE_RING_SIZE - 1)];
+            ProfileZone *zone = GetProfileZone(event->name, event->depth, event->start);
+            if (zone == NULL) continue;
+            zone->calls++;
+            zone->time += (event->end - event->start) * 1e-6f;
+        }
+    }
+
+    for (int i = 0; i < profiler.zoneCount; i++) {
+        ProfileZone *zone = &profiler.zones[i];
+        zone->average += (zone->time - zone->average) * PROFILE_SMOOTHING;
+    }
+}
+
+int GetProfileZoneCount(void) {
+    return profiler.zoneCount;
+}
+
+const ProfileZone *GetProfileZoneAt(int index) {
+    return &profiler.zones[index];
+}
+
+// Write the events still held by every thread as a chrome://tracing capture
+// NOTE: call between frames, threads still recording may overwrite events while they are written
+bool ExportProfileTrace(const char *fileName) {
+    FILE *file = fopen(fileName, "w");
+    if (file == NULL) {
+        printf("profiler: could not write %s\n", fileName);
+        return false;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    int events = 0;
+
+    int threadCount = atomic_load(&profiler.threadCount);
+    if (threadCount > MAX_PROFILE_THREADS) threadCount = MAX_PROFILE_THREADS;
+    for (int t = 0; t < threadCount; t++) {
+        ProfileThread *thread = &profiler.threads[t];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                (first) ? "" : ",\n", t, thread->name);
+        first = false;
+
+        unsigned int head = atomic_load_explicit(&thread->head, memory_order_acquire);
+        unsigned int begin = (head > PROFILE_RING_SIZE) ? head - PROFILE_RING_SIZE : 0;
+        for (unsigned int i = begin; i != head; i++) {
+            const ProfileEvent *event = &thread->events[i & (PROFILE_RING_SIZE - 1)];
+            if (event->start < profiler.origin) continue;
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", event->name, t,
+                    (event->start - profiler.origin) * 1e-3, (event->end - event->start) * 1e-3);
+            events++;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("profiler: %d events from %d threads written to %s\n", events, threadCount, fileName);
+    return true;
+}
+
+
+#endif
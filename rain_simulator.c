@@ -30,21 +30,111 @@
 #include <stdlib.h>             // Required for: NULL
 #include <stdio.h>
 #include "particles.h"
+#include "jobs.h"
+#include "raininstances.h"
+#include "frustum.h"
+#include "bvh.h"
+#include "heightmap.h"
+#include "splashes.h"
+#include "rainatlas.h"
+#include "assetloader.h"
+#include "scenepack.h"
+#include "bench.h"
+#include "profiler.h"
+#include "uniforms.h"
+#include "simclock.h"
+#include "lightclusters.h"
+#include "raintarget.h"
+#include "staticbatch.h"
+#include "meshlod.h"
+#include "shadervariants.h"
+#include "shadowatlas.h"
+#include "planarreflection.h"
+#include "ripples.h"
 
 #define RAYGUI_IMPLEMENTATION
 #include "raygui.h"
 #include "style_dark.h"
 
 
-#define MAX_LIGHTS  4           // Max dynamic lights supported by shader
+#define MAX_LIGHTS  4           // Lights toggled with [1]..[4], the shaders take up to MAX_CLUSTER_LIGHTS
 
-#define MAX_PARTICLES 99999
+// Grid of dim street lamps, enough lights to see the clustered lighting at work
+#define STREET_LAMP_ROW 16
+#define STREET_LAMP_COUNT (STREET_LAMP_ROW * STREET_LAMP_ROW)
+#define STREET_LAMP_SPACING 8.0f
+#define STREET_LAMP_HEIGHT 4.0f
+#define STREET_LAMP_INTENSITY 2.0f
 
-#define RAIN_BOUND_X 50
-#define RAIN_BOUND_Y 500
-#define RAIN_BOUND_Z 50
+#define MAX_PARTICLES 65536
+#define RAIN_JOB_CHUNK 4096 // drops per simulation job, multiple of PARTICLE_SIMD_WIDTH
+#define RAIN_JOB_CHUNKS ((MAX_PARTICLES + RAIN_JOB_CHUNK - 1) / RAIN_JOB_CHUNK)
+
+// Rain volume, centered on the camera and tiled around it as it moves
+#define RAIN_BOUND_X 64
+#define RAIN_BOUND_Y 40
+#define RAIN_BOUND_Z 64
+#define RAIN_FLOOR -1.0f    // lowest the volume will go, just under the ground
+
+// Horizontal distance from the camera where drops start getting thinned out
+#define RAIN_LOD_MID 12.0f
+#define RAIN_LOD_FAR 22.0f
+
+// Rain occlusion map resolution, world units per texel, and where the bake is cached
+#define RAIN_HEIGHTMAP_TEXEL 0.25f
+#define RAIN_HEIGHTMAP_CACHE "rain_heightmap.cache"
+
+// Rain streak database (cave.cs.columbia.edu/repository/Rain), packed into one atlas at load
+// Without it the single composed row of streaks is used
+#define RAIN_STREAK_DATABASE "resources/rain_streaks"
+#define RAIN_STREAK_ROW "resources/cv20_v30_h-_osc3.png"
+#define RAIN_STREAK_ROW_HORIZONTAL (RainAtlasAxis){ 10.0f, 20.0f, 9 } // h10 .. h170
+#define RAIN_ATLAS_CACHE "rain_atlas.cache"
+
+// Levels of detail of the city and the car, simplified once and cached
+#define CITY_LOD_CACHE "city_lod.cache"
+#define CAR_LOD_CACHE "car_lod.cache"
+#define LOD_PIXEL_ERROR 1.0f    // pixels a coarser level may move the surface by
+
+// Splash pool size, and how far from the camera drops still splash
+#define MAX_SPLASHES 16384
+#define SPLASH_DISTANCE 16.0f
+
+// Model placement, shared by the draw calls and the collision geometry
+#define CAR_POSITION (Vector3){ 0.0f, -0.1f, -10.0f }
+#define CAR_SCALE 0.05f
+#define CITY_POSITION (Vector3){ 75.0f, 0.0f, 75.0f }
+#define CITY_SCALE 0.01f
+#define CITY_CHUNK_SIZE 20.0f   // x/z size of the chunks the city is batched and culled in
+#define GROUND_HEIGHT 0.0f      // street level of the city, the puddles reflect in it
+
+// Puddle reflection resolution (--reflection-res) and frames between its draws (--reflection-interval)
+#define REFLECTION_DIVISOR 2
+#define REFLECTION_INTERVAL 1
+
+// Model files, read ahead on the asset loader threads while the window comes up
+#define CAR_MODEL_PATH "resources/toyota_land_cruiser/"
+#define CITY_MODEL_PATH "resources/ccity_building_set_1/"
+
+// Models and textures baked by scenebake, used instead of the glTF files when present
+#define SCENE_PACK_FILE "scene.pack"
+
+// Most texture data uploaded per frame while the scene textures stream in
+#define ASSET_UPLOAD_BUDGET (4 * 1024 * 1024)
+
+// Capture written by the trace key, open it in chrome://tracing
+#define PROFILE_TRACE_FILE "profile_trace.json"
+
+// Frames a --sim-only run records when --bench does not say
+#define BENCH_DEFAULT_FRAMES 600
+
+// Rain simulation steps per second (--sim-rate), and the most steps one frame may catch up
+#define SIM_STEP_RATE 60
+#define SIM_MAX_STEPS 4
+
+// Frame rate cap (--fps), 0 renders as fast as it can
+#define TARGET_FPS 60
 
-#define RAIN_STEP 0.05 // multipler to dT applied to rain animation
 
 
 //----------------------------------------------------------------------------------
@@ -66,16 +156,43 @@ typedef struct {
     Vector3 target;
     float color[4];
     float intensity;
-
-    // Shader light parameters locations
-    int typeLoc;
-    int enabledLoc;
-    int positionLoc;
-    int targetLoc;
-    int colorLoc;
-    int intensityLoc;
 } Light;
 
+// pbr.fs material features, each one a #define in the variant compiled for it
+typedef enum {
+    PBR_ALBEDO_MAP = 1 << 0,
+    PBR_NORMAL_MAP = 1 << 1,
+    PBR_MRA_MAP = 1 << 2,
+    PBR_EMISSIVE_MAP = 1 << 3
+} PbrFeature;
+
+// pbr.fs uniforms set every frame, looked up in every variant in this order
+typedef enum {
+    PBR_VIEW_POS = 0,
+    PBR_TILING,
+    PBR_EMISSIVE_COLOR,
+    PBR_EMISSIVE_POWER
+} PbrUniform;
+
+// Per frame rain update, split across the job system
+typedef struct RainUpdateJob {
+    RainParticles *rain;
+    const RainHeightmap *surface; // top of the city and car, NULL to let drops fall through
+    RainInstance *instances;
+    int *chunkCounts;   // instances emitted by each chunk
+    int *chunkHits;     // drops stopped by the scene in each chunk
+    Vector3 *impacts;   // where drops near the camera hit, one slice per chunk like instances
+    int *chunkImpacts;
+    bool keepImpacts;   // record impacts, for the splashes and the puddle ripples
+    RainCullStats *chunkStats;
+    RainLOD lod;
+    Frustum frustum;
+    bool cull;
+    float dt;           // seconds per step
+    int steps;          // steps to simulate this frame, may be 0
+    float alpha;        // where the frame falls between the last two steps, see simclock.h
+} RainUpdateJob;
+
 //----------------------------------------------------------------------------------
 // Global Variables Definition
 //----------------------------------------------------------------------------------
@@ -84,6 +201,15 @@ static bool logging = false;
 bool toggle_rain = true;
 bool toggle_orbit = true;
 bool toggle_pause = false;
+bool toggle_culling = true;
+bool toggle_collision = true;
+bool toggle_splashes = true;
+bool toggle_profiler = false;
+bool toggle_lamps = false;
+bool toggle_lod = true;
+bool toggle_shadows = true;
+bool toggle_puddles = true;
+int rain_resolution = 0;       // 0 full, 1 half, 2 quarter
 
 int screenWidth = 1920;
 int screenHeight = 1080;
@@ -96,12 +222,36 @@ int screenHeight = 1080;
 //----------------------------------------------------------------------------------
 // Module specific Functions Declaration
 //----------------------------------------------------------------------------------
-// Create a light and get shader locations
-static Light CreateLight(int type, Vector3 position, Vector3 target, Color color, float intensity, Shader shader);
+// Create a light, one of the MAX_LIGHTS
+static Light CreateLight(int type, Vector3 position, Vector3 target, Color color, float intensity);
 
-// Update light properties on shader
-// NOTE: Light shader locations should be available
-static void UpdateLight(Shader shader, Light light);
+// Hand an enabled light to the clusters for this frame
+// NOTE: Clustered lights are point lights, type and target are not used
+static void UpdateLight(LightClusters *clusters, Light light);
+
+// Integrate a range of drops and write their instance data
+static void UpdateRainJob(void *data, int begin, int end);
+
+// Respawn drops that fell below the scene surface, returns how many did
+// Hits close to the camera are added to impacts after the *impactCount already there,
+// at most end - begin in all
+static int CollideRainDrops(const RainUpdateJob *job, int begin, int end, Vector3 *impacts, int *impactCount);
+
+// Draw material with the pbr.fs variant for the maps it has textures for
+static void SetPbrMaterialShader(ShaderVariants *variants, Material *material);
+
+// Bounds of model placed with transform
+static BoundingBox GetModelDrawBounds(Model model, Matrix transform);
+
+// Model from the scene pack when it has it, otherwise from its glTF with the textures streamed in
+static Model LoadSceneModel(const ScenePack *pack, const char *fileName);
+static void UnloadSceneModel(const ScenePack *pack, Model model);
+
+// Benchmark the rain simulation alone, without a window or GL context
+static int RunSimulationBenchmark(int frames, const char *output, int threadCount);
+
+// Live per zone timings from the profiler
+static void DrawProfilerOverlay(Rectangle bounds);
 
 void InvalidArgsExit() {
     printf("Invalid arguments\n");
@@ -113,6 +263,15 @@ void InvalidArgsExit() {
 //----------------------------------------------------------------------------------
 int main(int argc, char** argv) {
 
+    int threadCount = 0; // one per core
+    int benchFrames = 0; // frames to benchmark, 0 runs interactively
+    float simRate = SIM_STEP_RATE;
+    int targetFps = TARGET_FPS;
+    const char *benchOutput = "bench.json";
+    bool simOnly = false;
+    int reflectionDivisor = REFLECTION_DIVISOR;
+    int reflectionInterval = REFLECTION_INTERVAL;
+
     // Process Arguments
     for (int i = 0; i < argc; i++) {
         if (strncmp(argv[i], "-w", 3) == 0) {
@@ -123,20 +282,86 @@ int main(int argc, char** argv) {
             if (i + 1 >= argc) InvalidArgsExit();
             screenHeight = strtol(argv[i + 1], NULL, 10);
         }
+        if (strncmp(argv[i], "-t", 3) == 0) {
+            if (i + 1 >= argc) InvalidArgsExit();
+            threadCount = strtol(argv[i + 1], NULL, 10);
+        }
+        if (strncmp(argv[i], "--bench", 8) == 0) {
+            if (i + 1 >= argc) InvalidArgsExit();
+            benchFrames = strtol(argv[i + 1], NULL, 10);
+            if (benchFrames <= 0) InvalidArgsExit();
+        }
+        if (strncmp(argv[i], "--bench-out", 12) == 0) {
+            if (i + 1 >= argc) InvalidArgsExit();
+            benchOutput = argv[i + 1];
+        }
+        if (strncmp(argv[i], "--sim-only", 11) == 0) {
+            simOnly = true;
+        }
+        if (strncmp(argv[i], "--sim-rate", 11) == 0) {
+            if (i + 1 >= argc) InvalidArgsExit();
+            simRate = strtof(argv[i + 1], NULL);
+            if (simRate <= 0.0f) InvalidArgsExit();
+        }
+        if (strncmp(argv[i], "--fps", 6) == 0) {
+            if (i + 1 >= argc) InvalidArgsExit();
+            targetFps = strtol(argv[i + 1], NULL, 10);
+            if (targetFps < 0) InvalidArgsExit();
+        }
+        if (strncmp(argv[i], "--rain-res", 11) == 0) {
+            if (i + 1 >= argc) InvalidArgsExit();
+            int divisor = strtol(argv[i + 1], NULL, 10);
+            if (divisor != 1 && divisor != 2 && divisor != 4) InvalidArgsExit();
+            rain_resolution = divisor / 2;
+        }
+        if (strncmp(argv[i], "--reflection-res", 17) == 0) {
+            if (i + 1 >= argc) InvalidArgsExit();
+            reflectionDivisor = strtol(argv[i + 1], NULL, 10);
+            if (reflectionDivisor != 1 && reflectionDivisor != 2 && reflectionDivisor != 4) InvalidArgsExit();
+        }
+        if (strncmp(argv[i], "--reflection-interval", 22) == 0) {
+            if (i + 1 >= argc) InvalidArgsExit();
+            reflectionInterval = strtol(argv[i + 1], NULL, 10);
+            if (reflectionInterval < 1) InvalidArgsExit();
+        }
     }
 
+    if (simOnly) return RunSimulationBenchmark((benchFrames > 0) ? benchFrames : BENCH_DEFAULT_FRAMES, benchOutput, threadCount);
+    bool benchmarking = (benchFrames > 0);
+
 
 
     // Initialization
     //--------------------------------------------------------------------------------------
 
 
-    SetConfigFlags(FLAG_MSAA_4X_HINT);
+    // benchmarks render offscreen the same way, the window is just not shown
+    SetConfigFlags(FLAG_MSAA_4X_HINT | ((benchmarking) ? FLAG_WINDOW_HIDDEN : 0));
     InitWindow(screenWidth, screenHeight, "raylib [shaders] example - basic pbr");
     GuiLoadStyleDark();
 
+    InitJobSystem(threadCount);
+    InitProfiler("main");
+
+    BeginDrawing();
+    ClearBackground(BLACK);
+    DrawText("Loading...", 10, 10, 20, LIGHTGRAY);
+    EndDrawing();
+
+    // Start reading models the scene pack does not have straight away, everything until LoadModelAsync overlaps with it
+    ScenePack scenePack = LoadScenePack(SCENE_PACK_FILE);
+    InitAssetLoader(0);
+    if (!HasScenePackModel(&scenePack, CITY_MODEL_PATH "scene.gltf")) {
+        PrefetchAssetFile(CITY_MODEL_PATH "scene.gltf");
+        PrefetchAssetFile(CITY_MODEL_PATH "scene.bin");
+    }
+    if (!HasScenePackModel(&scenePack, CAR_MODEL_PATH "scene.gltf")) {
+        PrefetchAssetFile(CAR_MODEL_PATH "scene.gltf");
+        PrefetchAssetFile(CAR_MODEL_PATH "scene.bin");
+    }
+
     //set rand seed
-    srand((unsigned int)GetTime());
+    srand((benchmarking) ? BENCH_SEED : (unsigned int)GetTime());
 
     // Define the camera to look into our 3d world
     Camera camera = {0};
@@ -146,100 +371,87 @@ int main(int argc, char** argv) {
     camera.fovy = 45.0f; // Camera field-of-view Y
     camera.projection = CAMERA_PERSPECTIVE; // Camera projection type
 
-    // Load PBR shader and setup all required locations
-    Shader shader = LoadShader(TextFormat("shaders/pbr.vs", GLSL_VERSION),
-            TextFormat("shaders/pbr.fs", GLSL_VERSION));
-    shader.locs[SHADER_LOC_MAP_ALBEDO] = GetShaderLocation(shader, "albedoMap");
-    shader.locs[SHADER_LOC_MAP_METALNESS] = GetShaderLocation(shader, "mraMap");
-    shader.locs[SHADER_LOC_MAP_NORMAL] = GetShaderLocation(shader, "normalMap");
-    shader.locs[SHADER_LOC_MAP_EMISSION] = GetShaderLocation(shader, "emissiveMap");
-    shader.locs[SHADER_LOC_COLOR_DIFFUSE] = GetShaderLocation(shader, "albedoColor");
-
-    // Setup additional required shader locations, including lights data
-    shader.locs[SHADER_LOC_VECTOR_VIEW] = GetShaderLocation(shader, "viewPos");
-    int lightCountLoc = GetShaderLocation(shader, "numOfLights");
-    int maxLightCount = MAX_LIGHTS;
-    SetShaderValue(shader, lightCountLoc, &maxLightCount, SHADER_UNIFORM_INT);
-
-    // Setup ambient color and intensity parameters
+    // PBR shader, compiled once for each combination of texture maps the materials have
+    const char *pbrFeatures[] = { "ALBEDO_MAP", "NORMAL_MAP", "MRA_MAP", "EMISSIVE_MAP" };
+    const char *pbrUniformNames[] = { "viewPos", "tiling", "emissiveColor", "emissivePower" };
+    ShaderVariants pbrVariants = LoadShaderVariants(TextFormat("shaders/pbr.vs", GLSL_VERSION),
+            TextFormat("shaders/pbr.fs", GLSL_VERSION), pbrFeatures, 4, pbrUniformNames, 4);
+
+
+
+    Model car = LoadSceneModel(&scenePack, CAR_MODEL_PATH "scene.gltf");
+    for (int i = 0; i < car.materialCount; i++) SetPbrMaterialShader(&pbrVariants, &car.materials[i]);
+
+    Model city = LoadSceneModel(&scenePack, CITY_MODEL_PATH "scene.gltf");
+    for (int i = 0; i < city.materialCount; i++) SetPbrMaterialShader(&pbrVariants, &city.materials[i]);
+
+    // Every variant the materials picked is compiled now, set up their locations and constant parameters
     float ambientIntensity = 0.02f;
     Color ambientColor = (Color){26, 32, 135, 255};
     Vector3 ambientColorNormalized = (Vector3){
         ambientColor.r / 255.0f, ambientColor.g / 255.0f, ambientColor.b / 255.0f
     };
-    SetShaderValue(shader, GetShaderLocation(shader, "ambientColor"), &ambientColorNormalized, SHADER_UNIFORM_VEC3);
-    SetShaderValue(shader, GetShaderLocation(shader, "ambient"), &ambientIntensity, SHADER_UNIFORM_FLOAT);
-
-    // Get location for shader parameters that can be modified in real time
-    int emissiveIntensityLoc = GetShaderLocation(shader, "emissivePower");
-    int emissiveColorLoc = GetShaderLocation(shader, "emissiveColor");
-    int textureTilingLoc = GetShaderLocation(shader, "tiling");
-
-
+    for (int i = 0; i < pbrVariants.count; i++) {
+        Shader *pbr = &pbrVariants.variants[i].shader;
+        pbr->locs[SHADER_LOC_MAP_ALBEDO] = GetShaderLocation(*pbr, "albedoMap");
+        pbr->locs[SHADER_LOC_MAP_METALNESS] = GetShaderLocation(*pbr, "mraMap");
+        pbr->locs[SHADER_LOC_MAP_NORMAL] = GetShaderLocation(*pbr, "normalMap");
+        pbr->locs[SHADER_LOC_MAP_EMISSION] = GetShaderLocation(*pbr, "emissiveMap");
+        pbr->locs[SHADER_LOC_COLOR_DIFFUSE] = GetShaderLocation(*pbr, "albedoColor");
+        SetShaderValue(*pbr, GetShaderLocation(*pbr, "ambientColor"), &ambientColorNormalized, SHADER_UNIFORM_VEC3);
+        SetShaderValue(*pbr, GetShaderLocation(*pbr, "ambient"), &ambientIntensity, SHADER_UNIFORM_FLOAT);
+    }
+    printf("pbr: %d shader variants\n", pbrVariants.count);
 
-      Model car = LoadModel("resources/toyota_land_cruiser/scene.gltf");
-//       for (int i = 0; i < car.materialCount; i++) {
-//           car.materials[i].shader = shader;
-// 
-// 
-//       }
 
+    // Collision geometry for the rain, placed the same way the models are drawn
+    double bvhStart = GetTime();
+    Model sceneModels[2] = { city, car };
+    Matrix sceneTransforms[2] = {
+        GetModelDrawTransform(city, CITY_POSITION, CITY_SCALE),
+        GetModelDrawTransform(car, CAR_POSITION, CAR_SCALE)
+    };
+    BVH sceneBVH = LoadBVHFromModels(sceneModels, sceneTransforms, 2);
+    printf("scene bvh: %d triangles, %d nodes, %.1f ms\n", sceneBVH.triangleCount, sceneBVH.nodeCount,
+            (GetTime() - bvhStart) * 1000.0);
 
+    // The city never moves, its meshes are merged by material and chunk and drawn from a culled list
+    double batchStart = GetTime();
+    StaticBatches cityBatches = LoadStaticBatches(city, GetModelDrawTransform(city, CITY_POSITION, CITY_SCALE), CITY_CHUNK_SIZE);
+    printf("city batches: %d from %d meshes, %.1f ms\n", cityBatches.batchCount, cityBatches.sourceMeshes,
+            (GetTime() - batchStart) * 1000.0);
+    UnloadStaticBatchSources(&cityBatches, city);
 
+    // Far away the city and car are drawn from simplified meshes
+    LoadStaticBatchLODs(&cityBatches, CITY_LOD_CACHE);
+    MeshLOD *carLods = LoadMeshLODs(car.meshes, car.meshCount, CAR_LOD_CACHE);
+    int carTriangles = 0;
 
-    Model city = LoadModel("resources/ccity_building_set_1/scene.gltf");
-    city.materials[0].shader = shader;
+    // Highest surface under every point of the scene, drops stop when they go below it
+    RainHeightmap rainSurface = LoadRainHeightmap(&sceneBVH, RAIN_HEIGHTMAP_TEXEL, RAIN_HEIGHTMAP_CACHE);
 
 
     Vector2 carTextureTiling = (Vector2){0.5f, 0.5f};
 
 
-    // Setup material texture maps usage in shader
-    // NOTE: By default, the texture maps are always used
-    int usage = 1;
-    SetShaderValue(shader, GetShaderLocation(shader, "useTexAlbedo"), &usage, SHADER_UNIFORM_INT);
-    SetShaderValue(shader, GetShaderLocation(shader, "useTexNormal"), &usage, SHADER_UNIFORM_INT);
-    SetShaderValue(shader, GetShaderLocation(shader, "useTexMRA"), &usage, SHADER_UNIFORM_INT);
-    SetShaderValue(shader, GetShaderLocation(shader, "useTexEmissive"), &usage, SHADER_UNIFORM_INT);
 
-
-    Particle particle_arr[MAX_PARTICLES] = {0};
-    int particle_count = 0;
-    int particle_age[MAX_PARTICLES] = {0};
-    double raindrop_timer = 0;
+    // Rain drops, simulated on the cpu and uploaded as packed instances
+    Vector3 rainSize = { RAIN_BOUND_X, RAIN_BOUND_Y, RAIN_BOUND_Z };
+    RainParticles rain = LoadRainParticles(MAX_PARTICLES,
+            Vector3Subtract(camera.position, Vector3Scale(rainSize, 0.5f)),
+            Vector3Add(camera.position, Vector3Scale(rainSize, 0.5f)),
+            (benchmarking) ? BENCH_SEED : (unsigned int)GetRandomValue(0, 0x7fffffff));
 
 
     double curr_time = 0;
 
 
-    // Define mesh to be instanced
-    // Mesh rdropmesh = GenMeshCube(0.5, 0.5, 0.5);
-     Mesh rdropmesh = GenMeshPlane(1.0f, 1.0f, 2, 2);
-
-    // Define transforms to be uploaded to GPU for instances
-    Matrix *transforms = (Matrix *)RL_CALLOC(MAX_PARTICLES, sizeof(Matrix));   // Pre-multiplied transformations passed to rlgl
-
-    // Translate and rotate planes randomly
-    // These starting positions will be used with the rain_offset to instantiate planes
-    for (int i = 0; i < MAX_PARTICLES; i++)
-    {
-        Matrix translation = MatrixTranslate(
-                (float)GetRandomValue(- RAIN_BOUND_X / 2.0, RAIN_BOUND_X / 2.0),
-                (float)GetRandomValue(- RAIN_BOUND_Y / 2.0, RAIN_BOUND_Y / 2.0),
-                (float)GetRandomValue(- RAIN_BOUND_Z / 2.0, RAIN_BOUND_Z / 2.0));
-
-
-        transforms[i] = translation;
-        // transforms[i] = MatrixMultiply(rotation, translation);
-    }
-
     // Load lighting shader
     Shader rainshader = LoadShader(TextFormat("shaders/rain.vs", GLSL_VERSION),
             TextFormat("shaders/rain.fs", GLSL_VERSION));
 
     // Get shader locations
     rainshader.locs[SHADER_LOC_MATRIX_MVP] = GetShaderLocation(rainshader, "mvp");
-    rainshader.locs[SHADER_LOC_VECTOR_VIEW] = GetShaderLocation(rainshader, "viewPos");
 
     int ambientLoc = GetShaderLocation(rainshader, "ambient");
     SetShaderValue(rainshader, ambientLoc, (float[4]){ 0.01f, 0.01f, 0.01f, 1.0f }, SHADER_UNIFORM_VEC4);
@@ -249,61 +461,183 @@ int main(int argc, char** argv) {
     matInstances.shader = rainshader;
     matInstances.maps[MATERIAL_MAP_DIFFUSE].color = RED;
 
-    int rainOffsetLoc = GetShaderLocation(rainshader, "rainoffset");
-    float rainoffset = 0.0;
-    SetShaderValue(rainshader, rainOffsetLoc, &rainoffset, SHADER_UNIFORM_FLOAT);
-    
-    int travelHeightLoc = GetShaderLocation(rainshader, "travelheight");
-    float travelHeight = RAIN_BOUND_Y / 2.0;
-    SetShaderValue(rainshader, travelHeightLoc, &travelHeight, SHADER_UNIFORM_FLOAT);
-    
     int camPositionLoc = GetShaderLocation(rainshader, "campos");
 
-    Texture2D raintexture = LoadTexture("resources/cv20_v30_h-_osc3.png");
-    matInstances.maps[MATERIAL_MAP_ALBEDO].texture = raintexture;
-
-    printf("raintexture w: %d, h: %d\n", raintexture.width, raintexture.height);
+    // streaks are clipped against the same surface the drops collide with
+    rainshader.locs[SHADER_LOC_MAP_HEIGHT] = GetShaderLocation(rainshader, "heightMap");
+    matInstances.maps[MATERIAL_MAP_HEIGHT].texture = rainSurface.texture;
+    Vector2 heightMapSize = GetRainHeightmapSize(&rainSurface);
+    SetShaderValue(rainshader, GetShaderLocation(rainshader, "heightMapOrigin"), &rainSurface.origin, SHADER_UNIFORM_VEC2);
+    SetShaderValue(rainshader, GetShaderLocation(rainshader, "heightMapSize"), &heightMapSize, SHADER_UNIFORM_VEC2);
+
+    Vector2 lodDistance = { RAIN_LOD_MID, RAIN_LOD_FAR };
+    SetShaderValue(rainshader, GetShaderLocation(rainshader, "lodDistance"), &lodDistance, SHADER_UNIFORM_VEC2);
+
+    // Per drop position and seed uploaded to the GPU for instancing
+    RainInstanceBuffer rainInstances = LoadRainInstanceBuffer(MAX_PARTICLES, rainshader);
+
+    int rainChunkCounts[RAIN_JOB_CHUNKS] = { 0 };
+    int rainChunkHits[RAIN_JOB_CHUNKS] = { 0 };
+    int rainHits = 0;
+    RainCullStats rainChunkStats[RAIN_JOB_CHUNKS] = { 0 };
+    RainCullStats rainStats = { 0 };
+    int rainInstanceCount = 0;
+    int rainChunkImpacts[RAIN_JOB_CHUNKS] = { 0 };
+    Vector3 *rainImpacts = RL_CALLOC(MAX_PARTICLES, sizeof(Vector3));
+    RainUpdateJob rainJob = { .rain = &rain, .instances = rainInstances.instances,
+        .chunkCounts = rainChunkCounts, .chunkHits = rainChunkHits, .chunkStats = rainChunkStats,
+        .impacts = rainImpacts, .chunkImpacts = rainChunkImpacts };
+    JobCounter rainCounter = { 0 };
+
+    // Splashes where drops hit the ground and roofs
+    Shader splashshader = LoadShader(TextFormat("shaders/splash.vs", GLSL_VERSION),
+            TextFormat("shaders/splash.fs", GLSL_VERSION));
+    splashshader.locs[SHADER_LOC_MATRIX_MVP] = GetShaderLocation(splashshader, "mvp");
+    int splashCamPositionLoc = GetShaderLocation(splashshader, "campos");
+
+    Material matSplashes = LoadMaterialDefault();
+    matSplashes.shader = splashshader;
+    matSplashes.maps[MATERIAL_MAP_DIFFUSE].color = (Color){ 40, 48, 64, 255 };
+    matSplashes.maps[MATERIAL_MAP_ALBEDO].texture = LoadSplashAtlas(64);
+
+    SplashPool splashes = LoadSplashPool(MAX_SPLASHES, splashshader);
+
+    RainAtlas rainAtlas = LoadRainAtlas(RAIN_STREAK_DATABASE, RAIN_ATLAS_CACHE);
+    if (rainAtlas.texture.id == 0) rainAtlas = LoadRainAtlasRow(RAIN_STREAK_ROW, RAIN_STREAK_ROW_HORIZONTAL);
+    SetRainAtlasShader(&rainAtlas, rainshader);
+    matInstances.maps[MATERIAL_MAP_ALBEDO].texture = rainAtlas.texture;
+
+    printf("rain atlas w: %d, h: %d\n", rainAtlas.texture.width, rainAtlas.texture.height);
      
     // Create some lights
     Light lights[MAX_LIGHTS] = {0};
-    lights[0] = CreateLight(LIGHT_POINT, (Vector3){-1.0f, 1.0f, -2.0f}, (Vector3){0.0f, 0.0f, 0.0f}, YELLOW, 40.0f,
-            rainshader);
-    lights[1] = CreateLight(LIGHT_POINT, (Vector3){2.0f, 1.0f, 1.0f}, (Vector3){0.0f, 0.0f, 0.0f}, GREEN, 30.3f, rainshader);
-    lights[2] = CreateLight(LIGHT_POINT, (Vector3){-2.0f, 1.0f, 1.0f}, (Vector3){0.0f, 0.0f, 0.0f}, RED, 150.3f, rainshader);
-    lights[3] = CreateLight(LIGHT_POINT, (Vector3){1.0f, 1.0f, -2.0f}, (Vector3){0.0f, 0.0f, 0.0f}, BLUE, 20.0f, rainshader);
+    lights[0] = CreateLight(LIGHT_POINT, (Vector3){-1.0f, 1.0f, -2.0f}, (Vector3){0.0f, 0.0f, 0.0f}, YELLOW, 40.0f);
+    lights[1] = CreateLight(LIGHT_POINT, (Vector3){2.0f, 1.0f, 1.0f}, (Vector3){0.0f, 0.0f, 0.0f}, GREEN, 30.3f);
+    lights[2] = CreateLight(LIGHT_POINT, (Vector3){-2.0f, 1.0f, 1.0f}, (Vector3){0.0f, 0.0f, 0.0f}, RED, 150.3f);
+    lights[3] = CreateLight(LIGHT_POINT, (Vector3){1.0f, 1.0f, -2.0f}, (Vector3){0.0f, 0.0f, 0.0f}, BLUE, 20.0f);
+
+    // Per frame uniforms go through a cache, values that did not change are not sent again
+    // (the pbr variants each have their own, see shadervariants.h)
+    ShaderUniforms rainUniforms = LoadShaderUniforms(rainshader);
+    ShaderUniforms splashUniforms = LoadShaderUniforms(splashshader);
+
+    // Street lamps, toggled together from the GUI
+    Light streetLamps[STREET_LAMP_COUNT] = { 0 };
+    for (int i = 0; i < STREET_LAMP_COUNT; i++) {
+        float x = (i % STREET_LAMP_ROW - STREET_LAMP_ROW / 2 + 0.5f) * STREET_LAMP_SPACING;
+        float z = (i / STREET_LAMP_ROW - STREET_LAMP_ROW / 2 + 0.5f) * STREET_LAMP_SPACING;
+        streetLamps[i] = (Light){ .type = LIGHT_POINT, .enabled = 1, .position = { x, STREET_LAMP_HEIGHT, z },
+            .color = { 1.0f, 0.75f, 0.45f, 1.0f }, .intensity = STREET_LAMP_INTENSITY };
+    }
+
+    // Lights are sorted into clusters of the view every frame, shaders only loop over their cluster's
+    LightClusters lightClusters = LoadLightClusters();
+    LightClusterLocations pbrClusterLocs[MAX_SHADER_VARIANTS];
+    for (int i = 0; i < pbrVariants.count; i++) pbrClusterLocs[i] = GetLightClusterLocations(pbrVariants.variants[i].shader);
+
+    // The closest lights cast shadows, the city is drawn into their tiles once and the car every frame
+    ShadowAtlas shadowAtlas = LoadShadowAtlas();
+    ShadowAtlasLocations pbrShadowLocs[MAX_SHADER_VARIANTS];
+    for (int i = 0; i < pbrVariants.count; i++) pbrShadowLocs[i] = GetShadowAtlasLocations(pbrVariants.variants[i].shader);
+    Material shadowMaterial = LoadMaterialDefault();    // only depth is kept, draw with the cheapest shader
+    Material *shadowMaterials = RL_MALLOC(city.materialCount * sizeof(Material));
+    for (int i = 0; i < city.materialCount; i++) shadowMaterials[i] = shadowMaterial;
+    BoundingBox carBounds = GetModelDrawBounds(car, GetModelDrawTransform(car, CAR_POSITION, CAR_SCALE));
+    Light frameLights[MAX_LIGHTS + STREET_LAMP_COUNT];
+    Vector3 shadowPositions[MAX_LIGHTS + STREET_LAMP_COUNT];
+    float shadowRanges[MAX_LIGHTS + STREET_LAMP_COUNT];
+    int shadowTiles[MAX_LIGHTS + STREET_LAMP_COUNT];
+    LightClusterLocations rainClusterLocs = GetLightClusterLocations(rainshader);
+
+    // Puddles reflect the scene mirrored in the ground, drawn smaller and maybe not every frame,
+    // lit by the lights mirrored into clusters of their own
+    PlanarReflection reflection = LoadPlanarReflection(GetRenderWidth(), GetRenderHeight(), reflectionDivisor,
+            reflectionInterval, GROUND_HEIGHT);
+    LightClusters reflectionClusters = LoadLightClusters();
+    PlanarReflectionLocations pbrReflectionLocs[MAX_SHADER_VARIANTS];
+    for (int i = 0; i < pbrVariants.count; i++) pbrReflectionLocs[i] = GetPlanarReflectionLocations(pbrVariants.variants[i].shader);
+
+    // Drops landing in the puddles ripple them, a wave simulation on the CPU tiled over the ground
+    Ripples ripples = LoadRipples(GROUND_HEIGHT);
+    for (int i = 0; i < pbrVariants.count; i++) SetRippleShaderValues(&ripples, pbrVariants.variants[i].shader);
+
+    // Rain drawn at reduced resolution is tested against the scene depth in rain.fs, then upsampled over the scene
+    Shader upsampleshader = LoadShader(0, TextFormat("shaders/upsample.fs", GLSL_VERSION));
+    RainTarget rainTarget = LoadRainTarget(GetRenderWidth(), GetRenderHeight(), 1 << rain_resolution, upsampleshader);
+    rain_resolution = rainTarget.divisor / 2;
+    rainshader.locs[SHADER_LOC_MAP_OCCLUSION] = GetShaderLocation(rainshader, "sceneDepth");
+    matInstances.maps[MATERIAL_MAP_OCCLUSION].texture = GetRainTargetDepth(&rainTarget);
+    int sceneDepthTexelLoc = GetShaderLocation(rainshader, "sceneDepthTexel");
+    Vector2 clipPlanes = { (float)rlGetCullDistanceNear(), (float)rlGetCullDistanceFar() };
+    SetShaderValue(rainshader, GetShaderLocation(rainshader, "clipPlanes"), &clipPlanes, SHADER_UNIFORM_VEC2);
+
+    // Benchmarks run uncapped on a fixed timestep, with every texture in place before the first frame
+    const char *benchStages[] = { "update", "simulate", "upload", "draw" };
+    Benchmark bench = LoadBenchmark(benchFrames, benchStages, 4);
+    if (benchmarking) {
+        while (!UpdateAssetLoader(ASSET_UPLOAD_BUDGET)) WaitTime(0.001);
+    } else {
+        SetTargetFPS(targetFps);
+    }
 
-    SetTargetFPS(60); // Set our game to run at 60 frames-per-second
+    // The rain steps at a fixed rate whatever the frame rate, frames draw it in between steps
+    SimClock simClock = InitSimClock(simRate, SIM_MAX_STEPS);
+    float benchTime = 0.0f;
+    bool exportTrace = false;   // asked for during the frame, written once it is over
                       //---------------------------------------------------------------------------------------
 
                       // Main game loop
-    while (!WindowShouldClose()) // Detect window close button or ESC key
+    while (!WindowShouldClose() && !(benchmarking && IsBenchmarkDone(&bench))) // Detect window close button or ESC key
     {
         // Update
+        BeginBenchFrame(&bench);
+        BeginProfileZone("frame");
+        BeginProfileZone("update");
 
         double last_time = curr_time;
         curr_time = GetTime();
         double dT;
-        if (toggle_pause) 
+        if (benchmarking)
+            dT = BENCH_TIMESTEP;
+        else if (toggle_pause) 
             dT = 0;
         else 
             dT = curr_time - last_time;
 
 
         //----------------------------------------------------------------------------------
-        if (toggle_orbit)
+        // Swap in model textures that finished decoding
+        bool assetsLoaded = UpdateAssetLoader(ASSET_UPLOAD_BUDGET);
+
+        if (benchmarking) {
+            camera = GetBenchCamera(benchTime);
+            benchTime += (float)dT;
+        } else if (toggle_orbit)
             UpdateCamera(&camera, CAMERA_ORBITAL);
         else 
             UpdateCamera(&camera, CAMERA_PERSPECTIVE);
 
+        // Animate raindrops on the workers while this thread sets up the frame
+        // the volume follows the camera so there is always rain around it
+        SetRainVolume(&rain, camera.position, rainSize, RAIN_FLOOR);
+        rainJob.lod = (RainLOD){ camera.position, RAIN_LOD_MID, RAIN_LOD_FAR };
+        rainJob.frustum = GetCameraFrustum(camera, (float)GetScreenWidth() / (float)GetScreenHeight());
+        rainJob.cull = toggle_culling;
+        rainJob.surface = (toggle_collision) ? &rainSurface : NULL;
+        rainJob.keepImpacts = toggle_splashes || toggle_puddles;
+        rainJob.steps = AdvanceSimClock(&simClock, dT);
+        rainJob.dt = (float)simClock.step;
+        rainJob.alpha = GetSimClockAlpha(&simClock);
+        JobParallelFor(&rainCounter, rain.count, RAIN_JOB_CHUNK, UpdateRainJob, &rainJob);
+        EndProfileZone();
+
+        BeginProfileZone("uniforms");
         // Update the shader with the camera view vector (points towards { 0.0f, 0.0f, 0.0f })
+        // rain.vs lights every drop from campos, the only camera uniform of the rain shader
         float cameraPos[3] = {camera.position.x, camera.position.y, camera.position.z};
-        SetShaderValue(shader, shader.locs[SHADER_LOC_VECTOR_VIEW], cameraPos, SHADER_UNIFORM_VEC3);
-        SetShaderValue(rainshader, rainshader.locs[SHADER_LOC_VECTOR_VIEW], cameraPos, SHADER_UNIFORM_VEC3);
-
-
-        // this is basically a repeat of above but I don't know if it will mess with
-        // the frag shader to have the same name in both
-        SetShaderValue(rainshader, camPositionLoc, cameraPos, SHADER_UNIFORM_VEC3);
+        SetShaderVariantsUniform(&pbrVariants, PBR_VIEW_POS, cameraPos, SHADER_UNIFORM_VEC3);
+        SetShaderUniform(&rainUniforms, camPositionLoc, cameraPos, SHADER_UNIFORM_VEC3);
+        SetShaderUniform(&splashUniforms, splashCamPositionLoc, cameraPos, SHADER_UNIFORM_VEC3);
 
 
 
@@ -313,56 +647,235 @@ int main(int argc, char** argv) {
         if (IsKeyPressed(KEY_THREE)) { lights[3].enabled = !lights[3].enabled; }
         if (IsKeyPressed(KEY_FOUR)) { lights[0].enabled = !lights[0].enabled; }
 
+        int frameLightCount = 0;
         for (int i = 0; i < MAX_LIGHTS; i++) {
-            UpdateLight(rainshader, lights[i]);
+            if (lights[i].enabled) frameLights[frameLightCount++] = lights[i];
+        }
+        if (toggle_lamps) {
+            for (int i = 0; i < STREET_LAMP_COUNT; i++) {
+                if (streetLamps[i].enabled) frameLights[frameLightCount++] = streetLamps[i];
+            }
         }
 
+        // lights with a shadow tile go to the clusters first and in tile order, pbr.fs finds the tile by light index
+        for (int i = 0; i < frameLightCount; i++) {
+            shadowPositions[i] = frameLights[i].position;
+            shadowRanges[i] = GetClusterLightRange(frameLights[i].intensity);
+        }
+        int shadowCandidates = (toggle_shadows) ? frameLightCount : 0;
+        AssignShadowLights(&shadowAtlas, shadowPositions, shadowRanges, shadowCandidates, camera.position, shadowTiles);
+
+        ClearClusterLights(&lightClusters);
+        for (int t = 0; t < shadowAtlas.count; t++) UpdateLight(&lightClusters, frameLights[shadowAtlas.lights[t]]);
+        for (int i = 0; i < frameLightCount; i++) {
+            if (i >= shadowCandidates || shadowTiles[i] < 0) UpdateLight(&lightClusters, frameLights[i]);
+        }
+        BeginProfileZone("light clusters");
+        UpdateLightClusters(&lightClusters, camera, GetRenderWidth(), GetRenderHeight());
+        bool drawReflection = toggle_puddles && IsPlanarReflectionDue(&reflection);
+        if (!toggle_puddles) ResetPlanarReflection(&reflection);
+        if (drawReflection) {
+            ClearClusterLights(&reflectionClusters);
+            for (int i = 0; i < frameLightCount; i++) {
+                Light mirrored = frameLights[i];
+                mirrored.position = MirrorPlanarReflectionPoint(&reflection, mirrored.position);
+                UpdateLight(&reflectionClusters, mirrored);
+            }
+            UpdateLightClusters(&reflectionClusters, camera, GetRenderWidth(), GetRenderHeight());
+        }
+        EndProfileZone();
+        // rain resolution picked in the GUI last frame, or the window changed size
+        if (!IsRainTargetFor(&rainTarget, 1 << rain_resolution, GetRenderWidth(), GetRenderHeight())) {
+            UnloadRainTarget(&rainTarget);
+            rainTarget = LoadRainTarget(GetRenderWidth(), GetRenderHeight(), 1 << rain_resolution, upsampleshader);
+            matInstances.maps[MATERIAL_MAP_OCCLUSION].texture = GetRainTargetDepth(&rainTarget);
+            rain_resolution = rainTarget.divisor / 2;     // back to full when it could not be made
+        }
+        Vector2 sceneDepthTexel = GetRainTargetTexel(&rainTarget);
+        SetShaderUniform(&rainUniforms, sceneDepthTexelLoc, &sceneDepthTexel, SHADER_UNIFORM_VEC2);
+
+        // pbr cluster, shadow and puddle uniforms are set after the reflection is drawn, it has its own
+        SetShaderVariantsUniform(&pbrVariants, PBR_TILING, &carTextureTiling, SHADER_UNIFORM_VEC2);
+        Vector4 carEmissiveColor = ColorNormalize(car.materials[0].maps[MATERIAL_MAP_EMISSION].color);
+        SetShaderVariantsUniform(&pbrVariants, PBR_EMISSIVE_COLOR, &carEmissiveColor, SHADER_UNIFORM_VEC4);
+        float emissiveIntensity = .01f;
+        SetShaderVariantsUniform(&pbrVariants, PBR_EMISSIVE_POWER, &emissiveIntensity, SHADER_UNIFORM_FLOAT);
+        SetLightClusterUniforms(&rainUniforms, rainClusterLocs, &lightClusters, 1.0f / rainTarget.divisor);
+
 
         // toggle logging with l
         if (IsKeyPressed(KEY_L)) {
             logging = !logging;
         }
 
-
-        // Update light values on shader (actually, only enable/disable them)
-        for (int i = 0; i < MAX_LIGHTS; i++) UpdateLight(shader, lights[i]);
+        // profiler overlay with p, chrome://tracing capture with t
+        if (IsKeyPressed(KEY_P)) toggle_profiler = !toggle_profiler;
+        if (IsKeyPressed(KEY_T)) exportTrace = true;
+        EndProfileZone();
 
 
 
         //---------------------------------------------------------------------
-        // Animate Raindrops
+        // Wait for the raindrops
         //---------------------------------------------------------------------
-       
-        rainoffset = rainoffset - (dT * RAIN_STEP);
-        if (rainoffset < 0.6) { // Hacky workaround, should be < 0, but weird translations are happening < .6
-            rainoffset = 1;
+
+        EndBenchStage(&bench, 0);
+        BeginProfileZone("wait rain");
+        JobWait(&rainCounter);
+        EndProfileZone();
+        EndBenchStage(&bench, 1);
+        BeginProfileZone("upload rain");
+        int rainChunkCount = (rain.count + RAIN_JOB_CHUNK - 1) / RAIN_JOB_CHUNK;
+        rainInstanceCount = CompactRainInstances(rainInstances.instances, rainChunkCounts, rainChunkCount, RAIN_JOB_CHUNK);
+        UpdateRainInstanceBuffer(&rainInstances, rainInstanceCount);
+
+        rainStats = (RainCullStats){ 0 };
+        rainHits = 0;
+        for (int i = 0; i < rainChunkCount; i++) {
+            rainHits += rainChunkHits[i];
+            rainStats.visible += rainChunkStats[i].visible;
+            rainStats.culled += rainChunkStats[i].culled;
+            rainStats.thinned += rainChunkStats[i].thinned;
+        }
+
+        // retire old splashes before the new ones take their slots
+        UpdateSplashes(&splashes, (float)dT);
+        for (int i = 0; i < rainChunkCount && toggle_splashes; i++) {
+            SpawnSplashes(&splashes, rainImpacts + i * RAIN_JOB_CHUNK, rainChunkImpacts[i]);
+        }
+
+        // the same drops ripple the puddles, stepped with the rain (whether they splash or not)
+        BeginProfileZone("ripples");
+        if (toggle_puddles) {
+            for (int i = 0; i < rainChunkCount; i++) {
+                AddRippleImpulses(&ripples, rainImpacts + i * RAIN_JOB_CHUNK, rainChunkImpacts[i]);
+            }
+            UpdateRipples(&ripples, rainJob.steps);
         }
+        EndProfileZone();
         if (logging) {
-            printf("rainoffset: %f\n", rainoffset);
+            printf("drop[0]: %f %f %f, drawn: %d, culled: %d, thinned: %d, hits: %d, splashes: %d\n", rain.px[0], rain.py[0],
+                    rain.pz[0], rainStats.visible, rainStats.culled, rainStats.thinned, rainHits, GetSplashCount(&splashes));
+            printf("lights: %d in %d cluster entries, at most %d per cluster, %d dropped\n", lightClusters.lightCount,
+                    lightClusters.indexCount, lightClusters.maxClusterLights, lightClusters.overflow);
+            printf("shadows: %d lights, %d static tiles drawn, %d dynamic tiles drawn\n", shadowAtlas.count,
+                    shadowAtlas.staticDraws, shadowAtlas.dynamicDraws);
+            printf("reflection: %dx%d, %d drawn this frame, every %d frames, ripple tiles uploaded: %d\n",
+                    reflection.target.texture.width, reflection.target.texture.height, reflection.draws,
+                    reflection.interval, ripples.uploads);
+            printf("city: %d batches drawn, %d culled, %d triangles, car: %d triangles\n", cityBatches.drawn,
+                    cityBatches.culled, cityBatches.triangles, carTriangles);
+            printf("sim: %d steps, alpha %.2f, %lld steps total, %.2f s dropped\n", rainJob.steps, rainJob.alpha,
+                    simClock.steps, simClock.dropped);
+            int uploads = rainUniforms.uploads + splashUniforms.uploads;
+            int skipped = rainUniforms.skipped + splashUniforms.skipped;
+            for (int i = 0; i < pbrVariants.count; i++) {
+                uploads += pbrVariants.variants[i].uniforms.uploads;
+                skipped += pbrVariants.variants[i].uniforms.skipped;
+            }
+            printf("uniforms: %d uploaded, %d unchanged\n", uploads, skipped);
         }
-        SetShaderValue(rainshader, rainOffsetLoc, &rainoffset, SHADER_UNIFORM_FLOAT);
+        for (int i = 0; i < pbrVariants.count; i++) ResetShaderUniformStats(&pbrVariants.variants[i].uniforms);
+        ResetShaderUniformStats(&rainUniforms);
+        ResetShaderUniformStats(&splashUniforms);
+        EndProfileZone();
+        EndBenchStage(&bench, 2);
 
 
         //----------------------------------------------------------------------------------
         // Draw
         //----------------------------------------------------------------------------------
+        BeginProfileZone("draw");
         BeginDrawing();
 
-        ClearBackground(BLACK);
-
-        BeginMode3D(camera);
+        // the city only into tiles a light just got, the car into the tiles that see it
+        BeginProfileZone("shadows");
+        if (HasStaleShadowTiles(&shadowAtlas)) {
+            BeginShadowLayer(&shadowAtlas, SHADOW_STATIC);
+            for (int t = 0; t < shadowAtlas.count; t++) {
+                if (!IsShadowTileStale(&shadowAtlas, t)) continue;
+                Frustum lightFrustum = BeginShadowTile(&shadowAtlas, t);
+                DrawStaticBatches(&cityBatches, shadowMaterials, &lightFrustum, NULL, MatrixIdentity());
+                EndShadowTile(&shadowAtlas);
+            }
+            EndShadowLayer(&shadowAtlas);
+        } else {
+            shadowAtlas.staticDraws = 0;
+        }
+        if (shadowAtlas.count > 0 || shadowAtlas.dynamicTiles != 0) {
+            Matrix carTransform = GetModelDrawTransform(car, CAR_POSITION, CAR_SCALE);
+            BeginShadowLayer(&shadowAtlas, SHADOW_DYNAMIC);
+            for (int t = 0; t < shadowAtlas.count; t++) {
+                Frustum lightFrustum = GetShadowTileFrustum(&shadowAtlas, t);
+                if (FrustumTestBox(&lightFrustum, carBounds) == FRUSTUM_OUTSIDE) continue;
+                BeginShadowTile(&shadowAtlas, t);
+                for (int i = 0; i < car.meshCount; i++) DrawMesh(car.meshes[i], shadowMaterial, carTransform);
+                EndShadowTile(&shadowAtlas);
+            }
+            EndShadowLayer(&shadowAtlas);
+        }
+        EndProfileZone();
+
+        // the scene mirrored in the ground, without shadows or puddles, only what the mirror shows
+        LODView lodView = GetLODView(camera, GetRenderHeight(), LOD_PIXEL_ERROR);
+        if (drawReflection) {
+            BeginProfileZone("reflection");
+            float noShadows = 0.0f;
+            for (int i = 0; i < pbrVariants.count; i++) {
+                ShaderVariant *variant = &pbrVariants.variants[i];
+                SetLightClusterUniforms(&variant->uniforms, pbrClusterLocs[i], &reflectionClusters, 1.0f / reflection.divisor);
+                SetShaderUniform(&variant->uniforms, pbrShadowLocs[i].lightCount, &noShadows, SHADER_UNIFORM_FLOAT);
+                SetPlanarReflectionUniforms(&variant->uniforms, pbrReflectionLocs[i], &reflection, 0.0f);
+            }
+            BindLightClusters(&reflectionClusters);
+            Frustum mirrorFrustum = BeginPlanarReflection(&reflection, camera);
+            Matrix mirror = GetPlanarReflectionMirror(&reflection);
+            if (FrustumTestBox(&mirrorFrustum, carBounds) != FRUSTUM_OUTSIDE) {
+                // levels picked for the car where it really is, like the main pass does
+                Matrix carTransform = GetModelDrawTransform(car, CAR_POSITION, CAR_SCALE);
+                Matrix carMirror = MatrixMultiply(carTransform, mirror);
+                for (int i = 0; i < car.meshCount; i++) {
+                    Mesh mesh = car.meshes[i];
+                    if (toggle_lod) mesh = carLods[i].levels[SelectMeshLOD(&carLods[i], carTransform, CAR_SCALE, &lodView)];
+                    DrawMesh(mesh, car.materials[car.meshMaterial[i]], carMirror);
+                }
+            }
+            DrawStaticBatches(&cityBatches, city.materials, &mirrorFrustum, (toggle_lod) ? &lodView : NULL, mirror);
+            EndPlanarReflection(&reflection);
+            EndProfileZone();
+        }
+        for (int i = 0; i < pbrVariants.count; i++) {
+            ShaderVariant *variant = &pbrVariants.variants[i];
+            SetLightClusterUniforms(&variant->uniforms, pbrClusterLocs[i], &lightClusters, 1.0f);
+            SetShadowAtlasUniforms(&variant->uniforms, pbrShadowLocs[i], &shadowAtlas);
+            SetPlanarReflectionUniforms(&variant->uniforms, pbrReflectionLocs[i], &reflection, (toggle_puddles) ? 1.0f : 0.0f);
+        }
 
+        BeginRainTargetScene(&rainTarget);
 
-        SetShaderValue(shader, textureTilingLoc, &carTextureTiling, SHADER_UNIFORM_VEC2);
-        Vector4 carEmissiveColor = ColorNormalize(car.materials[0].maps[MATERIAL_MAP_EMISSION].color);
-        SetShaderValue(shader, emissiveColorLoc, &carEmissiveColor, SHADER_UNIFORM_VEC4);
-        float emissiveIntensity = .01f;
-        SetShaderValue(shader, emissiveIntensityLoc, &emissiveIntensity, SHADER_UNIFORM_FLOAT);
+        ClearBackground(BLACK);
 
-        DrawModel(car, (Vector3){0.0f, -0.1f, -10.0f}, 0.05, WHITE); // Draw car model
+        BeginMode3D(camera);
+        BindLightClusters(&lightClusters);
+        BindShadowAtlas(&shadowAtlas);
+        BindPlanarReflection(&reflection);
+        BindRipples(&ripples);
+
+        BeginProfileZone("draw car");
+        if (toggle_lod) {
+            carTriangles = DrawModelLOD(car, carLods, GetModelDrawTransform(car, CAR_POSITION, CAR_SCALE), CAR_SCALE, &lodView);
+        } else {
+            DrawModel(car, CAR_POSITION, CAR_SCALE, WHITE); // Draw car model
+            carTriangles = 0;
+            for (int i = 0; i < car.meshCount; i++) carTriangles += car.meshes[i].triangleCount;
+        }
+        EndProfileZone();
         // DrawModel(stoplight, (Vector3){-0.0f, 0.0f, -4.0f}, 10.0f, WHITE); // Draw bus stop
 
-        DrawModel(city, (Vector3){75.0f, 0.0f, 75.0f}, .01, WHITE);
+        BeginProfileZone("draw city");
+        DrawStaticBatches(&cityBatches, city.materials, &rainJob.frustum, (toggle_lod) ? &lodView : NULL,
+                MatrixIdentity());  // the view the rain was culled against
+        EndProfileZone();
 
         // Draw spheres to show the lights positions
         for (int i = 0; i < MAX_LIGHTS; i++) {
@@ -376,13 +889,15 @@ int main(int argc, char** argv) {
 
 
 
-        // Color particle_color = (Color){255, 50, 50, 255};
-        // for (int i = 0; i < particle_count; i++) {
-        //     DrawSphereEx(particle_arr[i].p, 0.1f, 2, 2, particle_color);
-        // }
-
         BeginBlendMode(BLEND_ADDITIVE);
-        DrawMeshInstanced(rdropmesh, matInstances, transforms, MAX_PARTICLES);
+        if (!IsRainTargetReduced(&rainTarget)) {
+            BeginProfileZone("draw rain");
+            DrawRainInstances(&rainInstances, matInstances, rainInstanceCount);
+            EndProfileZone();
+        }
+        BeginProfileZone("draw splashes");
+        DrawSplashes(&splashes, matSplashes);
+        EndProfileZone();
         EndBlendMode();
 
         if (logging) {
@@ -391,38 +906,138 @@ int main(int argc, char** argv) {
 
 
         EndMode3D();
+        EndRainTargetScene(&rainTarget);
+
+        // rain into its own smaller target, then both onto the screen
+        if (IsRainTargetReduced(&rainTarget)) {
+            BeginProfileZone("draw rain");
+            BeginRainTargetRain(&rainTarget);
+            BeginMode3D(camera);
+            BeginBlendMode(BLEND_ADDITIVE);
+            DrawRainInstances(&rainInstances, matInstances, rainInstanceCount);
+            EndBlendMode();
+            EndMode3D();
+            EndRainTargetRain(&rainTarget);
+            EndProfileZone();
+
+            BeginProfileZone("upsample rain");
+            DrawRainTarget(&rainTarget);
+            EndProfileZone();
+        }
+        EndProfileZone();
 
+        BeginProfileZone("gui");
         GuiLabel((Rectangle){1 pw, 20 ph, 5 pw, 3 ph}, "Camera Orbit:");
         GuiToggle((Rectangle){6 pw, 20 ph, 5 pw, 3 ph}, ((toggle_orbit) ? "enabled" : "disabled"), &toggle_orbit);
 
         GuiLabel((Rectangle){1 pw, 25 ph, 5 pw, 3 ph}, "Pause Time:");
         GuiToggle((Rectangle){6 pw, 25 ph, 5 pw, 3 ph}, ((toggle_pause) ? "enabled" : "disabled"), &toggle_pause);
 
+        GuiLabel((Rectangle){1 pw, 30 ph, 5 pw, 3 ph}, "Rain Culling:");
+        GuiToggle((Rectangle){6 pw, 30 ph, 5 pw, 3 ph}, ((toggle_culling) ? "enabled" : "disabled"), &toggle_culling);
+        GuiLabel((Rectangle){1 pw, 33 ph, 15 pw, 3 ph}, TextFormat("drawn %d  culled %d  thinned %d",
+                    rainStats.visible, rainStats.culled, rainStats.thinned));
+
+        GuiLabel((Rectangle){1 pw, 37 ph, 5 pw, 3 ph}, "Rain Collision:");
+        GuiToggle((Rectangle){6 pw, 37 ph, 5 pw, 3 ph}, ((toggle_collision) ? "enabled" : "disabled"), &toggle_collision);
+
+        GuiLabel((Rectangle){1 pw, 41 ph, 5 pw, 3 ph}, "Rain Splashes:");
+        GuiToggle((Rectangle){6 pw, 41 ph, 5 pw, 3 ph}, ((toggle_splashes) ? "enabled" : "disabled"), &toggle_splashes);
+
          DrawText("Toggle lights: [1][2][3][4]", 10, 40, 20, LIGHTGRAY);
 
         DrawText("(c) Toyota Landcruiser model by Renafox (https://skfb.ly/MyHv)", screenWidth - 380, screenHeight - 20, 10, LIGHTGRAY);
 
         DrawFPS(10, 10);
 
+        if (!assetsLoaded) {
+            int texturesLoaded, texturesTotal;
+            GetAssetLoaderProgress(&texturesLoaded, &texturesTotal);
+            DrawText(TextFormat("Loading textures %d / %d", texturesLoaded, texturesTotal), 10, 70, 20, LIGHTGRAY);
+        }
+
+        GuiLabel((Rectangle){1 pw, 45 ph, 5 pw, 3 ph}, "Profiler [P]:");
+        GuiToggle((Rectangle){6 pw, 45 ph, 5 pw, 3 ph}, ((toggle_profiler) ? "enabled" : "disabled"), &toggle_profiler);
+        GuiLabel((Rectangle){1 pw, 49 ph, 5 pw, 3 ph}, "Street Lamps:");
+        GuiToggle((Rectangle){6 pw, 49 ph, 5 pw, 3 ph}, ((toggle_lamps) ? "enabled" : "disabled"), &toggle_lamps);
+        GuiLabel((Rectangle){1 pw, 52 ph, 15 pw, 3 ph}, TextFormat("lights %d  most per cluster %d",
+                    lightClusters.lightCount, lightClusters.maxClusterLights));
+        GuiLabel((Rectangle){1 pw, 56 ph, 5 pw, 3 ph}, "Rain Resolution:");
+        GuiToggleGroup((Rectangle){6 pw, 56 ph, 3 pw, 3 ph}, "FULL;HALF;QUARTER", &rain_resolution);
+        GuiLabel((Rectangle){1 pw, 60 ph, 5 pw, 3 ph}, "Mesh LOD:");
+        GuiToggle((Rectangle){6 pw, 60 ph, 5 pw, 3 ph}, ((toggle_lod) ? "enabled" : "disabled"), &toggle_lod);
+        GuiLabel((Rectangle){1 pw, 63 ph, 15 pw, 3 ph}, TextFormat("city triangles %d  car triangles %d",
+                    cityBatches.triangles, carTriangles));
+        GuiLabel((Rectangle){1 pw, 67 ph, 5 pw, 3 ph}, "Shadows:");
+        GuiToggle((Rectangle){6 pw, 67 ph, 5 pw, 3 ph}, ((toggle_shadows) ? "enabled" : "disabled"), &toggle_shadows);
+        GuiLabel((Rectangle){1 pw, 70 ph, 15 pw, 3 ph}, TextFormat("lights %d  tiles drawn: static %d  dynamic %d",
+                    shadowAtlas.count, shadowAtlas.staticDraws, shadowAtlas.dynamicDraws));
+        GuiLabel((Rectangle){1 pw, 74 ph, 5 pw, 3 ph}, "Puddles:");
+        GuiToggle((Rectangle){6 pw, 74 ph, 5 pw, 3 ph}, ((toggle_puddles) ? "enabled" : "disabled"), &toggle_puddles);
+        GuiLabel((Rectangle){1 pw, 77 ph, 15 pw, 3 ph}, TextFormat("reflection 1/%d every %d frames  ripple tiles %d",
+                    reflection.divisor, reflection.interval, ripples.uploads));
+
+        if (toggle_profiler) DrawProfilerOverlay((Rectangle){ 75 pw, 2 ph, 24 pw, 60 ph });
+        EndProfileZone();
+
+        BeginProfileZone("present");
         EndDrawing();
+        EndProfileZone();
+        EndProfileZone();
+        UpdateProfiler();
+
+        // every job of the frame was waited on and every zone is closed, nothing writes the rings now
+        if (exportTrace) ExportProfileTrace(PROFILE_TRACE_FILE);
+        exportTrace = false;
+        EndBenchStage(&bench, 3);
+        EndBenchFrame(&bench);
         //----------------------------------------------------------------------------------
     }
 
+    if (benchmarking) {
+        PrintBenchmark(&bench, "render");
+        ExportBenchmark(&bench, benchOutput, "render", GetJobThreadCount());
+    }
+    UnloadBenchmark(&bench);
+
     // De-Initialization
     //--------------------------------------------------------------------------------------
-    // Unbind (disconnect) shader from car.material[0]
-    // to avoid UnloadMaterial() trying to unload it automatically
-    car.materials[0].shader = (Shader){0};
-    UnloadMaterial(car.materials[0]);
-    car.materials[0].maps = NULL;
-    UnloadModel(car);
-
-    city.materials[0].shader = (Shader){0};
-    UnloadMaterial(city.materials[0]);
-    city.materials[0].maps = NULL;
-    UnloadModel(city);
-
-    UnloadShader(shader); // Unload Shader
+    // Unbind (disconnect) the variants from every material
+    // to avoid UnloadMaterial() trying to unload them automatically, UnloadShaderVariants() does
+    for (int i = 0; i < car.materialCount; i++) car.materials[i].shader = (Shader){0};
+    UnloadMeshLODs(carLods, car.meshCount);
+    UnloadSceneModel(&scenePack, car);
+
+    for (int i = 0; i < city.materialCount; i++) city.materials[i].shader = (Shader){0};
+    UnloadSceneModel(&scenePack, city);
+    UnloadStaticBatches(&cityBatches);
+    UnloadScenePack(&scenePack);
+
+    UnloadShaderVariants(&pbrVariants); // Unload every compiled variant
+
+    UnloadRainParticles(&rain);
+    UnloadRainInstanceBuffer(&rainInstances);
+    UnloadBVH(&sceneBVH);
+    UnloadRainHeightmap(&rainSurface);
+    UnloadSplashPool(&splashes);
+    UnloadRainAtlas(&rainAtlas);
+    UnloadTexture(matSplashes.maps[MATERIAL_MAP_ALBEDO].texture);
+    UnloadShader(splashshader);
+    UnloadShaderUniforms(&rainUniforms);
+    UnloadShaderUniforms(&splashUniforms);
+    UnloadLightClusters(&lightClusters);
+    UnloadShadowAtlas(&shadowAtlas);
+    UnloadPlanarReflection(&reflection);
+    UnloadRipples(&ripples);
+    UnloadLightClusters(&reflectionClusters);
+    RL_FREE(shadowMaterials);
+    UnloadMaterial(shadowMaterial);
+    UnloadRainTarget(&rainTarget);
+    UnloadShader(upsampleshader);
+    RL_FREE(rainImpacts);
+
+    ShutdownAssetLoader();
+    ShutdownJobSystem();
 
     CloseWindow(); // Close window and OpenGL context
                    //--------------------------------------------------------------------------------------
@@ -432,7 +1047,7 @@ int main(int argc, char** argv) {
 
 // Create light with provided data
 // NOTE: It updates the global lightCount and it's limited to MAX_LIGHTS
-static Light CreateLight(int type, Vector3 position, Vector3 target, Color color, float intensity, Shader shader) {
+static Light CreateLight(int type, Vector3 position, Vector3 target, Color color, float intensity) {
     Light light = {0};
 
     if (lightCount < MAX_LIGHTS) {
@@ -446,35 +1061,220 @@ static Light CreateLight(int type, Vector3 position, Vector3 target, Color color
         light.color[3] = (float)color.a / 255.0f;
         light.intensity = intensity;
 
-        // NOTE: Shader parameters names for lights must match the requested ones
-        light.enabledLoc = GetShaderLocation(shader, TextFormat("lights[%i].enabled", lightCount));
-        light.typeLoc = GetShaderLocation(shader, TextFormat("lights[%i].type", lightCount));
-        light.positionLoc = GetShaderLocation(shader, TextFormat("lights[%i].position", lightCount));
-        light.targetLoc = GetShaderLocation(shader, TextFormat("lights[%i].target", lightCount));
-        light.colorLoc = GetShaderLocation(shader, TextFormat("lights[%i].color", lightCount));
-        light.intensityLoc = GetShaderLocation(shader, TextFormat("lights[%i].intensity", lightCount));
-
-        UpdateLight(shader, light);
-
         lightCount++;
     }
 
     return light;
 }
 
-// Send light properties to shader
-// NOTE: Light shader locations should be available
-static void UpdateLight(Shader shader, Light light) {
-    SetShaderValue(shader, light.enabledLoc, &light.enabled, SHADER_UNIFORM_INT);
-    SetShaderValue(shader, light.typeLoc, &light.type, SHADER_UNIFORM_INT);
-
-    // Send to shader light position values
-    float position[3] = {light.position.x, light.position.y, light.position.z};
-    SetShaderValue(shader, light.positionLoc, position, SHADER_UNIFORM_VEC3);
-
-    // Send to shader light target position values
-    float target[3] = {light.target.x, light.target.y, light.target.z};
-    SetShaderValue(shader, light.targetLoc, target, SHADER_UNIFORM_VEC3);
-    SetShaderValue(shader, light.colorLoc, light.color, SHADER_UNIFORM_VEC4);
-    SetShaderValue(shader, light.intensityLoc, &light.intensity, SHADER_UNIFORM_FLOAT);
+// Lights the shaders see are the ones in the clusters, disabled lights are left out
+static void UpdateLight(LightClusters *clusters, Light light) {
+    if (!light.enabled) return;
+    Vector4 color = { light.color[0], light.color[1], light.color[2], light.color[3] };
+    AddClusterLight(clusters, light.position, color, light.intensity);
+}
+
+// Integrate a range of drops and write their instance data
+static void UpdateRainJob(void *data, int begin, int end) {
+    RainUpdateJob *job = (RainUpdateJob *)data;
+    RainParticles *rain = job->rain;
+    BeginProfileZone("rain job");
+
+    // each chunk writes into its own slice, compacted once every chunk is done
+    int chunk = begin / RAIN_JOB_CHUNK;
+    job->chunkHits[chunk] = 0;
+    job->chunkImpacts[chunk] = 0;
+    for (int step = 0; step < job->steps; step++) {
+        BeginProfileZone("integrate");
+        UpdateRainParticlesRange(rain, begin, end, job->dt);
+        EndProfileZone();
+
+        if (job->surface != NULL) {
+            BeginProfileZone("collide");
+            job->chunkHits[chunk] += CollideRainDrops(job, begin, end, job->impacts + begin, &job->chunkImpacts[chunk]);
+            EndProfileZone();
+        }
+    }
+
+    // frames in between steps draw the drops in between too
+    BeginProfileZone("emit");
+    job->chunkStats[chunk] = (RainCullStats){ 0 };
+    job->chunkCounts[chunk] = EmitRainInstances(rain, begin, end, job->alpha, job->lod, (job->cull) ? &job->frustum : NULL,
+            job->instances + begin, &job->chunkStats[chunk]);
+    EndProfileZone();
+
+    EndProfileZone();
+}
+
+// Respawn drops that fell below the scene surface, returns how many did
+// Hits close to the camera are added to impacts after the *impactCount already there,
+// at most end - begin in all
+static int CollideRainDrops(const RainUpdateJob *job, int begin, int end, Vector3 *impacts, int *impactCount) {
+    RainParticles *rain = job->rain;
+    const RainHeightmap *surface = job->surface;
+    float splashDistance = (job->keepImpacts) ? SPLASH_DISTANCE * SPLASH_DISTANCE : -1.0f;
+    int hitCount = 0;
+    int impactTotal = *impactCount;
+
+    for (int i = begin; i < end; i++) {
+        float height = GetRainSurfaceHeight(surface, rain->px[i], rain->pz[i]);
+        if (rain->py[i] >= height || rain->age[i] == 0.0f) continue; // above it, or respawned this step
+
+        // splashes too far away to see are not worth spawning
+        float dx = rain->px[i] - job->lod.camera.x;
+        float dz = rain->pz[i] - job->lod.camera.z;
+        if (dx * dx + dz * dz < splashDistance && impactTotal < end - begin) impacts[impactTotal++] = (Vector3){ rain->px[i], height, rain->pz[i] };
+
+        // back in at the top of the volume, carrying on by however far it went past the surface
+        // (at most one step, drops that wrapped into a building start right at the top)
+        float past = fminf(height - rain->py[i], -rain->vy[i] * job->dt);
+        rain->py[i] = rain->boundsMin.y - fmaxf(past, 0.0f);
+        RespawnRainDrop(rain, i, true);
+        hitCount++;
+    }
+
+    *impactCount = impactTotal;
+    return hitCount;
+}
+
+static void SetPbrMaterialShader(ShaderVariants *variants, Material *material) {
+    const int maps[4] = { MATERIAL_MAP_ALBEDO, MATERIAL_MAP_NORMAL, MATERIAL_MAP_METALNESS, MATERIAL_MAP_EMISSION };
+    const PbrFeature features[4] = { PBR_ALBEDO_MAP, PBR_NORMAL_MAP, PBR_MRA_MAP, PBR_EMISSIVE_MAP };
+
+    // raylib's default white texture stands in for a missing map, it adds nothing to sample
+    unsigned int mask = 0;
+    for (int i = 0; i < 4; i++) {
+        unsigned int id = material->maps[maps[i]].texture.id;
+        if (id != 0 && id != rlGetTextureIdDefault()) mask |= features[i];
+    }
+
+    ShaderVariant *variant = GetShaderVariant(variants, mask);
+    if (variant != NULL) material->shader = variant->shader;
+}
+
+static BoundingBox GetModelDrawBounds(Model model, Matrix transform) {
+    BoundingBox bounds = { { INFINITY, INFINITY, INFINITY }, { -INFINITY, -INFINITY, -INFINITY } };
+    for (int i = 0; i < model.meshCount; i++) {
+        BoundingBox box = GetMeshBoundingBox(model.meshes[i]);
+        for (int k = 0; k < 8; k++) {
+            Vector3 corner = { (k & 1) ? box.max.x : box.min.x, (k & 2) ? box.max.y : box.min.y, (k & 4) ? box.max.z : box.min.z };
+            corner = Vector3Transform(corner, transform);
+            bounds.min = Vector3Min(bounds.min, corner);
+            bounds.max = Vector3Max(bounds.max, corner);
+        }
+    }
+    return bounds;
+}
+
+static Model LoadSceneModel(const ScenePack *pack, const char *fileName) {
+    if (HasScenePackModel(pack, fileName)) return LoadScenePackModel(pack, fileName);
+    return LoadModelAsync(fileName);
+}
+
+static void UnloadSceneModel(const ScenePack *pack, Model model) {
+    if (IsScenePackModel(pack, model)) UnloadScenePackModel(model);
+    else UnloadModel(model);
+}
+
+static void DrawProfilerOverlay(Rectangle bounds) {
+    GuiPanel(bounds, "Profiler: ms per frame (average), calls  [T] trace");
+
+    float row = 2.2f * GuiGetStyle(DEFAULT, TEXT_SIZE);
+    float y = bounds.y + 1.5f * row;
+    for (int i = 0; i < GetProfileZoneCount() && y + row < bounds.y + bounds.height; i++, y += row) {
+        const ProfileZone *zone = GetProfileZoneAt(i);
+        float indent = 10.0f + 12.0f * zone->depth;
+        GuiLabel((Rectangle){ bounds.x + indent, y, bounds.width * 0.5f, row }, zone->name);
+        GuiLabel((Rectangle){ bounds.x + bounds.width * 0.55f, y, bounds.width * 0.45f, row },
+                TextFormat("%7.3f (%7.3f)  %d", zone->time, zone->average, zone->calls));
+    }
+}
+
+static int RunSimulationBenchmark(int frames, const char *output, int threadCount) {
+    InitJobSystem(threadCount);
+
+    // collision needs the scene, with no GL context to load the glTF files it has to come from the pack
+    ScenePack scenePack = OpenScenePack(SCENE_PACK_FILE);
+    BVH sceneBVH = { 0 };
+    RainHeightmap rainSurface = { 0 };
+    bool collision = HasScenePackModel(&scenePack, CITY_MODEL_PATH "scene.gltf") &&
+        HasScenePackModel(&scenePack, CAR_MODEL_PATH "scene.gltf");
+    if (collision) {
+        Model city = LoadScenePackModelData(&scenePack, CITY_MODEL_PATH "scene.gltf");
+        Model car = LoadScenePackModelData(&scenePack, CAR_MODEL_PATH "scene.gltf");
+        Model sceneModels[2] = { city, car };
+        Matrix sceneTransforms[2] = {
+            GetModelDrawTransform(city, CITY_POSITION, CITY_SCALE),
+            GetModelDrawTransform(car, CAR_POSITION, CAR_SCALE)
+        };
+        sceneBVH = LoadBVHFromModels(sceneModels, sceneTransforms, 2);
+        rainSurface = LoadRainHeightmapData(&sceneBVH, RAIN_HEIGHTMAP_TEXEL, RAIN_HEIGHTMAP_CACHE);
+        UnloadScenePackModel(city);
+        UnloadScenePackModel(car);
+    } else {
+        printf("bench: no %s, the simulation runs without rain collision (run scenebake first)\n", SCENE_PACK_FILE);
+    }
+
+    Vector3 rainSize = { RAIN_BOUND_X, RAIN_BOUND_Y, RAIN_BOUND_Z };
+    Camera camera = GetBenchCamera(0.0f);
+    RainParticles rain = LoadRainParticles(MAX_PARTICLES,
+            Vector3Subtract(camera.position, Vector3Scale(rainSize, 0.5f)),
+            Vector3Add(camera.position, Vector3Scale(rainSize, 0.5f)),
+            BENCH_SEED);
+
+    RainInstance *instances = RL_CALLOC(MAX_PARTICLES, sizeof(RainInstance));
+    Vector3 *impacts = RL_CALLOC(MAX_PARTICLES, sizeof(Vector3));
+    int chunkCounts[RAIN_JOB_CHUNKS] = { 0 };
+    int chunkHits[RAIN_JOB_CHUNKS] = { 0 };
+    int chunkImpacts[RAIN_JOB_CHUNKS] = { 0 };
+    RainCullStats chunkStats[RAIN_JOB_CHUNKS] = { 0 };
+    RainUpdateJob rainJob = { .rain = &rain, .instances = instances, .chunkCounts = chunkCounts,
+        .chunkHits = chunkHits, .chunkStats = chunkStats, .impacts = impacts, .chunkImpacts = chunkImpacts,
+        .surface = (collision) ? &rainSurface : NULL, .keepImpacts = true, .cull = true, .dt = BENCH_TIMESTEP,
+        .steps = 1, .alpha = 1.0f };
+    JobCounter rainCounter = { 0 };
+
+    // totals double as a check that two runs did the same work
+    long long drawn = 0;
+    long long hits = 0;
+    long long splashes = 0;
+
+    const char *stages[] = { "simulate", "compact" };
+    Benchmark bench = LoadBenchmark(frames, stages, 2);
+    while (!IsBenchmarkDone(&bench)) {
+        BeginBenchFrame(&bench);
+
+        camera = GetBenchCamera(bench.frame * BENCH_TIMESTEP);
+        SetRainVolume(&rain, camera.position, rainSize, RAIN_FLOOR);
+        rainJob.lod = (RainLOD){ camera.position, RAIN_LOD_MID, RAIN_LOD_FAR };
+        rainJob.frustum = GetCameraFrustum(camera, (float)screenWidth / (float)screenHeight);
+        JobParallelFor(&rainCounter, rain.count, RAIN_JOB_CHUNK, UpdateRainJob, &rainJob);
+        JobWait(&rainCounter);
+        EndBenchStage(&bench, 0);
+
+        int chunkCount = (rain.count + RAIN_JOB_CHUNK - 1) / RAIN_JOB_CHUNK;
+        drawn += CompactRainInstances(instances, chunkCounts, chunkCount, RAIN_JOB_CHUNK);
+        for (int i = 0; i < chunkCount; i++) {
+            hits += chunkHits[i];
+            splashes += chunkImpacts[i];
+        }
+        EndBenchStage(&bench, 1);
+
+        EndBenchFrame(&bench);
+    }
+
+    PrintBenchmark(&bench, "simulation");
+    printf("bench: drawn %lld, hits %lld, splashes %lld\n", drawn, hits, splashes);
+    bool exported = ExportBenchmark(&bench, output, "simulation", GetJobThreadCount());
+
+    UnloadBenchmark(&bench);
+    RL_FREE(impacts);
+    RL_FREE(instances);
+    UnloadRainParticles(&rain);
+    UnloadRainHeightmap(&rainSurface);
+    UnloadBVH(&sceneBVH);
+    UnloadScenePack(&scenePack);
+    ShutdownJobSystem();
+
+    return (exported) ? 0 : 1;
 }
@@ -0,0 +1,337 @@
+/*
+ * RainAtlas
+ *
+ * Builds the rain streak atlas from the rain streak database
+ * (cave.cs.columbia.edu/repository/Rain), replacing compose.py and the old
+ * texture manager.
+ *
+ * Database images are named cv<view>_v<vertical>_h<horizontal>_osc<osc>.png:
+ * the camera view angle, the light's vertical and horizontal angle and the
+ * drop oscillation. Every value found on an axis gets an index (values
+ * sorted, assumed evenly spaced) and the images are packed into one grid:
+ *
+ *   column = horizontal * oscillations + oscillation
+ *   row    = view * verticals + vertical
+ *
+ * rain.vs picks the cell from the same axes, see SetRainAtlasShader().
+ * Cells are scaled down when the grid would not fit in RAIN_ATLAS_MAX_SIZE.
+ *
+ * The PNGs are decoded and scaled in parallel on the job system, each job
+ * writing straight into its cells of the atlas. The packed atlas is saved
+ * to a versioned cache keyed by the database file names, sizes and dates,
+ * so later launches load one file and decode nothing.
+ *
+ */
+
+#ifndef RAINATLAS_H
+#define RAINATLAS_H
+
+#include "raylib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "jobs.h"
+
+#define RAIN_ATLAS_VERSION 1
+#define RAIN_ATLAS_MAX_SIZE 8192    // largest atlas side, in pixels
+#define RAIN_ATLAS_MAX_VALUES 32    // distinct values per axis
+
+
+// Values of one database parameter, value(i) = first + step * i
+typedef struct RainAtlasAxis {
+    float first;
+    float step;
+    int count;
+} RainAtlasAxis;
+
+typedef struct RainAtlas {
+    RainAtlasAxis view;         // cv, camera view angle
+    RainAtlasAxis vertical;     // v, light vertical angle
+    RainAtlasAxis horizontal;   // h, light horizontal angle
+    RainAtlasAxis oscillation;  // osc, drop shape
+    int cellWidth;
+    int cellHeight;
+    Texture2D texture;          // columns = horizontal * oscillation, rows = view * vertical
+} RainAtlas;
+
+// Cache file layout: header followed by the RGBA pixels of the atlas
+typedef struct RainAtlasHeader {
+    char magic[4];              // "RATL"
+    int version;
+    uint64_t key;
+    RainAtlasAxis view, vertical, horizontal, oscillation;
+    int cellWidth;
+    int cellHeight;
+} RainAtlasHeader;
+
+// One database image and the cell it goes to
+typedef struct RainAtlasSource {
+    const char *path;
+    int values[4];              // cv, v, h, osc as in the file name
+    int column;
+    int row;
+} RainAtlasSource;
+
+typedef struct RainAtlasBuild {
+    RainAtlasSource *sources;
+    RainAtlas *atlas;
+    unsigned char *pixels;      // RGBA atlas
+    int width;                  // atlas width in pixels
+} RainAtlasBuild;
+
+
+static int CompareRainAtlasPaths(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static int CompareRainAtlasValues(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+// Axis over the distinct sorted values, index of v is (v - first) / step
+static RainAtlasAxis MakeRainAtlasAxis(const int *values, int count) {
+    RainAtlasAxis axis = { (float)values[0], 1.0f, count };
+    if (count > 1) axis.step = (float)(values[count - 1] - values[0]) / (count - 1);
+
+    for (int i = 1; i < count; i++) {
+        if (values[i] - values[i - 1] != (int)axis.step) {
+            printf("rain atlas: values %d..%d are not evenly spaced, cells will be picked approximately\n",
+                    values[0], values[count - 1]);
+            break;
+        }
+    }
+    return axis;
+}
+
+static int GetRainAtlasIndex(const int *values, int count, int value) {
+    for (int i = 0; i < count; i++) {
+        if (values[i] == value) return i;
+    }
+    return 0;
+}
+
+// FNV-1a over what the atlas is built from, no image is opened
+static uint64_t HashRainAtlasSources(const RainAtlasSource *sources, int count) {
+    uint64_t hash = 14695981039346656037ull;
+    for (int i = 0; i < count; i++) {
+        for (const char *c = GetFileName(sources[i].path); *c != '\0'; c++) {
+            hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+        }
+        hash = (hash ^ (uint64_t)GetFileLength(sources[i].path)) * 1099511628211ull;
+        hash = (hash ^ (uint64_t)GetFileModTime(sources[i].path)) * 1099511628211ull;
+    }
+    hash = (hash ^ RAIN_ATLAS_MAX_SIZE) * 1099511628211ull;
+    return (hash ^ RAIN_ATLAS_VERSION) * 1099511628211ull;
+}
+
+static void DecodeRainAtlasJob(void *data, int begin, int end) {
+    RainAtlasBuild *build = (RainAtlasBuild *)data;
+    int cellWidth = build->atlas->cellWidth;
+    int cellHeight = build->atlas->cellHeight;
+
+    for (int i = begin; i < end; i++) {
+        RainAtlasSource *source = &build->sources[i];
+        Image image = LoadImage(source->path);
+        if (image.data == NULL) continue;
+
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        if (image.width != cellWidth || image.height != cellHeight) ImageResize(&image, cellWidth, cellHeight);
+
+        // cells never overlap, so jobs can write the atlas at the same time
+        unsigned char *cell = build->pixels + ((size_t)source->row * cellHeight * build->width + source->column * cellWidth) * 4;
+        for (int y = 0; y < cellHeight; y++) {
+            memcpy(cell + (size_t)y * build->width * 4, (unsigned char *)image.data + (size_t)y * cellWidth * 4, cellWidth * 4);
+        }
+        UnloadImage(image);
+    }
+}
+
+static bool LoadRainAtlasCache(const char *fileName, uint64_t key, RainAtlas *atlas, Image *image) {
+    if (!FileExists(fileName)) return false;
+
+    int size = 0;
+    unsigned char *data = LoadFileData(fileName, &size);
+    if (data == NULL) return false;
+
+    RainAtlasHeader header;
+    bool valid = (size >= (int)sizeof(header));
+    if (valid) {
+        memcpy(&header, data, sizeof(header));
+        int width = header.cellWidth * header.horizontal.count * header.oscillation.count;
+        int height = header.cellHeight * header.view.count * header.vertical.count;
+        valid = (memcmp(header.magic, "RATL", 4) == 0) && (header.version == RAIN_ATLAS_VERSION) && (header.key == key) &&
+            (width > 0) && (height > 0) && ((size_t)size == sizeof(header) + (size_t)width * height * 4);
+
+        if (valid) {
+            atlas->view = header.view;
+            atlas->vertical = header.vertical;
+            atlas->horizontal = header.horizontal;
+            atlas->oscillation = header.oscillation;
+            atlas->cellWidth = header.cellWidth;
+            atlas->cellHeight = header.cellHeight;
+
+            *image = (Image){ RL_MALLOC((size_t)width * height * 4), width, height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+            memcpy(image->data, data + sizeof(header), (size_t)width * height * 4);
+        }
+    }
+
+    UnloadFileData(data);
+    return valid;
+}
+
+static void SaveRainAtlasCache(const char *fileName, uint64_t key, const RainAtlas *atlas, Image image) {
+    RainAtlasHeader header = { { 'R', 'A', 'T', 'L' }, RAIN_ATLAS_VERSION, key, atlas->view, atlas->vertical,
+        atlas->horizontal, atlas->oscillation, atlas->cellWidth, atlas->cellHeight };
+    size_t pixelsSize = (size_t)image.width * image.height * 4;
+
+    unsigned char *data = malloc(sizeof(header) + pixelsSize);
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), image.data, pixelsSize);
+    if (!SaveFileData(fileName, data, (int)(sizeof(header) + pixelsSize))) {
+        printf("rain atlas: could not write cache %s\n", fileName);
+    }
+    free(data);
+}
+
+static Texture2D LoadRainAtlasTexture(Image image) {
+    Texture2D texture = LoadTextureFromImage(image);
+    SetTextureFilter(texture, TEXTURE_FILTER_BILINEAR);
+    SetTextureWrap(texture, TEXTURE_WRAP_CLAMP);
+    return texture;
+}
+
+// Build (or load from cacheFileName) the atlas of every streak image under databasePath
+// The texture id is 0 when there is no database
+RainAtlas LoadRainAtlas(const char *databasePath, const char *cacheFileName) {
+    RainAtlas atlas = { 0 };
+    if (!DirectoryExists(databasePath)) return atlas;
+
+    // sorted so the cache key does not depend on directory order
+    FilePathList files = LoadDirectoryFilesEx(databasePath, ".png", true);
+    qsort(files.paths, files.count, sizeof(char *), CompareRainAtlasPaths);
+
+    RainAtlasSource *sources = malloc(((files.count > 0) ? files.count : 1) * sizeof(RainAtlasSource));
+    int sourceCount = 0;
+    int axisValues[4][RAIN_ATLAS_MAX_VALUES];
+    int axisCount[4] = { 0 };
+
+    for (unsigned int i = 0; i < files.count; i++) {
+        RainAtlasSource source = { .path = files.paths[i] };
+        char end = 0;
+        if (sscanf(GetFileName(files.paths[i]), "cv%d_v%d_h%d_osc%d.pn%c", &source.values[0], &source.values[1],
+                    &source.values[2], &source.values[3], &end) != 5) continue;
+
+        bool fits = true;
+        for (int a = 0; a < 4; a++) {
+            int n = 0;
+            while (n < axisCount[a] && axisValues[a][n] != source.values[a]) n++;
+            if (n == axisCount[a]) {
+                if (n == RAIN_ATLAS_MAX_VALUES) { fits = false; break; }
+                axisValues[a][axisCount[a]++] = source.values[a];
+            }
+        }
+        if (fits) sources[sourceCount++] = source;
+    }
+
+    if (sourceCount == 0) {
+        printf("rain atlas: no streak images in %s\n", databasePath);
+        free(sources);
+        UnloadDirectoryFiles(files);
+        return atlas;
+    }
+
+    for (int a = 0; a < 4; a++) qsort(axisValues[a], axisCount[a], sizeof(int), CompareRainAtlasValues);
+    atlas.view = MakeRainAtlasAxis(axisValues[0], axisCount[0]);
+    atlas.vertical = MakeRainAtlasAxis(axisValues[1], axisCount[1]);
+    atlas.horizontal = MakeRainAtlasAxis(axisValues[2], axisCount[2]);
+    atlas.oscillation = MakeRainAtlasAxis(axisValues[3], axisCount[3]);
+
+    for (int i = 0; i < sourceCount; i++) {
+        int *v = sources[i].values;
+        sources[i].column = GetRainAtlasIndex(axisValues[2], axisCount[2], v[2]) * axisCount[3] +
+            GetRainAtlasIndex(axisValues[3], axisCount[3], v[3]);
+        sources[i].row = GetRainAtlasIndex(axisValues[0], axisCount[0], v[0]) * axisCount[1] +
+            GetRainAtlasIndex(axisValues[1], axisCount[1], v[1]);
+    }
+
+    int columns = atlas.horizontal.count * atlas.oscillation.count;
+    int rows = atlas.view.count * atlas.vertical.count;
+    uint64_t key = HashRainAtlasSources(sources, sourceCount);
+
+    Image image = { 0 };
+    if (LoadRainAtlasCache(cacheFileName, key, &atlas, &image)) {
+        printf("rain atlas: %d x %d cells from %s\n", columns, rows, cacheFileName);
+    } else {
+        double start = GetTime();
+
+        // every cell is the size of the first image, shrunk to fit the atlas
+        Image first = LoadImage(sources[0].path);
+        atlas.cellWidth = (first.width > 0) ? first.width : 1;
+        atlas.cellHeight = (first.height > 0) ? first.height : 1;
+        UnloadImage(first);
+        if (atlas.cellWidth * columns > RAIN_ATLAS_MAX_SIZE) atlas.cellWidth = RAIN_ATLAS_MAX_SIZE / columns;
+        if (atlas.cellHeight * rows > RAIN_ATLAS_MAX_SIZE) atlas.cellHeight = RAIN_ATLAS_MAX_SIZE / rows;
+
+        int width = atlas.cellWidth * columns;
+        int height = atlas.cellHeight * rows;
+        image = (Image){ RL_CALLOC((size_t)width * height, 4), width, height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+
+        RainAtlasBuild build = { sources, &atlas, image.data, width };
+        JobCounter counter = { 0 };
+        JobParallelFor(&counter, sourceCount, 4, DecodeRainAtlasJob, &build);
+        JobWait(&counter);
+
+        printf("rain atlas: %d images into %d x %d cells of %d x %d in %.1f ms\n", sourceCount, columns, rows,
+                atlas.cellWidth, atlas.cellHeight, (GetTime() - start) * 1000.0);
+        SaveRainAtlasCache(cacheFileName, key, &atlas, image);
+    }
+
+    atlas.texture = LoadRainAtlasTexture(image);
+    UnloadImage(image);
+    free(sources);
+    UnloadDirectoryFiles(files);
+    return atlas;
+}
+
+// Atlas of one already composed row of horizontal slices, cv<view>_v<vertical>_h-_osc<osc>.png
+// (the format compose.py wrote), used when the database is not available
+RainAtlas LoadRainAtlasRow(const char *fileName, RainAtlasAxis horizontal) {
+    RainAtlas atlas = { 0 };
+    int view = 0, vertical = 0, oscillation = 0;
+    if (sscanf(GetFileName(fileName), "cv%d_v%d_h-_osc%d", &view, &vertical, &oscillation) != 3) {
+        printf("rain atlas: %s is not a composed streak row\n", fileName);
+    }
+
+    Image image = LoadImage(fileName);
+    if (image.data == NULL) return atlas;
+
+    atlas.view = (RainAtlasAxis){ (float)view, 1.0f, 1 };
+    atlas.vertical = (RainAtlasAxis){ (float)vertical, 1.0f, 1 };
+    atlas.horizontal = horizontal;
+    atlas.oscillation = (RainAtlasAxis){ (float)oscillation, 1.0f, 1 };
+    atlas.cellWidth = image.width / horizontal.count;
+    atlas.cellHeight = image.height;
+    atlas.texture = LoadRainAtlasTexture(image);
+    UnloadImage(image);
+    return atlas;
+}
+
+void UnloadRainAtlas(RainAtlas *atlas) {
+    UnloadTexture(atlas->texture);
+    *atlas = (RainAtlas){ 0 };
+}
+
+// Axes for rain.vs to find cells with, as vec3(first, step, count)
+void SetRainAtlasShader(const RainAtlas *atlas, Shader shader) {
+    const RainAtlasAxis *axes[4] = { &atlas->view, &atlas->vertical, &atlas->horizontal, &atlas->oscillation };
+    const char *names[4] = { "streakView", "streakVertical", "streakHorizontal", "streakOscillation" };
+
+    for (int i = 0; i < 4; i++) {
+        Vector3 axis = { axes[i]->first, axes[i]->step, (float)axes[i]->count };
+        SetShaderValue(shader, GetShaderLocation(shader, names[i]), &axis, SHADER_UNIFORM_VEC3);
+    }
+}
+
+
+#endif
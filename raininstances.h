@@ -0,0 +1,402 @@
+/*
+ * RainInstances
+ *
+ * Instanced draw path for rain drops. DrawMeshInstanced() uploads a full
+ * 64 byte Matrix per drop, but rain.vs billboards every drop itself and only
+ * needs its position, so each instance here is a single packed vec4:
+ *
+ *   xyz: drop position (world space)
+ *   w:   per drop random value in [0, 1), used to vary the streak
+ *
+ * The drop quad and the instance stream are bound in one vertex array, and
+ * the instance stream is updated in place every frame.
+ *
+ * Only part of the simulated drops become instances: drops outside of the
+ * camera frustum are culled (a whole column of drops at a time when
+ * possible, otherwise 4 drops at a time with SSE), and the rest are thinned
+ * out by distance band from the camera (RainLOD). rain.vs brightens the
+ * survivors by the same factor so far rain keeps its overall density.
+ * Instances are emitted per job chunk into the chunk's own slice of the
+ * stream, then the slices are compacted before upload.
+ *
+ * Drops are emitted at alpha between their previous and current simulated
+ * position, so the rain moves smoothly when frames and simulation steps
+ * don't line up.
+ *
+ */
+
+#ifndef RAININSTANCES_H
+#define RAININSTANCES_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "particles.h"
+#include "frustum.h"
+
+// Share of drops kept past each LOD distance, rain.vs must use the same values
+#define RAIN_LOD_MID_DENSITY 0.5f
+#define RAIN_LOD_FAR_DENSITY 0.25f
+
+// Culling radius of a drop, half of the longest streak drawn by rain.vs
+#define RAIN_DROP_RADIUS 0.6f
+
+// One rain drop as seen by rain.vs, 16 bytes
+typedef struct RainInstance {
+    float x, y, z;
+    float seed;
+} RainInstance;
+
+// Distance bands used to thin out far drops
+typedef struct RainLOD {
+    Vector3 camera;
+    float midDistance;          // horizontal distance where RAIN_LOD_MID_DENSITY starts
+    float farDistance;          // horizontal distance where RAIN_LOD_FAR_DENSITY starts
+} RainLOD;
+
+// Where the simulated drops went this frame
+typedef struct RainCullStats {
+    int visible;                // drawn
+    int culled;                 // outside of the view frustum
+    int thinned;                // inside, but dropped by distance LOD
+} RainCullStats;
+
+typedef struct RainInstanceBuffer {
+    int capacity;
+    RainInstance *instances;    // cpu side stream, filled by the simulation
+
+    unsigned int vaoId;
+    unsigned int quadVboId;     // quad corner positions and texcoords
+    unsigned int indexVboId;
+    unsigned int instanceVboId;
+} RainInstanceBuffer;
+
+
+// Pack a drop seed into the [0, 1) random value stored in the instance
+static inline float RainInstanceSeed(uint32_t seed) {
+    return (seed >> 8) * (1.0f / 16777216.0f);
+}
+
+// Cull block [begin, end) (one column of drops, so spatially close) against
+// the frustum and thin it out by distance, writes survivors to out
+// frustum may be NULL when the whole block is known to be inside it
+static int EmitRainBlock(const RainParticles *ps, int begin, int end, float alpha, RainLOD lod,
+        const Frustum *frustum, RainInstance *out, RainCullStats *stats) {
+    float mid2 = lod.midDistance * lod.midDistance;
+    float far2 = lod.farDistance * lod.farDistance;
+    int planeCount = (frustum != NULL) ? 6 : 0;
+    int count = 0;
+    int i = begin;
+
+#if PARTICLE_SIMD_WIDTH > 1
+    static const int bitCount[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+    __m128 camx = _mm_set1_ps(lod.camera.x);
+    __m128 camz = _mm_set1_ps(lod.camera.z);
+    __m128 mid2v = _mm_set1_ps(mid2);
+    __m128 far2v = _mm_set1_ps(far2);
+    __m128 midDensity = _mm_set1_ps(RAIN_LOD_MID_DENSITY);
+    __m128 farDensity = _mm_set1_ps(RAIN_LOD_FAR_DENSITY);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 keepScale = _mm_set1_ps(1.0f / 256.0f);
+    __m128 t = _mm_set1_ps(alpha);
+    __m128i lowBits = _mm_set1_epi32(0xff);
+
+    __m128 pa[6], pb[6], pc[6], pd[6];
+    for (int p = 0; p < planeCount; p++) {
+        pa[p] = _mm_set1_ps(frustum->planes[p].x);
+        pb[p] = _mm_set1_ps(frustum->planes[p].y);
+        pc[p] = _mm_set1_ps(frustum->planes[p].z);
+        pd[p] = _mm_set1_ps(frustum->planes[p].w + RAIN_DROP_RADIUS);
+    }
+
+    for (; i + 4 <= end; i += 4) {
+        __m128 ox = _mm_loadu_ps(ps->ox + i);
+        __m128 oy = _mm_loadu_ps(ps->oy + i);
+        __m128 oz = _mm_loadu_ps(ps->oz + i);
+        __m128 x = _mm_add_ps(ox, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(ps->px + i), ox), t));
+        __m128 y = _mm_add_ps(oy, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(ps->py + i), oy), t));
+        __m128 z = _mm_add_ps(oz, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(ps->pz + i), oz), t));
+
+        __m128 visible = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < planeCount; p++) {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pa[p], x), _mm_mul_ps(pb[p], y)),
+                    _mm_add_ps(_mm_mul_ps(pc[p], z), pd[p]));
+            visible = _mm_and_ps(visible, _mm_cmpge_ps(dist, zero));
+        }
+
+        // density of the distance band, SSE2 has no blend so select with masks
+        __m128 dx = _mm_sub_ps(x, camx);
+        __m128 dz = _mm_sub_ps(z, camz);
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz));
+        __m128 isMid = _mm_cmpge_ps(d2, mid2v);
+        __m128 isFar = _mm_cmpge_ps(d2, far2v);
+        __m128 density = _mm_or_ps(_mm_and_ps(isMid, midDensity), _mm_andnot_ps(isMid, one));
+        density = _mm_or_ps(_mm_and_ps(isFar, farDensity), _mm_andnot_ps(isFar, density));
+
+        __m128i seeds = _mm_loadu_si128((const __m128i *)(ps->seed + i));
+        __m128 keep = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(seeds, lowBits)), keepScale);
+
+        int visibleBits = _mm_movemask_ps(visible);
+        int keepBits = _mm_movemask_ps(_mm_cmplt_ps(keep, density));
+        stats->culled += 4 - bitCount[visibleBits];
+        stats->thinned += bitCount[visibleBits & ~keepBits];
+
+        int write = visibleBits & keepBits;
+        if (write) {
+            float lanes[3][4];
+            _mm_storeu_ps(lanes[0], x);
+            _mm_storeu_ps(lanes[1], y);
+            _mm_storeu_ps(lanes[2], z);
+            for (int lane = 0; write; lane++, write >>= 1) {
+                if (write & 1) {
+                    out[count++] = (RainInstance){ lanes[0][lane], lanes[1][lane], lanes[2][lane],
+                        RainInstanceSeed(ps->seed[i + lane]) };
+                }
+            }
+        }
+    }
+#endif
+
+    for (; i < end; i++) {
+        Vector3 p = GetRainDropPosition(ps, i, alpha);
+        if (planeCount > 0 && !FrustumContainsSphere(frustum, p, RAIN_DROP_RADIUS)) {
+            stats->culled++;
+            continue;
+        }
+
+        float dx = p.x - lod.camera.x;
+        float dz = p.z - lod.camera.z;
+        float d2 = dx * dx + dz * dz;
+
+        // low seed bits decide which drops survive, the high bits are the instance seed
+        float keep = (ps->seed[i] & 0xff) * (1.0f / 256.0f);
+        float density = (d2 < mid2) ? 1.0f : (d2 < far2) ? RAIN_LOD_MID_DENSITY : RAIN_LOD_FAR_DENSITY;
+        if (keep >= density) {
+            stats->thinned++;
+            continue;
+        }
+
+        out[count++] = (RainInstance){ p.x, p.y, p.z, RainInstanceSeed(ps->seed[i]) };
+    }
+
+    return count;
+}
+
+// Grow box by the points (xs, ys, zs)[begin, end)
+static BoundingBox GrowRainBlockBounds(BoundingBox box, const float *xs, const float *ys, const float *zs, int begin, int end) {
+    int i = begin;
+
+#if PARTICLE_SIMD_WIDTH > 1
+    if (end - begin >= 4) {
+        __m128 minx = _mm_loadu_ps(xs + i), maxx = minx;
+        __m128 miny = _mm_loadu_ps(ys + i), maxy = miny;
+        __m128 minz = _mm_loadu_ps(zs + i), maxz = minz;
+        for (i += 4; i + 4 <= end; i += 4) {
+            __m128 x = _mm_loadu_ps(xs + i);
+            __m128 y = _mm_loadu_ps(ys + i);
+            __m128 z = _mm_loadu_ps(zs + i);
+            minx = _mm_min_ps(minx, x); maxx = _mm_max_ps(maxx, x);
+            miny = _mm_min_ps(miny, y); maxy = _mm_max_ps(maxy, y);
+            minz = _mm_min_ps(minz, z); maxz = _mm_max_ps(maxz, z);
+        }
+
+        float lanes[6][4];
+        _mm_storeu_ps(lanes[0], minx); _mm_storeu_ps(lanes[1], maxx);
+        _mm_storeu_ps(lanes[2], miny); _mm_storeu_ps(lanes[3], maxy);
+        _mm_storeu_ps(lanes[4], minz); _mm_storeu_ps(lanes[5], maxz);
+        for (int l = 0; l < 4; l++) {
+            box.min = Vector3Min(box.min, (Vector3){ lanes[0][l], lanes[2][l], lanes[4][l] });
+            box.max = Vector3Max(box.max, (Vector3){ lanes[1][l], lanes[3][l], lanes[5][l] });
+        }
+    }
+#endif
+
+    for (; i < end; i++) {
+        Vector3 p = { xs[i], ys[i], zs[i] };
+        box.min = Vector3Min(box.min, p);
+        box.max = Vector3Max(box.max, p);
+    }
+    return box;
+}
+
+// Bounds of the drops in [begin, end) anywhere between their previous and current position,
+// grown by the drop radius
+static BoundingBox GetRainBlockBounds(const RainParticles *ps, int begin, int end) {
+    BoundingBox box = { { ps->px[begin], ps->py[begin], ps->pz[begin] }, { ps->px[begin], ps->py[begin], ps->pz[begin] } };
+    box = GrowRainBlockBounds(box, ps->px, ps->py, ps->pz, begin, end);
+    box = GrowRainBlockBounds(box, ps->ox, ps->oy, ps->oz, begin, end);
+
+    Vector3 radius = { RAIN_DROP_RADIUS, RAIN_DROP_RADIUS, RAIN_DROP_RADIUS };
+    box.min = Vector3Subtract(box.min, radius);
+    box.max = Vector3Add(box.max, radius);
+    return box;
+}
+
+// Write the drops of [begin, end) that are inside frustum and survive LOD
+// thinning to out, frustum may be NULL to skip culling
+// alpha places drops between their previous (0) and current (1) simulated position
+// Returns the number of instances written, stats are accumulated
+int EmitRainInstances(const RainParticles *ps, int begin, int end, float alpha, RainLOD lod,
+        const Frustum *frustum, RainInstance *out, RainCullStats *stats) {
+    if (end > ps->count) end = ps->count;
+    int count = 0;
+
+    // whole columns are tested first, only the ones crossing the frustum are tested per drop
+    for (int block = begin; block < end; block += RAIN_COLUMN_DROPS) {
+        int blockEnd = (block + RAIN_COLUMN_DROPS < end) ? block + RAIN_COLUMN_DROPS : end;
+
+        FrustumTest test = FRUSTUM_INSIDE;
+        if (frustum != NULL) test = FrustumTestBox(frustum, GetRainBlockBounds(ps, block, blockEnd));
+
+        if (test == FRUSTUM_OUTSIDE) {
+            stats->culled += blockEnd - block;
+            continue;
+        }
+        count += EmitRainBlock(ps, block, blockEnd, alpha, lod, (test == FRUSTUM_INTERSECTS) ? frustum : NULL,
+                out + count, stats);
+    }
+
+    stats->visible += count;
+    return count;
+}
+
+// Move per chunk slices of instances (chunk i starts at i * chunkSize) together
+// Returns the total number of instances
+int CompactRainInstances(RainInstance *instances, const int *chunkCounts, int chunkCount, int chunkSize) {
+    int total = 0;
+    for (int i = 0; i < chunkCount; i++) {
+        if (total != i * chunkSize && chunkCounts[i] > 0) {
+            memmove(instances + total, instances + i * chunkSize, chunkCounts[i] * sizeof(RainInstance));
+        }
+        total += chunkCounts[i];
+    }
+    return total;
+}
+
+// Create the vertex array for shader, with room for capacity instances
+// Shader must declare vertexPosition, vertexTexCoord and instanceData attributes
+RainInstanceBuffer LoadRainInstanceBuffer(int capacity, Shader shader) {
+    RainInstanceBuffer buf = { 0 };
+    buf.capacity = capacity;
+    buf.instances = RL_CALLOC(capacity, sizeof(RainInstance));
+
+    // unit quad in the xy plane, rain.vs turns it to face the camera
+    // x, y, z, u, v
+    static const float quad[] = {
+        -0.5f,  0.5f, 0.0f,  0.0f, 0.0f,
+         0.5f,  0.5f, 0.0f,  1.0f, 0.0f,
+         0.5f, -0.5f, 0.0f,  1.0f, 1.0f,
+        -0.5f, -0.5f, 0.0f,  0.0f, 1.0f,
+    };
+    static const unsigned short indices[] = { 0, 2, 1, 0, 3, 2 };
+
+    int positionLoc = shader.locs[SHADER_LOC_VERTEX_POSITION];
+    int texcoordLoc = shader.locs[SHADER_LOC_VERTEX_TEXCOORD01];
+    int instanceLoc = GetShaderLocationAttrib(shader, "instanceData");
+
+    buf.vaoId = rlLoadVertexArray();
+    rlEnableVertexArray(buf.vaoId);
+
+    buf.quadVboId = rlLoadVertexBuffer(quad, sizeof(quad), false);
+    rlSetVertexAttribute(positionLoc, 3, RL_FLOAT, false, 5 * sizeof(float), 0);
+    rlEnableVertexAttribute(positionLoc);
+    rlSetVertexAttribute(texcoordLoc, 2, RL_FLOAT, false, 5 * sizeof(float), 3 * sizeof(float));
+    rlEnableVertexAttribute(texcoordLoc);
+
+    buf.instanceVboId = rlLoadVertexBuffer(buf.instances, capacity * sizeof(RainInstance), true);
+    if (instanceLoc >= 0) {
+        rlSetVertexAttribute(instanceLoc, 4, RL_FLOAT, false, sizeof(RainInstance), 0);
+        rlEnableVertexAttribute(instanceLoc);
+        rlSetVertexAttributeDivisor(instanceLoc, 1);
+    }
+
+    buf.indexVboId = rlLoadVertexBufferElement(indices, sizeof(indices), false);
+
+    rlDisableVertexArray();
+
+    if (instanceLoc < 0) printf("rain shader has no instanceData attribute\n");
+
+    return buf;
+}
+
+void UnloadRainInstanceBuffer(RainInstanceBuffer *buf) {
+    rlUnloadVertexArray(buf->vaoId);
+    rlUnloadVertexBuffer(buf->quadVboId);
+    rlUnloadVertexBuffer(buf->indexVboId);
+    rlUnloadVertexBuffer(buf->instanceVboId);
+    RL_FREE(buf->instances);
+    *buf = (RainInstanceBuffer){ 0 };
+}
+
+// Upload the first count instances
+void UpdateRainInstanceBuffer(RainInstanceBuffer *buf, int count) {
+    if (count > buf->capacity) count = buf->capacity;
+    if (count <= 0) return;
+    rlUpdateVertexBuffer(buf->instanceVboId, buf->instances, count * sizeof(RainInstance), 0);
+}
+
+// Draw count instances with the material shader and albedo texture
+// NOTE: Must be called inside BeginMode3D(), like DrawMeshInstanced()
+void DrawRainInstances(RainInstanceBuffer *buf, Material material, int count) {
+    if (count > buf->capacity) count = buf->capacity;
+    if (count <= 0) return;
+
+    Shader shader = material.shader;
+    rlEnableShader(shader.id);
+
+    if (shader.locs[SHADER_LOC_COLOR_DIFFUSE] != -1) {
+        Vector4 color = ColorNormalize(material.maps[MATERIAL_MAP_DIFFUSE].color);
+        rlSetUniform(shader.locs[SHADER_LOC_COLOR_DIFFUSE], &color, SHADER_UNIFORM_VEC4, 1);
+    }
+
+    // drops are already in world space
+    Matrix mvp = MatrixMultiply(MatrixMultiply(rlGetMatrixTransform(), rlGetMatrixModelview()), rlGetMatrixProjection());
+    rlSetUniformMatrix(shader.locs[SHADER_LOC_MATRIX_MVP], mvp);
+
+    int slot = 0;
+    rlActiveTextureSlot(slot);
+    rlEnableTexture(material.maps[MATERIAL_MAP_DIFFUSE].texture.id);
+    rlSetUniform(shader.locs[SHADER_LOC_MAP_DIFFUSE], &slot, SHADER_UNIFORM_INT, 1);
+
+    // surface heights the streaks are clipped against, sampled in rain.vs
+    bool heightMap = (shader.locs[SHADER_LOC_MAP_HEIGHT] != -1) && (material.maps[MATERIAL_MAP_HEIGHT].texture.id > 0);
+    if (heightMap) {
+        slot = 1;
+        rlActiveTextureSlot(slot);
+        rlEnableTexture(material.maps[MATERIAL_MAP_HEIGHT].texture.id);
+        rlSetUniform(shader.locs[SHADER_LOC_MAP_HEIGHT], &slot, SHADER_UNIFORM_INT, 1);
+    }
+
+    // scene depth the streaks are tested against when drawn at reduced resolution, see raintarget.h
+    bool sceneDepth = (shader.locs[SHADER_LOC_MAP_OCCLUSION] != -1) && (material.maps[MATERIAL_MAP_OCCLUSION].texture.id > 0);
+    if (sceneDepth) {
+        slot = 2;
+        rlActiveTextureSlot(slot);
+        rlEnableTexture(material.maps[MATERIAL_MAP_OCCLUSION].texture.id);
+        rlSetUniform(shader.locs[SHADER_LOC_MAP_OCCLUSION], &slot, SHADER_UNIFORM_INT, 1);
+    }
+
+    rlEnableVertexArray(buf->vaoId);
+    rlDrawVertexArrayElementsInstanced(0, 6, 0, count);
+    rlDisableVertexArray();
+
+    if (sceneDepth) {
+        rlActiveTextureSlot(2);
+        rlDisableTexture();
+    }
+    if (heightMap) {
+        rlActiveTextureSlot(1);
+        rlDisableTexture();
+    }
+    rlActiveTextureSlot(0);
+    rlDisableTexture();
+    rlDisableShader();
+}
+
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * RainTarget
+ *
+ * Reduced resolution rain. Thousands of thin additive quads cover the same
+ * pixels many times over and rain.fs blends up to five streaks for each, so at high
+ * resolutions (or on a software rasterizer) the rain is bound by fill rate.
+ * With a divisor of 2 or 4 the rain is drawn into its own render texture at
+ * half or quarter resolution and composited over the scene afterwards.
+ *
+ * The scene is then drawn first into a full resolution render texture whose
+ * depth is a texture. rain.fs tests its fragments against that depth itself
+ * (sampled at the centers of the reduced pixels), and the upsample shader
+ * blends the four reduced pixels around each full resolution one weighted by
+ * how close the scene depth under them is to the depth under the pixel, so
+ * rain does not bleed over the edges of buildings and the car.
+ *
+ * NOTE: render textures have no MSAA, the scene loses it while the rain is
+ * drawn at reduced resolution.
+ *
+ */
+
+#ifndef RAINTARGET_H
+#define RAINTARGET_H
+
+#include "raylib.h"
+#include "rlgl.h"
+#include <stdio.h>
+
+
+typedef struct RainTarget {
+    int divisor;                // screen pixels per rain pixel along each axis, 1 draws rain straight into the frame
+    int width;                  // of the screen it was made for
+    int height;
+    RenderTexture2D scene;      // full resolution, depth as a texture
+    RenderTexture2D rain;       // reduced resolution, rain only
+    Shader upsample;            // not owned
+    int sceneDepthLoc;
+} RainTarget;
+
+
+// Render texture whose depth attachment can be sampled
+static RenderTexture2D LoadDepthRenderTexture(int width, int height) {
+    RenderTexture2D target = { 0 };
+    target.id = rlLoadFramebuffer();
+    if (target.id == 0) return target;
+
+    rlEnableFramebuffer(target.id);
+    target.texture = (Texture2D){ rlLoadTexture(NULL, width, height, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, 1),
+        width, height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+    target.depth = (Texture2D){ rlLoadTextureDepth(width, height, false), width, height, 1, 19 };
+    rlFramebufferAttach(target.id, target.texture.id, RL_ATTACHMENT_COLOR_CHANNEL0, RL_ATTACHMENT_TEXTURE2D, 0);
+    rlFramebufferAttach(target.id, target.depth.id, RL_ATTACHMENT_DEPTH, RL_ATTACHMENT_TEXTURE2D, 0);
+    bool complete = rlFramebufferComplete(target.id);
+    rlDisableFramebuffer();
+
+    if (!complete) {
+        UnloadRenderTexture(target);
+        return (RenderTexture2D){ 0 };
+    }
+    return target;
+}
+
+// Targets for rain at 1/divisor of width x height, upsample is shaders/upsample.fs
+// Falls back to a divisor of 1 when depth textures are not supported
+RainTarget LoadRainTarget(int width, int height, int divisor, Shader upsample) {
+    RainTarget target = { 0 };
+    target.divisor = 1;
+    target.width = width;
+    target.height = height;
+    target.upsample = upsample;
+    if (divisor <= 1) return target;
+
+    target.scene = LoadDepthRenderTexture(width, height);
+    if (target.scene.id == 0) {
+        printf("rain target: no depth textures, rain stays at full resolution\n");
+        return target;
+    }
+    target.rain = LoadRenderTexture(width / divisor, height / divisor);
+    target.divisor = divisor;
+
+    // the upsample shader reads the four rain pixels around each screen pixel itself
+    SetTextureFilter(target.rain.texture, TEXTURE_FILTER_POINT);
+
+    Vector2 rainSize = { (float)target.rain.texture.width, (float)target.rain.texture.height };
+    Vector2 clipPlanes = { (float)rlGetCullDistanceNear(), (float)rlGetCullDistanceFar() };
+    target.sceneDepthLoc = GetShaderLocation(upsample, "sceneDepth");
+    SetShaderValue(upsample, GetShaderLocation(upsample, "rainSize"), &rainSize, SHADER_UNIFORM_VEC2);
+    SetShaderValue(upsample, GetShaderLocation(upsample, "clipPlanes"), &clipPlanes, SHADER_UNIFORM_VEC2);
+    return target;
+}
+
+void UnloadRainTarget(RainTarget *target) {
+    if (target->scene.id > 0) UnloadRenderTexture(target->scene);
+    if (target->rain.id > 0) UnloadRenderTexture(target->rain);
+    *target = (RainTarget){ 0 };
+}
+
+bool IsRainTargetReduced(const RainTarget *target) {
+    return target->divisor > 1;
+}
+
+// The target was made for a divisor of divisor on a width x height screen, otherwise it has to be loaded again
+bool IsRainTargetFor(const RainTarget *target, int divisor, int width, int height) {
+    return target->divisor == divisor && target->width == width && target->height == height;
+}
+
+// Scene depth the rain is tested against, an empty texture at full resolution
+Texture2D GetRainTargetDepth(const RainTarget *target) {
+    return target->scene.depth;
+}
+
+// Size of one rain pixel in scene depth texture coordinates, zero at full resolution
+Vector2 GetRainTargetTexel(const RainTarget *target) {
+    if (!IsRainTargetReduced(target)) return (Vector2){ 0.0f, 0.0f };
+    return (Vector2){ 1.0f / target->rain.texture.width, 1.0f / target->rain.texture.height };
+}
+
+// Draw the scene into the full resolution target (nothing to do at full resolution)
+void BeginRainTargetScene(const RainTarget *target) {
+    if (IsRainTargetReduced(target)) BeginTextureMode(target->scene);
+}
+
+void EndRainTargetScene(const RainTarget *target) {
+    if (IsRainTargetReduced(target)) EndTextureMode();
+}
+
+// Draw the rain into the reduced target, cleared to nothing
+void BeginRainTargetRain(const RainTarget *target) {
+    BeginTextureMode(target->rain);
+    ClearBackground(BLANK);
+}
+
+void EndRainTargetRain(const RainTarget *target) {
+    (void)target;
+    EndTextureMode();
+}
+
+// Draw the scene to the screen and the rain upsampled over it
+void DrawRainTarget(const RainTarget *target) {
+    Rectangle screen = { 0.0f, 0.0f, (float)GetScreenWidth(), (float)GetScreenHeight() };
+
+    // render textures are upside down
+    Texture2D scene = target->scene.texture;
+    DrawTexturePro(scene, (Rectangle){ 0.0f, 0.0f, (float)scene.width, -(float)scene.height }, screen,
+            (Vector2){ 0.0f, 0.0f }, 0.0f, WHITE);
+
+    // rain was already weighted by its alpha when it was drawn, so it is added as is
+    // the blend and shader modes flush the batch and drop its extra textures, the depth is bound after both
+    Texture2D rain = target->rain.texture;
+    BeginBlendMode(BLEND_ADD_COLORS);
+    BeginShaderMode(target->upsample);
+    SetShaderValueTexture(target->upsample, target->sceneDepthLoc, target->scene.depth);
+    DrawTexturePro(rain, (Rectangle){ 0.0f, 0.0f, (float)rain.width, -(float)rain.height }, screen,
+            (Vector2){ 0.0f, 0.0f }, 0.0f, WHITE);
+    EndShaderMode();
+    EndBlendMode();
+}
+
+
+#endif
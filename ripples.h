@@ -0,0 +1,291 @@
+/*
+ * Ripples
+ *
+ * Rings spreading from the drops that land in puddles. A height field over
+ * a tile of ground (repeated across all of it, like the puddle mask) is
+ * stepped with the discrete 2D wave equation on the CPU,
+ *
+ *   next = (left + right + up + down) / 2 - previous, times a damping
+ *
+ * written over the previous step in place, rows split across the job
+ * system and each row 4 (SSE) or 8 (AVX) cells at a time. The field wraps
+ * around at its edges so the tile repeats without seams. Values too small
+ * to see are flushed to zero in the same loop, waves die out for good
+ * instead of decaying into denormals.
+ *
+ * Drop impacts are pushed in as a batch before the steps of a frame. The
+ * cost is the same every step whatever the rain does: the whole field is
+ * stepped, at the rate of the rain simulation.
+ *
+ * The slopes of the field go to pbr.fs as a two channel texture (x and z
+ * slope). The field is split into RIPPLE_TILE square tiles, and only the
+ * tiles with waves in them (or that just calmed down) are converted and
+ * uploaded again, each with one sub-image update. To make that a single
+ * copy the slopes are kept tile by tile rather than row by row.
+ *
+ * The slopes take texture unit RIPPLE_TEXTURE_UNIT, past the 8 an ES 2.0
+ * context has to offer. Where the GL version does not promise enough units
+ * the ripples are left out: nothing is simulated or bound, and pbr.fs gets
+ * a rippleStrength of 0.
+ *
+ */
+
+#ifndef RIPPLES_H
+#define RIPPLES_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include "jobs.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define RIPPLE_SIMD_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RIPPLE_SIMD_WIDTH 4
+#else
+#define RIPPLE_SIMD_WIDTH 1
+#endif
+
+#define RIPPLE_SIZE 256                 // cells along each side of the field, power of two
+#define RIPPLE_TILE 32                  // cells along each side of a tile
+#define RIPPLE_TILES_X (RIPPLE_SIZE / RIPPLE_TILE)
+#define RIPPLE_TILES (RIPPLE_TILES_X * RIPPLE_TILES_X)
+#define RIPPLE_SCALE 8.0f               // world units the field covers before it repeats
+#define RIPPLE_DAMPING 0.985f           // per step
+#define RIPPLE_IMPULSE 0.25f            // depth a drop pushes the surface down by
+#define RIPPLE_SLOPE 4.0f               // slope of a height difference of 1 across two cells
+#define RIPPLE_FLUSH 1e-6f              // heights under this are set to zero
+#define RIPPLE_EPSILON 1e-3f            // tiles with no height over this are calm and not uploaded
+#define RIPPLE_GROUND_TOLERANCE 0.1f    // how far over the ground a drop may land and still ripple it
+#define RIPPLE_JOB_ROWS 16
+#define RIPPLE_JOB_TILES 4
+
+#define RIPPLE_TEXTURE_UNIT 15          // after the cluster textures, needs 16 units
+
+
+typedef struct Ripples {
+    float *heights[2];              // RIPPLE_SIZE * RIPPLE_SIZE, row by row
+    int current;                    // heights[current] is the last step, the other one the step before
+    unsigned char *slopes;          // x and z slope per cell, tile by tile
+    bool active[RIPPLE_TILES];      // tiles with waves after the last update
+    bool dirty[RIPPLE_TILES];       // tiles whose slopes changed in the last update
+    Texture2D texture;
+    float height;                   // of the ground, drops landing higher do not ripple it
+    int impulses;                   // drops added since the last update
+    int uploads;                    // tiles uploaded by the last update
+} Ripples;
+
+// Fragment texture units every context of the running GL version has, the GL_MAX_TEXTURE_IMAGE_UNITS minimum
+// NOTE: rlgl does not report the actual limit, older versions are taken at the ES 2.0 minimum
+static int GetRippleTextureUnits(void) {
+    int version = rlGetVersion();
+    return (version == RL_OPENGL_33 || version == RL_OPENGL_43 || version == RL_OPENGL_ES_30) ? 16 : 8;
+}
+
+// Calm field over the ground at height, without a texture (and so without ripples) when there is no unit for it
+Ripples LoadRipples(float height) {
+    Ripples ripples = { 0 };
+    if (GetRippleTextureUnits() <= RIPPLE_TEXTURE_UNIT) {
+        printf("ripples: no texture unit %d on this GL version, the puddles stay calm\n", RIPPLE_TEXTURE_UNIT);
+        return ripples;
+    }
+
+    ripples.heights[0] = RL_CALLOC(RIPPLE_SIZE * RIPPLE_SIZE, sizeof(float));
+    ripples.heights[1] = RL_CALLOC(RIPPLE_SIZE * RIPPLE_SIZE, sizeof(float));
+    ripples.slopes = RL_MALLOC(RIPPLE_SIZE * RIPPLE_SIZE * 2);
+    memset(ripples.slopes, 128, RIPPLE_SIZE * RIPPLE_SIZE * 2);
+    ripples.height = height;
+
+    // flat everywhere, the layout does not matter yet
+    Image flat = { ripples.slopes, RIPPLE_SIZE, RIPPLE_SIZE, 1, PIXELFORMAT_UNCOMPRESSED_GRAY_ALPHA };
+    ripples.texture = LoadTextureFromImage(flat);
+    SetTextureFilter(ripples.texture, TEXTURE_FILTER_BILINEAR);
+    SetTextureWrap(ripples.texture, TEXTURE_WRAP_REPEAT);
+    return ripples;
+}
+
+void UnloadRipples(Ripples *ripples) {
+    RL_FREE(ripples->heights[0]);
+    RL_FREE(ripples->heights[1]);
+    RL_FREE(ripples->slopes);
+    if (ripples->texture.id > 0) UnloadTexture(ripples->texture);
+    *ripples = (Ripples){ 0 };
+}
+
+// Push the surface down where each of count drops landed, drops off the ground are skipped
+void AddRippleImpulses(Ripples *ripples, const Vector3 *impacts, int count) {
+    if (ripples->texture.id == 0) return;
+    float *h = ripples->heights[ripples->current];
+    const int mask = RIPPLE_SIZE - 1;
+    for (int i = 0; i < count; i++) {
+        if (impacts[i].y > ripples->height + RIPPLE_GROUND_TOLERANCE) continue;
+        int x = (int)floorf(impacts[i].x * (RIPPLE_SIZE / RIPPLE_SCALE)) & mask;
+        int y = (int)floorf(impacts[i].z * (RIPPLE_SIZE / RIPPLE_SCALE)) & mask;
+
+        // a small cross rather than one cell, single cells ring at the grid frequency
+        h[y * RIPPLE_SIZE + x] -= RIPPLE_IMPULSE;
+        h[y * RIPPLE_SIZE + ((x + 1) & mask)] -= RIPPLE_IMPULSE * 0.5f;
+        h[y * RIPPLE_SIZE + ((x - 1) & mask)] -= RIPPLE_IMPULSE * 0.5f;
+        h[((y + 1) & mask) * RIPPLE_SIZE + x] -= RIPPLE_IMPULSE * 0.5f;
+        h[((y - 1) & mask) * RIPPLE_SIZE + x] -= RIPPLE_IMPULSE * 0.5f;
+        ripples->impulses++;
+    }
+}
+
+// Cells [begin, end) of one row, wrapping around at the edges of the field
+// out holds the step before and gets the next one
+static void StepRippleRowScalar(const float *up, const float *row, const float *down, float *out, int begin, int end) {
+    const int mask = RIPPLE_SIZE - 1;
+    for (int x = begin; x < end; x++) {
+        float next = ((row[(x - 1) & mask] + row[(x + 1) & mask] + (up[x] + down[x])) * 0.5f - out[x]) * RIPPLE_DAMPING;
+        out[x] = (fabsf(next) < RIPPLE_FLUSH) ? 0.0f : next;
+    }
+}
+
+#if RIPPLE_SIMD_WIDTH == 8
+// Cells [begin, end) of one row, none of them on an edge
+static void StepRippleRowSIMD(const float *up, const float *row, const float *down, float *out, int begin, int end) {
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 damping = _mm256_set1_ps(RIPPLE_DAMPING);
+    __m256 flush = _mm256_set1_ps(RIPPLE_FLUSH);
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    for (int x = begin; x < end; x += 8) {
+        __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(row + x - 1), _mm256_loadu_ps(row + x + 1)),
+                _mm256_add_ps(_mm256_loadu_ps(up + x), _mm256_loadu_ps(down + x)));
+        __m256 next = _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(sum, half), _mm256_loadu_ps(out + x)), damping);
+        __m256 visible = _mm256_cmp_ps(_mm256_andnot_ps(sign, next), flush, _CMP_GE_OQ);
+        _mm256_storeu_ps(out + x, _mm256_and_ps(next, visible));
+    }
+}
+#elif RIPPLE_SIMD_WIDTH == 4
+static void StepRippleRowSIMD(const float *up, const float *row, const float *down, float *out, int begin, int end) {
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 damping = _mm_set1_ps(RIPPLE_DAMPING);
+    __m128 flush = _mm_set1_ps(RIPPLE_FLUSH);
+    __m128 sign = _mm_set1_ps(-0.0f);
+    for (int x = begin; x < end; x += 4) {
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row + x - 1), _mm_loadu_ps(row + x + 1)),
+                _mm_add_ps(_mm_loadu_ps(up + x), _mm_loadu_ps(down + x)));
+        __m128 next = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(sum, half), _mm_loadu_ps(out + x)), damping);
+        __m128 visible = _mm_cmpge_ps(_mm_andnot_ps(sign, next), flush);
+        _mm_storeu_ps(out + x, _mm_and_ps(next, visible));
+    }
+}
+#endif
+
+// Step rows [begin, end), reading heights[current] and writing over the other one
+// Rows only write themselves, so disjoint ranges may be stepped from different threads
+static void StepRipplesJob(void *data, int begin, int end) {
+    Ripples *ripples = (Ripples *)data;
+    const float *h = ripples->heights[ripples->current];
+    float *next = ripples->heights[ripples->current ^ 1];
+    const int mask = RIPPLE_SIZE - 1;
+
+    for (int y = begin; y < end; y++) {
+        const float *up = h + ((y - 1) & mask) * RIPPLE_SIZE;
+        const float *row = h + y * RIPPLE_SIZE;
+        const float *down = h + ((y + 1) & mask) * RIPPLE_SIZE;
+        float *out = next + y * RIPPLE_SIZE;
+
+        // the first and last cell wrap, the ones in between have both neighbours in the row
+        int x = 1;
+#if RIPPLE_SIMD_WIDTH > 1
+        int simdEnd = 1 + (RIPPLE_SIZE - 2) / RIPPLE_SIMD_WIDTH * RIPPLE_SIMD_WIDTH;
+        StepRippleRowSIMD(up, row, down, out, 1, simdEnd);
+        x = simdEnd;
+#endif
+        StepRippleRowScalar(up, row, down, out, x, RIPPLE_SIZE);
+        StepRippleRowScalar(up, row, down, out, 0, 1);
+    }
+}
+
+// Find the tiles [begin, end) with waves and convert the ones that changed to slopes
+static void UpdateRippleTilesJob(void *data, int begin, int end) {
+    Ripples *ripples = (Ripples *)data;
+    const float *h = ripples->heights[ripples->current];
+    const float *previous = ripples->heights[ripples->current ^ 1];
+    const int mask = RIPPLE_SIZE - 1;
+
+    for (int t = begin; t < end; t++) {
+        int left = (t % RIPPLE_TILES_X) * RIPPLE_TILE;
+        int top = (t / RIPPLE_TILES_X) * RIPPLE_TILE;
+
+        // both steps, a wave passing through zero still moves
+        float peak = 0.0f;
+        for (int y = top; y < top + RIPPLE_TILE; y++) {
+            for (int x = left; x < left + RIPPLE_TILE; x++) {
+                peak = fmaxf(peak, fmaxf(fabsf(h[y * RIPPLE_SIZE + x]), fabsf(previous[y * RIPPLE_SIZE + x])));
+            }
+        }
+        bool active = (peak >= RIPPLE_EPSILON);
+        ripples->dirty[t] = active || ripples->active[t];   // one more upload to flatten it out
+        ripples->active[t] = active;
+        if (!ripples->dirty[t]) continue;
+
+        unsigned char *slopes = ripples->slopes + t * RIPPLE_TILE * RIPPLE_TILE * 2;
+        for (int y = top; y < top + RIPPLE_TILE; y++) {
+            const float *row = h + y * RIPPLE_SIZE;
+            const float *up = h + ((y - 1) & mask) * RIPPLE_SIZE;
+            const float *down = h + ((y + 1) & mask) * RIPPLE_SIZE;
+            for (int x = left; x < left + RIPPLE_TILE; x++) {
+                float sx = Clamp((row[(x + 1) & mask] - row[(x - 1) & mask]) * RIPPLE_SLOPE, -1.0f, 1.0f);
+                float sz = Clamp((down[x] - up[x]) * RIPPLE_SLOPE, -1.0f, 1.0f);
+                *slopes++ = (unsigned char)(sx * 127.0f + 128.0f);
+                *slopes++ = (unsigned char)(sz * 127.0f + 128.0f);
+            }
+        }
+    }
+}
+
+// Run steps wave steps on every core and upload the tiles that changed
+// NOTE: Waits for its jobs, call it where the frame would wait anyway
+void UpdateRipples(Ripples *ripples, int steps) {
+    ripples->uploads = 0;
+    if (ripples->texture.id == 0 || (steps <= 0 && ripples->impulses == 0)) return;
+    ripples->impulses = 0;
+
+    JobCounter counter = { 0 };
+    for (int s = 0; s < steps; s++) {
+        JobParallelFor(&counter, RIPPLE_SIZE, RIPPLE_JOB_ROWS, StepRipplesJob, ripples);
+        JobWait(&counter);
+        ripples->current ^= 1;
+    }
+    JobParallelFor(&counter, RIPPLE_TILES, RIPPLE_JOB_TILES, UpdateRippleTilesJob, ripples);
+    JobWait(&counter);
+
+    for (int t = 0; t < RIPPLE_TILES; t++) {
+        if (!ripples->dirty[t]) continue;
+        Rectangle tile = { (float)((t % RIPPLE_TILES_X) * RIPPLE_TILE), (float)((t / RIPPLE_TILES_X) * RIPPLE_TILE),
+            RIPPLE_TILE, RIPPLE_TILE };
+        UpdateTextureRec(ripples->texture, tile, ripples->slopes + t * RIPPLE_TILE * RIPPLE_TILE * 2);
+        ripples->uploads++;
+    }
+}
+
+// Bind the slopes at RIPPLE_TEXTURE_UNIT for the rest of the frame
+void BindRipples(const Ripples *ripples) {
+    if (ripples->texture.id == 0) return;
+    rlActiveTextureSlot(RIPPLE_TEXTURE_UNIT);
+    rlEnableTexture(ripples->texture.id);
+    rlActiveTextureSlot(0);
+}
+
+// Point the rippleMap sampler of shader at RIPPLE_TEXTURE_UNIT and tell it how the field is tiled
+// Without a texture the sampler stays on unit 0 and the strength is 0
+void SetRippleShaderValues(const Ripples *ripples, Shader shader) {
+    float scale = 1.0f / RIPPLE_SCALE;
+    float strength = (ripples->texture.id > 0) ? 1.0f : 0.0f;
+    if (ripples->texture.id > 0) {
+        int unit = RIPPLE_TEXTURE_UNIT;
+        SetShaderValue(shader, GetShaderLocation(shader, "rippleMap"), &unit, SHADER_UNIFORM_SAMPLER2D);
+    }
+    SetShaderValue(shader, GetShaderLocation(shader, "rippleScale"), &scale, SHADER_UNIFORM_FLOAT);
+    SetShaderValue(shader, GetShaderLocation(shader, "rippleStrength"), &strength, SHADER_UNIFORM_FLOAT);
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*******************************************************************************************
+ *  CS216 - RainShader scene baker
+ *
+ *  Bakes the glTF models into one scene pack (scenepack.h) that rainshader maps at
+ *  startup instead of parsing the glTF files and decoding their textures.
+ *
+ *  Usage: scenebake [-o scene.pack] [--no-compress] [model.gltf ...]
+ *  Without models the ones rainshader draws are baked. Run it from the directory
+ *  rainshader runs in, models are found in the pack by the path they were baked from.
+ *  Textures are block compressed (BC1/BC3) unless --no-compress is given, for GPUs
+ *  without DXT support.
+ *
+ ********************************************************************************************/
+
+#include "raylib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jobs.h"
+#include "scenepack.h"
+
+#define MAX_BAKE_MODELS 16
+
+static const char *defaultModels[] = {
+    "resources/ccity_building_set_1/scene.gltf",
+    "resources/toyota_land_cruiser/scene.gltf",
+};
+
+int main(int argc, char **argv) {
+    const char *output = "scene.pack";
+    const char *sources[MAX_BAKE_MODELS];
+    int count = 0;
+    bool compress = true;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-o", 3) == 0) {
+            if (i + 1 >= argc) {
+                printf("usage: %s [-o scene.pack] [--no-compress] [model.gltf ...]\n", argv[0]);
+                return 1;
+            }
+            output = argv[++i];
+        } else if (strncmp(argv[i], "--no-compress", 14) == 0) {
+            compress = false;
+        } else if (count < MAX_BAKE_MODELS) {
+            sources[count++] = argv[i];
+        }
+    }
+    if (count == 0) {
+        count = sizeof(defaultModels) / sizeof(defaultModels[0]);
+        for (int i = 0; i < count; i++) sources[i] = defaultModels[i];
+    }
+
+    // LoadModel uploads meshes and textures, it needs a context even if nothing is drawn
+    SetConfigFlags(FLAG_WINDOW_HIDDEN);
+    SetTraceLogLevel(LOG_WARNING);
+    InitWindow(64, 64, "scenebake");
+    InitJobSystem(0);
+
+    // NOTE: LoadModel falls back to a cube for missing files, check first
+    Model models[MAX_BAKE_MODELS];
+    int loaded = 0;
+    while (loaded < count && FileExists(sources[loaded])) {
+        models[loaded] = LoadModel(sources[loaded]);
+        loaded++;
+    }
+    if (loaded < count) printf("scenebake: could not find %s\n", sources[loaded]);
+
+    bool written = (loaded == count) && ExportScenePack(models, sources, count, output, compress);
+
+    for (int i = 0; i < loaded; i++) UnloadModel(models[i]);
+    ShutdownJobSystem();
+    CloseWindow();
+
+    return (written) ? 0 : 1;
+}
@@ -0,0 +1,677 @@
+/*
+ * ScenePack
+ *
+ * Binary scene pack baked offline from the glTF models (see scenebake.c),
+ * so startup does not parse JSON or decode PNGs.
+ *
+ * The pack is one file laid out for direct use: a header, fixed size tables
+ * of models, meshes, materials and textures, then the payloads, each aligned
+ * to SCENE_PACK_ALIGN. Vertex and index arrays are stored exactly as raylib
+ * keeps them in a Mesh and textures are stored cooked (texturecook.h): a
+ * gamma correct mip chain, block compressed (BC1/BC3) unless the bake was
+ * told not to. At runtime the file is mapped read only, meshes point straight into
+ * the mapping and are uploaded from it, and so are the textures. Nothing is
+ * copied, loading costs the page faults of the data that is touched.
+ *
+ * The pack records the modification time of every file it was baked from:
+ * the glTF of each model and the buffers and images its uris name. If one of
+ * them changed the pack is ignored and the models load from their glTF as
+ * before, so a stale pack never shows old geometry or textures.
+ *
+ * The mapping has to stay alive as long as the models use it (the CPU side
+ * mesh arrays live in it), UnloadScenePack() goes after the models.
+ * OpenScenePack() and LoadScenePackModelData() stop short of the GPU upload
+ * and work without a GL context, for the simulation only benchmark. A GPU
+ * without DXT support cannot upload a compressed pack, the models then load
+ * from their glTF (bake with --no-compress for such machines).
+ *
+ */
+
+#ifndef SCENEPACK_H
+#define SCENEPACK_H
+
+#include "raylib.h"
+#include "rlgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "texturecook.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define SCENE_PACK_VERSION 4        // bump when the layout changes
+#define SCENE_PACK_ALIGN 64         // payload alignment in the file
+#define SCENE_PACK_SOURCE_SIZE 128  // source file paths, a model's glTF path is also its name in the pack
+
+
+typedef struct ScenePackHeader {
+    char magic[4];              // "SPAK"
+    int32_t version;
+    int32_t materialMaps;       // MAX_MATERIAL_MAPS the pack was baked with
+    int32_t modelCount;
+    int32_t meshCount;
+    int32_t materialCount;
+    int32_t textureCount;
+    int32_t sourceCount;
+} ScenePackHeader;
+
+typedef struct ScenePackModel {
+    char source[SCENE_PACK_SOURCE_SIZE];
+    Matrix transform;
+    int32_t firstMesh;
+    int32_t meshCount;
+    int32_t firstMaterial;
+    int32_t materialCount;
+} ScenePackModel;
+
+// Payload offsets from the start of the file, 0 when the mesh has no such array
+typedef struct ScenePackMesh {
+    int32_t vertexCount;
+    int32_t triangleCount;
+    int32_t material;           // index into the model's materials
+    int32_t padding;
+    uint64_t vertices;          // float xyz
+    uint64_t texcoords;         // float uv
+    uint64_t texcoords2;
+    uint64_t normals;           // float xyz
+    uint64_t tangents;          // float xyzw
+    uint64_t colors;            // rgba8
+    uint64_t indices;           // unsigned short, 3 per triangle
+} ScenePackMesh;
+
+typedef struct ScenePackMaterial {
+    int32_t textures[MAX_MATERIAL_MAPS]; // index into the pack textures, -1 keeps the default
+    Color colors[MAX_MATERIAL_MAPS];
+    float values[MAX_MATERIAL_MAPS];
+    float params[4];
+} ScenePackMaterial;
+
+typedef struct ScenePackTexture {
+    int32_t width;
+    int32_t height;
+    int32_t format;             // PixelFormat
+    int32_t mipmaps;
+    uint64_t offset;            // whole mip chain, largest level first, as raylib lays it out
+    uint64_t size;
+} ScenePackTexture;
+
+// File the pack was baked from
+typedef struct ScenePackSource {
+    char path[SCENE_PACK_SOURCE_SIZE];
+    int64_t modTime;
+} ScenePackSource;
+
+typedef struct ScenePack {
+    unsigned char *data;        // the mapped file, NULL when no pack is loaded
+    size_t size;
+    bool mapped;                // false when it had to be read into memory instead
+    const ScenePackHeader *header;
+    const ScenePackModel *models;
+    const ScenePackMesh *meshes;
+    const ScenePackMaterial *materials;
+    const ScenePackTexture *textureInfo;
+    const ScenePackSource *sources;
+    Texture2D *textures;        // uploaded once, shared by every material using them
+} ScenePack;
+
+
+static size_t GetScenePackMipChainSize(int width, int height, int format, int mipmaps) {
+    size_t size = 0;
+    for (int i = 0; i < mipmaps; i++) {
+        size += GetPixelDataSize(width, height, format);
+        width = (width > 1) ? width / 2 : 1;
+        height = (height > 1) ? height / 2 : 1;
+    }
+    return size;
+}
+
+// Formats CookTexture() writes, anything else would reach rlLoadTexture() unchecked
+static bool IsScenePackFormat(int format) {
+    return format == PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 || format == PIXELFORMAT_COMPRESSED_DXT1_RGB ||
+        format == PIXELFORMAT_COMPRESSED_DXT5_RGBA;
+}
+
+// Payload [offset, offset + size) lies inside the pack
+static bool IsScenePackRangeValid(const ScenePack *pack, uint64_t offset, uint64_t size) {
+    return offset <= pack->size && size <= pack->size - offset;
+}
+
+static bool IsScenePackMeshValid(const ScenePack *pack, const ScenePackMesh *mesh) {
+    uint64_t vc = mesh->vertexCount;
+    if (mesh->vertexCount <= 0 || mesh->triangleCount < 0 || mesh->vertices == 0) return false;
+    if (!IsScenePackRangeValid(pack, mesh->vertices, vc * 3 * sizeof(float))) return false;
+    if (mesh->texcoords && !IsScenePackRangeValid(pack, mesh->texcoords, vc * 2 * sizeof(float))) return false;
+    if (mesh->texcoords2 && !IsScenePackRangeValid(pack, mesh->texcoords2, vc * 2 * sizeof(float))) return false;
+    if (mesh->normals && !IsScenePackRangeValid(pack, mesh->normals, vc * 3 * sizeof(float))) return false;
+    if (mesh->tangents && !IsScenePackRangeValid(pack, mesh->tangents, vc * 4 * sizeof(float))) return false;
+    if (mesh->colors && !IsScenePackRangeValid(pack, mesh->colors, vc * 4)) return false;
+    if (mesh->indices && !IsScenePackRangeValid(pack, mesh->indices, (uint64_t)mesh->triangleCount * 3 * sizeof(unsigned short))) return false;
+    return true;
+}
+
+static void CloseScenePackFile(ScenePack *pack) {
+#if !defined(_WIN32)
+    if (pack->mapped) munmap(pack->data, pack->size);
+    else
+#endif
+    UnloadFileData(pack->data);
+    *pack = (ScenePack){ 0 };
+}
+
+// Map the pack read only, read it into memory where there is no mmap
+static bool OpenScenePackFile(ScenePack *pack, const char *fileName) {
+#if !defined(_WIN32)
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            pack->data = data;
+            pack->size = info.st_size;
+            pack->mapped = true;
+        }
+    }
+    close(fd);
+    return pack->mapped;
+#else
+    int size = 0;
+    pack->data = LoadFileData(fileName, &size);
+    pack->size = size;
+    return pack->data != NULL;
+#endif
+}
+
+// Check the tables fit in the file and the payloads they point at do too
+static bool ValidateScenePack(ScenePack *pack) {
+    if (pack->size < sizeof(ScenePackHeader)) return false;
+
+    const ScenePackHeader *header = (const ScenePackHeader *)pack->data;
+    if (memcmp(header->magic, "SPAK", 4) != 0 || header->version != SCENE_PACK_VERSION ||
+            header->materialMaps != MAX_MATERIAL_MAPS) return false;
+    if (header->modelCount < 0 || header->meshCount < 0 || header->materialCount < 0 || header->textureCount < 0 ||
+            header->sourceCount < 0) return false;
+
+    uint64_t tables = sizeof(ScenePackHeader) + (uint64_t)header->modelCount * sizeof(ScenePackModel) +
+        (uint64_t)header->meshCount * sizeof(ScenePackMesh) + (uint64_t)header->materialCount * sizeof(ScenePackMaterial) +
+        (uint64_t)header->textureCount * sizeof(ScenePackTexture) + (uint64_t)header->sourceCount * sizeof(ScenePackSource);
+    if (tables > pack->size) return false;
+
+    pack->header = header;
+    pack->models = (const ScenePackModel *)(header + 1);
+    pack->meshes = (const ScenePackMesh *)(pack->models + header->modelCount);
+    pack->materials = (const ScenePackMaterial *)(pack->meshes + header->meshCount);
+    pack->textureInfo = (const ScenePackTexture *)(pack->materials + header->materialCount);
+    pack->sources = (const ScenePackSource *)(pack->textureInfo + header->textureCount);
+
+    for (int i = 0; i < header->modelCount; i++) {
+        const ScenePackModel *model = &pack->models[i];
+        if (model->firstMesh < 0 || model->meshCount < 0 || model->firstMesh > header->meshCount - model->meshCount) return false;
+        if (model->firstMaterial < 0 || model->materialCount <= 0 ||
+                model->firstMaterial > header->materialCount - model->materialCount) return false;
+
+        for (int m = model->firstMesh; m < model->firstMesh + model->meshCount; m++) {
+            if (!IsScenePackMeshValid(pack, &pack->meshes[m])) return false;
+            if (pack->meshes[m].material < 0 || pack->meshes[m].material >= model->materialCount) return false;
+        }
+    }
+    for (int i = 0; i < header->materialCount; i++) {
+        for (int k = 0; k < MAX_MATERIAL_MAPS; k++) {
+            if (pack->materials[i].textures[k] >= header->textureCount) return false;
+        }
+    }
+    for (int i = 0; i < header->textureCount; i++) {
+        const ScenePackTexture *texture = &pack->textureInfo[i];
+        if (texture->width <= 0 || texture->height <= 0 || texture->mipmaps <= 0) return false;
+        if (!IsScenePackFormat(texture->format)) return false;
+        // mipmapped filtering samples black from a chain that stops short of 1x1
+        if (texture->mipmaps != 1 && texture->mipmaps != GetCookMipCount(texture->width, texture->height)) return false;
+        if (texture->size != GetScenePackMipChainSize(texture->width, texture->height, texture->format, texture->mipmaps)) return false;
+        if (!IsScenePackRangeValid(pack, texture->offset, texture->size)) return false;
+    }
+    for (int i = 0; i < header->sourceCount; i++) {
+        if (memchr(pack->sources[i].path, '\0', SCENE_PACK_SOURCE_SIZE) == NULL) return false;
+    }
+
+    return true;
+}
+
+static int FindScenePackModel(const ScenePack *pack, const char *fileName) {
+    if (pack->header == NULL) return -1;
+    for (int i = 0; i < pack->header->modelCount; i++) {
+        if (strncmp(pack->models[i].source, fileName, SCENE_PACK_SOURCE_SIZE) == 0) return i;
+    }
+    return -1;
+}
+
+// Map a baked scene pack without uploading anything
+// Returns an empty pack (data NULL) when the file is missing, invalid or a file it was baked from changed
+ScenePack OpenScenePack(const char *fileName) {
+    ScenePack pack = { 0 };
+    if (!FileExists(fileName)) return pack;
+
+    if (!OpenScenePackFile(&pack, fileName)) {
+        printf("scene pack: could not open %s\n", fileName);
+        return pack;
+    }
+    if (!ValidateScenePack(&pack)) {
+        printf("scene pack: %s is not a version %d pack, bake it again\n", fileName, SCENE_PACK_VERSION);
+        CloseScenePackFile(&pack);
+        return pack;
+    }
+
+    // sources that are not shipped can not be stale
+    for (int i = 0; i < pack.header->sourceCount; i++) {
+        const ScenePackSource *source = &pack.sources[i];
+        if (FileExists(source->path) && GetFileModTime(source->path) != source->modTime) {
+            printf("scene pack: %s changed since %s was baked, loading the glTF models\n", source->path, fileName);
+            CloseScenePackFile(&pack);
+            return pack;
+        }
+    }
+
+    return pack;
+}
+
+// Map a baked scene pack and upload its textures, see OpenScenePack
+ScenePack LoadScenePack(const char *fileName) {
+    double start = GetTime();
+    ScenePack pack = OpenScenePack(fileName);
+    if (pack.data == NULL) return pack;
+
+    // straight from the mapping, mip chain included
+    pack.textures = RL_CALLOC(pack.header->textureCount, sizeof(Texture2D));
+    for (int i = 0; i < pack.header->textureCount; i++) {
+        const ScenePackTexture *info = &pack.textureInfo[i];
+        Texture2D texture = { 0 };
+        texture.id = rlLoadTexture(pack.data + info->offset, info->width, info->height, info->format, info->mipmaps);
+        texture.width = info->width;
+        texture.height = info->height;
+        texture.mipmaps = info->mipmaps;
+        texture.format = info->format;
+        if (texture.mipmaps > 1) SetTextureFilter(texture, TEXTURE_FILTER_TRILINEAR);
+        pack.textures[i] = texture;
+
+        // compressed formats the GPU does not take fail to upload
+        if (texture.id == 0) {
+            printf("scene pack: texture format %d of %s is not supported, loading the glTF models\n", info->format, fileName);
+            for (int k = 0; k < i; k++) UnloadTexture(pack.textures[k]);
+            RL_FREE(pack.textures);
+            CloseScenePackFile(&pack);
+            return pack;
+        }
+    }
+
+    printf("scene pack: %d models, %d meshes, %d textures from %s in %.1f ms\n", pack.header->modelCount,
+            pack.header->meshCount, pack.header->textureCount, fileName, (GetTime() - start) * 1000.0);
+    return pack;
+}
+
+bool HasScenePackModel(const ScenePack *pack, const char *fileName) {
+    return FindScenePackModel(pack, fileName) >= 0;
+}
+
+// Model baked from fileName with its meshes left in the mapping, uploaded when upload is set
+static Model BuildScenePackModel(const ScenePack *pack, const char *fileName, bool upload) {
+    Model model = { 0 };
+    int index = FindScenePackModel(pack, fileName);
+    if (index < 0) return model;
+
+    const ScenePackModel *info = &pack->models[index];
+    model.transform = info->transform;
+    model.meshCount = info->meshCount;
+    model.materialCount = info->materialCount;
+    model.meshes = RL_CALLOC(model.meshCount, sizeof(Mesh));
+    model.meshMaterial = RL_CALLOC(model.meshCount, sizeof(int));
+    model.materials = RL_CALLOC(model.materialCount, sizeof(Material));
+
+    for (int i = 0; i < model.meshCount; i++) {
+        const ScenePackMesh *source = &pack->meshes[info->firstMesh + i];
+        unsigned char *data = pack->data;
+        Mesh *mesh = &model.meshes[i];
+
+        // the GL upload only reads these, the mapping is read only
+        mesh->vertexCount = source->vertexCount;
+        mesh->triangleCount = source->triangleCount;
+        mesh->vertices = (float *)(data + source->vertices);
+        mesh->texcoords = (source->texcoords) ? (float *)(data + source->texcoords) : NULL;
+        mesh->texcoords2 = (source->texcoords2) ? (float *)(data + source->texcoords2) : NULL;
+        mesh->normals = (source->normals) ? (float *)(data + source->normals) : NULL;
+        mesh->tangents = (source->tangents) ? (float *)(data + source->tangents) : NULL;
+        mesh->colors = (source->colors) ? (unsigned char *)(data + source->colors) : NULL;
+        mesh->indices = (source->indices) ? (unsigned short *)(data + source->indices) : NULL;
+        if (upload) UploadMesh(mesh, false);
+
+        model.meshMaterial[i] = source->material;
+    }
+
+    for (int i = 0; i < model.materialCount; i++) {
+        const ScenePackMaterial *source = &pack->materials[info->firstMaterial + i];
+        Material material = LoadMaterialDefault();
+        for (int k = 0; k < MAX_MATERIAL_MAPS; k++) {
+            if (source->textures[k] >= 0 && pack->textures != NULL) material.maps[k].texture = pack->textures[source->textures[k]];
+            material.maps[k].color = source->colors[k];
+            material.maps[k].value = source->values[k];
+        }
+        memcpy(material.params, source->params, sizeof(material.params));
+        model.materials[i] = material;
+    }
+
+    return model;
+}
+
+// Model baked from fileName, meshCount is 0 when the pack does not have it
+// The mesh arrays stay in the mapping, unload it with UnloadScenePackModel
+Model LoadScenePackModel(const ScenePack *pack, const char *fileName) {
+    return BuildScenePackModel(pack, fileName, true);
+}
+
+// Same without the GPU upload, the meshes only have their CPU side arrays
+Model LoadScenePackModelData(const ScenePack *pack, const char *fileName) {
+    return BuildScenePackModel(pack, fileName, false);
+}
+
+// The model's mesh arrays point into pack
+bool IsScenePackModel(const ScenePack *pack, Model model) {
+    if (pack->data == NULL || model.meshCount == 0) return false;
+    unsigned char *vertices = (unsigned char *)model.meshes[0].vertices;
+    return vertices >= pack->data && vertices < pack->data + pack->size;
+}
+
+// Unload a model from LoadScenePackModel, the pack keeps its textures and the caller its shaders
+void UnloadScenePackModel(Model model) {
+    for (int i = 0; i < model.meshCount; i++) {
+        Mesh mesh = model.meshes[i];
+        mesh.vertices = NULL;
+        mesh.texcoords = NULL;
+        mesh.texcoords2 = NULL;
+        mesh.normals = NULL;
+        mesh.tangents = NULL;
+        mesh.colors = NULL;
+        mesh.indices = NULL;
+        if (mesh.vboId != NULL) UnloadMesh(mesh);   // GPU buffers may already be gone, see UnloadStaticBatchSources
+    }
+    for (int i = 0; i < model.materialCount; i++) RL_FREE(model.materials[i].maps);
+
+    RL_FREE(model.meshes);
+    RL_FREE(model.materials);
+    RL_FREE(model.meshMaterial);
+}
+
+void UnloadScenePack(ScenePack *pack) {
+    if (pack->data == NULL) return;
+    if (pack->textures != NULL) {
+        for (int i = 0; i < pack->header->textureCount; i++) UnloadTexture(pack->textures[i]);
+        RL_FREE(pack->textures);
+    }
+    CloseScenePackFile(pack);
+}
+
+
+//----------------------------------------------------------------------------------
+// Baking, used by scenebake
+//----------------------------------------------------------------------------------
+
+typedef struct ScenePackImage {
+    Image image;                // cooked
+    uint64_t hash;              // of the source pixels
+    TextureCookKind kind;
+    uint64_t offset;
+} ScenePackImage;
+
+typedef struct ScenePackWriter {
+    ScenePackHeader header;
+    ScenePackModel *models;
+    ScenePackMesh *meshes;
+    ScenePackMaterial *materials;
+    ScenePackTexture *textures;
+    ScenePackImage *images;     // decoded texture payloads, parallel to textures
+    ScenePackSource *sources;
+    uint64_t end;               // size of the file laid out so far
+    bool compress;              // block compress color and data textures
+} ScenePackWriter;
+
+// Reserve size bytes of payload, returns its offset
+static uint64_t ReserveScenePackData(ScenePackWriter *writer, uint64_t size) {
+    uint64_t offset = (writer->end + SCENE_PACK_ALIGN - 1) & ~(uint64_t)(SCENE_PACK_ALIGN - 1);
+    writer->end = offset + size;
+    return offset;
+}
+
+static uint64_t HashScenePackImage(Image image) {
+    uint64_t hash = 14695981039346656037ull;
+    const unsigned char *bytes = image.data;
+    int size = GetPixelDataSize(image.width, image.height, image.format);
+    for (int i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Record path as a source of the pack, once
+static bool AddScenePackSource(ScenePackWriter *writer, const char *path) {
+    if (strlen(path) >= SCENE_PACK_SOURCE_SIZE) {
+        printf("scene pack: source path too long %s\n", path);
+        return false;
+    }
+    for (int i = 0; i < writer->header.sourceCount; i++) {
+        if (strcmp(writer->sources[i].path, path) == 0) return true;
+    }
+
+    int index = writer->header.sourceCount++;
+    writer->sources = RL_REALLOC(writer->sources, writer->header.sourceCount * sizeof(ScenePackSource));
+    writer->sources[index] = (ScenePackSource){ 0 };
+    strcpy(writer->sources[index].path, path);
+    writer->sources[index].modTime = GetFileModTime(path);
+    return true;
+}
+
+// Record a glTF and every file its uris name (buffers and images), embedded data: uris have no file
+// NOTE: No JSON parser here, every "uri" string is taken, the glTF keys have no other use for the name
+static bool AddScenePackModelSources(ScenePackWriter *writer, const char *gltf) {
+    if (!AddScenePackSource(writer, gltf)) return false;
+
+    char *text = LoadFileText(gltf);
+    if (text == NULL) return true;
+
+    char directory[SCENE_PACK_SOURCE_SIZE];
+    snprintf(directory, sizeof(directory), "%s", GetDirectoryPath(gltf));
+
+    bool added = true;
+    for (const char *key = strstr(text, "\"uri\""); key != NULL && added; key = strstr(key + 5, "\"uri\"")) {
+        const char *value = key + 5;
+        while (*value == ' ' || *value == '\t' || *value == '\r' || *value == '\n' || *value == ':') value++;
+        if (*value != '"') continue;
+        value++;
+
+        // JSON escapes are only \/ in file names
+        char uri[SCENE_PACK_SOURCE_SIZE];
+        int length = 0;
+        for (; *value != '"' && *value != '\0' && length < SCENE_PACK_SOURCE_SIZE - 1; value++) {
+            if (*value == '\\' && value[1] != '\0') value++;
+            uri[length++] = *value;
+        }
+        uri[length] = '\0';
+
+        if (length == 0 || strncmp(uri, "data:", 5) == 0) continue;
+        added = AddScenePackSource(writer, TextFormat("%s/%s", directory, uri));
+    }
+
+    UnloadFileText(text);
+    return added;
+}
+
+// How the texture of a material map is filtered and compressed
+static TextureCookKind GetScenePackTextureKind(int map) {
+    if (map == MATERIAL_MAP_ALBEDO || map == MATERIAL_MAP_EMISSION) return TEXTURE_COOK_COLOR;
+    if (map == MATERIAL_MAP_NORMAL) return TEXTURE_COOK_NORMAL;
+    return TEXTURE_COOK_DATA;
+}
+
+// Pack texture holding the cooked pixels of texture, textures with identical pixels used the same way are stored once
+static int AddScenePackTexture(ScenePackWriter *writer, Texture2D texture, TextureCookKind kind) {
+    if (texture.id == 0 || texture.id == rlGetTextureIdDefault()) return -1;
+
+    Image source = LoadImageFromTexture(texture);
+    if (source.data == NULL) return -1;
+    uint64_t hash = HashScenePackImage(source);
+
+    for (int i = 0; i < writer->header.textureCount; i++) {
+        Image other = writer->images[i].image;
+        if (writer->images[i].hash == hash && writer->images[i].kind == kind && other.width == source.width &&
+                other.height == source.height) {
+            UnloadImage(source);
+            return i;
+        }
+    }
+
+    Image image = CookTexture(source, kind, writer->compress);
+    UnloadImage(source);
+
+    int index = writer->header.textureCount++;
+    writer->textures = RL_REALLOC(writer->textures, writer->header.textureCount * sizeof(ScenePackTexture));
+    writer->images = RL_REALLOC(writer->images, writer->header.textureCount * sizeof(ScenePackImage));
+
+    ScenePackTexture info = { image.width, image.height, image.format, image.mipmaps, 0, 0 };
+    info.size = GetScenePackMipChainSize(image.width, image.height, image.format, image.mipmaps);
+    writer->textures[index] = info;
+    writer->images[index] = (ScenePackImage){ image, hash, kind, 0 };
+    return index;
+}
+
+static void WriteScenePackData(FILE *file, uint64_t offset, const void *data, uint64_t size) {
+    static const unsigned char zeros[SCENE_PACK_ALIGN] = { 0 };
+    long position = ftell(file);
+    if ((uint64_t)position < offset) fwrite(zeros, 1, offset - position, file);
+    fwrite(data, 1, size, file);
+}
+
+// Bake count models into a pack, sources are the glTF files they were loaded from
+// Needs a GL context, textures are read back from the GPU, and cooked on the job threads if there are any
+bool ExportScenePack(const Model *models, const char **sources, int count, const char *fileName, bool compress) {
+    ScenePackWriter writer = { 0 };
+    writer.compress = compress;
+    memcpy(writer.header.magic, "SPAK", 4);
+    writer.header.version = SCENE_PACK_VERSION;
+    writer.header.materialMaps = MAX_MATERIAL_MAPS;
+    writer.header.modelCount = count;
+
+    for (int i = 0; i < count; i++) {
+        if (!AddScenePackModelSources(&writer, sources[i])) {
+            RL_FREE(writer.sources);
+            return false;
+        }
+        writer.header.meshCount += models[i].meshCount;
+        writer.header.materialCount += models[i].materialCount;
+    }
+
+    writer.models = RL_CALLOC(count, sizeof(ScenePackModel));
+    writer.meshes = RL_CALLOC(writer.header.meshCount, sizeof(ScenePackMesh));
+    writer.materials = RL_CALLOC(writer.header.materialCount, sizeof(ScenePackMaterial));
+
+    // materials first, the texture table has to be complete before the layout is
+    int material = 0;
+    for (int i = 0; i < count; i++) {
+        for (int m = 0; m < models[i].materialCount; m++, material++) {
+            Material source = models[i].materials[m];
+            ScenePackMaterial *packed = &writer.materials[material];
+            for (int k = 0; k < MAX_MATERIAL_MAPS; k++) {
+                packed->textures[k] = AddScenePackTexture(&writer, source.maps[k].texture, GetScenePackTextureKind(k));
+                packed->colors[k] = source.maps[k].color;
+                packed->values[k] = source.maps[k].value;
+            }
+            memcpy(packed->params, source.params, sizeof(packed->params));
+        }
+    }
+
+    writer.end = sizeof(ScenePackHeader) + count * sizeof(ScenePackModel) +
+        writer.header.meshCount * sizeof(ScenePackMesh) + writer.header.materialCount * sizeof(ScenePackMaterial) +
+        writer.header.textureCount * sizeof(ScenePackTexture) + writer.header.sourceCount * sizeof(ScenePackSource);
+
+    int mesh = 0;
+    material = 0;
+    for (int i = 0; i < count; i++) {
+        ScenePackModel *packed = &writer.models[i];
+        strcpy(packed->source, sources[i]);
+        packed->transform = models[i].transform;
+        packed->firstMesh = mesh;
+        packed->meshCount = models[i].meshCount;
+        packed->firstMaterial = material;
+        packed->materialCount = models[i].materialCount;
+        material += models[i].materialCount;
+
+        for (int m = 0; m < models[i].meshCount; m++, mesh++) {
+            Mesh source = models[i].meshes[m];
+            uint64_t vc = source.vertexCount;
+            ScenePackMesh *out = &writer.meshes[mesh];
+            out->vertexCount = source.vertexCount;
+            out->triangleCount = source.triangleCount;
+            out->material = models[i].meshMaterial[m];
+            out->vertices = ReserveScenePackData(&writer, vc * 3 * sizeof(float));
+            if (source.texcoords) out->texcoords = ReserveScenePackData(&writer, vc * 2 * sizeof(float));
+            if (source.texcoords2) out->texcoords2 = ReserveScenePackData(&writer, vc * 2 * sizeof(float));
+            if (source.normals) out->normals = ReserveScenePackData(&writer, vc * 3 * sizeof(float));
+            if (source.tangents) out->tangents = ReserveScenePackData(&writer, vc * 4 * sizeof(float));
+            if (source.colors) out->colors = ReserveScenePackData(&writer, vc * 4);
+            if (source.indices) out->indices = ReserveScenePackData(&writer, (uint64_t)source.triangleCount * 3 * sizeof(unsigned short));
+        }
+    }
+    for (int i = 0; i < writer.header.textureCount; i++) {
+        writer.textures[i].offset = ReserveScenePackData(&writer, writer.textures[i].size);
+    }
+
+    FILE *file = fopen(fileName, "wb");
+    bool written = (file != NULL);
+    if (written) {
+        fwrite(&writer.header, sizeof(writer.header), 1, file);
+        fwrite(writer.models, sizeof(ScenePackModel), count, file);
+        fwrite(writer.meshes, sizeof(ScenePackMesh), writer.header.meshCount, file);
+        fwrite(writer.materials, sizeof(ScenePackMaterial), writer.header.materialCount, file);
+        fwrite(writer.textures, sizeof(ScenePackTexture), writer.header.textureCount, file);
+        fwrite(writer.sources, sizeof(ScenePackSource), writer.header.sourceCount, file);
+
+        // payloads in the order they were reserved, offsets only grow
+        mesh = 0;
+        for (int i = 0; i < count; i++) {
+            for (int m = 0; m < models[i].meshCount; m++, mesh++) {
+                Mesh source = models[i].meshes[m];
+                const ScenePackMesh *out = &writer.meshes[mesh];
+                uint64_t vc = source.vertexCount;
+                WriteScenePackData(file, out->vertices, source.vertices, vc * 3 * sizeof(float));
+                if (out->texcoords) WriteScenePackData(file, out->texcoords, source.texcoords, vc * 2 * sizeof(float));
+                if (out->texcoords2) WriteScenePackData(file, out->texcoords2, source.texcoords2, vc * 2 * sizeof(float));
+                if (out->normals) WriteScenePackData(file, out->normals, source.normals, vc * 3 * sizeof(float));
+                if (out->tangents) WriteScenePackData(file, out->tangents, source.tangents, vc * 4 * sizeof(float));
+                if (out->colors) WriteScenePackData(file, out->colors, source.colors, vc * 4);
+                if (out->indices) WriteScenePackData(file, out->indices, source.indices, (uint64_t)out->triangleCount * 3 * sizeof(unsigned short));
+            }
+        }
+        for (int i = 0; i < writer.header.textureCount; i++) {
+            WriteScenePackData(file, writer.textures[i].offset, writer.images[i].image.data, writer.textures[i].size);
+        }
+
+        written = (ferror(file) == 0);
+        fclose(file);
+    }
+
+    printf("scene pack: %d models, %d meshes, %d textures, %.1f MB %s %s\n", count, writer.header.meshCount,
+            writer.header.textureCount, writer.end / (1024.0 * 1024.0), (written) ? "written to" : "could not be written to",
+            fileName);
+
+    for (int i = 0; i < writer.header.textureCount; i++) UnloadImage(writer.images[i].image);
+    RL_FREE(writer.sources);
+    RL_FREE(writer.images);
+    RL_FREE(writer.textures);
+    RL_FREE(writer.materials);
+    RL_FREE(writer.meshes);
+    RL_FREE(writer.models);
+    return written;
+}
+
+
+#endif
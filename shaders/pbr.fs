@@ -2,58 +2,182 @@
 
 precision highp float;
 
-#define MAX_LIGHTS              4
-#define LIGHT_DIRECTIONAL       0
-#define LIGHT_POINT             1
 #define PI 3.14159265358979323846
 
-struct Light {
-    int enabled;
-    int type;
-    vec3 position;
-    vec3 target;
-    vec4 color;
-    float intensity;
-};
+// Material features, defined per variant by shadervariants.h (one program per combination):
+//   ALBEDO_MAP    albedoMap times albedoColor, otherwise albedoColor alone
+//   NORMAL_MAP    normalMap through TBN, otherwise the interpolated normal
+//   MRA_MAP       metallic/roughness/occlusion from mraMap on top of the values
+//   EMISSIVE_MAP  emissiveMap (green) times emissiveColor, otherwise no emission
 
 // Input vertex attributes (from vertex shader)
 varying vec3 fragPosition;
 varying vec2 fragTexCoord;
 varying vec4 fragColor;
 varying vec3 fragNormal;
-varying vec4 shadowPos;
+#if defined(NORMAL_MAP)
 varying mat3 TBN;
+#endif
 
 // Input uniform values
-uniform int numOfLights;
+#if defined(ALBEDO_MAP)
 uniform sampler2D albedoMap;
+#endif
+#if defined(MRA_MAP)
 uniform sampler2D mraMap;
+#endif
+#if defined(NORMAL_MAP)
 uniform sampler2D normalMap;
+#endif
+#if defined(EMISSIVE_MAP)
 uniform sampler2D emissiveMap; // r: Hight g:emissive
+uniform vec4  emissiveColor;
+uniform float emissivePower;
+#endif
 
 uniform vec2 tiling;
 uniform vec2 offset;
 
-uniform int useTexAlbedo;
-uniform int useTexNormal;
-uniform int useTexMRA;
-uniform int useTexEmissive;
-
 uniform vec4  albedoColor;
-uniform vec4  emissiveColor;
-uniform float normalValue;
 uniform float metallicValue;
 uniform float roughnessValue;
 uniform float aoValue;
-uniform float emissivePower;
 
 // Input lighting values
-uniform Light lights[MAX_LIGHTS];
 uniform vec3 viewPos;
 
 uniform vec3 ambientColor;
 uniform float ambient;
 
+// Clustered lights, built by lightclusters.h, the sizes must match it
+#define MAX_LIGHTS_PER_CLUSTER  32
+const float CLUSTER_LIGHT_TEXELS = 2048.0;              // MAX_CLUSTER_LIGHTS*2
+const vec2 CLUSTER_INDEX_SIZE = vec2(512.0, 216.0);     // CLUSTER_INDEX_WIDTH, CLUSTER_INDEX_HEIGHT
+
+uniform sampler2D clusterLights;    // per light (position, range) then (color, intensity)
+uniform sampler2D clusterGrid;      // per cluster offset*64 + count into clusterIndices
+uniform sampler2D clusterIndices;
+uniform vec3 clusterOrigin;
+uniform vec3 clusterForward;
+uniform vec4 clusterScreen;         // (tile width, tile height, tiles x, tiles y) in pixels
+uniform vec4 clusterDepth;          // (first slice depth, slices per log depth, slices, -)
+
+// (offset, count) of the light list of the cluster the fragment at position is in
+vec2 ClusterLights(vec3 position)
+{
+    float depth = max(dot(position - clusterOrigin, clusterForward), clusterDepth.x);
+    float slice = min(floor(log(depth/clusterDepth.x)*clusterDepth.y), clusterDepth.z - 1.0);
+    vec2 tile = min(floor(gl_FragCoord.xy/clusterScreen.xy), clusterScreen.zw - 1.0);
+    vec2 uv = vec2((tile.y*clusterScreen.z + tile.x + 0.5)/(clusterScreen.z*clusterScreen.w), (slice + 0.5)/clusterDepth.z);
+    float cell = texture2D(clusterGrid, uv).r;
+    float first = floor(cell/64.0);
+    return vec2(first, cell - first*64.0);
+}
+
+// Light index at entry of the index list
+float ClusterLightIndex(float entry)
+{
+    float row = floor(entry/CLUSTER_INDEX_SIZE.x);
+    return texture2D(clusterIndices, (vec2(entry - row*CLUSTER_INDEX_SIZE.x, row) + 0.5)/CLUSTER_INDEX_SIZE).r;
+}
+
+vec4 ClusterLightPosition(float index)
+{
+    return texture2D(clusterLights, vec2((2.0*index + 0.5)/CLUSTER_LIGHT_TEXELS, 0.5));
+}
+
+vec4 ClusterLightColor(float index)
+{
+    return texture2D(clusterLights, vec2((2.0*index + 1.5)/CLUSTER_LIGHT_TEXELS, 0.5));
+}
+
+// Fades a light out to nothing at its range
+float ClusterLightFade(float dist, float range)
+{
+    float x = dist/range;
+    float fade = clamp(1.0 - x*x*x*x, 0.0, 1.0);
+    return fade*fade;
+}
+
+// Shadowed lights, drawn by shadowatlas.h, the sizes must match it
+const float SHADOW_ATLAS_TILES = 4.0;
+const float SHADOW_TILE_SIZE = 512.0;
+const float SHADOW_TAN_HALF_FOV = 1.7320508;        // tan(SHADOW_FOV/2)
+const float SHADOW_NEAR = 0.05;
+const float SHADOW_BIAS = 0.02;                     // per unit of depth, on top of the same again
+
+uniform sampler2D shadowStatic;     // depth of the city seen down from each light, a tile per light
+uniform sampler2D shadowDynamic;    // the same for the car, redrawn every frame
+uniform float shadowLightCount;     // the first lights of the clusters are the shadowed ones, in tile order
+
+// Distance below the light of a depth buffer value of its tile
+float ShadowDepth(float depth, float far)
+{
+    float n = SHADOW_NEAR;
+    return 2.0*n*far/(far + n - (2.0*depth - 1.0)*(far - n));
+}
+
+// How much of the light at index reaches a fragment offset from it, 2x2 texels compared
+// Outside the view down from the light nothing is shadowed
+float LightShadow(float index, vec3 offset, float range)
+{
+    float depth = -offset.y;
+    vec2 ndc = vec2(offset.x, -offset.z)/(depth*SHADOW_TAN_HALF_FOV);
+    if (depth <= SHADOW_NEAR || abs(ndc.x) >= 1.0 || abs(ndc.y) >= 1.0) return 1.0;
+
+    float row = floor(index/SHADOW_ATLAS_TILES);
+    vec2 tile = vec2(index - row*SHADOW_ATLAS_TILES, row)*SHADOW_TILE_SIZE;
+    vec2 texel = clamp((ndc*0.5 + 0.5)*SHADOW_TILE_SIZE, 1.0, SHADOW_TILE_SIZE - 1.0);
+    float bias = SHADOW_BIAS*(depth + 1.0);
+
+    float lit = 0.0;
+    for (int i = 0; i < 4; i++)
+    {
+        vec2 tap = vec2(mod(float(i), 2.0), floor(float(i)/2.0)) - 0.5;
+        vec2 uv = (tile + texel + tap)/(SHADOW_ATLAS_TILES*SHADOW_TILE_SIZE);
+        float occluder = min(texture2D(shadowStatic, uv).r, texture2D(shadowDynamic, uv).r);
+        lit += step(depth - bias, ShadowDepth(occluder, range));
+    }
+    return lit*0.25;
+}
+
+// Puddles, reflecting the scene drawn mirrored in the ground by planarreflection.h
+const float PUDDLE_TOLERANCE = 0.05;                // how far over the plane ground fragments may be
+const float RIPPLE_DISTORTION = 0.03;               // reflection offset per unit of ripple slope, in screens
+
+uniform sampler2D reflectionMap;    // at a fraction of the screen resolution, maybe a few frames old
+uniform sampler2D puddleMask;       // r: how wet the ground is, tiled over x/z
+uniform mat4 reflectionMatrix;      // view-projection the reflection was drawn with
+uniform float puddleHeight;         // of the reflection plane
+uniform float puddleScale;          // mask repeats per world unit
+uniform float puddleStrength;       // 0 for no puddles, also while the reflection is drawn
+uniform sampler2D rippleMap;        // ra: x/z slope of the rain ripples (ripples.h), tiled over x/z
+uniform float rippleScale;          // ripple map repeats per world unit
+uniform float rippleStrength;       // 0 where the ripples have no texture unit
+
+// Color with the reflection over it where the fragment is flat ground in a puddle
+// Water reflects little looking down into it and nearly everything at grazing angles
+vec3 Puddles(vec3 color)
+{
+    if (puddleStrength <= 0.0) return color;
+
+    // the mask is read before any per fragment branch, its mip level needs derivatives
+    float wet = texture2D(puddleMask, fragPosition.xz*puddleScale).r*puddleStrength;
+    if (wet <= 0.0 || fragPosition.y > puddleHeight + PUDDLE_TOLERANCE || fragNormal.y < 0.9) return color;
+
+    // ripples tilt the water, the reflection shifts with the slope
+    vec2 slope = (texture2D(rippleMap, fragPosition.xz*rippleScale).ra*2.0 - 1.0)*rippleStrength;
+    vec3 N = normalize(vec3(-slope.x, 1.0, -slope.y));
+
+    // ground points are their own mirror image, projecting them finds them in the reflection
+    vec4 clip = reflectionMatrix*vec4(fragPosition, 1.0);
+    vec3 reflection = texture2D(reflectionMap, clip.xy/clip.w*0.5 + 0.5 + slope*RIPPLE_DISTORTION).rgb;
+
+    float cosView = max(dot(N, normalize(viewPos - fragPosition)), 0.0);
+    float fresnel = 0.02 + 0.98*pow(1.0 - cosView, 5.0);
+    return mix(color, reflection, wet*fresnel);
+}
+
 // Reflectivity in range 0.0 to 1.0
 // NOTE: Reflectivity is increased when surface view at larger angle
 vec3 SchlickFresnel(float hDotV,vec3 refl)
@@ -81,46 +205,60 @@ float GeomSmith(float nDotV,float nDotL,float roughness)
 
 vec3 ComputePBR()
 {
-    vec3 albedo = texture2D(albedoMap, vec2(fragTexCoord.x*tiling.x + offset.x, fragTexCoord.y*tiling.y + offset.y)).rgb;
-    albedo = vec3(albedoColor.x*albedo.x, albedoColor.y*albedo.y, albedoColor.z*albedo.z);
-    
+    vec2 uv = fragTexCoord*tiling + offset;
+
+    vec3 albedo = albedoColor.rgb;
+#if defined(ALBEDO_MAP)
+    albedo *= texture2D(albedoMap, uv).rgb;
+#endif
+
+#if defined(MRA_MAP)
+    vec4 mra = texture2D(mraMap, uv);
+    float metallic = clamp(mra.r + metallicValue, 0.04, 1.0);
+    float roughness = clamp(mra.g + roughnessValue, 0.04, 1.0);
+    float ao = (mra.b + aoValue)*0.5;
+#else
     float metallic = clamp(metallicValue, 0.0, 1.0);
     float roughness = clamp(roughnessValue, 0.0, 1.0);
     float ao = clamp(aoValue, 0.0, 1.0);
-    
-    if (useTexMRA == 1)
-    {
-        vec4 mra = texture2D(mraMap, vec2(fragTexCoord.x*tiling.x + offset.x, fragTexCoord.y*tiling.y + offset.y));
-        metallic = clamp(mra.r + metallicValue, 0.04, 1.0);
-        roughness = clamp(mra.g + roughnessValue, 0.04, 1.0);
-        ao = (mra.b + aoValue)*0.5;
-    }
+#endif
 
+#if defined(NORMAL_MAP)
+    vec3 N = texture2D(normalMap, uv).rgb;
+    N = normalize(N*2.0 - 1.0);
+    N = normalize(N*TBN);
+#else
     vec3 N = normalize(fragNormal);
-    if (useTexNormal == 1)
-    {
-        N = texture2D(normalMap, vec2(fragTexCoord.x*tiling.x + offset.y, fragTexCoord.y*tiling.y + offset.y)).rgb;
-        N = normalize(N*2.0 - 1.0);
-        N = normalize(N*TBN);
-    }
+#endif
 
     vec3 V = normalize(viewPos - fragPosition);
 
-    vec3 emissive = vec3(0);
-    emissive = (texture2D(emissiveMap, vec2(fragTexCoord.x*tiling.x + offset.x, fragTexCoord.y*tiling.y + offset.y)).rgb).g*emissiveColor.rgb*emissivePower*float(useTexEmissive);
+#if defined(EMISSIVE_MAP)
+    vec3 emissive = texture2D(emissiveMap, uv).g*emissiveColor.rgb*emissivePower;
+#else
+    vec3 emissive = vec3(0.0);
+#endif
 
     // return N;//vec3(metallic,metallic,metallic);
     // If  dia-electric use base reflectivity of 0.04 otherwise ut is a metal use albedo as base reflectivity
     vec3 baseRefl = mix(vec3(0.04), albedo.rgb, metallic);
     vec3 lightAccum = vec3(0.0);  // Acumulate lighting lum
 
-    for (int i = 0; i < 4; i++)
+    // only the lights reaching this fragment's cluster
+    vec2 cluster = ClusterLights(fragPosition);
+    for (int i = 0; i < MAX_LIGHTS_PER_CLUSTER; i++)
     {
-        vec3 L = normalize(lights[i].position - fragPosition);      // Compute light vector
+        if (float(i) >= cluster.y) break;
+        float index = ClusterLightIndex(cluster.x + float(i));
+        vec4 light = ClusterLightPosition(index);
+        vec4 lightColor = ClusterLightColor(index);
+
+        vec3 L = normalize(light.xyz - fragPosition);               // Compute light vector
         vec3 H = normalize(V + L);                                  // Compute halfway bisecting vector
-        float dist = length(lights[i].position - fragPosition);     // Compute distance to light
-        float attenuation = 1.0/(dist*dist*0.23);                   // Compute attenuation
-        vec3 radiance = lights[i].color.rgb*lights[i].intensity*attenuation; // Compute input radiance, light energy comming in
+        float dist = length(light.xyz - fragPosition);              // Compute distance to light
+        float attenuation = ClusterLightFade(dist, light.w)/(dist*dist*0.23); // Compute attenuation
+        vec3 radiance = lightColor.rgb*lightColor.a*attenuation;   // Compute input radiance, light energy comming in
+        if (index < shadowLightCount) radiance *= LightShadow(index, fragPosition - light.xyz, light.w);
 
         // Cook-Torrance BRDF distribution function
         float nDotV = max(dot(N,V), 0.0000001);
@@ -139,7 +277,7 @@ vec3 ComputePBR()
         
         // Mult kD by the inverse of metallnes, only non-metals should have diffuse light
         kD *= 1.0 - metallic;
-        lightAccum += ((kD*albedo.rgb/PI + spec)*radiance*nDotL)*float(lights[i].enabled); // Angle of light has impact on result
+        lightAccum += (kD*albedo.rgb/PI + spec)*radiance*nDotL;  // Angle of light has impact on result
     }
     
     vec3 ambientFinal = (ambientColor + albedo)*ambient*0.5;
@@ -157,5 +295,8 @@ void main()
     // Gamma correction
     color = pow(color, vec3(1.0/2.2));
 
+    // after tonemapping, the reflection went through it already
+    color = Puddles(color);
+
     gl_FragColor = vec4(color,1.0);
 }
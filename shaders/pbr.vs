@@ -19,7 +19,9 @@ varying vec3 fragPosition;
 varying vec2 fragTexCoord;
 varying vec4 fragColor;
 varying vec3 fragNormal;
-varying mat3 TBN;
+#if defined(NORMAL_MAP)
+varying mat3 TBN;               // only variants with a normal map use it, see pbr.fs
+#endif
 
 const float normalOffset = 0.1;
 
@@ -51,9 +53,6 @@ mat3 transpose(mat3 m)
 
 void main()
 {
-    // Compute binormal from vertex normal and tangent
-    vec3 vertexBinormal = cross(vertexNormal, vertexTangent);
-
     // Compute fragment normal based on normal transformations
     mat3 normalMatrix = transpose(inverse(mat3(matModel)));
 
@@ -62,12 +61,16 @@ void main()
 
     fragTexCoord = vertexTexCoord*2.0;
     fragNormal = normalize(normalMatrix*vertexNormal);
+#if defined(NORMAL_MAP)
+    // Compute binormal from vertex normal and tangent
+    vec3 vertexBinormal = cross(vertexNormal, vertexTangent);
     vec3 fragTangent = normalize(normalMatrix*vertexTangent);
     fragTangent = normalize(fragTangent - dot(fragTangent, fragNormal)*fragNormal);
     vec3 fragBinormal = normalize(normalMatrix*vertexBinormal);
     fragBinormal = cross(fragNormal, fragTangent);
 
     TBN = transpose(mat3(fragTangent, fragBinormal, fragNormal));
+#endif
 
     // Calculate final vertex position
     gl_Position = mvp*vec4(vertexPosition, 1.0);
@@ -1,117 +1,67 @@
 #version 100
 
 
-precision mediump float;
+// highp for the weights, a light right next to a drop goes past what mediump holds
+precision highp float;
 
 // Input vertex attributes (from vertex shader)
-varying vec3 fragPosition;
-varying vec2 fragTexCoord;
-varying vec4 fragColor;
-varying vec3 fragNormal;
-varying vec3 particalPos;
+// Streaks and their weights are picked per drop in rain.vs
+varying vec4 fragTexCoord;      // xy within a streak cell, zw atlas offset of the front lit streak
+varying vec4 streakOffsets01;
+varying vec4 streakOffsets23;
+varying vec4 frontWeight;
+varying vec4 lightWeight0;
+varying vec4 lightWeight1;
+varying vec4 lightWeight2;
+varying vec4 lightWeight3;
 
 // Input uniform values
 uniform sampler2D texture0;
-uniform vec4 colDiffuse;
 
 // NOTE: Add your custom variables here
 
-#define     MAX_LIGHTS              4
-#define     LIGHT_DIRECTIONAL       0
-#define     LIGHT_POINT             1
+// Scene depth when the rain is drawn at reduced resolution, see raintarget.h
+uniform sampler2D sceneDepth;
+uniform vec2 sceneDepthTexel;       // 1/size of the target the rain is drawn into, zero when the depth test does it
+uniform vec2 clipPlanes;            // (near, far)
 
-struct Light {
-    int enabled;
-    int type;
-    vec3 position;
-    vec3 target;
-    vec4 color;
-    float intensity; 
-};
-
-// Input lighting values
-uniform Light lights[MAX_LIGHTS];
-uniform vec4 ambient;
-uniform vec3 viewPos;
-
-
-
-const float SLICE_WIDTH = 1.0 / 9.0;
+// View distance of a depth buffer value
+float LinearDepth(float depth)
+{
+    float n = clipPlanes.x;
+    float f = clipPlanes.y;
+    return 2.0*n*f/(f + n - (2.0*depth - 1.0)*(f - n));
+}
 
 
 void main()
 {
-
-    vec2 newTexCoord = vec2(fragTexCoord.x / 9.0, fragTexCoord.y);
-
-    // Texel color fetching from texture sampler
-    // vec4 texelColor = texture2D(texture0, newTexCoord);
-
-    // start off with ambient light
-    vec4 texelColor = texture2D(texture0, newTexCoord) * ambient;
-    vec3 lightDot = vec3(0.0);
-    vec3 normal = normalize(fragNormal);
-    vec3 viewD = normalize(viewPos - fragPosition);
-    vec3 specular = vec3(0.0);
-
-    vec4 tint = colDiffuse * fragColor;
-
-
-    for (int i = 0; i < MAX_LIGHTS; i++)
+    // the reduced target has no depth of the scene, behind it is tested here
+    if (sceneDepthTexel.x > 0.0)
     {
-         if (lights[i].enabled == 1)
-         {
-                vec3 light = vec3(0.0);
-                float distance = 0.0;
- 
-                if (lights[i].type == LIGHT_DIRECTIONAL)
-                {
-                    light = (lights[i].target - lights[i].position);
-                    distance = length(light);
-                    light = -normalize(light);
-                }
-    
-                if (lights[i].type == LIGHT_POINT)
-                {
-                    light = lights[i].position - fragPosition;
-                    distance = length(light);
-                    light = normalize(light);
-                }
-
-            
-                float intensity = 5.0  / (distance * distance);
-                intensity *= lights[i].intensity;
-
-                // angle between the camera and light on the xz plane
-                float camToLight = acos(dot(normalize(vec2(light.xz)), normalize(vec2(viewD.xz))));
-
-
-                int section = int(camToLight / 2.0 /3.1415962 * 9.0);
-
-                // offset into texture
-                vec2 sectionTexCoord = newTexCoord;
-                 sectionTexCoord.x += SLICE_WIDTH * float(section);
-
+        float scene = texture2D(sceneDepth, gl_FragCoord.xy*sceneDepthTexel).r;
+        if (LinearDepth(gl_FragCoord.z) > LinearDepth(scene)) discard;
+    }
 
-                vec4 color = texture2D(texture0, sectionTexCoord);
-                color *= intensity;
-                color *= lights[i].color;
-                texelColor += color;
-                
+    // far drops are thinned out, the weights already scale the rest back up
+    vec2 uv = fragTexCoord.xy;
+    vec4 finalColor = texture2D(texture0, uv + fragTexCoord.zw)*frontWeight;
 
-//              float NdotL = max(dot(normal, light), 0.0);
-//              lightDot += lights[i].color.rgb*NdotL;
- 
-//              float specCo = 0.0;
-//              if (NdotL > 0.0) specCo = pow(max(0.0, dot(viewD, reflect(-(light), normal))), 16.0); // 16 refers to shine
-//              specular += specCo;
+    // lights fill the slots brightest first, the first empty one ends them
+    if (lightWeight0.a > 0.0)
+    {
+        finalColor += texture2D(texture0, uv + streakOffsets01.xy)*lightWeight0;
+        if (lightWeight1.a > 0.0)
+        {
+            finalColor += texture2D(texture0, uv + streakOffsets01.zw)*lightWeight1;
+            if (lightWeight2.a > 0.0)
+            {
+                finalColor += texture2D(texture0, uv + streakOffsets23.xy)*lightWeight2;
+                if (lightWeight3.a > 0.0) finalColor += texture2D(texture0, uv + streakOffsets23.zw)*lightWeight3;
+            }
         }
     }
 
-    vec4 finalColor = texelColor;
-//     vec4 finalColor = (texelColor*((tint + vec4(specular, 1.0))*vec4(lightDot, 1.0)));
-//     finalColor += texelColor*(ambient/5.0);
-
     // Gamma correction
     gl_FragColor = pow(finalColor, vec4(1.0/2.2));
 }
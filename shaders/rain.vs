@@ -5,92 +5,235 @@
 // Input vertex attributes
 attribute vec3 vertexPosition;
 attribute vec2 vertexTexCoord;
-attribute vec3 vertexNormal;
-attribute vec4 vertexColor;
 
-attribute mat4 instanceTransform;
+// Per drop attributes: xyz world position, w random value in [0, 1)
+attribute vec4 instanceData;
 
 // Input uniform values
 uniform mat4 mvp;
-uniform mat4 matNormal;
 
 // Output vertex attributes (to fragment shader)
-varying vec3 fragPosition;
-varying vec2 fragTexCoord;
-varying vec4 fragColor;
-varying vec3 fragNormal;
-varying vec3 particalPos;
+// The lighting is the same along a whole streak, so it is worked out here once per drop: the streak
+// picked from the atlas for each light and the color it is added with. rain.fs only fetches and sums.
+varying vec4 fragTexCoord;      // xy within a streak cell, zw atlas offset of the front lit streak
+varying vec4 streakOffsets01;   // atlas offsets of the streaks of the brightest two lights
+varying vec4 streakOffsets23;   // and of the next two
+varying vec4 frontWeight;       // ambient and every light past the brightest four, on the front lit streak
+varying vec4 lightWeight0;      // brightest light first, zero when the drop has fewer lights
+varying vec4 lightWeight1;
+varying vec4 lightWeight2;
+varying vec4 lightWeight3;
 
-
-// Rain offset, used to animate rain position
-uniform float rainoffset; // (0, 1)
-uniform float travelheight; // must be 1/2 height of rain bounds
 uniform vec3 campos;
 
+// Input lighting values
+uniform vec4 ambient;
 
-void main()
+// Horizontal distances where far drops are thinned out on the cpu
+uniform vec2 lodDistance; // (mid, far)
+
+// Highest surface of the scene on x/z, see heightmap.h
+uniform sampler2D heightMap;
+uniform vec2 heightMapOrigin; // world x/z of the map corner
+uniform vec2 heightMapSize;   // world size of the map
+
+// Streak atlas axes as (first, step, count), see rainatlas.h
+uniform vec3 streakView;
+uniform vec3 streakVertical;
+uniform vec3 streakHorizontal;
+uniform vec3 streakOscillation;
+
+// Clustered lights, built by lightclusters.h, the sizes must match it
+#define MAX_LIGHTS_PER_CLUSTER  32
+const float CLUSTER_LIGHT_TEXELS = 2048.0;              // MAX_CLUSTER_LIGHTS*2
+const vec2 CLUSTER_INDEX_SIZE = vec2(512.0, 216.0);     // CLUSTER_INDEX_WIDTH, CLUSTER_INDEX_HEIGHT
+
+uniform sampler2D clusterLights;    // per light (position, range) then (color, intensity)
+uniform sampler2D clusterGrid;      // per cluster offset*64 + count into clusterIndices
+uniform sampler2D clusterIndices;
+uniform vec3 clusterOrigin;
+uniform vec3 clusterForward;
+uniform vec4 clusterScreen;         // (tile width, tile height, tiles x, tiles y) in pixels
+uniform vec4 clusterDepth;          // (first slice depth, slices per log depth, slices, -)
+
+const float STREAK_WIDTH = 0.05;
+const float STREAK_LENGTH = 1.0;
+
+// Share of drops kept past each LOD distance, must match RAIN_LOD_* in raininstances.h
+const float LOD_MID_DENSITY = 0.5;
+const float LOD_FAR_DENSITY = 0.25;
+
+// Height of empty texels, must match RAIN_HEIGHTMAP_EMPTY in heightmap.h
+const float HEIGHTMAP_EMPTY = -1000000.0;
+
+
+// (offset, count) of the light list of the cluster at position, pixel is where it is on the target
+vec2 ClusterLights(vec3 position, vec2 pixel)
 {
-    particalPos = (instanceTransform * vec4(1.0)).xyz;
-    vec4 position = vec4(vertexPosition, 1.0);
-
-    // interp accross (-travelheight, travelheight) without division
-    float offset = ( travelheight * rainoffset * 2.0 ) - travelheight;
-
-    // plane faces straight up, we must point it towards camera
-    vec3 instancePos = (
-            instanceTransform * 
-            (vec4(1.0) + vec4(0.0, offset, 0.0, 1.0))
-        ).xyz ;
-    
-    // vec from plane center to camera
-    vec3 d = campos - instancePos;
-    // vec3 d = campos - vec3(0.0);
+    float depth = max(dot(position - clusterOrigin, clusterForward), clusterDepth.x);
+    float slice = min(floor(log(depth/clusterDepth.x)*clusterDepth.y), clusterDepth.z - 1.0);
+    vec2 tile = clamp(floor(pixel/clusterScreen.xy), vec2(0.0), clusterScreen.zw - 1.0);
+    vec2 uv = vec2((tile.y*clusterScreen.z + tile.x + 0.5)/(clusterScreen.z*clusterScreen.w), (slice + 0.5)/clusterDepth.z);
+    float cell = texture2D(clusterGrid, uv).r;
+    float first = floor(cell/64.0);
+    return vec2(first, cell - first*64.0);
+}
 
-    // billboarding to face the camera
-    vec3 up = vec3(0.0, 1.0, 0.0); // fixed up direction
+// Light index at entry of the index list
+float ClusterLightIndex(float entry)
+{
+    float row = floor(entry/CLUSTER_INDEX_SIZE.x);
+    return texture2D(clusterIndices, (vec2(entry - row*CLUSTER_INDEX_SIZE.x, row) + 0.5)/CLUSTER_INDEX_SIZE).r;
+}
 
-    vec3 newz = normalize(d); // towards eye
-    vec3 newy = normalize(cross(d, up)); // towards right
-    vec3 newx = cross(newy, newz); // towards top of screen
-    // newx is already normalized
-    
-    mat4 billboardMat = mat4(
-        vec4(newy, 0.0),
-        vec4(newx, 0.0),
-        vec4(newz, 0.0),
-        vec4(0.0, 0.0, 0.0, 1.0)
-    );
+vec4 ClusterLightPosition(float index)
+{
+    return texture2D(clusterLights, vec2((2.0*index + 0.5)/CLUSTER_LIGHT_TEXELS, 0.5));
+}
 
-    // apply squish
-    mat4 scalemat = mat4(
-        0.05, 0.0, 0.0, 0.0,
-        0.0, 1.0, 0.0, 0.0,
-        0.0, 0.0, 1.0, 0.0,
-        0.0, 0.0, 0.0, 1.0
-    );
-    position = scalemat * position;
+vec4 ClusterLightColor(float index)
+{
+    return texture2D(clusterLights, vec2((2.0*index + 1.5)/CLUSTER_LIGHT_TEXELS, 0.5));
+}
 
+// Fades a light out to nothing at its range
+float ClusterLightFade(float dist, float range)
+{
+    float x = dist/range;
+    float fade = clamp(1.0 - x*x*x*x, 0.0, 1.0);
+    return fade*fade;
+}
 
-    // apply bilboard transformation
-    position = billboardMat * position;
-    
+float StreakIndex(vec3 axis, float value)
+{
+    return clamp(floor((value - axis.x)/max(axis.y, 0.0001) + 0.5), 0.0, axis.z - 1.0);
+}
+
+// Atlas offset of the streak lit from the given angles (degrees) around the drop
+// cell is the (oscillation, view) index of the drop, grid the size of the atlas in streaks
+vec2 StreakOffset(vec2 cell, vec2 grid, float horizontal, float vertical)
+{
+    return vec2(StreakIndex(streakHorizontal, horizontal)*streakOscillation.z + cell.x,
+                cell.y*streakVertical.z + StreakIndex(streakVertical, vertical))/grid;
+}
+
+float Brightness(vec4 weight)
+{
+    return max(weight.r, max(weight.g, weight.b));
+}
+
+// Swap the light into the slot when it is the brighter one, the dimmer one goes on to the next slot
+void KeepBrighter(inout vec4 weight, inout vec2 offset, inout vec4 slotWeight, inout vec2 slotOffset)
+{
+    if (Brightness(weight) > Brightness(slotWeight))
+    {
+        vec4 w = slotWeight;
+        vec2 o = slotOffset;
+        slotWeight = weight;
+        slotOffset = offset;
+        weight = w;
+        offset = o;
+    }
+}
+
+float SurfaceHeight(vec2 xz)
+{
+    vec2 uv = (xz - heightMapOrigin)/heightMapSize;
+    if (uv.x < 0.0 || uv.y < 0.0 || uv.x > 1.0 || uv.y > 1.0) return HEIGHTMAP_EMPTY;
+    return texture2D(heightMap, uv).r;
+}
+
+
+void main()
+{
+    // drop position is simulated on the cpu
+    vec3 instancePos = instanceData.xyz;
 
-    // offset the rain position on y axis 
-    position.y = position.y + offset;
+    // quad lies in the xy plane, we must point it towards camera
 
+    // vec from plane center to camera
+    vec3 d = campos - instancePos;
 
+    // billboarding to face the camera
+    vec3 up = vec3(0.0, 1.0, 0.0); // fixed up direction
 
-    // Compute MVP for current instance
-    mat4 mvpi = mvp*instanceTransform;
+    vec3 newz = normalize(d); // towards eye
+    vec3 newx = normalize(cross(up, d)); // towards right
+    vec3 newy = cross(newz, newx); // towards top of screen
+    // newy is already normalized
+
+    // apply squish, vary the streak length a little per drop
+    float streakLength = STREAK_LENGTH * (0.8 + 0.4 * instanceData.w);
+    vec3 position = instancePos
+        + newx * vertexPosition.x * STREAK_WIDTH
+        + newy * vertexPosition.y * streakLength;
+
+    // cut the streak off where it goes into a roof or the ground
+    position.y = max(position.y, SurfaceHeight(instancePos.xz));
+
+    // thinned out drops stand in for the ones that were dropped
+    float horizontal = length(d.xz);
+    float density = 1.0;
+    if (horizontal >= lodDistance.x) density = LOD_MID_DENSITY;
+    if (horizontal >= lodDistance.y) density = LOD_FAR_DENSITY;
+    vec4 thinning = vec4(vec3(1.0 / density), 1.0);
+
+    // each drop keeps one oscillation, the view angle is the camera elevation seen from the drop
+    float viewAngle = degrees(asin(clamp(abs(newz.y), 0.0, 1.0)));
+    vec2 cell = vec2(floor(instanceData.w*streakOscillation.z), StreakIndex(streakView, viewAngle));
+    vec2 grid = vec2(streakHorizontal.z*streakOscillation.z, streakView.z*streakVertical.z);
+
+    // start off with ambient light, as if lit from straight ahead
+    fragTexCoord = vec4(vertexTexCoord/grid, StreakOffset(cell, grid, 0.0, 0.0));
+    vec4 front = ambient*thinning;
+    vec4 weight0 = vec4(0.0), weight1 = vec4(0.0), weight2 = vec4(0.0), weight3 = vec4(0.0);
+    vec2 offset0 = vec2(0.0), offset1 = vec2(0.0), offset2 = vec2(0.0), offset3 = vec2(0.0);
+
+    // the lights of the cluster the middle of the drop is in
+    vec4 center = mvp*vec4(instancePos, 1.0);
+    vec2 cluster = vec2(0.0);
+    if (center.w > 0.0) cluster = ClusterLights(instancePos, (center.xy/center.w*0.5 + 0.5)*clusterScreen.xy*clusterScreen.zw);
+
+    for (int i = 0; i < MAX_LIGHTS_PER_CLUSTER; i++)
+    {
+        if (float(i) >= cluster.y) break;
+
+        float index = ClusterLightIndex(cluster.x + float(i));
+        vec4 lightPosition = ClusterLightPosition(index);
+        vec4 lightColor = ClusterLightColor(index);
+
+        vec3 light = lightPosition.xyz - instancePos;
+        float distance = length(light);
+        light = normalize(light);
+
+        float intensity = 5.0  / (distance * distance);
+        intensity *= lightColor.a * ClusterLightFade(distance, lightPosition.w);
+        if (intensity <= 0.0) continue;
+
+        // angle between the camera and light on the xz plane, and of the light above the drop
+        float camToLight = degrees(acos(clamp(dot(normalize(vec2(light.xz)), normalize(vec2(d.xz))), -1.0, 1.0)));
+        float lightElevation = degrees(asin(clamp(light.y, -1.0, 1.0)));
+
+        vec4 weight = vec4(lightColor.rgb, 1.0)*intensity*thinning;
+        vec2 offset = StreakOffset(cell, grid, camToLight, lightElevation);
+
+        // the brightest four keep their own streak, the rest are added to the front lit one
+        KeepBrighter(weight, offset, weight0, offset0);
+        KeepBrighter(weight, offset, weight1, offset1);
+        KeepBrighter(weight, offset, weight2, offset2);
+        KeepBrighter(weight, offset, weight3, offset3);
+        front += weight;
+    }
 
     // Send vertex attributes to fragment shader
-    fragPosition = vec3(mvpi*position);
-    fragTexCoord = vertexTexCoord;
-    fragColor = vertexColor;
-    fragNormal = newz;
-    // fragNormal = normalize(vec3(matNormal*vec4(vertexNormal, 1.0)));
+    streakOffsets01 = vec4(offset0, offset1);
+    streakOffsets23 = vec4(offset2, offset3);
+    frontWeight = front;
+    lightWeight0 = weight0;
+    lightWeight1 = weight1;
+    lightWeight2 = weight2;
+    lightWeight3 = weight3;
 
     // Calculate final vertex position
-    gl_Position = mvpi*position;
+    gl_Position = mvp*vec4(position, 1.0);
 }
-
@@ -0,0 +1,23 @@
+#version 100
+
+
+precision mediump float;
+
+// Input vertex attributes (from vertex shader)
+varying vec2 fragTexCoord;
+varying float fragFade;
+
+// Input uniform values
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+
+
+void main()
+{
+    // atlas frames already fade out, fragFade smooths the steps between them
+    vec4 texelColor = texture2D(texture0, fragTexCoord);
+    vec4 finalColor = texelColor*colDiffuse*texelColor.a*fragFade;
+
+    // Gamma correction
+    gl_FragColor = pow(finalColor, vec4(1.0/2.2));
+}
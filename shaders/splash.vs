@@ -0,0 +1,54 @@
+#version 100
+
+
+
+// Input vertex attributes
+attribute vec3 vertexPosition;
+attribute vec2 vertexTexCoord;
+
+// Per splash attributes: xyz impact position, w pool time of the impact
+attribute vec4 instanceData;
+
+// Input uniform values
+uniform mat4 mvp;
+uniform vec3 campos;
+uniform float splashTime;
+
+// Output vertex attributes (to fragment shader)
+varying vec2 fragTexCoord;
+varying float fragFade;
+
+// Must match SPLASH_* in splashes.h
+const float SPLASH_LIFETIME = 0.3;
+const float ATLAS_COLUMNS = 4.0;
+const float ATLAS_ROWS = 2.0;
+
+const float SPLASH_SIZE = 0.25;
+
+
+void main()
+{
+    vec3 splashPos = instanceData.xyz;
+    float age = clamp((splashTime - instanceData.w)/SPLASH_LIFETIME, 0.0, 0.999);
+
+    // random value per splash from its position
+    float seed = fract(sin(dot(splashPos.xz, vec2(12.9898, 78.233)))*43758.5453);
+
+    // stay upright and turn around y to face the camera
+    vec3 d = campos - splashPos;
+    vec3 right = normalize(vec3(d.z, 0.0, -d.x));
+
+    float size = SPLASH_SIZE*(0.7 + 0.6*seed);
+    vec3 position = splashPos
+        + right*vertexPosition.x*size
+        + vec3(0.0, vertexPosition.y*size, 0.0);
+
+    // pick the atlas frame for this age
+    float frame = floor(age*ATLAS_COLUMNS*ATLAS_ROWS);
+    vec2 cell = vec2(mod(frame, ATLAS_COLUMNS), floor(frame/ATLAS_COLUMNS));
+
+    fragTexCoord = (cell + vertexTexCoord)/vec2(ATLAS_COLUMNS, ATLAS_ROWS);
+    fragFade = 1.0 - age;
+
+    gl_Position = mvp*vec4(position, 1.0);
+}
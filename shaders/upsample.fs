@@ -0,0 +1,56 @@
+#version 100
+
+
+// highp for the depths, mediump cannot tell the far ones apart
+precision highp float;
+
+// Input vertex attributes (from vertex shader)
+varying vec2 fragTexCoord;
+varying vec4 fragColor;
+
+// Input uniform values
+uniform sampler2D texture0;         // reduced resolution rain, point filtered
+uniform sampler2D sceneDepth;       // full resolution scene depth
+uniform vec2 rainSize;              // size of texture0 in pixels
+uniform vec2 clipPlanes;            // (near, far)
+
+// Keeps the weights finite where the depths match exactly
+const float DEPTH_EPSILON = 0.01;
+
+
+// View distance of a depth buffer value
+float LinearDepth(float depth)
+{
+    float n = clipPlanes.x;
+    float f = clipPlanes.y;
+    return 2.0*n*f/(f + n - (2.0*depth - 1.0)*(f - n));
+}
+
+
+void main()
+{
+    float depth = LinearDepth(texture2D(sceneDepth, fragTexCoord).r);
+
+    // the four rain pixels around this one and how far it is between them
+    vec2 position = fragTexCoord*rainSize - 0.5;
+    vec2 base = floor(position);
+    vec2 f = position - base;
+
+    vec4 color = vec4(0.0);
+    float total = 0.0;
+    for (int i = 0; i < 4; i++)
+    {
+        vec2 offset = vec2(mod(float(i), 2.0), floor(float(i)/2.0));
+        vec2 uv = (clamp(base + offset, vec2(0.0), rainSize - 1.0) + 0.5)/rainSize;
+
+        // bilinear weight, lowered the further the scene under that rain pixel is from the scene under this one
+        vec2 b = mix(1.0 - f, f, offset);
+        float difference = abs(LinearDepth(texture2D(sceneDepth, uv).r) - depth)/depth;
+        float weight = b.x*b.y/(DEPTH_EPSILON + difference);
+
+        color += texture2D(texture0, uv)*weight;
+        total += weight;
+    }
+
+    gl_FragColor = color/max(total, 0.0001);
+}
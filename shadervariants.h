@@ -0,0 +1,146 @@
+/*
+ * ShaderVariants
+ *
+ * Compile time permutations of one shader. The sources are read once and
+ * each variant is compiled with a #define for every feature bit it has,
+ * inserted right after the #version line, so the shader can #ifdef away the
+ * texture fetches and math a material does not use instead of branching on
+ * uniforms in the fragment hot path.
+ *
+ * Variants are compiled the first time they are asked for and kept, keyed
+ * by their feature mask. Materials pick theirs at load, so nothing compiles
+ * mid frame. GLSL 100 has no program binaries (without extensions), the
+ * cache lives as long as the ShaderVariants does.
+ *
+ * Each variant has its own uniform cache (uniforms.h) and the locations of
+ * the uniforms named at load, in the same order. SetShaderVariantsUniform()
+ * sets a value on every variant, and like SetShaderUniform() only uploads
+ * to the programs where it changed.
+ *
+ */
+
+#ifndef SHADERVARIANTS_H
+#define SHADERVARIANTS_H
+
+#include "raylib.h"
+#include "rlgl.h"
+#include <stdio.h>
+#include <string.h>
+#include "uniforms.h"
+
+#define MAX_SHADER_VARIANTS 16
+#define MAX_SHADER_FEATURES 8
+#define MAX_SHADER_VARIANT_UNIFORMS 8
+
+
+typedef struct ShaderVariant {
+    unsigned int features;      // feature bits, bit i defines features[i]
+    Shader shader;
+    ShaderUniforms uniforms;
+    int locs[MAX_SHADER_VARIANT_UNIFORMS];  // of the uniforms named at load, -1 where the variant has none
+} ShaderVariant;
+
+typedef struct ShaderVariants {
+    char *vsCode;               // NULL for raylib's default vertex shader
+    char *fsCode;
+    const char *features[MAX_SHADER_FEATURES];
+    int featureCount;
+    const char *uniforms[MAX_SHADER_VARIANT_UNIFORMS];
+    int uniformCount;
+    ShaderVariant variants[MAX_SHADER_VARIANTS];
+    int count;
+} ShaderVariants;
+
+
+// Sources of vsFileName and fsFileName, compiled per feature mask by GetShaderVariant
+// features are the defines for the feature bits, uniforms the names looked up in every variant
+// NOTE: the name arrays are not copied, they have to outlive the variants
+ShaderVariants LoadShaderVariants(const char *vsFileName, const char *fsFileName, const char **features, int featureCount,
+        const char **uniforms, int uniformCount) {
+    ShaderVariants variants = { 0 };
+    if (vsFileName != NULL) variants.vsCode = LoadFileText(vsFileName);
+    if (fsFileName != NULL) variants.fsCode = LoadFileText(fsFileName);
+
+    variants.featureCount = (featureCount < MAX_SHADER_FEATURES) ? featureCount : MAX_SHADER_FEATURES;
+    for (int i = 0; i < variants.featureCount; i++) variants.features[i] = features[i];
+    variants.uniformCount = (uniformCount < MAX_SHADER_VARIANT_UNIFORMS) ? uniformCount : MAX_SHADER_VARIANT_UNIFORMS;
+    for (int i = 0; i < variants.uniformCount; i++) variants.uniforms[i] = uniforms[i];
+    return variants;
+}
+
+void UnloadShaderVariants(ShaderVariants *variants) {
+    for (int i = 0; i < variants->count; i++) {
+        UnloadShader(variants->variants[i].shader);
+        UnloadShaderUniforms(&variants->variants[i].uniforms);
+    }
+    if (variants->vsCode != NULL) UnloadFileText(variants->vsCode);
+    if (variants->fsCode != NULL) UnloadFileText(variants->fsCode);
+    *variants = (ShaderVariants){ 0 };
+}
+
+// code with a #define for each feature bit after its #version line, free with RL_FREE
+static char *DefineShaderFeatures(const ShaderVariants *variants, const char *code, unsigned int features) {
+    if (code == NULL) return NULL;
+
+    // the #version line has to stay first
+    const char *body = code;
+    const char *version = strstr(code, "#version");
+    if (version != NULL) {
+        const char *end = strchr(version, '\n');
+        body = (end != NULL) ? end + 1 : version + strlen(version);
+    }
+
+    size_t size = strlen(code) + 2;
+    for (int i = 0; i < variants->featureCount; i++) size += strlen(variants->features[i]) + 10;
+    char *result = RL_MALLOC(size);
+
+    size_t length = body - code;
+    memcpy(result, code, length);
+    if (length > 0 && result[length - 1] != '\n') result[length++] = '\n';
+    for (int i = 0; i < variants->featureCount; i++) {
+        if (features & (1u << i)) length += sprintf(result + length, "#define %s\n", variants->features[i]);
+    }
+    strcpy(result + length, body);
+    return result;
+}
+
+// Variant with the features bits set, compiled now if it is the first time it is asked for
+// Returns NULL when every variant slot is taken or the variant does not compile
+ShaderVariant *GetShaderVariant(ShaderVariants *variants, unsigned int features) {
+    for (int i = 0; i < variants->count; i++) {
+        if (variants->variants[i].features == features) return &variants->variants[i];
+    }
+    if (variants->count >= MAX_SHADER_VARIANTS) {
+        printf("shader variants: no room for variant 0x%x\n", features);
+        return NULL;
+    }
+
+    char *vsCode = DefineShaderFeatures(variants, variants->vsCode, features);
+    char *fsCode = DefineShaderFeatures(variants, variants->fsCode, features);
+    Shader shader = LoadShaderFromMemory(vsCode, fsCode);
+    RL_FREE(vsCode);
+    RL_FREE(fsCode);
+    // raylib hands back its default shader on a failed compile, it must not get the variant's locations and uniforms
+    if (shader.id == 0 || shader.id == rlGetShaderIdDefault()) {
+        printf("shader variants: variant 0x%x did not compile\n", features);
+        return NULL;
+    }
+
+    ShaderVariant *variant = &variants->variants[variants->count++];
+    variant->features = features;
+    variant->shader = shader;
+    variant->uniforms = LoadShaderUniforms(shader);
+    for (int i = 0; i < variants->uniformCount; i++) variant->locs[i] = GetShaderLocation(shader, variants->uniforms[i]);
+    return variant;
+}
+
+// Set the uniform named uniforms[uniform] at load on every variant that has it
+void SetShaderVariantsUniform(ShaderVariants *variants, int uniform, const void *value, int type) {
+    for (int i = 0; i < variants->count; i++) {
+        ShaderVariant *variant = &variants->variants[i];
+        SetShaderUniform(&variant->uniforms, variant->locs[uniform], value, type);
+    }
+}
+
+
+#endif
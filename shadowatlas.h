@@ -0,0 +1,311 @@
+/*
+ * ShadowAtlas
+ *
+ * Shadows for the lights closest to the viewer, without drawing the city
+ * again every frame. Each shadowed light gets a tile of a depth atlas and
+ * looks straight down from where it is (street lamps light the street below
+ * them) through a SHADOW_FOV perspective, out to its range.
+ *
+ * There are two atlases with the same tiles:
+ *
+ *   static:   the city. A tile is only drawn when a light gets it or the
+ *             light in it moved, otherwise it is kept from frame to frame.
+ *   dynamic:  casters that move (the car). Redrawn every frame, but only in
+ *             the tiles whose view the casters are in, and the tiles they
+ *             left are cleared, so the cost follows the moving content.
+ *
+ * pbr.fs takes the nearer of the two depths, compared over 2x2 texels.
+ *
+ * The shaders find a light's tile from its index in the light list of the
+ * clusters: the shadowed lights go in first, in tile order, and pbr.fs
+ * shadows light i when i < shadowLightCount. AssignShadowLights() keeps a
+ * light in the tile it had as long as it stays shadowed, and fills the
+ * tiles from 0 without gaps.
+ *
+ * GLSL 100 has no shadow samplers, the depth is read as a plain texture
+ * (like the scene depth of raintarget.h). Without depth textures there are
+ * no shadows.
+ *
+ */
+
+#ifndef SHADOWATLAS_H
+#define SHADOWATLAS_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include <stdio.h>
+#include <math.h>
+#include "frustum.h"
+#include "uniforms.h"
+
+#define SHADOW_ATLAS_TILES 4        // tiles along each side of the atlas
+#define SHADOW_LIGHTS (SHADOW_ATLAS_TILES * SHADOW_ATLAS_TILES)
+#define SHADOW_TILE_SIZE 512        // pixels, the atlas is SHADOW_ATLAS_TILES * SHADOW_TILE_SIZE wide
+#define SHADOW_FOV 120.0f           // degrees, of the view down from each light
+#define SHADOW_NEAR 0.05f
+
+#define SHADOW_TEXTURE_UNIT 10      // static and dynamic depth take this unit and the next, after the material maps pbr.fs uses
+
+
+typedef enum {
+    SHADOW_STATIC = 0,
+    SHADOW_DYNAMIC
+} ShadowLayer;
+
+typedef struct ShadowTile {
+    Vector3 position;           // of the light drawn into it
+    float range;                // its far plane
+    bool stale;                 // static depth has to be drawn again
+} ShadowTile;
+
+typedef struct ShadowAtlas {
+    RenderTexture2D layers[2];  // by ShadowLayer, depth as a texture
+    ShadowTile tiles[SHADOW_LIGHTS];
+    int count;                  // lights with a tile this frame, in tiles 0 .. count - 1
+    int lights[SHADOW_LIGHTS];  // index of the light of each tile, into the lights last given to AssignShadowLights
+    unsigned int dynamicTiles;  // tiles with dynamic casters drawn, bit per tile
+    unsigned int dynamicDrawn;  // the same for this frame, while the dynamic layer is drawn
+    ShadowLayer layer;          // being drawn
+    int staticDraws;            // tiles drawn this frame
+    int dynamicDraws;
+} ShadowAtlas;
+
+// Shadow uniforms of a shader
+typedef struct ShadowAtlasLocations {
+    int lightCount;
+} ShadowAtlasLocations;
+
+
+// Render texture whose depth attachment can be sampled, cleared to the far plane
+// Depth only, nothing reads color. rlgl can not set the draw buffer to GL_NONE, so a driver that calls a framebuffer
+// without color incomplete (desktop GL before 4.1 to the letter) gets an RGBA8 color attachment after all
+static RenderTexture2D LoadShadowLayer(int size) {
+    RenderTexture2D target = { 0 };
+    target.id = rlLoadFramebuffer();
+    if (target.id == 0) return target;
+
+    rlEnableFramebuffer(target.id);
+    // BeginTextureMode() takes the viewport from the texture size, with or without a texture
+    target.texture = (Texture2D){ 0, size, size, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+    target.depth = (Texture2D){ rlLoadTextureDepth(size, size, false), size, size, 1, 19 };
+    rlFramebufferAttach(target.id, target.depth.id, RL_ATTACHMENT_DEPTH, RL_ATTACHMENT_TEXTURE2D, 0);
+    bool complete = rlFramebufferComplete(target.id);
+    if (!complete) {
+        target.texture.id = rlLoadTexture(NULL, size, size, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8, 1);
+        rlFramebufferAttach(target.id, target.texture.id, RL_ATTACHMENT_COLOR_CHANNEL0, RL_ATTACHMENT_TEXTURE2D, 0);
+        complete = rlFramebufferComplete(target.id);
+    }
+    if (complete) {
+        rlViewport(0, 0, size, size);
+        rlClearColor(255, 255, 255, 255);
+        rlClearScreenBuffers();
+    }
+    rlDisableFramebuffer();
+
+    if (!complete) {
+        UnloadRenderTexture(target);
+        return (RenderTexture2D){ 0 };
+    }
+
+    // compared texel by texel in pbr.fs, and never sampled past the edge of a tile
+    SetTextureFilter(target.depth, TEXTURE_FILTER_POINT);
+    SetTextureWrap(target.depth, TEXTURE_WRAP_CLAMP);
+    return target;
+}
+
+// Atlases for SHADOW_LIGHTS lights, without tiles when depth textures are not supported
+ShadowAtlas LoadShadowAtlas(void) {
+    ShadowAtlas atlas = { 0 };
+    int size = SHADOW_ATLAS_TILES * SHADOW_TILE_SIZE;
+    atlas.layers[SHADOW_STATIC] = LoadShadowLayer(size);
+    atlas.layers[SHADOW_DYNAMIC] = LoadShadowLayer(size);
+    if (atlas.layers[SHADOW_STATIC].id == 0 || atlas.layers[SHADOW_DYNAMIC].id == 0) {
+        printf("shadow atlas: no depth textures, lights cast no shadows\n");
+        if (atlas.layers[SHADOW_STATIC].id > 0) UnloadRenderTexture(atlas.layers[SHADOW_STATIC]);
+        if (atlas.layers[SHADOW_DYNAMIC].id > 0) UnloadRenderTexture(atlas.layers[SHADOW_DYNAMIC]);
+        atlas.layers[SHADOW_STATIC] = atlas.layers[SHADOW_DYNAMIC] = (RenderTexture2D){ 0 };
+    }
+    rlViewport(0, 0, GetRenderWidth(), GetRenderHeight());
+    return atlas;
+}
+
+void UnloadShadowAtlas(ShadowAtlas *atlas) {
+    if (atlas->layers[SHADOW_STATIC].id > 0) UnloadRenderTexture(atlas->layers[SHADOW_STATIC]);
+    if (atlas->layers[SHADOW_DYNAMIC].id > 0) UnloadRenderTexture(atlas->layers[SHADOW_DYNAMIC]);
+    *atlas = (ShadowAtlas){ 0 };
+}
+
+// Give tiles to the SHADOW_LIGHTS of count lights closest to viewer
+// tiles gets the tile of every light, -1 for the ones without shadows
+void AssignShadowLights(ShadowAtlas *atlas, const Vector3 *positions, const float *ranges, int count, Vector3 viewer, int *tiles) {
+    for (int i = 0; i < count; i++) tiles[i] = -1;
+    if (atlas->layers[SHADOW_STATIC].id == 0) count = 0;
+
+    // closest lights, kept sorted by distance
+    int closest[SHADOW_LIGHTS];
+    float distances[SHADOW_LIGHTS];
+    int closestCount = 0;
+    for (int i = 0; i < count; i++) {
+        float distance = Vector3DistanceSqr(positions[i], viewer);
+        if (closestCount == SHADOW_LIGHTS && distance >= distances[SHADOW_LIGHTS - 1]) continue;
+        int k = (closestCount < SHADOW_LIGHTS) ? closestCount++ : SHADOW_LIGHTS - 1;
+        for (; k > 0 && distances[k - 1] > distance; k--) {
+            closest[k] = closest[k - 1];
+            distances[k] = distances[k - 1];
+        }
+        closest[k] = i;
+        distances[k] = distance;
+    }
+
+    // lights that did not move keep their tile if it is still in use, the others take the free ones
+    bool taken[SHADOW_LIGHTS] = { 0 };
+    for (int c = 0; c < closestCount; c++) {
+        int i = closest[c];
+        for (int t = 0; t < atlas->count && t < closestCount; t++) {
+            const ShadowTile *tile = &atlas->tiles[t];
+            if (taken[t] || !Vector3Equals(tile->position, positions[i]) || tile->range != ranges[i]) continue;
+            taken[t] = true;
+            tiles[i] = t;
+            break;
+        }
+    }
+    int next = 0;
+    for (int c = 0; c < closestCount; c++) {
+        int i = closest[c];
+        if (tiles[i] >= 0) continue;
+        while (taken[next]) next++;
+        taken[next] = true;
+        tiles[i] = next;
+        atlas->tiles[next] = (ShadowTile){ positions[i], ranges[i], true };
+    }
+
+    atlas->count = closestCount;
+    for (int c = 0; c < closestCount; c++) atlas->lights[tiles[closest[c]]] = closest[c];
+}
+
+// Some tile in use needs its static depth drawn this frame
+bool HasStaleShadowTiles(const ShadowAtlas *atlas) {
+    for (int t = 0; t < atlas->count; t++) {
+        if (atlas->tiles[t].stale) return true;
+    }
+    return false;
+}
+
+// The static depth of tile has to be drawn (again) before it is used
+bool IsShadowTileStale(const ShadowAtlas *atlas, int tile) {
+    return atlas->tiles[tile].stale;
+}
+
+// View down from the light of tile and its projection out to the light's range
+// NOTE: pbr.fs inverts this in LightShadow(), the axes have to stay as they are
+static void GetShadowTileMatrices(const ShadowAtlas *atlas, int tile, Matrix *view, Matrix *projection) {
+    const ShadowTile *light = &atlas->tiles[tile];
+    Vector3 target = { light->position.x, light->position.y - 1.0f, light->position.z };
+    *view = MatrixLookAt(light->position, target, (Vector3){ 0.0f, 0.0f, -1.0f });
+    *projection = MatrixPerspective(SHADOW_FOV * DEG2RAD, 1.0, SHADOW_NEAR, fmaxf(light->range, SHADOW_NEAR * 2.0f));
+}
+
+// Frustum of the light of tile, to test casters against before drawing them
+Frustum GetShadowTileFrustum(const ShadowAtlas *atlas, int tile) {
+    Matrix view, projection;
+    GetShadowTileMatrices(atlas, tile, &view, &projection);
+    return GetFrustumFromMatrix(MatrixMultiply(view, projection));
+}
+
+// Clear one tile of the layer being drawn to the far plane
+static void ClearShadowTile(int tile) {
+    int x = (tile % SHADOW_ATLAS_TILES) * SHADOW_TILE_SIZE;
+    int y = (tile / SHADOW_ATLAS_TILES) * SHADOW_TILE_SIZE;
+    rlViewport(x, y, SHADOW_TILE_SIZE, SHADOW_TILE_SIZE);
+    rlEnableScissorTest();
+    rlScissor(x, y, SHADOW_TILE_SIZE, SHADOW_TILE_SIZE);
+    rlClearColor(255, 255, 255, 255);
+    rlClearScreenBuffers();
+}
+
+// Draw into one layer, tile by tile with BeginShadowTile/EndShadowTile
+void BeginShadowLayer(ShadowAtlas *atlas, ShadowLayer layer) {
+    atlas->layer = layer;
+    if (layer == SHADOW_STATIC) atlas->staticDraws = 0;
+    else {
+        atlas->dynamicDraws = 0;
+        atlas->dynamicDrawn = 0;
+    }
+    BeginTextureMode(atlas->layers[layer]);
+}
+
+void EndShadowLayer(ShadowAtlas *atlas) {
+    // tiles the dynamic casters left since last frame
+    if (atlas->layer == SHADOW_DYNAMIC) {
+        for (int t = 0; t < SHADOW_LIGHTS; t++) {
+            if ((atlas->dynamicTiles & ~atlas->dynamicDrawn) & (1u << t)) ClearShadowTile(t);
+        }
+        rlDisableScissorTest();
+        atlas->dynamicTiles = atlas->dynamicDrawn;
+    }
+    EndTextureMode();
+}
+
+// Clear tile and set up to draw the casters it sees from its light, returns the light's frustum to cull them with
+// NOTE: Draw with a plain material, only the depth is kept
+Frustum BeginShadowTile(ShadowAtlas *atlas, int tile) {
+    rlDrawRenderBatchActive();
+    ClearShadowTile(tile);
+    if (atlas->layer == SHADOW_STATIC) {
+        atlas->tiles[tile].stale = false;
+        atlas->staticDraws++;
+    } else {
+        atlas->dynamicDrawn |= 1u << tile;
+        atlas->dynamicDraws++;
+    }
+
+    Matrix view, projection;
+    GetShadowTileMatrices(atlas, tile, &view, &projection);
+    rlMatrixMode(RL_PROJECTION);
+    rlLoadIdentity();
+    rlMultMatrixf(MatrixToFloat(projection));
+    rlMatrixMode(RL_MODELVIEW);
+    rlLoadIdentity();
+    rlMultMatrixf(MatrixToFloat(view));
+    rlEnableDepthTest();
+
+    return GetFrustumFromMatrix(MatrixMultiply(view, projection));
+}
+
+void EndShadowTile(ShadowAtlas *atlas) {
+    (void)atlas;
+    rlDrawRenderBatchActive();
+    rlDisableDepthTest();
+    rlDisableScissorTest();
+}
+
+// Bind both layers from SHADOW_TEXTURE_UNIT on for the rest of the frame
+void BindShadowAtlas(const ShadowAtlas *atlas) {
+    for (int i = 0; i < 2; i++) {
+        rlActiveTextureSlot(SHADOW_TEXTURE_UNIT + i);
+        rlEnableTexture(atlas->layers[i].depth.id);
+    }
+    rlActiveTextureSlot(0);
+}
+
+ShadowAtlasLocations GetShadowAtlasLocations(Shader shader) {
+    const char *samplers[2] = { "shadowStatic", "shadowDynamic" };
+    for (int i = 0; i < 2; i++) {
+        int unit = SHADOW_TEXTURE_UNIT + i;
+        SetShaderValue(shader, GetShaderLocation(shader, samplers[i]), &unit, SHADER_UNIFORM_SAMPLER2D);
+    }
+
+    ShadowAtlasLocations locs = { 0 };
+    locs.lightCount = GetShaderLocation(shader, "shadowLightCount");
+    return locs;
+}
+
+// Send how many of the first lights of the clusters have a tile
+void SetShadowAtlasUniforms(ShaderUniforms *uniforms, ShadowAtlasLocations locs, const ShadowAtlas *atlas) {
+    float count = (float)atlas->count;
+    SetShaderUniform(uniforms, locs.lightCount, &count, SHADER_UNIFORM_FLOAT);
+}
+
+
+#endif
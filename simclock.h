@@ -0,0 +1,78 @@
+/*
+ * SimClock
+ *
+ * Fixed timestep clock for the rain simulation. Every frame hands it the
+ * real time that passed and gets back how many whole steps of 1/rate
+ * seconds to simulate, zero or more, the rest is carried over to the next
+ * frame. GetSimClockAlpha() is how far that leftover is into the next step,
+ * the renderer draws the simulation that far between its last two states.
+ *
+ * The simulation then behaves the same at any frame rate: drops fall the
+ * same distance per step whether the window runs at 30, 60 or 144 Hz or
+ * uncapped, and collision never sees a step long enough to go through a
+ * roof.
+ *
+ * A frame that took far too long (a hitch, a breakpoint, the first frame
+ * after loading) would ask for a burst of steps that makes the next frame
+ * slow as well, so at most maxSteps are taken and the rest of the time is
+ * dropped.
+ *
+ */
+
+#ifndef SIMCLOCK_H
+#define SIMCLOCK_H
+
+#include <math.h>
+
+
+typedef struct SimClock {
+    double step;                // seconds per simulation step
+    double accumulator;         // time not simulated yet, less than a step after AdvanceSimClock
+    int maxSteps;               // most steps taken in one frame
+    long long steps;            // taken since the clock was made
+    double dropped;             // seconds thrown away by the maxSteps limit
+} SimClock;
+
+
+// Clock running rate steps per second
+SimClock InitSimClock(float rate, int maxSteps) {
+    SimClock clock = { 0 };
+    clock.step = 1.0 / rate;
+    clock.maxSteps = (maxSteps > 0) ? maxSteps : 1;
+    return clock;
+}
+
+// Change the rate, the time already carried over is kept
+void SetSimClockRate(SimClock *clock, float rate) {
+    clock->step = 1.0 / rate;
+}
+
+// Add frameTime seconds and return the number of steps to simulate for it
+int AdvanceSimClock(SimClock *clock, double frameTime) {
+    if (frameTime > 0.0) clock->accumulator += frameTime;
+
+    int steps = 0;
+    while (clock->accumulator >= clock->step && steps < clock->maxSteps) {
+        clock->accumulator -= clock->step;
+        steps++;
+    }
+
+    // over the limit, keep only the part of a step so alpha still moves on smoothly
+    if (clock->accumulator >= clock->step) {
+        double kept = fmod(clock->accumulator, clock->step);
+        clock->dropped += clock->accumulator - kept;
+        clock->accumulator = kept;
+    }
+
+    clock->steps += steps;
+    return steps;
+}
+
+// Position of the frame between the previous step (0) and the last one (1)
+float GetSimClockAlpha(const SimClock *clock) {
+    float alpha = (float)(clock->accumulator / clock->step);
+    return (alpha < 1.0f) ? alpha : 1.0f;
+}
+
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * Splashes
+ *
+ * Short lived splash sprites spawned where rain drops hit the ground or a
+ * roof.
+ *
+ * Every splash lives for the same SPLASH_LIFETIME, so they die in the order
+ * they were born and the pool is a fixed size ring buffer: spawning writes
+ * at the head, retiring moves the tail past expired splashes, and when the
+ * pool is full the oldest splashes are overwritten. Nothing is allocated
+ * after load.
+ *
+ * A splash is a packed vec4 (position and birth time) that never changes
+ * once written, so the GPU instance buffer mirrors the ring: each frame only
+ * the new splashes are uploaded, and the live range is drawn with one or
+ * two instanced draws (two when it wraps around the end of the ring).
+ * splash.vs works out the age of each splash from the pool clock and picks
+ * the frame of the splash atlas to show.
+ *
+ */
+
+#ifndef SPLASHES_H
+#define SPLASHES_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include <stdio.h>
+#include <stdint.h>
+
+#define SPLASH_LIFETIME 0.3f        // seconds, must match splash.vs
+#define SPLASH_ATLAS_COLUMNS 4      // frames of the splash atlas, must match splash.vs
+#define SPLASH_ATLAS_ROWS 2
+
+
+// xyz: where the drop hit, w: pool time it hit at
+typedef struct SplashInstance {
+    float x, y, z;
+    float birth;
+} SplashInstance;
+
+typedef struct SplashPool {
+    int capacity;               // power of two
+    uint32_t head;              // splashes ever spawned, the ring index is head & (capacity - 1)
+    uint32_t tail;              // oldest live splash
+    uint32_t uploaded;          // splashes before this are on the GPU
+    float time;                 // pool clock, splash ages are measured against it
+    SplashInstance *instances;  // ring of capacity splashes
+
+    int instanceLoc;
+    int timeLoc;                // splashTime uniform, the pool clock
+    unsigned int vaoId;
+    unsigned int quadVboId;
+    unsigned int indexVboId;
+    unsigned int instanceVboId;
+} SplashPool;
+
+
+// Create a pool of capacity splashes (rounded up to a power of two) drawn with shader
+// Shader must declare vertexPosition, vertexTexCoord and instanceData attributes
+SplashPool LoadSplashPool(int capacity, Shader shader) {
+    SplashPool pool = { 0 };
+    pool.capacity = 1;
+    while (pool.capacity < capacity) pool.capacity *= 2;
+    pool.instances = RL_CALLOC(pool.capacity, sizeof(SplashInstance));
+
+    // unit quad standing on its bottom edge, splash.vs turns it to face the camera
+    // x, y, z, u, v
+    static const float quad[] = {
+        -0.5f, 1.0f, 0.0f,  0.0f, 0.0f,
+         0.5f, 1.0f, 0.0f,  1.0f, 0.0f,
+         0.5f, 0.0f, 0.0f,  1.0f, 1.0f,
+        -0.5f, 0.0f, 0.0f,  0.0f, 1.0f,
+    };
+    static const unsigned short indices[] = { 0, 2, 1, 0, 3, 2 };
+
+    int positionLoc = shader.locs[SHADER_LOC_VERTEX_POSITION];
+    int texcoordLoc = shader.locs[SHADER_LOC_VERTEX_TEXCOORD01];
+    pool.instanceLoc = GetShaderLocationAttrib(shader, "instanceData");
+    pool.timeLoc = GetShaderLocation(shader, "splashTime");
+
+    pool.vaoId = rlLoadVertexArray();
+    rlEnableVertexArray(pool.vaoId);
+
+    pool.quadVboId = rlLoadVertexBuffer(quad, sizeof(quad), false);
+    rlSetVertexAttribute(positionLoc, 3, RL_FLOAT, false, 5 * sizeof(float), 0);
+    rlEnableVertexAttribute(positionLoc);
+    rlSetVertexAttribute(texcoordLoc, 2, RL_FLOAT, false, 5 * sizeof(float), 3 * sizeof(float));
+    rlEnableVertexAttribute(texcoordLoc);
+
+    pool.instanceVboId = rlLoadVertexBuffer(pool.instances, pool.capacity * sizeof(SplashInstance), true);
+    if (pool.instanceLoc >= 0) {
+        rlSetVertexAttribute(pool.instanceLoc, 4, RL_FLOAT, false, sizeof(SplashInstance), 0);
+        rlEnableVertexAttribute(pool.instanceLoc);
+        rlSetVertexAttributeDivisor(pool.instanceLoc, 1);
+    }
+
+    pool.indexVboId = rlLoadVertexBufferElement(indices, sizeof(indices), false);
+
+    rlDisableVertexArray();
+
+    if (pool.instanceLoc < 0) printf("splash shader has no instanceData attribute\n");
+
+    return pool;
+}
+
+void UnloadSplashPool(SplashPool *pool) {
+    rlUnloadVertexArray(pool->vaoId);
+    rlUnloadVertexBuffer(pool->quadVboId);
+    rlUnloadVertexBuffer(pool->indexVboId);
+    rlUnloadVertexBuffer(pool->instanceVboId);
+    RL_FREE(pool->instances);
+    *pool = (SplashPool){ 0 };
+}
+
+int GetSplashCount(const SplashPool *pool) {
+    return (int)(pool->head - pool->tail);
+}
+
+// Advance the pool clock and retire splashes that have played out
+void UpdateSplashes(SplashPool *pool, float dt) {
+    pool->time += dt;
+
+    uint32_t mask = pool->capacity - 1;
+    while (pool->tail != pool->head && pool->time - pool->instances[pool->tail & mask].birth >= SPLASH_LIFETIME) {
+        pool->tail++;
+    }
+}
+
+// Start a splash at each of count points
+void SpawnSplashes(SplashPool *pool, const Vector3 *points, int count) {
+    // more than the whole pool, only the newest ones would survive anyway
+    if (count > pool->capacity) {
+        points += count - pool->capacity;
+        count = pool->capacity;
+    }
+
+    uint32_t mask = pool->capacity - 1;
+    for (int i = 0; i < count; i++) {
+        pool->instances[(pool->head + i) & mask] = (SplashInstance){ points[i].x, points[i].y, points[i].z, pool->time };
+    }
+    pool->head += count;
+
+    // full, the oldest splashes were overwritten
+    if (pool->head - pool->tail > (uint32_t)pool->capacity) pool->tail = pool->head - pool->capacity;
+}
+
+// Upload ring slots [first, first + count), split in two where it wraps
+static void UploadSplashRange(SplashPool *pool, uint32_t first, int count) {
+    uint32_t start = first & (pool->capacity - 1);
+    int part = (count < pool->capacity - (int)start) ? count : pool->capacity - (int)start;
+    rlUpdateVertexBuffer(pool->instanceVboId, pool->instances + start, part * sizeof(SplashInstance), start * sizeof(SplashInstance));
+    if (count > part) {
+        rlUpdateVertexBuffer(pool->instanceVboId, pool->instances, (count - part) * sizeof(SplashInstance), 0);
+    }
+}
+
+// Draw count instances starting at ring slot start
+// NOTE: there is no base instance on GLES2, the instance attribute is pointed at the slot instead
+static void DrawSplashRange(SplashPool *pool, int start, int count) {
+    rlEnableVertexBuffer(pool->instanceVboId);
+    rlSetVertexAttribute(pool->instanceLoc, 4, RL_FLOAT, false, sizeof(SplashInstance), start * sizeof(SplashInstance));
+    rlDrawVertexArrayElementsInstanced(0, 6, 0, count);
+}
+
+// Upload new splashes and draw every live one with the material shader and albedo texture (the atlas)
+void DrawSplashes(SplashPool *pool, Material material) {
+    // anything overwritten before it was uploaded is gone
+    if (pool->head - pool->uploaded > (uint32_t)pool->capacity) pool->uploaded = pool->head - pool->capacity;
+    if (pool->uploaded != pool->head) {
+        UploadSplashRange(pool, pool->uploaded, (int)(pool->head - pool->uploaded));
+        pool->uploaded = pool->head;
+    }
+
+    int count = GetSplashCount(pool);
+    if (count <= 0 || pool->instanceLoc < 0) return;
+
+    Shader shader = material.shader;
+    rlEnableShader(shader.id);
+
+    if (shader.locs[SHADER_LOC_COLOR_DIFFUSE] != -1) {
+        Vector4 color = ColorNormalize(material.maps[MATERIAL_MAP_DIFFUSE].color);
+        rlSetUniform(shader.locs[SHADER_LOC_COLOR_DIFFUSE], &color, SHADER_UNIFORM_VEC4, 1);
+    }
+
+    // splashes are already in world space
+    Matrix mvp = MatrixMultiply(MatrixMultiply(rlGetMatrixTransform(), rlGetMatrixModelview()), rlGetMatrixProjection());
+    rlSetUniformMatrix(shader.locs[SHADER_LOC_MATRIX_MVP], mvp);
+    rlSetUniform(pool->timeLoc, &pool->time, SHADER_UNIFORM_FLOAT, 1);
+
+    int slot = 0;
+    rlActiveTextureSlot(slot);
+    rlEnableTexture(material.maps[MATERIAL_MAP_DIFFUSE].texture.id);
+    rlSetUniform(shader.locs[SHADER_LOC_MAP_DIFFUSE], &slot, SHADER_UNIFORM_INT, 1);
+
+    rlEnableVertexArray(pool->vaoId);
+    int start = (int)(pool->tail & (pool->capacity - 1));
+    int part = (count < pool->capacity - start) ? count : pool->capacity - start;
+    DrawSplashRange(pool, start, part);
+    if (count > part) DrawSplashRange(pool, 0, count - part);
+
+    // leave the attribute where LoadSplashPool put it
+    rlSetVertexAttribute(pool->instanceLoc, 4, RL_FLOAT, false, sizeof(SplashInstance), 0);
+    rlDisableVertexBuffer();
+    rlDisableVertexArray();
+
+    rlActiveTextureSlot(0);
+    rlDisableTexture();
+    rlDisableShader();
+}
+
+// Side on splash animation, SPLASH_ATLAS_COLUMNS x SPLASH_ATLAS_ROWS frames of frameSize pixels
+// A crown of droplets thrown up and out from the impact, shrinking and fading as they fall back
+Texture2D LoadSplashAtlas(int frameSize) {
+    int frames = SPLASH_ATLAS_COLUMNS * SPLASH_ATLAS_ROWS;
+    Image atlas = GenImageColor(frameSize * SPLASH_ATLAS_COLUMNS, frameSize * SPLASH_ATLAS_ROWS, BLANK);
+
+    const int droplets = 7;
+    for (int f = 0; f < frames; f++) {
+        float t = (f + 0.5f) / frames;
+        float fade = 1.0f - t;
+        Vector2 base = {
+            (f % SPLASH_ATLAS_COLUMNS) * frameSize + frameSize * 0.5f,
+            (f / SPLASH_ATLAS_COLUMNS + 1) * frameSize - 2.0f
+        };
+
+        // flattened ring spreading out on the surface
+        float ring = frameSize * (0.1f + 0.35f * t);
+        for (int k = -3; k <= 3; k++) {
+            Vector2 p = { base.x + ring * k / 3.0f, base.y - 1.0f };
+            ImageDrawCircleV(&atlas, p, 1, ColorAlpha(WHITE, 0.5f * fade));
+        }
+
+        // droplets on ballistic arcs, angles spread around straight up
+        for (int k = 0; k < droplets; k++) {
+            float angle = (30.0f + 120.0f * k / (droplets - 1)) * DEG2RAD;
+            float speed = 0.9f + 0.25f * ((k * 5) % 3);
+            float x = cosf(angle) * speed * t;
+            float y = sinf(angle) * speed * t - t * t;
+            if (y < 0.0f) continue;
+
+            Vector2 p = { base.x + x * frameSize * 0.35f, base.y - y * frameSize * 2.5f };
+            int radius = (int)(frameSize * 0.06f * (1.0f - 0.5f * t) + 0.5f);
+            ImageDrawCircleV(&atlas, p, (radius > 0) ? radius : 1, ColorAlpha(WHITE, fade));
+        }
+    }
+
+    Texture2D texture = LoadTextureFromImage(atlas);
+    SetTextureFilter(texture, TEXTURE_FILTER_BILINEAR);
+    SetTextureWrap(texture, TEXTURE_WRAP_CLAMP);
+    UnloadImage(atlas);
+    return texture;
+}
+
+
+#endif
@@ -0,0 +1,322 @@
+/*
+ * StaticBatch
+ *
+ * Load time batching of a model that never moves. DrawModel() draws every
+ * mesh of the model on its own in file order, so a model made of hundreds of
+ * small meshes costs hundreds of draws and material changes per frame, all of
+ * them even when most of the model is behind the camera.
+ *
+ * LoadStaticBatches() bakes the model placement into its vertices and splits
+ * its triangles by material and by a grid of chunkSize chunks on x/z (by
+ * triangle centroid). Each material and chunk becomes one mesh, or a few when
+ * it has more vertices than 16 bit indices reach. The batches are kept sorted
+ * by material, and DrawStaticBatches() draws the ones in the view frustum in
+ * that order, so the draw count follows the number of materials and chunks
+ * in view instead of the number of meshes in the asset.
+ *
+ * Batches refer to materials by index, textures streamed into the model
+ * materials after batching are picked up.
+ *
+ * LoadStaticBatchLODs() adds levels of detail to every batch (see meshlod.h),
+ * a batch is then drawn at the level its distance from the view allows.
+ *
+ * Once batched the model's own meshes are never drawn, UnloadStaticBatchSources()
+ * frees their GPU buffers and keeps the CPU arrays collision and LODs are built from.
+ *
+ */
+
+#ifndef STATICBATCH_H
+#define STATICBATCH_H
+
+#include "raylib.h"
+#include "raymath.h"
+#include "rlgl.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "frustum.h"
+#include "meshlod.h"
+
+#define STATIC_BATCH_MAX_VERTICES 65535     // indices are unsigned short
+
+#ifndef MAX_MESH_VERTEX_BUFFERS
+#define MAX_MESH_VERTEX_BUFFERS 9           // length of Mesh.vboId, from raylib 5.5 config.h which is not public
+#endif
+
+
+typedef struct StaticBatch {
+    Mesh mesh;                  // world space
+    int material;               // index into the model materials
+    BoundingBox bounds;
+} StaticBatch;
+
+typedef struct StaticBatches {
+    StaticBatch *batches;       // sorted by material
+    int batchCount;
+    MeshLOD *lods;              // per batch, NULL until LoadStaticBatchLODs
+    int sourceMeshes;           // meshes of the model that were batched
+    int drawn;                  // batches drawn by the last DrawStaticBatches
+    int culled;
+    int triangles;              // drawn by the last DrawStaticBatches
+} StaticBatches;
+
+// One source triangle on its way into a batch
+typedef struct StaticBatchTriangle {
+    int key;                    // material * chunks + chunk
+    int mesh;
+    int triangle;
+} StaticBatchTriangle;
+
+
+static int CompareStaticBatchTriangles(const void *a, const void *b) {
+    const StaticBatchTriangle *ta = a;
+    const StaticBatchTriangle *tb = b;
+    if (ta->key != tb->key) return (ta->key < tb->key) ? -1 : 1;
+    if (ta->mesh != tb->mesh) return (ta->mesh < tb->mesh) ? -1 : 1;
+    return (ta->triangle < tb->triangle) ? -1 : (ta->triangle > tb->triangle);
+}
+
+static inline int GetStaticBatchIndex(const Mesh *mesh, int triangle, int corner) {
+    return (mesh->indices != NULL) ? mesh->indices[triangle * 3 + corner] : triangle * 3 + corner;
+}
+
+// Mesh for the triangles [begin, end) of a run, all of one material and chunk
+// remap and stamp hold one entry per vertex of each source mesh, stamp marks the vertices already in this batch
+static StaticBatch BuildStaticBatch(const Model *model, const Matrix *transform, const StaticBatchTriangle *triangles,
+        int begin, int end, int vertexCount, int **remap, int **stamp, int batchId) {
+    StaticBatch batch = { 0 };
+    batch.material = model->meshMaterial[triangles[begin].mesh];
+
+    bool normals = false, texcoords = false, tangents = false, colors = false;
+    for (int t = begin; t < end; t++) {
+        const Mesh *source = &model->meshes[triangles[t].mesh];
+        normals |= (source->normals != NULL);
+        texcoords |= (source->texcoords != NULL);
+        tangents |= (source->tangents != NULL);
+        colors |= (source->colors != NULL);
+    }
+
+    Mesh mesh = { 0 };
+    mesh.vertexCount = vertexCount;
+    mesh.triangleCount = end - begin;
+    mesh.vertices = RL_CALLOC(vertexCount * 3, sizeof(float));
+    mesh.indices = RL_CALLOC(mesh.triangleCount * 3, sizeof(unsigned short));
+    if (normals) mesh.normals = RL_CALLOC(vertexCount * 3, sizeof(float));
+    if (texcoords) mesh.texcoords = RL_CALLOC(vertexCount * 2, sizeof(float));
+    if (tangents) mesh.tangents = RL_CALLOC(vertexCount * 4, sizeof(float));
+    if (colors) mesh.colors = RL_CALLOC(vertexCount * 4, sizeof(unsigned char));
+
+    // normals and tangents only turn with the model, the scale is uniform
+    Matrix rotation = *transform;
+    rotation.m12 = rotation.m13 = rotation.m14 = 0.0f;
+
+    int vertices = 0;
+    for (int t = begin; t < end; t++) {
+        const Mesh *source = &model->meshes[triangles[t].mesh];
+        int *meshRemap = remap[triangles[t].mesh];
+        int *meshStamp = stamp[triangles[t].mesh];
+
+        for (int k = 0; k < 3; k++) {
+            int index = GetStaticBatchIndex(source, triangles[t].triangle, k);
+            if (meshStamp[index] != batchId) {
+                int v = vertices++;
+                meshStamp[index] = batchId;
+                meshRemap[index] = v;
+
+                Vector3 p = { source->vertices[index * 3], source->vertices[index * 3 + 1], source->vertices[index * 3 + 2] };
+                p = Vector3Transform(p, *transform);
+                memcpy(&mesh.vertices[v * 3], &p, sizeof(Vector3));
+
+                if (normals) {
+                    Vector3 n = { 0.0f, 1.0f, 0.0f };
+                    if (source->normals != NULL) {
+                        n = (Vector3){ source->normals[index * 3], source->normals[index * 3 + 1], source->normals[index * 3 + 2] };
+                        n = Vector3Normalize(Vector3Transform(n, rotation));
+                    }
+                    memcpy(&mesh.normals[v * 3], &n, sizeof(Vector3));
+                }
+                if (texcoords && source->texcoords != NULL) {
+                    memcpy(&mesh.texcoords[v * 2], &source->texcoords[index * 2], 2 * sizeof(float));
+                }
+                if (tangents) {
+                    Vector4 tangent = { 1.0f, 0.0f, 0.0f, 1.0f };
+                    if (source->tangents != NULL) {
+                        const float *st = &source->tangents[index * 4];
+                        Vector3 d = Vector3Normalize(Vector3Transform((Vector3){ st[0], st[1], st[2] }, rotation));
+                        tangent = (Vector4){ d.x, d.y, d.z, st[3] };
+                    }
+                    memcpy(&mesh.tangents[v * 4], &tangent, sizeof(Vector4));
+                }
+                if (colors) {
+                    if (source->colors != NULL) memcpy(&mesh.colors[v * 4], &source->colors[index * 4], 4);
+                    else memset(&mesh.colors[v * 4], 255, 4);
+                }
+            }
+            mesh.indices[(t - begin) * 3 + k] = (unsigned short)meshRemap[index];
+        }
+    }
+
+    UploadMesh(&mesh, false);
+    batch.mesh = mesh;
+    batch.bounds = GetMeshBoundingBox(mesh);
+    return batch;
+}
+
+// Batch every mesh of model, placed with transform (see GetModelDrawTransform), in chunks of chunkSize on x/z
+StaticBatches LoadStaticBatches(Model model, Matrix transform, float chunkSize) {
+    StaticBatches result = { 0 };
+
+    // world bounds of the model, for the chunk grid
+    int count = 0;
+    Vector3 min = { INFINITY, INFINITY, INFINITY };
+    Vector3 max = { -INFINITY, -INFINITY, -INFINITY };
+    for (int i = 0; i < model.meshCount; i++) {
+        const Mesh *mesh = &model.meshes[i];
+        if (mesh->vertices == NULL) continue;
+        count += mesh->triangleCount;
+        result.sourceMeshes++;
+        for (int v = 0; v < mesh->vertexCount; v++) {
+            Vector3 p = Vector3Transform((Vector3){ mesh->vertices[v * 3], mesh->vertices[v * 3 + 1], mesh->vertices[v * 3 + 2] }, transform);
+            min = Vector3Min(min, p);
+            max = Vector3Max(max, p);
+        }
+    }
+    if (count == 0) return result;
+
+    int chunksX = (int)((max.x - min.x) / chunkSize) + 1;
+    int chunksZ = (int)((max.z - min.z) / chunkSize) + 1;
+
+    StaticBatchTriangle *triangles = malloc(count * sizeof(StaticBatchTriangle));
+    int **remap = calloc(model.meshCount, sizeof(int *));
+    int **stamp = calloc(model.meshCount, sizeof(int *));
+    int n = 0;
+    for (int i = 0; i < model.meshCount; i++) {
+        const Mesh *mesh = &model.meshes[i];
+        if (mesh->vertices == NULL) continue;
+        remap[i] = malloc(mesh->vertexCount * sizeof(int));
+        stamp[i] = malloc(mesh->vertexCount * sizeof(int));
+        for (int v = 0; v < mesh->vertexCount; v++) stamp[i][v] = -1;
+
+        for (int t = 0; t < mesh->triangleCount; t++) {
+            Vector3 centroid = { 0 };
+            for (int k = 0; k < 3; k++) {
+                int index = GetStaticBatchIndex(mesh, t, k);
+                centroid = Vector3Add(centroid, (Vector3){ mesh->vertices[index * 3], mesh->vertices[index * 3 + 1], mesh->vertices[index * 3 + 2] });
+            }
+            centroid = Vector3Transform(Vector3Scale(centroid, 1.0f / 3.0f), transform);
+            int cx = Clamp((int)((centroid.x - min.x) / chunkSize), 0, chunksX - 1);
+            int cz = Clamp((int)((centroid.z - min.z) / chunkSize), 0, chunksZ - 1);
+            triangles[n++] = (StaticBatchTriangle){ model.meshMaterial[i] * chunksX * chunksZ + cz * chunksX + cx, i, t };
+        }
+    }
+    qsort(triangles, n, sizeof(StaticBatchTriangle), CompareStaticBatchTriangles);
+
+    // a batch per run of one key, cut short where its vertices would not fit the indices
+    int capacity = 64;
+    result.batches = malloc(capacity * sizeof(StaticBatch));
+    int begin = 0;
+    while (begin < n) {
+        int batchId = result.batchCount;
+        int vertices = 0;
+        int end = begin;
+        while (end < n && triangles[end].key == triangles[begin].key) {
+            const Mesh *mesh = &model.meshes[triangles[end].mesh];
+            int added = 0;
+            for (int k = 0; k < 3; k++) {
+                int index = GetStaticBatchIndex(mesh, triangles[end].triangle, k);
+                if (stamp[triangles[end].mesh][index] != batchId) {
+                    stamp[triangles[end].mesh][index] = batchId;
+                    added++;
+                }
+            }
+            if (vertices + added > STATIC_BATCH_MAX_VERTICES) break;
+            vertices += added;
+            end++;
+        }
+
+        // counting marked the vertices with this id, BuildStaticBatch needs them unmarked
+        for (int t = begin; t < end; t++) {
+            const Mesh *mesh = &model.meshes[triangles[t].mesh];
+            for (int k = 0; k < 3; k++) stamp[triangles[t].mesh][GetStaticBatchIndex(mesh, triangles[t].triangle, k)] = -1;
+        }
+        if (end < n) {
+            const Mesh *mesh = &model.meshes[triangles[end].mesh];
+            for (int k = 0; k < 3; k++) stamp[triangles[end].mesh][GetStaticBatchIndex(mesh, triangles[end].triangle, k)] = -1;
+        }
+
+        if (result.batchCount == capacity) {
+            capacity *= 2;
+            result.batches = realloc(result.batches, capacity * sizeof(StaticBatch));
+        }
+        result.batches[result.batchCount++] = BuildStaticBatch(&model, &transform, triangles, begin, end, vertices, remap, stamp, batchId);
+        begin = end;
+    }
+
+    for (int i = 0; i < model.meshCount; i++) {
+        free(remap[i]);
+        free(stamp[i]);
+    }
+    free(remap);
+    free(stamp);
+    free(triangles);
+    return result;
+}
+
+// Levels of detail of every batch, cached in cacheFileName
+void LoadStaticBatchLODs(StaticBatches *batches, const char *cacheFileName) {
+    Mesh *meshes = malloc(((batches->batchCount > 0) ? batches->batchCount : 1) * sizeof(Mesh));
+    for (int i = 0; i < batches->batchCount; i++) meshes[i] = batches->batches[i].mesh;
+    batches->lods = LoadMeshLODs(meshes, batches->batchCount, cacheFileName);
+    free(meshes);
+}
+
+// Free the vertex arrays and buffers of the meshes of model the batches were made from, nothing draws them any more
+// The CPU arrays stay and the model is unloaded as usual, UnloadMesh() skips the zeroed ids
+void UnloadStaticBatchSources(const StaticBatches *batches, Model model) {
+    if (batches->batchCount == 0) return;
+    for (int i = 0; i < model.meshCount; i++) {
+        Mesh *mesh = &model.meshes[i];
+        if (mesh->vaoId > 0) rlUnloadVertexArray(mesh->vaoId);
+        mesh->vaoId = 0;
+        if (mesh->vboId == NULL) continue;
+        for (int k = 0; k < MAX_MESH_VERTEX_BUFFERS; k++) {
+            if (mesh->vboId[k] > 0) rlUnloadVertexBuffer(mesh->vboId[k]);
+            mesh->vboId[k] = 0;
+        }
+    }
+}
+
+void UnloadStaticBatches(StaticBatches *batches) {
+    UnloadMeshLODs(batches->lods, batches->batchCount);
+    for (int i = 0; i < batches->batchCount; i++) UnloadMesh(batches->batches[i].mesh);
+    free(batches->batches);
+    *batches = (StaticBatches){ 0 };
+}
+
+// Draw the batches in the frustum (all of them when frustum is NULL) with the materials of the model they came from
+// at the level of detail view allows, full detail when view is NULL or there are no levels
+// transform goes on top of the baked placement (MatrixIdentity() for none), frustum and view see the batches without it
+// NOTE: Must be called inside BeginMode3D(), like DrawModel()
+void DrawStaticBatches(StaticBatches *batches, const Material *materials, const Frustum *frustum, const LODView *view,
+        Matrix transform) {
+    batches->drawn = 0;
+    batches->culled = 0;
+    batches->triangles = 0;
+    for (int i = 0; i < batches->batchCount; i++) {
+        const StaticBatch *batch = &batches->batches[i];
+        if (frustum != NULL && FrustumTestBox(frustum, batch->bounds) == FRUSTUM_OUTSIDE) {
+            batches->culled++;
+            continue;
+        }
+        Mesh mesh = batch->mesh;
+        if (view != NULL && batches->lods != NULL) {
+            mesh = batches->lods[i].levels[SelectMeshLOD(&batches->lods[i], MatrixIdentity(), 1.0f, view)];
+        }
+        DrawMesh(mesh, materials[batch->material], transform);
+        batches->drawn++;
+        batches->triangles += mesh.triangleCount;
+    }
+}
+
+
+#endif
@@ -0,0 +1,347 @@
+/*
+ * TextureCook
+ *
+ * Offline preparation of material textures for the scene pack. glTF
+ * textures come as full size RGBA8 PNGs, CookTexture() turns one into what
+ * the GPU should sample:
+ *
+ *   mips:     the full chain, each level a 2x2 box of the one above. Color
+ *             maps (albedo, emission) are stored in sRGB, their texels are
+ *             averaged in linear light and converted back, so mips do not
+ *             get darker. Normal maps are averaged as vectors and
+ *             renormalized, other data maps are averaged as they are.
+ *   blocks:   optionally BC1 (DXT1), or BC3 (DXT5) where the texture has
+ *             alpha, encoded on the job threads. Normal maps stay RGBA8:
+ *             raylib has no two channel (BC5/RGTC) format and BC1 bends
+ *             normals visibly. Levels under 4x4 are padded to one block
+ *             with their edge texels, so the chain still goes down to 1x1
+ *             (a cut chain is mipmap incomplete and samples black). raylib
+ *             sizes a level like 4x2 as half a block, sizes whose chain
+ *             passes through one stay RGBA8.
+ *
+ * The result is an Image with its mips in one buffer (raylib layout), the
+ * scene pack stores it as is and the runtime uploads it with
+ * rlLoadTexture().
+ *
+ * The block encoder fits the endpoints along the principal axis of the 16
+ * colors of a block (a few power iterations), insets them by 1/16 of their
+ * range, rounds to 565 and picks the closest of the 4 palette colors for each
+ * texel. It is meant for an offline bake, not for quality competitions.
+ *
+ */
+
+#ifndef TEXTURECOOK_H
+#define TEXTURECOOK_H
+
+#include "raylib.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "jobs.h"
+
+#define TEXTURE_COOK_BLOCK_ROWS 8       // block rows per encode job
+
+
+typedef enum {
+    TEXTURE_COOK_COLOR = 0,     // sRGB color, albedo and emission
+    TEXTURE_COOK_DATA,          // linear values, metalness/roughness/occlusion
+    TEXTURE_COOK_NORMAL         // tangent space normals
+} TextureCookKind;
+
+typedef struct TextureCookJob {
+    const unsigned char *pixels;    // RGBA8 level
+    unsigned char *blocks;
+    int width;
+    int height;
+    bool alpha;                     // BC3, otherwise BC1
+} TextureCookJob;
+
+
+//----------------------------------------------------------------------------------
+// Mips
+//----------------------------------------------------------------------------------
+
+static float CookSrgbToLinear(unsigned char value) {
+    float c = value / 255.0f;
+    return (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static unsigned char CookLinearToSrgb(float c) {
+    c = (c <= 0.0031308f) ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+    c = c * 255.0f + 0.5f;
+    return (unsigned char)((c < 0.0f) ? 0.0f : (c > 255.0f) ? 255.0f : c);
+}
+
+static inline unsigned char CookUnorm(float c) {
+    c = c * 255.0f + 0.5f;
+    return (unsigned char)((c < 0.0f) ? 0.0f : (c > 255.0f) ? 255.0f : c);
+}
+
+// Next level of an RGBA8 level, each texel the average of the (up to) 2x2 texels above it
+static void CookMipLevel(const unsigned char *src, int width, int height, unsigned char *dst, TextureCookKind kind) {
+    int w = (width > 1) ? width / 2 : 1;
+    int h = (height > 1) ? height / 2 : 1;
+
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            float sum[4] = { 0 };
+            int count = 0;
+            for (int dy = 0; dy < 2; dy++) {
+                for (int dx = 0; dx < 2; dx++) {
+                    int sx = x * 2 + dx, sy = y * 2 + dy;
+                    if (sx >= width || sy >= height) continue;
+                    const unsigned char *p = &src[(sy * width + sx) * 4];
+                    for (int c = 0; c < 3; c++) {
+                        if (kind == TEXTURE_COOK_COLOR) sum[c] += CookSrgbToLinear(p[c]);
+                        else if (kind == TEXTURE_COOK_NORMAL) sum[c] += p[c] / 127.5f - 1.0f;
+                        else sum[c] += p[c] / 255.0f;
+                    }
+                    sum[3] += p[3] / 255.0f;
+                    count++;
+                }
+            }
+
+            unsigned char *q = &dst[(y * w + x) * 4];
+            if (kind == TEXTURE_COOK_NORMAL) {
+                float length = sqrtf(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                if (length <= 0.0f) { sum[2] = 1.0f; length = 1.0f; }
+                for (int c = 0; c < 3; c++) q[c] = CookUnorm((sum[c] / length) * 0.5f + 0.5f);
+            } else {
+                for (int c = 0; c < 3; c++) {
+                    q[c] = (kind == TEXTURE_COOK_COLOR) ? CookLinearToSrgb(sum[c] / count) : CookUnorm(sum[c] / count);
+                }
+            }
+            q[3] = CookUnorm(sum[3] / count);
+        }
+    }
+}
+
+// Every level of a chain from width x height is whole 4x4 blocks or fits one block (what raylib sizes BC levels as)
+// Levels like 4x2 are neither, those textures are not compressed
+static bool IsCookBlockChain(int width, int height) {
+    for (;;) {
+        if (width < 4 && height < 4) return true;
+        if (width % 4 != 0 || height % 4 != 0) return false;
+        width /= 2;
+        height /= 2;
+    }
+}
+
+// Levels from width x height down to 1x1
+static int GetCookMipCount(int width, int height) {
+    int count = 1;
+    while (width > 1 || height > 1) {
+        width = (width > 1) ? width / 2 : 1;
+        height = (height > 1) ? height / 2 : 1;
+        count++;
+    }
+    return count;
+}
+
+
+//----------------------------------------------------------------------------------
+// Blocks
+//----------------------------------------------------------------------------------
+
+static inline uint16_t CookPack565(const float *c) {
+    int r = (int)(c[0] * 31.0f / 255.0f + 0.5f);
+    int g = (int)(c[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int)(c[2] * 31.0f / 255.0f + 0.5f);
+    r = (r < 0) ? 0 : (r > 31) ? 31 : r;
+    g = (g < 0) ? 0 : (g > 63) ? 63 : g;
+    b = (b < 0) ? 0 : (b > 31) ? 31 : b;
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static inline void CookUnpack565(uint16_t v, float *c) {
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (float)((r << 3) | (r >> 2));
+    c[1] = (float)((g << 2) | (g >> 4));
+    c[2] = (float)((b << 3) | (b >> 2));
+}
+
+// BC1 color block of 16 RGBA8 texels, always in 4 color mode
+static void EncodeCookColorBlock(const unsigned char *texels, unsigned char *out) {
+    float mean[3] = { 0 };
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) mean[c] += texels[i * 4 + c] / 16.0f;
+    }
+
+    // principal axis of the colors, from the covariance by power iteration
+    float cov[6] = { 0 };
+    for (int i = 0; i < 16; i++) {
+        float d[3] = { texels[i * 4] - mean[0], texels[i * 4 + 1] - mean[1], texels[i * 4 + 2] - mean[2] };
+        cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+    }
+    float axis[3] = { 0.577f, 0.577f, 0.577f };
+    for (int k = 0; k < 4; k++) {
+        float next[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]
+        };
+        float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f) break;
+        for (int c = 0; c < 3; c++) axis[c] = next[c] / length;
+    }
+
+    // extremes along it, pulled in a little as the palette ends are rarely hit exactly
+    float lo = INFINITY, hi = -INFINITY;
+    for (int i = 0; i < 16; i++) {
+        float t = (texels[i * 4] - mean[0]) * axis[0] + (texels[i * 4 + 1] - mean[1]) * axis[1] + (texels[i * 4 + 2] - mean[2]) * axis[2];
+        if (t < lo) lo = t;
+        if (t > hi) hi = t;
+    }
+    float inset = (hi - lo) / 16.0f;
+    float c0[3], c1[3];
+    for (int c = 0; c < 3; c++) {
+        c0[c] = mean[c] + axis[c] * (hi - inset);
+        c1[c] = mean[c] + axis[c] * (lo + inset);
+    }
+
+    uint16_t e0 = CookPack565(c0), e1 = CookPack565(c1);
+    if (e0 < e1) { uint16_t t = e0; e0 = e1; e1 = t; }
+
+    uint32_t indices = 0;
+    if (e0 != e1) {
+        float palette[4][3];
+        CookUnpack565(e0, palette[0]);
+        CookUnpack565(e1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0;
+            float bestDistance = INFINITY;
+            for (int p = 0; p < 4; p++) {
+                float dr = texels[i * 4] - palette[p][0], dg = texels[i * 4 + 1] - palette[p][1], db = texels[i * 4 + 2] - palette[p][2];
+                float distance = dr * dr + dg * dg + db * db;
+                if (distance < bestDistance) { bestDistance = distance; best = p; }
+            }
+            indices |= (uint32_t)best << (i * 2);
+        }
+    }
+
+    out[0] = e0 & 0xff; out[1] = e0 >> 8;
+    out[2] = e1 & 0xff; out[3] = e1 >> 8;
+    for (int k = 0; k < 4; k++) out[4 + k] = (indices >> (k * 8)) & 0xff;
+}
+
+// BC3 alpha block of 16 RGBA8 texels, in 8 value mode
+static void EncodeCookAlphaBlock(const unsigned char *texels, unsigned char *out) {
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; i++) {
+        int a = texels[i * 4 + 3];
+        if (a > a0) a0 = a;
+        if (a < a1) a1 = a;
+    }
+
+    uint64_t indices = 0;
+    if (a0 > a1) {
+        int palette[8] = { a0, a1 };
+        for (int p = 1; p < 7; p++) palette[p + 1] = ((7 - p) * a0 + p * a1) / 7;
+        for (int i = 0; i < 16; i++) {
+            int a = texels[i * 4 + 3], best = 0, bestDistance = 256;
+            for (int p = 0; p < 8; p++) {
+                int distance = abs(a - palette[p]);
+                if (distance < bestDistance) { bestDistance = distance; best = p; }
+            }
+            indices |= (uint64_t)best << (i * 3);
+        }
+    }
+
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+    for (int k = 0; k < 6; k++) out[2 + k] = (indices >> (k * 8)) & 0xff;
+}
+
+static void EncodeCookBlocksJob(void *data, int begin, int end) {
+    const TextureCookJob *job = (const TextureCookJob *)data;
+    int blocksX = (job->width + 3) / 4;
+    int blockSize = (job->alpha) ? 16 : 8;
+
+    for (int by = begin; by < end; by++) {
+        for (int bx = 0; bx < blocksX; bx++) {
+            // levels under 4 texels repeat their edge to fill the block
+            unsigned char texels[16 * 4];
+            for (int y = 0; y < 4; y++) {
+                int sy = (by * 4 + y < job->height) ? by * 4 + y : job->height - 1;
+                for (int x = 0; x < 4; x++) {
+                    int sx = (bx * 4 + x < job->width) ? bx * 4 + x : job->width - 1;
+                    memcpy(&texels[(y * 4 + x) * 4], &job->pixels[(sy * job->width + sx) * 4], 4);
+                }
+            }
+            unsigned char *out = &job->blocks[(by * blocksX + bx) * blockSize];
+            if (job->alpha) {
+                EncodeCookAlphaBlock(texels, out);
+                out += 8;
+            }
+            EncodeCookColorBlock(texels, out);
+        }
+    }
+}
+
+
+//----------------------------------------------------------------------------------
+// Cook
+//----------------------------------------------------------------------------------
+
+// Image with the full mip chain of image, block compressed when compress is set and the kind and size allow it
+// image is left as it was, the result is a new image
+Image CookTexture(Image image, TextureCookKind kind, bool compress) {
+    Image base = ImageCopy(image);
+    ImageFormat(&base, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+    int width = base.width, height = base.height;
+
+    // RGBA8 chain, levels back to back
+    int mipmaps = GetCookMipCount(width, height);
+    size_t size = 0;
+    for (int i = 0, w = width, h = height; i < mipmaps; i++, w = (w > 1) ? w / 2 : 1, h = (h > 1) ? h / 2 : 1) size += (size_t)w * h * 4;
+    unsigned char *chain = RL_MALLOC(size);
+    memcpy(chain, base.data, (size_t)width * height * 4);
+    UnloadImage(base);
+
+    unsigned char *level = chain;
+    for (int i = 1, w = width, h = height; i < mipmaps; i++) {
+        unsigned char *next = level + (size_t)w * h * 4;
+        CookMipLevel(level, w, h, next, kind);
+        level = next;
+        w = (w > 1) ? w / 2 : 1;
+        h = (h > 1) ? h / 2 : 1;
+    }
+
+    Image result = { chain, width, height, mipmaps, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+    if (!compress || kind == TEXTURE_COOK_NORMAL || !IsCookBlockChain(width, height)) return result;
+
+    bool alpha = false;
+    for (int i = 0; i < width * height && !alpha; i++) alpha = (chain[i * 4 + 3] < 255);
+    int format = (alpha) ? PIXELFORMAT_COMPRESSED_DXT5_RGBA : PIXELFORMAT_COMPRESSED_DXT1_RGB;
+    int blockSize = (alpha) ? 16 : 8;
+
+    // every level down to 1x1, the chain has to be complete for mipmapped filtering (GLES2 has no max level)
+    size_t compressedSize = 0;
+    for (int i = 0, w = width, h = height; i < mipmaps; i++, w = (w > 1) ? w / 2 : 1, h = (h > 1) ? h / 2 : 1) {
+        compressedSize += (size_t)((w + 3) / 4) * ((h + 3) / 4) * blockSize;
+    }
+    unsigned char *blocks = RL_MALLOC(compressedSize);
+
+    const unsigned char *pixels = chain;
+    unsigned char *out = blocks;
+    for (int i = 0, w = width, h = height; i < mipmaps; i++, w = (w > 1) ? w / 2 : 1, h = (h > 1) ? h / 2 : 1) {
+        TextureCookJob job = { pixels, out, w, h, alpha };
+        JobCounter counter = { 0 };
+        JobParallelFor(&counter, (h + 3) / 4, TEXTURE_COOK_BLOCK_ROWS, EncodeCookBlocksJob, &job);
+        JobWait(&counter);
+        pixels += (size_t)w * h * 4;
+        out += (size_t)((w + 3) / 4) * ((h + 3) / 4) * blockSize;
+    }
+
+    RL_FREE(chain);
+    return (Image){ blocks, width, height, mipmaps, format };
+}
+
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Uniforms
+ *
+ * Per shader cache of the last value set at each uniform location.
+ * SetShaderValue() binds the program and calls into the driver every time,
+ * even when the value is the same as last frame, which is the common case
+ * for lights and material parameters. SetShaderUniform() compares against
+ * the cached value first and only uploads what changed.
+ *
+ * The shaders are GLSL 100 (GLES2 level), which has no uniform buffer
+ * objects, so values shared by several shaders (lights, camera) are still
+ * set once per shader, but each shader only pays for the ones that changed.
+ *
+ * Every value for a cached location has to go through the cache, a direct
+ * SetShaderValue() on the same location leaves it stale. Matrices and
+ * arrays are not cached, they are passed straight through.
+ *
+ */
+
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+#include "raylib.h"
+#include <string.h>
+#include <stdbool.h>
+
+#define MAX_CACHED_UNIFORMS 256     // locations past this are uploaded every time
+
+
+typedef struct UniformSlot {
+    bool set;
+    int type;
+    unsigned char value[16];    // up to a vec4
+} UniformSlot;
+
+typedef struct ShaderUniforms {
+    Shader shader;
+    UniformSlot *slots;         // by location
+    int uploads;                // values sent to the driver since the last ResetShaderUniformStats
+    int skipped;                // values that were already set
+} ShaderUniforms;
+
+
+ShaderUniforms LoadShaderUniforms(Shader shader) {
+    ShaderUniforms uniforms = { 0 };
+    uniforms.shader = shader;
+    uniforms.slots = RL_CALLOC(MAX_CACHED_UNIFORMS, sizeof(UniformSlot));
+    return uniforms;
+}
+
+void UnloadShaderUniforms(ShaderUniforms *uniforms) {
+    RL_FREE(uniforms->slots);
+    *uniforms = (ShaderUniforms){ 0 };
+}
+
+// Bytes of one value of a uniform type, 0 for types that are not cached
+static int GetUniformSize(int type) {
+    switch (type) {
+        case SHADER_UNIFORM_FLOAT: case SHADER_UNIFORM_INT: case SHADER_UNIFORM_SAMPLER2D: return 4;
+        case SHADER_UNIFORM_VEC2: case SHADER_UNIFORM_IVEC2: return 8;
+        case SHADER_UNIFORM_VEC3: case SHADER_UNIFORM_IVEC3: return 12;
+        case SHADER_UNIFORM_VEC4: case SHADER_UNIFORM_IVEC4: return 16;
+        default: return 0;
+    }
+}
+
+// SetShaderValue that skips the upload when loc already holds value, returns true when it uploaded
+bool SetShaderUniform(ShaderUniforms *uniforms, int loc, const void *value, int type) {
+    if (loc < 0) return false;
+
+    int size = GetUniformSize(type);
+    if (size > 0 && loc < MAX_CACHED_UNIFORMS) {
+        UniformSlot *slot = &uniforms->slots[loc];
+        if (slot->set && slot->type == type && memcmp(slot->value, value, size) == 0) {
+            uniforms->skipped++;
+            return false;
+        }
+        slot->set = true;
+        slot->type = type;
+        memcpy(slot->value, value, size);
+    }
+
+    SetShaderValue(uniforms->shader, loc, value, type);
+    uniforms->uploads++;
+    return true;
+}
+
+// Forget every cached value, the next set of each uploads again (after the program was relinked)
+void InvalidateShaderUniforms(ShaderUniforms *uniforms) {
+    memset(uniforms->slots, 0, MAX_CACHED_UNIFORMS * sizeof(UniformSlot));
+}
+
+void ResetShaderUniformStats(ShaderUniforms *uniforms) {
+    uniforms->uploads = 0;
+    uniforms->skipped = 0;
+}
+
+
+#endif